@@ -18,15 +18,230 @@
  **********************************************************************/
 #include "imemdata.h"
 
+#include <stdio.h>
 #include <ctype.h>
+#include <time.h>
 #include <assert.h>
 
+#if defined(__linux__)
+#include <errno.h>
+#include <sys/syscall.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+	defined(_M_IX86)) && (!defined(IDISABLE_SIMD))
+#define IMEM_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) || defined(__clang__)
+#include <cpuid.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define IMEM_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(IMEM_SSE2) && (defined(__clang__) || \
+	(defined(__GNUC__) && (__GNUC__ >= 5)) || \
+	(defined(_MSC_VER) && (_MSC_VER >= 1900)))
+#define IMEM_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/* functions using extensions the compiler was not told about */
+#if defined(__GNUC__) || defined(__clang__)
+#define IMEM_TARGET(x) __attribute__((target(x)))
+#else
+#define IMEM_TARGET(x)
+#endif
+
+static inline int imem_ctz32(IUINT32 x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	return __builtin_ctz(x);
+#elif defined(_MSC_VER)
+	unsigned long r;
+	_BitScanForward(&r, x);
+	return (int)r;
+#else
+	int n = 0;
+	for (; (x & 1) == 0; x >>= 1) n++;
+	return n;
+#endif
+}
+
 /**********************************************************************
  * Dictionary Basic Interface
  **********************************************************************/
 
+/*-------------------------------------------------------------------*/
+/* flat layout: swiss table style control bytes, a slot array and   */
+/* entries kept in the nodes container so pos and sid stay stable   */
+/*-------------------------------------------------------------------*/
+#define IDICT_GROUP		16
+#define IDICT_EMPTY		0x80
+#define IDICT_DELETED	0xfe
+
+/* integer keys hash to themselves, spread them over tag and index */
+static inline iulong _idict_mix(iulong hash)
+{
+	IUINT64 h = ((IUINT64)hash) * 0x9e3779b97f4a7c15ull;
+	return (iulong)(h ^ (h >> 32));
+}
+
+/* bit i set if ctrl[i] == tag, for 16 consecutive control bytes */
+static inline IUINT32 _idict_match(const IUINT8 *ctrl, IUINT8 tag)
+{
+#ifdef IMEM_SSE2
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+	__m128i t = _mm_set1_epi8((char)tag);
+	return (IUINT32)_mm_movemask_epi8(_mm_cmpeq_epi8(g, t));
+#else
+	IUINT32 mask = 0;
+	int i;
+	for (i = 0; i < IDICT_GROUP; i++) {
+		if (ctrl[i] == tag) mask |= 1ul << i;
+	}
+	return mask;
+#endif
+}
+
+/* bit i set if ctrl[i] is empty or deleted */
+static inline IUINT32 _idict_match_free(const IUINT8 *ctrl)
+{
+#ifdef IMEM_SSE2
+	__m128i g = _mm_loadu_si128((const __m128i*)ctrl);
+	return (IUINT32)_mm_movemask_epi8(g);
+#else
+	IUINT32 mask = 0;
+	int i;
+	for (i = 0; i < IDICT_GROUP; i++) {
+		if (ctrl[i] & 0x80) mask |= 1ul << i;
+	}
+	return mask;
+#endif
+}
+
+/* control bytes past the end mirror the first group */
+static inline void _idict_flat_set(idict_t *dict, ilong index, IUINT8 tag)
+{
+	dict->ctrl[index] = tag;
+	if (index < IDICT_GROUP) dict->ctrl[dict->length + index] = tag;
+}
+
+/* first free slot on the probe sequence of a hash */
+static inline ilong _idict_flat_free(const idict_t *dict, iulong mixed)
+{
+	ilong mask = dict->mask, pos = (ilong)(mixed >> 7) & mask;
+	ilong step = 0;
+	while (1) {
+		IUINT32 m = _idict_match_free(dict->ctrl + pos);
+		if (m) return (pos + imem_ctz32(m)) & mask;
+		step += IDICT_GROUP;
+		pos = (pos + step) & mask;
+	}
+}
+
+/* slot index holding a key, -1 if absent */
+static inline ilong _idict_flat_find(const idict_t *dict, 
+	const ivalue_t *key)
+{
+	iulong hash = key->hash, mixed = _idict_mix(hash);
+	IUINT8 tag = (IUINT8)(mixed & 0x7f);
+	ilong mask = dict->mask, pos = (ilong)(mixed >> 7) & mask;
+	ilong step = 0;
+	while (1) {
+		const IUINT8 *group = dict->ctrl + pos;
+		IUINT32 m = _idict_match(group, tag);
+		for (; m; m &= m - 1) {
+			ilong index = (pos + imem_ctz32(m)) & mask;
+			const struct IDICTSLOT *slot = &dict->slots[index];
+			if (slot->hash == hash) {
+				if (it_cmp(&slot->entry->key, key) == 0) 
+					return index;
+			}
+		}
+		if (_idict_match(group, IDICT_EMPTY)) return -1;
+		step += IDICT_GROUP;
+		pos = (pos + step) & mask;
+	}
+}
+
+/* rebuild the flat table, growing it when it is more than half full */
+static int _idict_flat_rehash(idict_t *dict, ilong capacity)
+{
+	struct IDICTSLOT *slots;
+	IUINT8 *ctrl;
+	ilong pos;
+	while (dict->size * 16 >= capacity * 7) capacity <<= 1;
+	slots = (struct IDICTSLOT*)ikmem_malloc(capacity * 
+			sizeof(struct IDICTSLOT) + capacity + IDICT_GROUP);
+	if (slots == NULL) return -1;
+	if (dict->slots) ikmem_free(dict->slots);
+	ctrl = (IUINT8*)(slots + capacity);
+	memset(ctrl, IDICT_EMPTY, capacity + IDICT_GROUP);
+	dict->slots = slots;
+	dict->ctrl = ctrl;
+	dict->length = capacity;
+	dict->mask = capacity - 1;
+	for (dict->shift = 0; (1l << dict->shift) < capacity; ) dict->shift++;
+	pos = imnode_head(&dict->nodes);
+	for (; pos >= 0; pos = IMNODE_NEXT(&dict->nodes, pos)) {
+		idictentry_t *entry = (idictentry_t*)IMNODE_DATA(&dict->nodes, pos);
+		iulong mixed = _idict_mix(entry->key.hash);
+		ilong index = _idict_flat_free(dict, mixed);
+		_idict_flat_set(dict, index, (IUINT8)(mixed & 0x7f));
+		slots[index].hash = entry->key.hash;
+		slots[index].entry = entry;
+	}
+	dict->growth = capacity - (capacity >> 3) - dict->size;
+	return 0;
+}
+
+/* link a new entry, the table must have growth left */
+static inline void _idict_flat_link(idict_t *dict, idictentry_t *entry)
+{
+	iulong mixed = _idict_mix(entry->key.hash);
+	ilong index = _idict_flat_free(dict, mixed);
+	if (dict->ctrl[index] == IDICT_EMPTY) dict->growth--;
+	_idict_flat_set(dict, index, (IUINT8)(mixed & 0x7f));
+	dict->slots[index].hash = entry->key.hash;
+	dict->slots[index].entry = entry;
+}
+
+/* unlink an entry: the slot can go back to empty only if no probe 
+ * sequence ever saw a full group around it */
+static inline void _idict_flat_unlink(idict_t *dict, idictentry_t *entry)
+{
+	ilong index = _idict_flat_find(dict, &entry->key);
+	IUINT32 before, after;
+	int lead, trail;
+	if (index < 0) return;
+	before = _idict_match(dict->ctrl + ((index - IDICT_GROUP) & dict->mask),
+			IDICT_EMPTY);
+	after = _idict_match(dict->ctrl + index, IDICT_EMPTY);
+	for (lead = 0; lead < IDICT_GROUP; lead++) {
+		if (before & (1ul << (IDICT_GROUP - 1 - lead))) break;
+	}
+	trail = (after == 0)? IDICT_GROUP : imem_ctz32(after);
+	if (before != 0 && after != 0 && lead + trail < IDICT_GROUP) {
+		_idict_flat_set(dict, index, IDICT_EMPTY);
+		dict->growth++;
+	}	else {
+		_idict_flat_set(dict, index, IDICT_DELETED);
+	}
+}
+
+
 /* create */
 idict_t *idict_create(void)
+{
+	return idict_create_ex(IDICT_CHAINED);
+}
+
+/* create with a table layout */
+idict_t *idict_create_ex(int flags)
 {
 	idict_t *dict;
 	ilong i;
@@ -41,16 +256,34 @@ idict_t *idict_create(void)
 	dict->mask = dict->length - 1;
 	dict->size = 0;
 	dict->nodes.grow_limit = 8192;
-
-	if (iv_resize(&dict->vect, sizeof(struct IDICTBUCKET) * dict->length)) {
+	dict->flags = flags;
+	dict->table = NULL;
+	dict->ctrl = NULL;
+	dict->slots = NULL;
+	dict->growth = 0;
+	dict->oldtable = NULL;
+	dict->oldmask = 0;
+	dict->rehash = -1;
+	iv_init(&dict->oldvect, &ikmem_allocator);
+
+	if (flags & IDICT_FLAT) {
+		if (_idict_flat_rehash(dict, dict->length)) {
+			imnode_destroy(&dict->nodes);
+			ikmem_free(dict);
+			return NULL;
+		}
+	}
+	else if (iv_resize(&dict->vect, sizeof(struct IDICTBUCKET) * 
+		dict->length)) {
 		ikmem_free(dict);
 		return NULL;
 	}
-
-	dict->table = (struct IDICTBUCKET*)dict->vect.data;
-	for (i = 0; i < dict->length; i++) {
-		iqueue_init(&dict->table[i].head);
-		dict->table[i].count = 0;
+	else {
+		dict->table = (struct IDICTBUCKET*)dict->vect.data;
+		for (i = 0; i < dict->length; i++) {
+			iqueue_init(&dict->table[i].head);
+			dict->table[i].count = 0;
+		}
 	}
 
 	for (i = 0; i < (ilong)IDICT_LRUSIZE; i++) 
@@ -75,11 +308,89 @@ void idict_delete(idict_t *dict)
 		it_destroy(&entry->val);
 		index = imnode_next(&dict->nodes, index);
 	}
+	if (dict->slots) ikmem_free(dict->slots);
+	iv_destroy(&dict->oldvect);
 	iv_destroy(&dict->vect);
 	imnode_destroy(&dict->nodes);
 	ikmem_free(dict);
 }
 
+/* migrate old buckets, each step moves one non-empty bucket and 
+ * at most ten empty ones are skipped per step. old bucket i can only
+ * spread into new buckets i and i + oldsize, which are initialized
+ * here rather than all at once when the rehash starts */
+static void _idict_rehash_step(idict_t *dict, ilong steps)
+{
+	ilong visits = steps * 10;
+	while (dict->rehash >= 0) {
+		struct IDICTBUCKET *bucket = &dict->oldtable[dict->rehash];
+		iqueue_head *head = &bucket->head;
+		struct IDICTBUCKET *lo, *hi;
+		if (steps == 0 || visits == 0) break;
+		lo = &dict->table[dict->rehash];
+		hi = &dict->table[dict->rehash + dict->oldmask + 1];
+		iqueue_init(&lo->head);
+		iqueue_init(&hi->head);
+		lo->count = 0;
+		hi->count = 0;
+		if (iqueue_is_empty(head)) {
+			visits--;
+		}	else {
+			while (!iqueue_is_empty(head)) {
+				idictentry_t *entry;
+				struct IDICTBUCKET *target;
+				entry = iqueue_entry(head->next, idictentry_t, queue);
+				target = &dict->table[entry->key.hash & dict->mask];
+				iqueue_del(&entry->queue);
+				iqueue_add_tail(&entry->queue, &target->head);
+				target->count++;
+			}
+			bucket->count = 0;
+			steps--;
+		}
+		if (++dict->rehash > dict->oldmask) {
+			iv_destroy(&dict->oldvect);
+			dict->oldtable = NULL;
+			dict->oldmask = 0;
+			dict->rehash = -1;
+		}
+	}
+}
+
+/* start an incremental rehash into a table twice as large */
+static int _idict_rehash_start(idict_t *dict, int newshift)
+{
+	struct IVECTOR vect = dict->vect;
+	ilong newsize = (1l << newshift);
+
+	iv_init(&dict->vect, &ikmem_allocator);
+	if (iv_resize(&dict->vect, sizeof(struct IDICTBUCKET) * newsize)) {
+		dict->vect = vect;
+		return -1;
+	}
+
+	dict->oldvect = vect;
+	dict->oldtable = dict->table;
+	dict->oldmask = dict->mask;
+	dict->rehash = 0;
+	dict->table = (struct IDICTBUCKET*)dict->vect.data;
+	dict->length = newsize;
+	dict->shift = newshift;
+	dict->mask = newsize - 1;
+
+	return 0;
+}
+
+/* bucket holding a hash: old buckets not yet migrated are still live */
+static inline struct IDICTBUCKET *_idict_bucket(idict_t *dict, iulong hash)
+{
+	if (dict->rehash >= 0) {
+		ilong index = (ilong)(hash & dict->oldmask);
+		if (index >= dict->rehash) return &dict->oldtable[index];
+	}
+	return &dict->table[hash & dict->mask];
+}
+
 /* search pair */
 static inline idictentry_t *_idict_search(idict_t *dict, const ivalue_t *key)
 {
@@ -89,6 +400,14 @@ static inline idictentry_t *_idict_search(idict_t *dict, const ivalue_t *key)
 	iulong hash1;
 	iulong hash2;
 
+	if (dict->flags & IDICT_FLAT) {
+		ilong index = _idict_flat_find(dict, key);
+		return (index < 0)? NULL : dict->slots[index].entry;
+	}
+
+	if (dict->rehash >= 0) 
+		_idict_rehash_step(dict, IDICT_REHASH_STEP);
+
 	hash1 = key->hash;
 	hash2 = ((hash1 & 0xffff) + (hash1 >> 16)) & (IDICT_LRUSIZE - 1);
 	recent = dict->lru[hash2];
@@ -100,7 +419,7 @@ static inline idictentry_t *_idict_search(idict_t *dict, const ivalue_t *key)
 		}
 	}
 
-	bucket = &dict->table[hash1 & dict->mask];
+	bucket = _idict_bucket(dict, hash1);
 	head = &bucket->head;
 
 	for (p = head->next; p != head; p = p->next) {
@@ -148,6 +467,90 @@ ivalue_t *idict_search(idict_t *dict, const ivalue_t *key, ilong *pos)
 	return &entry->val;
 }
 
+#if defined(__GNUC__) || defined(__clang__)
+#define IDICT_PREFETCH(p) __builtin_prefetch((const void*)(p))
+#elif defined(IMEM_SSE2)
+#define IDICT_PREFETCH(p) _mm_prefetch((const char*)(p), _MM_HINT_T0)
+#else
+#define IDICT_PREFETCH(p) ((void)0)
+#endif
+
+#define IDICT_BATCH		16
+
+/* round 0 pulls in the bucket or control bytes of a hash, round 1 
+ * (once they are cached) the first entry the lookup will compare */
+static inline void _idict_prefetch(idict_t *dict, iulong hash, int round)
+{
+	if (dict->flags & IDICT_FLAT) {
+		iulong mixed = _idict_mix(hash);
+		ilong pos = (ilong)(mixed >> 7) & dict->mask;
+		if (round == 0) {
+			IDICT_PREFETCH(dict->ctrl + pos);
+			IDICT_PREFETCH(dict->slots + pos);
+		}	else {
+			IUINT32 m = _idict_match(dict->ctrl + pos, (IUINT8)(mixed & 0x7f));
+			if (m) {
+				ilong index = (pos + imem_ctz32(m)) & dict->mask;
+				IDICT_PREFETCH(dict->slots + index);
+				IDICT_PREFETCH(dict->slots[index].entry);
+			}
+		}
+	}	else {
+		struct IDICTBUCKET *bucket = _idict_bucket(dict, hash);
+		if (round == 0) {
+			IDICT_PREFETCH(bucket);
+		}
+		else if (!iqueue_is_empty(&bucket->head)) {
+			iqueue_head *node = bucket->head.next;
+			IDICT_PREFETCH(iqueue_entry(node, idictentry_t, queue));
+			IDICT_PREFETCH(node);
+		}
+	}
+}
+
+/* resolve up to IDICT_BATCH prepared keys, their misses overlap */
+static void _idict_search_many(idict_t *dict, ivalue_t *keys, int count,
+	idictentry_t **entries)
+{
+	int i;
+	for (i = 0; i < count; i++) _idict_prefetch(dict, keys[i].hash, 0);
+	for (i = 0; i < count; i++) _idict_prefetch(dict, keys[i].hash, 1);
+	for (i = 0; i < count; i++) entries[i] = _idict_search(dict, &keys[i]);
+}
+
+/* search many keys */
+ilong idict_search_batch(idict_t *dict, const ivalue_t *keys, ilong n,
+	ivalue_t **vals)
+{
+	idictentry_t *entries[IDICT_BATCH];
+	ivalue_t kk[IDICT_BATCH];
+	ilong base, found = 0;
+	int size, i;
+	for (base = 0; base < n; base += size) {
+		size = (n - base < IDICT_BATCH)? (int)(n - base) : IDICT_BATCH;
+		for (i = 0; i < size; i++) _idict_refval(&kk[i], &keys[base + i]);
+		_idict_search_many(dict, kk, size, entries);
+		for (i = 0; i < size; i++) {
+			vals[base + i] = entries[i]? &entries[i]->val : NULL;
+			if (entries[i]) found++;
+		}
+	}
+	return found;
+}
+
+/* resolve a chunk of integer keys */
+static inline void _idict_search_many_i(idict_t *dict, const ilong *keys,
+	int count, idictentry_t **entries)
+{
+	ivalue_t kk[IDICT_BATCH];
+	int i;
+	for (i = 0; i < count; i++) {
+		it_init_int(&kk[i], keys[i]);
+		kk[i].hash = (iulong)keys[i];
+	}
+	_idict_search_many(dict, kk, count, entries);
+}
+
 /* calculate lru hash */
 static inline iulong _idict_lruhash(iulong hash)
 {
@@ -195,6 +598,62 @@ static inline int _idict_resize(idict_t *dict, int newshift)
 	return 0;
 }
 
+/* create an entry for a key known to be absent */
+static inline idictentry_t *_idict_entry_new(idict_t *dict, 
+	const ivalue_t *key, const ivalue_t *val)
+{
+	idictentry_t *entry;
+	ilong pos;
+
+	pos = imnode_new(&dict->nodes);
+	if (pos < 0) return NULL;
+
+	entry = (struct IDICTENTRY*)IMNODE_DATA(&dict->nodes, pos);
+
+	/* copy key & value */
+	it_init(&entry->key, it_type(key));
+	it_init(&entry->val, it_type(val));
+
+	it_cpy(&entry->key, key);
+	it_cpy(&entry->val, val);
+	entry->key.hash = key->hash;
+
+	entry->pos = pos;
+	entry->sid = ++dict->inc;
+	iqueue_init(&entry->queue);
+
+	return entry;
+}
+
+/* update pair in the flat layout */
+static ilong _idict_flat_update(idict_t *dict, const ivalue_t *key, 
+	const ivalue_t *val, int isupdate)
+{
+	idictentry_t *entry;
+	ilong index;
+
+	index = _idict_flat_find(dict, key);
+
+	if (index >= 0) {
+		if (isupdate == 0) return -2;
+		entry = dict->slots[index].entry;
+		it_cpy(&entry->val, val);
+		return entry->pos;
+	}
+
+	if (dict->growth <= 0) {
+		if (_idict_flat_rehash(dict, dict->length)) return -3;
+	}
+
+	entry = _idict_entry_new(dict, key, val);
+	if (entry == NULL) return -3;
+
+	_idict_flat_link(dict, entry);
+	dict->size++;
+
+	return entry->pos;
+}
+
 /* update pair inline */
 static inline ilong _idict_update(idict_t *dict, const ivalue_t *key, 
 	const ivalue_t *val, int isupdate)
@@ -206,6 +665,12 @@ static inline ilong _idict_update(idict_t *dict, const ivalue_t *key,
 	iulong hash2;
 	ilong pos;
 
+	if (dict->flags & IDICT_FLAT) 
+		return _idict_flat_update(dict, key, val, isupdate);
+
+	if (dict->rehash >= 0) 
+		_idict_rehash_step(dict, IDICT_REHASH_STEP);
+
 	hash1 = key->hash;
 	hash2 = _idict_lruhash(hash1);
 	recent = dict->lru[hash2];
@@ -221,7 +686,7 @@ static inline ilong _idict_update(idict_t *dict, const ivalue_t *key,
 		}
 	}
 
-	bucket = &dict->table[hash1 & dict->mask];
+	bucket = _idict_bucket(dict, hash1);
 	head = &bucket->head;
 
 	/* check bucket queue */
@@ -237,21 +702,9 @@ static inline ilong _idict_update(idict_t *dict, const ivalue_t *key,
 	}
 
 	/* new entry */
-	pos = imnode_new(&dict->nodes);
-	if (pos < 0) return -3;
-
-	entry = (struct IDICTENTRY*)IMNODE_DATA(&dict->nodes, pos);
-
-	/* copy key & value */
-	it_init(&entry->key, it_type(key));
-	it_init(&entry->val, it_type(val));
-
-	it_cpy(&entry->key, key);
-	it_cpy(&entry->val, val);
-	entry->key.hash = key->hash;
-
-	entry->pos = pos;
-	entry->sid = ++dict->inc;
+	entry = _idict_entry_new(dict, key, val);
+	if (entry == NULL) return -3;
+	pos = entry->pos;
 
 	/* add to bucket queue */
 	iqueue_add_tail(&entry->queue, &bucket->head);
@@ -261,8 +714,14 @@ static inline ilong _idict_update(idict_t *dict, const ivalue_t *key,
 	dict->size++;
 
 	/* check necessary of table-growwing */
-	if (dict->size >= (dict->length << 1)) 
-		_idict_resize(dict, dict->shift + 1);
+	if (dict->size >= (dict->length << 1)) {
+		if ((dict->flags & IDICT_INCREMENTAL) == 0) {
+			_idict_resize(dict, dict->shift + 1);
+		}
+		else if (dict->rehash < 0) {
+			_idict_rehash_start(dict, (int)dict->shift + 1);
+		}
+	}
 
 	return pos;
 }
@@ -284,8 +743,15 @@ static inline int _idict_del(idict_t *dict, idictentry_t *entry)
 	hash1 = entry->key.hash;
 	hash2 = _idict_lruhash(hash1);
 
-	bucket = &dict->table[hash1 & dict->mask];
-	iqueue_del(&entry->queue);
+	if (dict->flags & IDICT_FLAT) {
+		_idict_flat_unlink(dict, entry);
+		bucket = NULL;
+	}	else {
+		if (dict->rehash >= 0) 
+			_idict_rehash_step(dict, IDICT_REHASH_STEP);
+		bucket = _idict_bucket(dict, hash1);
+		iqueue_del(&entry->queue);
+	}
 
 	dict->lru[hash2] = NULL;
 
@@ -296,7 +762,7 @@ static inline int _idict_del(idict_t *dict, idictentry_t *entry)
 	entry->sid = -1;
 
 	imnode_del(&dict->nodes, pos);
-	bucket->count--;
+	if (bucket) bucket->count--;
 	dict->size--;
 
 	return 0;
@@ -398,6 +864,17 @@ ilong idict_pos_next(idict_t *dict, ilong pos)
 	return imnode_next(&dict->nodes, pos);
 }
 
+/* advance a pending incremental rehash */
+int idict_rehash(idict_t *dict, ilong steps)
+{
+	assert(dict);
+	if (dict->rehash >= 0) {
+		if (steps < 0) steps = dict->oldmask + 1;
+		_idict_rehash_step(dict, steps);
+	}
+	return (dict->rehash >= 0)? 1 : 0;
+}
+
 /* clear dict */
 void idict_clear(idict_t *dict)
 {
@@ -494,6 +971,50 @@ int idict_search_ip(idict_t *dict, ilong key, void**ptr)
 	return 0;
 }
 
+/* search many: key(int) val(int) */
+ilong idict_search_batch_ii(idict_t *dict, const ilong *keys, ilong n,
+	ilong *vals, int *found)
+{
+	idictentry_t *entries[IDICT_BATCH];
+	ilong base, count = 0;
+	int size, i;
+	for (base = 0; base < n; base += size) {
+		size = (n - base < IDICT_BATCH)? (int)(n - base) : IDICT_BATCH;
+		_idict_search_many_i(dict, keys + base, size, entries);
+		for (i = 0; i < size; i++) {
+			int hit = 0;
+			if (entries[i] && it_type(&entries[i]->val) == ITYPE_INT) {
+				vals[base + i] = it_int(&entries[i]->val);
+				hit = 1;
+				count++;
+			}
+			if (found) found[base + i] = hit;
+		}
+	}
+	return count;
+}
+
+/* search many: key(int) val(ptr) */
+ilong idict_search_batch_ip(idict_t *dict, const ilong *keys, ilong n,
+	void **ptrs)
+{
+	idictentry_t *entries[IDICT_BATCH];
+	ilong base, count = 0;
+	int size, i;
+	for (base = 0; base < n; base += size) {
+		size = (n - base < IDICT_BATCH)? (int)(n - base) : IDICT_BATCH;
+		_idict_search_many_i(dict, keys + base, size, entries);
+		for (i = 0; i < size; i++) {
+			ptrs[base + i] = NULL;
+			if (entries[i] && it_type(&entries[i]->val) == ITYPE_PTR) {
+				ptrs[base + i] = it_ptr(&entries[i]->val);
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
 /* add: key(str) val(str) */
 ilong idict_add_ss(idict_t *dict, const char *key, ilong keysize,
 	const char *val, ilong valsize)
@@ -1135,6 +1656,30 @@ ilong ims_flat(const struct IMSTREAM *s, void **pointer)
 	return s->pos_write - s->pos_read;
 }
 
+/* get ptrs and sizes of the first (count) pages, returns page number */
+int ims_iovec(const struct IMSTREAM *s, void *ptrs[], ilong sizes[], 
+	int count)
+{
+	const struct IQUEUEHEAD *p;
+	ilong remain = s->size;
+	ilong pos = s->pos_read;
+	int n = 0;
+	for (p = s->head.next; p != &s->head && n < count; p = p->next) {
+		struct IMSPAGE *page = iqueue_entry(p, struct IMSPAGE, head);
+		ilong size = page->size - pos;
+		if (remain <= 0) break;
+		if (size > remain) size = remain;
+		if (size > 0) {
+			ptrs[n] = page->data + pos;
+			sizes[n] = size;
+			remain -= size;
+			n++;
+		}
+		pos = 0;
+	}
+	return n;
+}
+
 
 /**********************************************************************
  * common string operation
@@ -1700,6 +2245,514 @@ const char *istrcsvtok(const char *text, ilong *next, ilong *size)
 }
 
 
+/**********************************************************************
+ * cpu features and vectorized scanning
+ **********************************************************************/
+static volatile int icpu_features_cache = -1;
+static volatile int icpu_features_disabled = 0;
+
+#ifdef IMEM_X86
+static void icpu_cpuid(int leaf, IUINT32 *regs)
+{
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, leaf, 0);
+	regs[0] = r[0]; regs[1] = r[1]; regs[2] = r[2]; regs[3] = r[3];
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(leaf, 0, a, b, c, d);
+	regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+/* ymm state enabled by the os */
+static int icpu_ymm_enabled(void)
+{
+#if defined(_MSC_VER)
+	return ((_xgetbv(0) & 6) == 6)? 1 : 0;
+#else
+	IUINT32 a, d;
+	__asm__ __volatile__ ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((a & 6) == 6)? 1 : 0;
+#endif
+}
+#endif
+
+/* detect instruction set extensions */
+int icpu_features(void)
+{
+	int features = icpu_features_cache;
+	if (features < 0) {
+		features = 0;
+	#ifdef IMEM_X86
+		{
+			IUINT32 r[4], top;
+			icpu_cpuid(0, r);
+			top = r[0];
+			if (top >= 1) {
+				icpu_cpuid(1, r);
+				if (r[3] & (1ul << 26)) features |= ICPU_SSE2;
+				if (r[2] & (1ul << 9)) features |= ICPU_SSSE3;
+				if (r[2] & (1ul << 19)) features |= ICPU_SSE41;
+				if (r[2] & (1ul << 20)) features |= ICPU_SSE42;
+				if (r[2] & (1ul << 1)) features |= ICPU_PCLMUL;
+				if ((r[2] & (1ul << 27)) && (r[2] & (1ul << 28))) {
+					if (icpu_ymm_enabled()) features |= ICPU_AVX;
+				}
+			}
+			if (top >= 7) {
+				icpu_cpuid(7, r);
+				if ((r[1] & (1ul << 5)) && (features & ICPU_AVX)) 
+					features |= ICPU_AVX2;
+				if (r[1] & (1ul << 29)) features |= ICPU_SHA;
+			}
+		}
+	#endif
+		icpu_features_cache = features;
+	}
+	return features & ~icpu_features_disabled;
+}
+
+/* mask out features */
+void icpu_features_mask(int mask)
+{
+	icpu_features_disabled = mask;
+}
+
+/* portable scan, memchr is usually vectorized by the libc */
+static ilong imemscan_tail(const IUINT8 *src, ilong i, ilong size, int ch,
+	IUINT32 *pos, ilong n, ilong count)
+{
+	while (n < count && i < size) {
+		const IUINT8 *p = (const IUINT8*)memchr(src + i, ch, size - i);
+		if (p == NULL) break;
+		i = (ilong)(p - src);
+		pos[n++] = (IUINT32)i++;
+	}
+	return n;
+}
+
+#ifdef IMEM_SSE2
+static ilong imemscan_sse2(const IUINT8 *src, ilong size, int ch,
+	IUINT32 *pos, ilong count)
+{
+	__m128i key = _mm_set1_epi8((char)ch);
+	ilong i = 0, n = 0;
+	for (; i + 16 <= size; i += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(src + i));
+		IUINT32 mask = (IUINT32)_mm_movemask_epi8(_mm_cmpeq_epi8(x, key));
+		for (; mask != 0 && n < count; mask &= mask - 1) {
+			pos[n++] = (IUINT32)(i + imem_ctz32(mask));
+		}
+		if (n >= count) return n;
+	}
+	return imemscan_tail(src, i, size, ch, pos, n, count);
+}
+#endif
+
+#ifdef IMEM_AVX2
+IMEM_TARGET("avx2")
+static ilong imemscan_avx2(const IUINT8 *src, ilong size, int ch,
+	IUINT32 *pos, ilong count)
+{
+	__m256i key = _mm256_set1_epi8((char)ch);
+	ilong i = 0, n = 0;
+	for (; i + 32 <= size; i += 32) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(src + i));
+		IUINT32 mask = (IUINT32)_mm256_movemask_epi8(
+			_mm256_cmpeq_epi8(x, key));
+		for (; mask != 0 && n < count; mask &= mask - 1) {
+			pos[n++] = (IUINT32)(i + imem_ctz32(mask));
+		}
+		if (n >= count) return n;
+	}
+	return imemscan_tail(src, i, size, ch, pos, n, count);
+}
+#endif
+
+/* offsets of bytes equal to ch */
+ilong imemscan(const void *ptr, ilong size, int ch, IUINT32 *pos, 
+	ilong count)
+{
+	const IUINT8 *src = (const IUINT8*)ptr;
+	if (size <= 0 || count <= 0) return 0;
+	ch &= 0xff;
+#ifdef IMEM_AVX2
+	if (size >= 32 && (icpu_features() & ICPU_AVX2)) 
+		return imemscan_avx2(src, size, ch, pos, count);
+#endif
+#ifdef IMEM_SSE2
+	if (size >= 16 && (icpu_features() & ICPU_SSE2))
+		return imemscan_sse2(src, size, ch, pos, count);
+#endif
+	return imemscan_tail(src, 0, size, ch, pos, 0, count);
+}
+
+
+/**********************************************************************
+ * seeded string hash: wyhash style mixing, and for long keys on AVX2 
+ * machines eight 64-bit lanes accumulated a stripe at a time
+ **********************************************************************/
+#define IWY_S0		0x2d358dccaa6c78a5ull
+#define IWY_S1		0x8bb84b93962eacc9ull
+#define IWY_S2		0x4b33a62ed433d4a3ull
+#define IWY_S3		0x4d5a2da51de1aa47ull
+
+#define ISTRHASH_LONG		1024	/* keys from here take the lane path */
+#define ISTRHASH_STRIPE		64
+#define ISTRHASH_BLOCK		16		/* stripes between scrambles */
+
+static IUINT64 istrhash_secret = 0;			/* published by istrhash_state */
+static volatile long istrhash_state = 0;	/* 0: none, 1: seeding, 2: ready */
+static IUINT64 istrhash_key[8];				/* lane keys of the seed */
+static IUINT64 istrhash_acc[8];				/* lane initial values */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ISTRHASH_CAS(p, o, n) __sync_bool_compare_and_swap(p, o, n)
+#if defined(__ATOMIC_ACQUIRE)
+#define ISTRHASH_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ISTRHASH_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define ISTRHASH_LOAD(p) (__sync_synchronize(), *(p))
+#define ISTRHASH_STORE(p, v) do { __sync_synchronize(); *(p) = (v); } while (0)
+#endif
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define ISTRHASH_CAS(p, o, n) (_InterlockedCompareExchange(p, n, o) == (o))
+#define ISTRHASH_LOAD(p) (*(p))
+#define ISTRHASH_STORE(p, v) do { _ReadWriteBarrier(); *(p) = (v); } while (0)
+#else
+#define ISTRHASH_CAS(p, o, n) ((*(p) == (o))? ((*(p) = (n)), 1) : 0)
+#define ISTRHASH_LOAD(p) (*(p))
+#define ISTRHASH_STORE(p, v) do { *(p) = (v); } while (0)
+#endif
+
+/* 64x64->128 multiply, low half in a and high half in b */
+static inline void _iwy_mum(IUINT64 *a, IUINT64 *b)
+{
+#if defined(__SIZEOF_INT128__)
+	__uint128_t r = (__uint128_t)(*a) * (*b);
+	*a = (IUINT64)r;
+	*b = (IUINT64)(r >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+	*a = _umul128(*a, *b, b);
+#else
+	IUINT64 ha = *a >> 32, hb = *b >> 32;
+	IUINT64 la = (IUINT32)*a, lb = (IUINT32)*b;
+	IUINT64 rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+	IUINT64 t = rl + (rm0 << 32), lo, hi;
+	IUINT64 c = (t < rl)? 1 : 0;
+	lo = t + (rm1 << 32);
+	c += (lo < t)? 1 : 0;
+	hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+	*a = lo;
+	*b = hi;
+#endif
+}
+
+static inline IUINT64 _iwy_mix(IUINT64 a, IUINT64 b)
+{
+	_iwy_mum(&a, &b);
+	return a ^ b;
+}
+
+static inline IUINT64 _iwy_r8(const IUINT8 *p)
+{
+#if IWORDS_BIG_ENDIAN
+	return ((IUINT64)p[0]) | ((IUINT64)p[1] << 8) | 
+		((IUINT64)p[2] << 16) | ((IUINT64)p[3] << 24) |
+		((IUINT64)p[4] << 32) | ((IUINT64)p[5] << 40) |
+		((IUINT64)p[6] << 48) | ((IUINT64)p[7] << 56);
+#else
+	IUINT64 v;
+	memcpy(&v, p, 8);
+	return v;
+#endif
+}
+
+static inline IUINT64 _iwy_r4(const IUINT8 *p)
+{
+#if IWORDS_BIG_ENDIAN
+	return ((IUINT64)p[0]) | ((IUINT64)p[1] << 8) | 
+		((IUINT64)p[2] << 16) | ((IUINT64)p[3] << 24);
+#else
+	IUINT32 v;
+	memcpy(&v, p, 4);
+	return v;
+#endif
+}
+
+/* lane keys and initial values, derived from the seed */
+static void istrhash_lanes(IUINT64 seed, IUINT64 *key, IUINT64 *acc)
+{
+	static const IUINT64 s[4] = { IWY_S0, IWY_S1, IWY_S2, IWY_S3 };
+	int i;
+	for (i = 0; i < 8; i++) {
+		IUINT64 x = seed ^ s[i & 3];
+		key[i] = _iwy_mix(x, s[(i + 1) & 3] + (IUINT64)i);
+		acc[i] = _iwy_mix(x ^ key[i], s[(i + 2) & 3]);
+	}
+}
+
+/* acc[i] += lo32(d ^ k) * hi32(d ^ k), acc[i ^ 1] += d, per stripe; 
+ * scramble: acc ^= acc >> 47, acc ^= k, acc *= 0x9e3779b1 */
+static void istrhash_stripes_c(IUINT64 *acc, const IUINT8 *p, 
+	size_t count, const IUINT64 *key, int scramble)
+{
+	size_t n;
+	int i;
+	for (n = 0; n < count; n++, p += ISTRHASH_STRIPE) {
+		for (i = 0; i < 8; i++) {
+			IUINT64 d = _iwy_r8(p + i * 8);
+			IUINT64 x = d ^ key[i];
+			acc[i] += (x & 0xffffffffu) * (x >> 32);
+			acc[i ^ 1] += d;
+		}
+	}
+	if (scramble) {
+		for (i = 0; i < 8; i++) {
+			IUINT64 a = acc[i];
+			a ^= a >> 47;
+			a ^= key[i ^ 7];
+			acc[i] = a * 0x9e3779b1u;
+		}
+	}
+}
+
+#if defined(IMEM_AVX2) && (!IWORDS_BIG_ENDIAN)
+IMEM_TARGET("avx2")
+static void istrhash_stripes_avx2(IUINT64 *acc, const IUINT8 *p, 
+	size_t count, const IUINT64 *key, int scramble)
+{
+	__m256i a0 = _mm256_loadu_si256((const __m256i*)(acc + 0));
+	__m256i a1 = _mm256_loadu_si256((const __m256i*)(acc + 4));
+	__m256i k0 = _mm256_loadu_si256((const __m256i*)(key + 0));
+	__m256i k1 = _mm256_loadu_si256((const __m256i*)(key + 4));
+	size_t n;
+	for (n = 0; n < count; n++, p += ISTRHASH_STRIPE) {
+		__m256i d0 = _mm256_loadu_si256((const __m256i*)(p + 0));
+		__m256i d1 = _mm256_loadu_si256((const __m256i*)(p + 32));
+		__m256i x0 = _mm256_xor_si256(d0, k0);
+		__m256i x1 = _mm256_xor_si256(d1, k1);
+		a0 = _mm256_add_epi64(a0, 
+			_mm256_mul_epu32(x0, _mm256_srli_epi64(x0, 32)));
+		a1 = _mm256_add_epi64(a1, 
+			_mm256_mul_epu32(x1, _mm256_srli_epi64(x1, 32)));
+		a0 = _mm256_add_epi64(a0, _mm256_shuffle_epi32(d0, 0x4e));
+		a1 = _mm256_add_epi64(a1, _mm256_shuffle_epi32(d1, 0x4e));
+	}
+	if (scramble) {
+		__m256i prime = _mm256_set1_epi32((int)0x9e3779b1u);
+		/* key[i ^ 7]: lanes 0-3 take key 7..4, lanes 4-7 take 3..0 */
+		__m256i r0 = _mm256_permute4x64_epi64(k1, 0x1b);
+		__m256i r1 = _mm256_permute4x64_epi64(k0, 0x1b);
+		__m256i x0 = _mm256_xor_si256(a0, _mm256_srli_epi64(a0, 47));
+		__m256i x1 = _mm256_xor_si256(a1, _mm256_srli_epi64(a1, 47));
+		x0 = _mm256_xor_si256(x0, r0);
+		x1 = _mm256_xor_si256(x1, r1);
+		a0 = _mm256_add_epi64(_mm256_mul_epu32(x0, prime), 
+			_mm256_slli_epi64(_mm256_mul_epu32(
+				_mm256_srli_epi64(x0, 32), prime), 32));
+		a1 = _mm256_add_epi64(_mm256_mul_epu32(x1, prime), 
+			_mm256_slli_epi64(_mm256_mul_epu32(
+				_mm256_srli_epi64(x1, 32), prime), 32));
+	}
+	_mm256_storeu_si256((__m256i*)(acc + 0), a0);
+	_mm256_storeu_si256((__m256i*)(acc + 4), a1);
+}
+#endif
+
+/* process seeded keys of ISTRHASH_LONG bytes or more, AVX2 only runs
+ * the same stripes faster so the value does not depend on the cpu */
+static IUINT64 istrhash_long(const IUINT8 *p, size_t len, IUINT64 seed)
+{
+	void (*stripes)(IUINT64*, const IUINT8*, size_t, const IUINT64*, int);
+	const IUINT64 *key = istrhash_key;
+	IUINT64 acc[8], h;
+	size_t count = (len - 1) / ISTRHASH_STRIPE, n;
+	int i;
+	stripes = istrhash_stripes_c;
+#if defined(IMEM_AVX2) && (!IWORDS_BIG_ENDIAN)
+	if (icpu_features() & ICPU_AVX2) stripes = istrhash_stripes_avx2;
+#endif
+	memcpy(acc, istrhash_acc, sizeof(acc));
+	for (n = 0; n + ISTRHASH_BLOCK <= count; n += ISTRHASH_BLOCK) {
+		stripes(acc, p + n * ISTRHASH_STRIPE, ISTRHASH_BLOCK, key, 1);
+	}
+	if (n < count) {
+		stripes(acc, p + n * ISTRHASH_STRIPE, count - n, key, 0);
+	}
+	stripes(acc, p + len - ISTRHASH_STRIPE, 1, key, 0);
+	h = seed ^ ((IUINT64)len * 0x9e3779b97f4a7c15ull);
+	for (i = 0; i < 8; i += 2) {
+		h = _iwy_mix(h ^ acc[i], acc[i + 1] ^ IWY_S1);
+	}
+	return _iwy_mix(h ^ IWY_S0, (IUINT64)len ^ IWY_S1);
+}
+
+/* hash with an already mixed seed */
+static inline IUINT64 _istrhash64(const void *data, size_t len, 
+	IUINT64 seed)
+{
+	const IUINT8 *p = (const IUINT8*)data;
+	IUINT64 a, b;
+	if (len <= 16) {
+		if (len >= 4) {
+			size_t k = (len >> 3) << 2;
+			a = (_iwy_r4(p) << 32) | _iwy_r4(p + k);
+			b = (_iwy_r4(p + len - 4) << 32) | _iwy_r4(p + len - 4 - k);
+		}
+		else if (len > 0) {
+			a = ((IUINT64)p[0] << 16) | ((IUINT64)p[len >> 1] << 8) | 
+				p[len - 1];
+			b = 0;
+		}
+		else {
+			a = b = 0;
+		}
+	}
+	else {
+		size_t i = len;
+		if (i > 48) {
+			IUINT64 see1 = seed, see2 = seed;
+			do {
+				seed = _iwy_mix(_iwy_r8(p) ^ IWY_S1, _iwy_r8(p + 8) ^ seed);
+				see1 = _iwy_mix(_iwy_r8(p + 16) ^ IWY_S2, 
+						_iwy_r8(p + 24) ^ see1);
+				see2 = _iwy_mix(_iwy_r8(p + 32) ^ IWY_S3, 
+						_iwy_r8(p + 40) ^ see2);
+				p += 48;
+				i -= 48;
+			}	while (i > 48);
+			seed ^= see1 ^ see2;
+		}
+		while (i > 16) {
+			seed = _iwy_mix(_iwy_r8(p) ^ IWY_S1, _iwy_r8(p + 8) ^ seed);
+			i -= 16;
+			p += 16;
+		}
+		a = _iwy_r8(p + i - 16);
+		b = _iwy_r8(p + i - 8);
+	}
+	a ^= IWY_S1;
+	b ^= seed;
+	_iwy_mum(&a, &b);
+	return _iwy_mix(a ^ IWY_S0 ^ (IUINT64)len, b ^ IWY_S1);
+}
+
+/* 64-bit hash of data with an explicit seed */
+IUINT64 istrhash64(const void *data, size_t size, IUINT64 seed)
+{
+	seed ^= _iwy_mix(seed ^ IWY_S0, IWY_S1);
+	return _istrhash64(data, size, seed);
+}
+
+/* system entropy: getrandom, /dev/urandom or RtlGenRandom */
+int irandom_bytes(void *buffer, size_t size)
+{
+	unsigned char *ptr = (unsigned char*)buffer;
+#if defined(_WIN32) && !defined(_XBOX)
+	typedef BOOLEAN (WINAPI *RtlGenRandom_t)(PVOID, ULONG);
+	static RtlGenRandom_t RtlGenRandom_o = NULL;
+	if (RtlGenRandom_o == NULL) {
+		HMODULE advapi = LoadLibraryA("advapi32.dll");
+		if (advapi == NULL) return -1;
+		RtlGenRandom_o = (RtlGenRandom_t)
+			GetProcAddress(advapi, "SystemFunction036");
+		if (RtlGenRandom_o == NULL) return -1;
+	}
+	while (size > 0) {
+		ULONG chunk = (size > 0x10000)? 0x10000 : (ULONG)size;
+		if (!RtlGenRandom_o(ptr, chunk)) return -1;
+		ptr += chunk;
+		size -= chunk;
+	}
+	return 0;
+#else
+	FILE *fp;
+#if defined(__linux__) && defined(SYS_getrandom)
+	while (size > 0) {
+		long hr = syscall(SYS_getrandom, ptr, size, 0);
+		if (hr < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		ptr += hr;
+		size -= (size_t)hr;
+	}
+	if (size == 0) return 0;
+#endif
+	fp = fopen("/dev/urandom", "rb");
+	if (fp == NULL) return -1;
+	while (size > 0) {
+		size_t hr = fread(ptr, 1, size, fp);
+		if (hr == 0) break;
+		ptr += hr;
+		size -= hr;
+	}
+	fclose(fp);
+	return (size == 0)? 0 : -1;
+#endif
+}
+
+/* publish a seed, istrhash_state must be 1 (owned by the caller) */
+static void istrhash_seed_set(IUINT64 seed)
+{
+	seed ^= _iwy_mix(seed ^ IWY_S0, IWY_S1);
+	istrhash_lanes(seed, istrhash_key, istrhash_acc);
+	icpu_features();	/* detect now, istrhash_long only reads the cache */
+	istrhash_secret = seed;
+	ISTRHASH_STORE(&istrhash_state, 2);
+}
+
+/* pick a process seed once from system entropy, when none is available
+ * fall back to time and addresses that move with ASLR */
+static IUINT64 istrhash_secret_init(void)
+{
+	while (ISTRHASH_LOAD(&istrhash_state) != 2) {
+		if (ISTRHASH_CAS(&istrhash_state, 0, 1)) {
+			IUINT64 x = 0;
+			if (irandom_bytes(&x, sizeof(x)) != 0 || x == 0) {
+				IUINT64 y = (IUINT64)clock();
+				IUINT64 z = (IUINT64)(size_t)&x;
+				void *ptr = malloc(16);
+				x = _iwy_mix((IUINT64)time(NULL) ^ IWY_S0, z ^ IWY_S1);
+				x = _iwy_mix(x ^ y ^ (IUINT64)(size_t)ptr, 
+						(IUINT64)(size_t)&istrhash_state ^ IWY_S2);
+				free(ptr);
+			}
+			istrhash_seed_set(x);
+		}
+	}
+	return istrhash_secret;
+}
+
+/* set the process seed, fails once any string has been hashed */
+int istrhash_seed(IUINT64 seed)
+{
+	if (!ISTRHASH_CAS(&istrhash_state, 0, 1)) return -1;
+	istrhash_seed_set(seed);
+	return 0;
+}
+
+/* process seeded string hash used by it_hashstr */
+iulong istrhash(const char *name, iulong len)
+{
+	IUINT64 h, seed;
+	if (ISTRHASH_LOAD(&istrhash_state) == 2) {
+		seed = istrhash_secret;
+	}	else {
+		seed = istrhash_secret_init();
+	}
+	if (len >= ISTRHASH_LONG) 
+		h = istrhash_long((const IUINT8*)name, (size_t)len, seed);
+	else
+		h = _istrhash64(name, (size_t)len, seed);
+	if (sizeof(iulong) < 8) h ^= h >> 32;
+	return (iulong)h;
+}
+
+
 /**********************************************************************
  * ivalue_t string library
  **********************************************************************/
@@ -2486,17 +3539,426 @@ int istring_list_join(const istring_list_t *strings, const char *str,
 /**********************************************************************
  * BASE64 / BASE32 / BASE16
  **********************************************************************/
+static const char ibase64_alphabet[] = 
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static const char ibase32_alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+/* decoder tables: digit value, or one of the classes below */
+#define IBASE_PAD		0xfd
+#define IBASE_SPACE		0xfe
+#define IBASE_INVALID	0xff
+
+static IUINT8 ibase64_table[256];
+static IUINT8 ibase32_table[256];
+static IUINT8 ibase16_table[256];
+static volatile int ibase_inited = 0;
+
+/* tables are deterministic, a racing init writes the same values */
+static void ibase_init(void)
+{
+	int i;
+	if (ibase_inited) return;
+	for (i = 0; i < 256; i++) {
+		IUINT8 c = IBASE_INVALID;
+		if (i == ' ' || i == '\t' || i == '\r' || i == '\n') c = IBASE_SPACE;
+		ibase64_table[i] = ibase32_table[i] = ibase16_table[i] = c;
+	}
+	for (i = 0; i < 64; i++) {
+		ibase64_table[(IUINT8)ibase64_alphabet[i]] = (IUINT8)i;
+	}
+	for (i = 0; i < 32; i++) {
+		ibase32_table[(IUINT8)ibase32_alphabet[i]] = (IUINT8)i;
+		ibase32_table[tolower((IUINT8)ibase32_alphabet[i])] = (IUINT8)i;
+	}
+	for (i = 0; i < 16; i++) {
+		ibase16_table[(IUINT8)"0123456789ABCDEF"[i]] = (IUINT8)i;
+		ibase16_table[(IUINT8)"0123456789abcdef"[i]] = (IUINT8)i;
+	}
+	ibase64_table['='] = IBASE_PAD;
+	ibase32_table['='] = IBASE_PAD;
+	ibase_inited = 1;
+}
+
+/* vector kernel: decodes whole groups, returns characters consumed */
+typedef ilong (*ibase_kernel_t)(const IUINT8 *src, ilong size, IUINT8 *dst);
+
+/* strict decoder shared by the three codecs: white space is skipped,
+ * padding is only accepted at the end and must complete the group, a
+ * trailing group which can't hold whole bytes is rejected. inlined so
+ * that each codec gets its group size as constants. */
+static inline ilong ibase_decode(const IUINT8 *s, ilong size, IUINT8 *dst,
+	const IUINT8 *table, int bits, int group, ibase_kernel_t kernel,
+	ilong threshold)
+{
+	IUINT8 *d = dst;
+	IUINT64 acc = 0;
+	ilong i = 0;
+	int n = 0, pad = 0, nbytes, k;
+	while (i < size) {
+		IUINT8 v;
+		if (n == 0 && kernel != NULL && size - i >= threshold) {
+			ilong used = kernel(s + i, size - i, d);
+			if (used > 0) {
+				i += used;
+				d += (used * bits) >> 3;
+				continue;
+			}
+		}
+		if (n == 0 && size - i >= group) {
+			/* digits are below 64, every class has the top bit set */
+			for (v = 0, k = 0; k < group; k++) {
+				v |= table[s[i + k]];
+				acc = (acc << bits) | table[s[i + k]];
+			}
+			if ((v & 0x80) == 0) {
+				for (k = (group * bits) - 8; k >= 0; k -= 8) 
+					*d++ = (IUINT8)(acc >> k);
+				i += group;
+				acc = 0;
+				continue;
+			}
+			acc = 0;
+		}
+		v = table[s[i++]];
+		if (v < 64) {
+			acc = (acc << bits) | v;
+			if (++n == group) {
+				for (k = (group * bits) - 8; k >= 0; k -= 8) 
+					*d++ = (IUINT8)(acc >> k);
+				acc = 0;
+				n = 0;
+			}
+		}
+		else if (v == IBASE_PAD) {
+			for (pad = 1; i < size; i++) {
+				v = table[s[i]];
+				if (v == IBASE_PAD) pad++;
+				else if (v != IBASE_SPACE) return -1;
+			}
+			if (n == 0 || pad != group - n) return -1;
+		}
+		else if (v != IBASE_SPACE) {
+			return -1;
+		}
+	}
+	nbytes = (n * bits) >> 3;
+	if (n * bits - nbytes * 8 >= bits) return -1;
+	for (k = nbytes - 1; k >= 0; k--) {
+		*d++ = (IUINT8)(acc >> (n * bits - nbytes * 8 + k * 8));
+	}
+	return (ilong)(d - dst);
+}
+
+
+
+#ifdef IMEM_AVX2
+/* pshufb kernels need immintrin.h, they are gated like the avx2 ones */
+
+/* 16 sextets to ascii, one pshufb selects the offset of each range */
+IMEM_TARGET("ssse3")
+static inline __m128i ibase64_ascii_ssse3(__m128i x)
+{
+	const __m128i lut = _mm_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, 
+		-4, -4, -4, -19, -16, 65, 0, 0);
+	__m128i r = _mm_subs_epu8(x, _mm_set1_epi8(51));
+	__m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), x);
+	r = _mm_or_si128(r, _mm_and_si128(less, _mm_set1_epi8(13)));
+	return _mm_add_epi8(x, _mm_shuffle_epi8(lut, r));
+}
+
+/* 12 bytes (of 16 loaded) to 16 sextets */
+IMEM_TARGET("ssse3")
+static inline __m128i ibase64_split_ssse3(__m128i x)
+{
+	const __m128i shuf = _mm_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 
+		7, 6, 8, 7, 10, 9, 11, 10);
+	__m128i t0, t1;
+	x = _mm_shuffle_epi8(x, shuf);
+	t0 = _mm_and_si128(x, _mm_set1_epi32(0x0fc0fc00));
+	t0 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	t1 = _mm_and_si128(x, _mm_set1_epi32(0x003f03f0));
+	t1 = _mm_mullo_epi16(t1, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t0, t1);
+}
+
+/* returns bytes consumed, a multiple of 12 */
+IMEM_TARGET("ssse3")
+static ilong ibase64_encode_ssse3(const IUINT8 *s, ilong size, char *d)
+{
+	ilong i = 0;
+	for (; i + 16 <= size; i += 12, d += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+		x = ibase64_ascii_ssse3(ibase64_split_ssse3(x));
+		_mm_storeu_si128((__m128i*)d, x);
+	}
+	return i;
+}
+
+/* validate 16 characters and map them to sextets, -1 for non base64 */
+IMEM_TARGET("ssse3")
+static inline int ibase64_values_ssse3(__m128i *x)
+{
+	const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 
+		0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 
+		0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, 
+		-71, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	__m128i hi = _mm_and_si128(_mm_srli_epi32(*x, 4), mask);
+	__m128i lo = _mm_and_si128(*x, mask);
+	__m128i bad = _mm_and_si128(_mm_shuffle_epi8(lut_lo, lo), 
+		_mm_shuffle_epi8(lut_hi, hi));
+	__m128i eq;
+	if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) 
+		!= 0xffff) return -1;
+	eq = _mm_cmpeq_epi8(*x, _mm_set1_epi8(0x2f));
+	*x = _mm_add_epi8(*x, _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq, hi)));
+	return 0;
+}
+
+/* 16 sextets to 12 bytes in the low part */
+IMEM_TARGET("ssse3")
+static inline __m128i ibase64_merge_ssse3(__m128i x)
+{
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 
+		14, 13, 12, -1, -1, -1, -1);
+	x = _mm_maddubs_epi16(x, _mm_set1_epi32(0x01400140));
+	x = _mm_madd_epi16(x, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(x, shuf);
+}
+
+IMEM_TARGET("ssse3")
+static ilong ibase64_decode_ssse3(const IUINT8 *s, ilong size, IUINT8 *d)
+{
+	ilong i = 0;
+	for (; i + 16 <= size; i += 16, d += 12) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+		IUINT32 tail;
+		if (ibase64_values_ssse3(&x) != 0) break;
+		x = ibase64_merge_ssse3(x);
+		_mm_storel_epi64((__m128i*)d, x);
+		tail = (IUINT32)_mm_cvtsi128_si32(_mm_srli_si128(x, 8));
+		memcpy(d + 8, &tail, 4);
+	}
+	return i;
+}
+
+IMEM_TARGET("avx2")
+static ilong ibase64_encode_avx2(const IUINT8 *s, ilong size, char *d)
+{
+	const __m256i shuf = _mm256_setr_epi8(1, 0, 2, 1, 4, 3, 5, 4, 
+		7, 6, 8, 7, 10, 9, 11, 10, 1, 0, 2, 1, 4, 3, 5, 4, 
+		7, 6, 8, 7, 10, 9, 11, 10);
+	const __m256i lut = _mm256_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, 
+		-4, -4, -4, -19, -16, 65, 0, 0, 71, -4, -4, -4, -4, -4, -4, -4, 
+		-4, -4, -4, -19, -16, 65, 0, 0);
+	ilong i = 0;
+	for (; i + 28 <= size; i += 24, d += 32) {
+		__m128i lo = _mm_loadu_si128((const __m128i*)(s + i));
+		__m128i hi = _mm_loadu_si128((const __m128i*)(s + i + 12));
+		__m256i x = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), 
+				hi, 1);
+		__m256i t0, t1, r, less;
+		x = _mm256_shuffle_epi8(x, shuf);
+		t0 = _mm256_and_si256(x, _mm256_set1_epi32(0x0fc0fc00));
+		t0 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		t1 = _mm256_and_si256(x, _mm256_set1_epi32(0x003f03f0));
+		t1 = _mm256_mullo_epi16(t1, _mm256_set1_epi32(0x01000010));
+		x = _mm256_or_si256(t0, t1);
+		r = _mm256_subs_epu8(x, _mm256_set1_epi8(51));
+		less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), x);
+		r = _mm256_or_si256(r, _mm256_and_si256(less, 
+				_mm256_set1_epi8(13)));
+		x = _mm256_add_epi8(x, _mm256_shuffle_epi8(lut, r));
+		_mm256_storeu_si256((__m256i*)d, x);
+	}
+	return i;
+}
+
+IMEM_TARGET("avx2")
+static ilong ibase64_decode_avx2(const IUINT8 *s, ilong size, IUINT8 *d)
+{
+	const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 
+		0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 
+		0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 
+		0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 
+		0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, 
+		-71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4, -65, -65, -71, -71, 
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i shuf = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 
+		14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 
+		14, 13, 12, -1, -1, -1, -1);
+	const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	ilong i = 0;
+	for (; i + 32 <= size; i += 32, d += 24) {
+		__m256i x = _mm256_loadu_si256((const __m256i*)(s + i));
+		__m256i hi = _mm256_and_si256(_mm256_srli_epi32(x, 4), mask);
+		__m256i lo = _mm256_and_si256(x, mask);
+		__m256i bad = _mm256_and_si256(_mm256_shuffle_epi8(lut_lo, lo),
+				_mm256_shuffle_epi8(lut_hi, hi));
+		__m256i eq;
+		if (!_mm256_testz_si256(bad, bad)) break;
+		eq = _mm256_cmpeq_epi8(x, _mm256_set1_epi8(0x2f));
+		x = _mm256_add_epi8(x, _mm256_shuffle_epi8(lut_roll, 
+				_mm256_add_epi8(eq, hi)));
+		x = _mm256_maddubs_epi16(x, _mm256_set1_epi32(0x01400140));
+		x = _mm256_madd_epi16(x, _mm256_set1_epi32(0x00011000));
+		x = _mm256_shuffle_epi8(x, shuf);
+		x = _mm256_permutevar8x32_epi32(x, pack);
+		_mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(x));
+		_mm_storel_epi64((__m128i*)(d + 16), 
+				_mm256_extracti128_si256(x, 1));
+	}
+	return i;
+}
+
+static ilong ibase64_decode_fast(const IUINT8 *s, ilong size, IUINT8 *d)
+{
+	ilong i = 0;
+	if (size >= 32 && (icpu_features() & ICPU_AVX2)) {
+		i = ibase64_decode_avx2(s, size, d);
+		d += (i >> 2) * 3;
+	}
+	if (size - i >= 16 && (icpu_features() & ICPU_SSSE3)) {
+		i += ibase64_decode_ssse3(s + i, size - i, d);
+	}
+	return i;
+}
+
+/* 10 bytes (of 16 loaded) to 16 quintets, two 40 bits groups */
+IMEM_TARGET("ssse3")
+static ilong ibase32_encode_ssse3(const IUINT8 *s, ilong size, char *d)
+{
+	const __m128i shuf = _mm_setr_epi8(4, 3, 2, 1, 0, -1, -1, -1, 
+		9, 8, 7, 6, 5, -1, -1, -1);
+	const __m128i m20 = _mm_set_epi32(0, 0xfffff, 0, 0xfffff);
+	const __m128i m10 = _mm_set1_epi32(0x3ff);
+	const __m128i m5 = _mm_set1_epi16(0x1f);
+	ilong i = 0;
+	for (; i + 16 <= size; i += 10, d += 16) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+		__m128i big;
+		x = _mm_shuffle_epi8(x, shuf);
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi64(x, 20), m20),
+			_mm_slli_epi64(_mm_and_si128(x, m20), 32));
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 10), m10),
+			_mm_slli_epi32(_mm_and_si128(x, m10), 16));
+		x = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(x, 5), m5),
+			_mm_slli_epi16(_mm_and_si128(x, m5), 8));
+		big = _mm_cmpgt_epi8(x, _mm_set1_epi8(25));
+		x = _mm_add_epi8(x, _mm_set1_epi8('A'));
+		x = _mm_add_epi8(x, _mm_and_si128(big, _mm_set1_epi8('2' - 26 - 'A')));
+		_mm_storeu_si128((__m128i*)d, x);
+	}
+	return i;
+}
+
+/* 16 characters to 10 bytes, stops at the first non base32 block */
+IMEM_TARGET("ssse3")
+static ilong ibase32_decode_fast(const IUINT8 *s, ilong size, IUINT8 *d)
+{
+	const __m128i shuf = _mm_setr_epi8(4, 3, 2, 1, 0, 12, 11, 10, 9, 8,
+		-1, -1, -1, -1, -1, -1);
+	const __m128i m32 = _mm_set_epi32(0, -1, 0, -1);
+	ilong i = 0;
+	for (; i + 16 <= size; i += 16, d += 10) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+		__m128i letter = _mm_sub_epi8(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+				_mm_set1_epi8('a'));
+		__m128i digit = _mm_sub_epi8(x, _mm_set1_epi8('2'));
+		__m128i isl = _mm_cmpeq_epi8(_mm_min_epu8(letter, 
+				_mm_set1_epi8(25)), letter);
+		__m128i isd = _mm_cmpeq_epi8(_mm_min_epu8(digit, 
+				_mm_set1_epi8(5)), digit);
+		if (_mm_movemask_epi8(_mm_or_si128(isl, isd)) != 0xffff) break;
+		x = _mm_or_si128(_mm_and_si128(isl, letter), 
+			_mm_and_si128(isd, _mm_add_epi8(digit, _mm_set1_epi8(26))));
+		x = _mm_maddubs_epi16(x, _mm_set1_epi16(0x0120));
+		x = _mm_madd_epi16(x, _mm_set1_epi32(0x00010400));
+		x = _mm_or_si128(_mm_slli_epi64(_mm_and_si128(x, m32), 20),
+			_mm_srli_epi64(x, 32));
+		x = _mm_shuffle_epi8(x, shuf);
+		_mm_storel_epi64((__m128i*)d, x);
+		d[8] = (IUINT8)(_mm_extract_epi16(x, 4) & 0xff);
+		d[9] = (IUINT8)((_mm_extract_epi16(x, 4) >> 8) & 0xff);
+	}
+	return i;
+}
+#endif
+
+#ifdef IMEM_SSE2
+/* 16 bytes to 32 hex digits */
+static ilong ibase16_encode_sse2(const IUINT8 *s, ilong size, char *d)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	ilong i = 0;
+	for (; i + 16 <= size; i += 16, d += 32) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(s + i));
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(x, 4), mask);
+		__m128i lo = _mm_and_si128(x, mask);
+		__m128i a = _mm_unpacklo_epi8(hi, lo);
+		__m128i b = _mm_unpackhi_epi8(hi, lo);
+		__m128i nine = _mm_set1_epi8(9), seven = _mm_set1_epi8(7);
+		a = _mm_add_epi8(_mm_add_epi8(a, _mm_set1_epi8('0')), 
+			_mm_and_si128(_mm_cmpgt_epi8(a, nine), seven));
+		b = _mm_add_epi8(_mm_add_epi8(b, _mm_set1_epi8('0')), 
+			_mm_and_si128(_mm_cmpgt_epi8(b, nine), seven));
+		_mm_storeu_si128((__m128i*)d, a);
+		_mm_storeu_si128((__m128i*)(d + 16), b);
+	}
+	return i;
+}
+
+/* 16 hex digits to nibbles, -1 if any of them isn't one */
+static inline int ibase16_values_sse2(__m128i *x)
+{
+	__m128i digit = _mm_sub_epi8(*x, _mm_set1_epi8('0'));
+	__m128i letter = _mm_sub_epi8(_mm_or_si128(*x, _mm_set1_epi8(0x20)),
+			_mm_set1_epi8('a'));
+	__m128i isd = _mm_cmpeq_epi8(_mm_min_epu8(digit, _mm_set1_epi8(9)), 
+			digit);
+	__m128i isl = _mm_cmpeq_epi8(_mm_min_epu8(letter, _mm_set1_epi8(5)), 
+			letter);
+	if (_mm_movemask_epi8(_mm_or_si128(isd, isl)) != 0xffff) return -1;
+	*x = _mm_or_si128(_mm_and_si128(isd, digit), 
+		_mm_and_si128(isl, _mm_add_epi8(letter, _mm_set1_epi8(10))));
+	return 0;
+}
+
+/* 32 hex digits to 16 bytes */
+static ilong ibase16_decode_fast(const IUINT8 *s, ilong size, IUINT8 *d)
+{
+	const __m128i low = _mm_set1_epi16(0xff);
+	ilong i = 0;
+	for (; i + 32 <= size; i += 32, d += 16) {
+		__m128i a = _mm_loadu_si128((const __m128i*)(s + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(s + i + 16));
+		if (ibase16_values_sse2(&a) != 0) break;
+		if (ibase16_values_sse2(&b) != 0) break;
+		a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low), 4),
+			_mm_srli_epi16(a, 8));
+		b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low), 4),
+			_mm_srli_epi16(b, 8));
+		_mm_storeu_si128((__m128i*)d, _mm_packus_epi16(a, b));
+	}
+	return i;
+}
+#endif
 
 /* encode data as a base64 string, returns string size,
    if dst == 0, returns how many bytes needed for encode (>=real) */
 ilong ibase64_encode(const void *src, ilong size, char *dst)
 {
 	const IUINT8 *s = (const IUINT8*)src;
-	static const char encode[] = 
-	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	iulong c;
 	char *d = dst;
-	int i;
+	ilong i = 0;
 
 	if (size == 0) return 0;
 
@@ -2508,33 +3970,45 @@ ilong ibase64_encode(const void *src, ilong size, char *dst)
 		return result;
 	}
 
-	for (i = 0; i < size; ) {
-		c = s[i]; 
-		c <<= 8;
-		i++;
-		c += (i < size)? s[i] : 0;
-		c <<= 8;
-		i++;
-		c += (i < size)? s[i] : 0;
-		i++;
-		*d++ = encode[(c >> 18) & 0x3f];
-		*d++ = encode[(c >> 12) & 0x3f];
-		*d++ = (i > (size + 1))? '=' : encode[(c >> 6) & 0x3f];
-		*d++ = (i > (size + 0))? '=' : encode[(c >> 0) & 0x3f];
+#ifdef IMEM_AVX2
+	if (size >= 28 && (icpu_features() & ICPU_AVX2)) {
+		i = ibase64_encode_avx2(s, size, d);
+		d += (i / 3) * 4;
+	}
+	if (size - i >= 16 && (icpu_features() & ICPU_SSSE3)) {
+		ilong k = ibase64_encode_ssse3(s + i, size - i, d);
+		d += (k / 3) * 4;
+		i += k;
+	}
+#endif
+
+	for (; i + 3 <= size; i += 3, d += 4) {
+		IUINT32 c = (((IUINT32)s[i]) << 16) | (((IUINT32)s[i + 1]) << 8) |
+			((IUINT32)s[i + 2]);
+		d[0] = ibase64_alphabet[(c >> 18) & 0x3f];
+		d[1] = ibase64_alphabet[(c >> 12) & 0x3f];
+		d[2] = ibase64_alphabet[(c >> 6) & 0x3f];
+		d[3] = ibase64_alphabet[c & 0x3f];
+	}
+
+	if (i < size) {
+		IUINT32 c = ((IUINT32)s[i]) << 16;
+		if (i + 1 < size) c |= ((IUINT32)s[i + 1]) << 8;
+		d[0] = ibase64_alphabet[(c >> 18) & 0x3f];
+		d[1] = ibase64_alphabet[(c >> 12) & 0x3f];
+		d[2] = (i + 1 < size)? ibase64_alphabet[(c >> 6) & 0x3f] : '=';
+		d[3] = '=';
+		d += 4;
 	}
 
 	d[0] = '\0';
 	return (ilong)(d - dst);
 }
 
-/* decode a base64 string into data, returns data size */
+/* decode a base64 string into data, returns data size, or -1 */
 ilong ibase64_decode(const char *src, ilong size, void *dst)
 {
-	static iulong decode[256] = { 0xff };
-	const IUINT8 *s = (const IUINT8*)src;
-	IUINT8 *d = (IUINT8*)dst;
-	iulong mark, i, j, c, k;
-	char b[3];
+	ibase_kernel_t kernel = NULL;
 
 	if (size == 0) return 0;
 	if (size < 0) size = strlen(src);
@@ -2545,73 +4019,20 @@ ilong ibase64_decode(const char *src, ilong size, void *dst)
 		return nbytes;
 	}
 
-	if (decode[0] == 0xff) {
-		for (i = 1; i < 256; i++) {
-			if (i >= 'A' && i <= 'Z') decode[i] = i - 'A';
-			else if (i >= 'a' && i <= 'z') decode[i] = i - 'a' + 26;
-			else if (i >= '0' && i <= '9') decode[i] = i - '0' + 52;
-			else if (i == '+') decode[i] = 62;
-			else if (i == '/') decode[i] = 63;
-			else if (i == '=') decode[i] = 0;
-			else decode[i] = 88;
-		}
-		decode[0] = 88;
-	}
-
-	#define ibase64_skip(s, i, size) {					\
-			for (; i < size; i++) {						\
-				if (decode[s[i]] <= 64) break;			\
-			}											\
-			if (i >= size) { i = size + 1; break; } 	\
-		}
-	
-	for (i = 0, j = 0, k = 0; i < (iulong)size; ) {
-		mark = 0;
-		c = 0;
-
-		ibase64_skip(s, i, (iulong)size);
-		c += decode[s[i]];
-		c <<= 6;
-		i++;
-		
-		ibase64_skip(s, i, (iulong)size);
-		c += decode[s[i]];
-		c <<= 6;
-		i++;
-
-		ibase64_skip(s, i, (iulong)size);
-		if (s[i] != '=') {
-			c += decode[s[i]];
-			c <<= 6;
-			i++;
-			ibase64_skip(s, i, (iulong)size);
-			if (s[i] != '=') c += decode[s[i]], i++;
-			else i = size, mark = 1;
-		}	else {
-			i = size;
-			mark = 2;
-			c <<= 6;
-		}
-
-		b[0] = (IUINT8)((c >> 16) & 0xff);
-		b[1] = (IUINT8)((c >>  8) & 0xff);
-		b[2] = (IUINT8)((c >>  0) & 0xff);
-
-		for (j = 0; j < 3 - mark; j++) 
-			d[k++] = b[j];
-	}
-
-	return (ilong)k;
+	ibase_init();
+#ifdef IMEM_AVX2
+	if (icpu_features() & ICPU_SSSE3) kernel = ibase64_decode_fast;
+#endif
+	return ibase_decode((const IUINT8*)src, size, (IUINT8*)dst, 
+		ibase64_table, 6, 4, kernel, 16);
 }
 
 /* encode data as a base32 string, returns string size */
 ilong ibase32_encode(const void *src, ilong size, char *dst)
 {
-	static const char encode[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
-	const IUINT8 *buffer = (const IUINT8*)src;
-	IUINT8 word;
-	ilong i, index;
-	char *ptr = dst;
+	const IUINT8 *s = (const IUINT8*)src;
+	char *d = dst;
+	ilong i = 0;
 
 	if (size == 0) return 0;
 
@@ -2622,40 +4043,34 @@ ilong ibase32_encode(const void *src, ilong size, char *dst)
 		return result;
 	}
 
-	for (i = 0, index = 0; i < size; ) {
-		if (index > 3) {
-			word = (buffer[i] & (0xFF >> index));
-			index = (index + 5) % 8;
-			word <<= index;
-			if (i < size - 1) {
-				word |= buffer[i + 1] >> (8 - index);
-			}
-			i++;
-		}	else {
-			word = (buffer[i] >> (8 - (index + 5))) & 0x1F;
-			index = (index + 5) & 7;
-			if (index == 0) i++;
+#ifdef IMEM_AVX2
+	if (size >= 16 && (icpu_features() & ICPU_SSSE3)) {
+		i = ibase32_encode_ssse3(s, size, d);
+		d += (i / 5) * 8;
+	}
+#endif
+
+	for (; i < size; i += 5) {
+		IUINT64 c = 0;
+		int n = (size - i < 5)? (int)(size - i) : 5;
+		int k, m = (n * 8 + 4) / 5;
+		for (k = 0; k < 5; k++) {
+			c = (c << 8) | ((k < n)? s[i + k] : 0);
 		}
-
-		assert(word < 32);
-		*(dst++) = (char)encode[word];
+		for (k = 0; k < 8; k++) {
+			d[k] = (k < m)? ibase32_alphabet[(c >> (35 - k * 5)) & 31] : '=';
+		}
+		d += 8;
 	}
 
-	while ((((ilong)(dst - ptr)) & 7) != 0) *dst++ = '=';
-
-	*dst = 0;
-
-	return (ilong)(dst - ptr);
+	d[0] = '\0';
+	return (ilong)(d - dst);
 }
 
-/* decode a base32 string into data, returns data size */
+/* decode a base32 string into data, returns data size, or -1 */
 ilong ibase32_decode(const char *src, ilong size, void *dst)
 {
-	const IUINT8 *lptr = (const IUINT8*)src;
-	IUINT8 *buffer = (IUINT8*)dst;
-	IUINT8 word;
-	ilong offset, last, i;
-	int index;
+	ibase_kernel_t kernel = NULL;
 
 	if (size == 0) return 0;
 	if (size < 0) size = strlen(src);
@@ -2665,35 +4080,12 @@ ilong ibase32_decode(const char *src, ilong size, void *dst)
 		return need;
 	}
 
-	for(i = 0, index = 0, offset = 0, last = -1; i < size; i++) {
-		IUINT8 ch = lptr[i];
-
-		if (ch >= '2' && ch <= '7') word = ch - '2' + 26;
-		else if (ch >= 'A' && ch <= 'Z') word = ch - 'A';
-		else if (ch >= 'a' && ch <= 'z') word = ch - 'a';
-		else continue;
-
-		if (index <= 3) {
-			index = (index + 5) & 7;
-			if (index == 0) {
-				if (last < offset) buffer[offset] = 0, last = offset;
-				buffer[offset] |= word;
-				offset++;
-			}	else {
-				if (last < offset) buffer[offset] = 0, last = offset;
-				buffer[offset] |= word << (8 - index);
-			}
-		}	else {
-			index = (index + 5) & 7;
-			if (last < offset) buffer[offset] = 0, last = offset;
-			buffer[offset] |= (word >> index);
-			offset++;
-			buffer[offset] = word << (8 - index);
-			last = offset;
-		}
-	}
-
-	return offset;
+	ibase_init();
+#ifdef IMEM_AVX2
+	if (icpu_features() & ICPU_SSSE3) kernel = ibase32_decode_fast;
+#endif
+	return ibase_decode((const IUINT8*)src, size, (IUINT8*)dst,
+		ibase32_table, 5, 8, kernel, 16);
 }
 
 /* encode data as a base16 string, returns string size */
@@ -2704,6 +4096,14 @@ ilong ibase16_encode(const void *src, ilong size, char *dst)
 	char *output = dst;
 	if (src == NULL || dst == NULL) 
 		return 2 * size;
+#ifdef IMEM_SSE2
+	if (size >= 16 && (icpu_features() & ICPU_SSE2)) {
+		ilong k = ibase16_encode_sse2(ptr, size, output);
+		output += k * 2;
+		ptr += k;
+		size -= k;
+	}
+#endif
 	for (; size > 0; output += 2, ptr++, size--) {
 		output[0] = encode[ptr[0] >> 4];
 		output[1] = encode[ptr[0] & 15];
@@ -2711,30 +4111,23 @@ ilong ibase16_encode(const void *src, ilong size, char *dst)
 	return (ilong)(output - dst);
 }
 
-/* decode a base16 string into data, returns data size */
+/* decode a base16 string into data, returns data size, or -1 */
 ilong ibase16_decode(const char *src, ilong size, void *dst)
 {
-	const IUINT8 *in = (const IUINT8*)src;
-	IUINT8 *out = (IUINT8*)dst, word = 0, decode = 0;
-	int index = 0;
+	ibase_kernel_t kernel = NULL;
 
 	if (size == 0) return 0;
 	if (size < 0) size = strlen(src);
 
 	if (src == NULL || dst == NULL) 
 		return size >> 1;
-	
-	for (; size > 0; size--) {
-		IUINT8 ch = *in++;
-		if (ch >= '0' && ch <= '9') word = ch - '0';
-		else if (ch >= 'A' && ch <= 'F') word = ch - 'A' + 10;
-		else if (ch >= 'a' && ch <= 'f') word = ch - 'a' + 10;
-		else continue;
-		if (index == 0) decode = word << 4, index = 1;
-		else decode |= word & 0xf, *out++ = decode, index = 0;
-	}
 
-	return (ilong)(out - (IUINT8*)dst);
+	ibase_init();
+#ifdef IMEM_SSE2
+	if (icpu_features() & ICPU_SSE2) kernel = ibase16_decode_fast;
+#endif
+	return ibase_decode((const IUINT8*)src, size, (IUINT8*)dst,
+		ibase16_table, 4, 2, kernel, 32);
 }
 
 
@@ -2792,3 +4185,243 @@ void icrypt_rc4_crypt(unsigned char *box, int *x, int *y,
 }
 
 
+
+
+/**********************************************************************
+ * CHACHA20
+ **********************************************************************/
+#define ICHACHA_ROTL(v, n) (((v) << (n)) | ((v) >> (32 - (n))))
+
+#define ICHACHA_QR(a, b, c, d) do { \
+		a += b; d ^= a; d = ICHACHA_ROTL(d, 16); \
+		c += d; b ^= c; b = ICHACHA_ROTL(b, 12); \
+		a += b; d ^= a; d = ICHACHA_ROTL(d, 8); \
+		c += d; b ^= c; b = ICHACHA_ROTL(b, 7); \
+	}	while (0)
+
+/* chacha20 init */
+void icrypt_chacha20_init(ICHACHA20 *ctx, const unsigned char *key,
+	const unsigned char *nonce, IUINT64 counter)
+{
+	static const char sigma[] = "expand 32-byte k";
+	int i;
+	for (i = 0; i < 4; i++) {
+		idecode32u_lsb(sigma + i * 4, &ctx->state[i]);
+	}
+	for (i = 0; i < 8; i++) {
+		idecode32u_lsb((const char*)key + i * 4, &ctx->state[4 + i]);
+	}
+	ctx->state[12] = (IUINT32)(counter & 0xffffffff);
+	ctx->state[13] = (IUINT32)(counter >> 32);
+	for (i = 0; i < 2; i++) {
+		if (nonce == NULL) ctx->state[14 + i] = 0;
+		else idecode32u_lsb((const char*)nonce + i * 4, &ctx->state[14 + i]);
+	}
+	ctx->avail = 0;
+}
+
+/* advance the 64-bit block counter */
+static inline void icrypt_chacha20_next(IUINT32 *state, IUINT32 blocks)
+{
+	IUINT32 lo = state[12];
+	state[12] = lo + blocks;
+	if (state[12] < lo) state[13]++;
+}
+
+/* one keystream block */
+static void icrypt_chacha20_block(IUINT32 *state, unsigned char *out)
+{
+	IUINT32 x[16];
+	int i;
+	for (i = 0; i < 16; i++) x[i] = state[i];
+	for (i = 0; i < 10; i++) {
+		ICHACHA_QR(x[0], x[4], x[8], x[12]);
+		ICHACHA_QR(x[1], x[5], x[9], x[13]);
+		ICHACHA_QR(x[2], x[6], x[10], x[14]);
+		ICHACHA_QR(x[3], x[7], x[11], x[15]);
+		ICHACHA_QR(x[0], x[5], x[10], x[15]);
+		ICHACHA_QR(x[1], x[6], x[11], x[12]);
+		ICHACHA_QR(x[2], x[7], x[8], x[13]);
+		ICHACHA_QR(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++) {
+		iencode32u_lsb((char*)out + i * 4, x[i] + state[i]);
+	}
+	icrypt_chacha20_next(state, 1);
+}
+
+#ifdef IMEM_SSE2
+#define ICHACHA_ROTL128(v, n) \
+	_mm_or_si128(_mm_slli_epi32(v, n), _mm_srli_epi32(v, 32 - (n)))
+
+#define ICHACHA_QR128(a, b, c, d) do { \
+		a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); \
+		d = ICHACHA_ROTL128(d, 16); \
+		c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); \
+		b = ICHACHA_ROTL128(b, 12); \
+		a = _mm_add_epi32(a, b); d = _mm_xor_si128(d, a); \
+		d = ICHACHA_ROTL128(d, 8); \
+		c = _mm_add_epi32(c, d); b = _mm_xor_si128(b, c); \
+		b = ICHACHA_ROTL128(b, 7); \
+	}	while (0)
+
+/* four blocks, one per lane: 256 bytes */
+static void icrypt_chacha20_sse2(IUINT32 *state, const unsigned char *src,
+	unsigned char *dst)
+{
+	__m128i x[16], o[16];
+	IUINT32 lo = state[12], hi = state[13];
+	int i, g;
+	for (i = 0; i < 16; i++) o[i] = _mm_set1_epi32((int)state[i]);
+	o[12] = _mm_set_epi32((int)(lo + 3), (int)(lo + 2), (int)(lo + 1), 
+		(int)lo);
+	o[13] = _mm_set_epi32((int)(hi + (lo + 3 < lo)), 
+		(int)(hi + (lo + 2 < lo)), (int)(hi + (lo + 1 < lo)), (int)hi);
+	for (i = 0; i < 16; i++) x[i] = o[i];
+	for (i = 0; i < 10; i++) {
+		ICHACHA_QR128(x[0], x[4], x[8], x[12]);
+		ICHACHA_QR128(x[1], x[5], x[9], x[13]);
+		ICHACHA_QR128(x[2], x[6], x[10], x[14]);
+		ICHACHA_QR128(x[3], x[7], x[11], x[15]);
+		ICHACHA_QR128(x[0], x[5], x[10], x[15]);
+		ICHACHA_QR128(x[1], x[6], x[11], x[12]);
+		ICHACHA_QR128(x[2], x[7], x[8], x[13]);
+		ICHACHA_QR128(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++) x[i] = _mm_add_epi32(x[i], o[i]);
+	/* transpose words 4g..4g+3 of the four blocks */
+	for (g = 0; g < 4; g++) {
+		__m128i t0 = _mm_unpacklo_epi32(x[g * 4 + 0], x[g * 4 + 1]);
+		__m128i t1 = _mm_unpacklo_epi32(x[g * 4 + 2], x[g * 4 + 3]);
+		__m128i t2 = _mm_unpackhi_epi32(x[g * 4 + 0], x[g * 4 + 1]);
+		__m128i t3 = _mm_unpackhi_epi32(x[g * 4 + 2], x[g * 4 + 3]);
+		__m128i r[4];
+		r[0] = _mm_unpacklo_epi64(t0, t1);
+		r[1] = _mm_unpackhi_epi64(t0, t1);
+		r[2] = _mm_unpacklo_epi64(t2, t3);
+		r[3] = _mm_unpackhi_epi64(t2, t3);
+		for (i = 0; i < 4; i++) {
+			const __m128i *s = (const __m128i*)(src + i * 64 + g * 16);
+			__m128i *d = (__m128i*)(dst + i * 64 + g * 16);
+			_mm_storeu_si128(d, _mm_xor_si128(_mm_loadu_si128(s), r[i]));
+		}
+	}
+	icrypt_chacha20_next(state, 4);
+}
+#endif
+
+#ifdef IMEM_AVX2
+#define ICHACHA_ROTL256(v, n) \
+	_mm256_or_si256(_mm256_slli_epi32(v, n), _mm256_srli_epi32(v, 32 - (n)))
+
+#define ICHACHA_QR256(a, b, c, d) do { \
+		a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); \
+		d = _mm256_shuffle_epi8(d, r16); \
+		c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); \
+		b = ICHACHA_ROTL256(b, 12); \
+		a = _mm256_add_epi32(a, b); d = _mm256_xor_si256(d, a); \
+		d = _mm256_shuffle_epi8(d, r8); \
+		c = _mm256_add_epi32(c, d); b = _mm256_xor_si256(b, c); \
+		b = ICHACHA_ROTL256(b, 7); \
+	}	while (0)
+
+/* eight blocks, one per lane: 512 bytes */
+IMEM_TARGET("avx2")
+static void icrypt_chacha20_avx2(IUINT32 *state, const unsigned char *src,
+	unsigned char *dst)
+{
+	__m256i x[16], o[16], r16, r8;
+	IUINT32 lo = state[12], hi = state[13], l[8], h[8];
+	int i, g;
+	r16 = _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 
+		1, 0, 3, 2, 13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2);
+	r8 = _mm256_set_epi8(14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 
+		2, 1, 0, 3, 14, 13, 12, 15, 10, 9, 8, 11, 6, 5, 4, 7, 2, 1, 0, 3);
+	for (i = 0; i < 16; i++) o[i] = _mm256_set1_epi32((int)state[i]);
+	for (i = 0; i < 8; i++) {
+		l[i] = lo + (IUINT32)i;
+		h[i] = hi + ((l[i] < lo)? 1 : 0);
+	}
+	o[12] = _mm256_loadu_si256((const __m256i*)l);
+	o[13] = _mm256_loadu_si256((const __m256i*)h);
+	for (i = 0; i < 16; i++) x[i] = o[i];
+	for (i = 0; i < 10; i++) {
+		ICHACHA_QR256(x[0], x[4], x[8], x[12]);
+		ICHACHA_QR256(x[1], x[5], x[9], x[13]);
+		ICHACHA_QR256(x[2], x[6], x[10], x[14]);
+		ICHACHA_QR256(x[3], x[7], x[11], x[15]);
+		ICHACHA_QR256(x[0], x[5], x[10], x[15]);
+		ICHACHA_QR256(x[1], x[6], x[11], x[12]);
+		ICHACHA_QR256(x[2], x[7], x[8], x[13]);
+		ICHACHA_QR256(x[3], x[4], x[9], x[14]);
+	}
+	for (i = 0; i < 16; i++) x[i] = _mm256_add_epi32(x[i], o[i]);
+	/* per 128-bit lane transpose: r[g][k] holds words 4g..4g+3 of 
+	 * block k in the low lane and of block k + 4 in the high lane */
+	{
+		__m256i r[4][4];
+		for (g = 0; g < 4; g++) {
+			__m256i t0 = _mm256_unpacklo_epi32(x[g * 4 + 0], x[g * 4 + 1]);
+			__m256i t1 = _mm256_unpacklo_epi32(x[g * 4 + 2], x[g * 4 + 3]);
+			__m256i t2 = _mm256_unpackhi_epi32(x[g * 4 + 0], x[g * 4 + 1]);
+			__m256i t3 = _mm256_unpackhi_epi32(x[g * 4 + 2], x[g * 4 + 3]);
+			r[g][0] = _mm256_unpacklo_epi64(t0, t1);
+			r[g][1] = _mm256_unpackhi_epi64(t0, t1);
+			r[g][2] = _mm256_unpacklo_epi64(t2, t3);
+			r[g][3] = _mm256_unpackhi_epi64(t2, t3);
+		}
+		for (i = 0; i < 4; i++) {
+			__m256i k[4];
+			k[0] = _mm256_permute2x128_si256(r[0][i], r[1][i], 0x20);
+			k[1] = _mm256_permute2x128_si256(r[2][i], r[3][i], 0x20);
+			k[2] = _mm256_permute2x128_si256(r[0][i], r[1][i], 0x31);
+			k[3] = _mm256_permute2x128_si256(r[2][i], r[3][i], 0x31);
+			for (g = 0; g < 4; g++) {
+				long pos = (g < 2)? (i * 64 + g * 32) : 
+					((i + 4) * 64 + (g - 2) * 32);
+				const __m256i *s = (const __m256i*)(src + pos);
+				__m256i *d = (__m256i*)(dst + pos);
+				_mm256_storeu_si256(d, 
+					_mm256_xor_si256(_mm256_loadu_si256(s), k[g]));
+			}
+		}
+	}
+	icrypt_chacha20_next(state, 8);
+}
+#endif
+
+/* chacha20 crypt */
+void icrypt_chacha20_crypt(ICHACHA20 *ctx, const unsigned char *src,
+	unsigned char *dst, ilong size)
+{
+	int features = 0;
+	int i;
+	/* keystream left from the previous call */
+	for (; ctx->avail > 0 && size > 0; size--, ctx->avail--) {
+		*dst++ = *src++ ^ ctx->stream[64 - ctx->avail];
+	}
+	if (size >= 256) features = icpu_features();
+#ifdef IMEM_AVX2
+	if (features & ICPU_AVX2) {
+		for (; size >= 512; size -= 512, src += 512, dst += 512) {
+			icrypt_chacha20_avx2(ctx->state, src, dst);
+		}
+	}
+#endif
+#ifdef IMEM_SSE2
+	if (features & ICPU_SSE2) {
+		for (; size >= 256; size -= 256, src += 256, dst += 256) {
+			icrypt_chacha20_sse2(ctx->state, src, dst);
+		}
+	}
+#endif
+	for (; size >= 64; size -= 64, src += 64, dst += 64) {
+		icrypt_chacha20_block(ctx->state, ctx->stream);
+		for (i = 0; i < 64; i++) dst[i] = src[i] ^ ctx->stream[i];
+	}
+	if (size > 0) {
+		icrypt_chacha20_block(ctx->state, ctx->stream);
+		for (i = 0; i < size; i++) dst[i] = src[i] ^ ctx->stream[i];
+		ctx->avail = 64 - (int)size;
+	}
+}
@@ -637,7 +637,27 @@ static inline ivalue_t *it_strcatc2(ivalue_t *v, const char *s)
 	return it_strcatc(v, s, (ilong)strlen(s));
 }
 
-/* string hash 1 inline */
+/* seeded 64-bit hash (wyhash style), portable and stable for a seed */
+IUINT64 istrhash64(const void *data, size_t size, IUINT64 seed);
+
+/* string hash with a per-process seed chosen on first use, so keys 
+ * from the network cannot be crafted to collide. keys of 1KB or more
+ * go through a lane accumulator (AVX2 when the cpu has it), the value
+ * for a fixed seed is the same on every cpu */
+iulong istrhash(const char *name, iulong len);
+
+/* fix the process seed (eg. for reproducible runs), it must be called
+ * before any string key has been hashed: returns 0 for success and -1
+ * when a seed is already in use, since changing it would break every
+ * dictionary holding string keys */
+int istrhash_seed(IUINT64 seed);
+
+/* fill buffer with bytes from the system csprng (getrandom or 
+ * /dev/urandom, RtlGenRandom on windows), returns 0 for success */
+int irandom_bytes(void *buffer, size_t size);
+
+/* legacy string hash, it_hashstr uses it when compiled with
+ * IMEM_LEGACY_STRHASH: samples one byte every (len >> 5) + 1 */
 static inline iulong _istrhash(const char *name, iulong len)
 {
 	iulong step = (len >> 5) + 1;
@@ -652,7 +672,11 @@ static inline iulong _istrhash(const char *name, iulong len)
 static inline void it_hashstr(ivalue_t *v)
 {
 	if (it_type(v) != ITYPE_STR) return;
+#ifdef IMEM_LEGACY_STRHASH
 	it_hash(v) = _istrhash(it_str(v), it_size(v));
+#else
+	it_hash(v) = istrhash(it_str(v), it_size(v));
+#endif
 	it_rehash(v) = 1;
 }
 
@@ -687,12 +711,29 @@ struct IDICTBUCKET
 	ilong count;				/* how many entries in the bucket */
 };
 
+/* a slot of the flat table: full hash and the entry it locates */
+struct IDICTSLOT
+{
+	iulong hash;				/* key hash */
+	struct IDICTENTRY *entry;	/* entry in the nodes container */
+};
+
 #ifndef IDICT_LRUSHIFT
 #define IDICT_LRUSHIFT		4
 #endif
 
 #define IDICT_LRUSIZE		(1ul << IDICT_LRUSHIFT)
 
+/* table layouts for idict_create_ex */
+#define IDICT_CHAINED		0	/* bucket lists (default) */
+#define IDICT_FLAT			1	/* open addressing, 16-way tag probing */
+#define IDICT_INCREMENTAL	2	/* chained: spread growth over operations */
+
+/* old buckets migrated by each operation during incremental rehash */
+#ifndef IDICT_REHASH_STEP
+#define IDICT_REHASH_STEP	4
+#endif
+
 
 /*-------------------------------------------------------------------*/
 /* IDICTIONARY - dictionary definition                               */
@@ -708,6 +749,14 @@ struct IDICTIONARY
 	ilong inc;						/* auto increasement */
 	ilong length;					/* hash table size */
 	struct IDICTENTRY *lru[IDICT_LRUSIZE];		/* lru cache */
+	int flags;						/* IDICT_CHAINED or IDICT_FLAT */
+	unsigned char *ctrl;			/* flat: control byte per slot */
+	struct IDICTSLOT *slots;		/* flat: slot array */
+	ilong growth;					/* flat: inserts before rehash */
+	struct IDICTBUCKET *oldtable;	/* incremental: table being drained */
+	struct IVECTOR oldvect;			/* incremental: old table memory */
+	ilong oldmask;					/* incremental: old table mask */
+	ilong rehash;					/* incremental: next old bucket or -1 */
 };
 
 typedef struct IDICTIONARY idict_t;
@@ -721,6 +770,16 @@ typedef struct IDICTENTRY idictentry_t;
 /* create dictionary */
 idict_t *idict_create(void);
 
+/* create dictionary with a table layout: IDICT_CHAINED keeps entries
+   in bucket lists, IDICT_FLAT probes control bytes 16 at a time and 
+   only touches an entry whose hash matches */
+idict_t *idict_create_ex(int flags);
+
+/* move up to steps buckets of a pending incremental rehash into the 
+   new table (steps < 0 finishes it), call it from idle ticks so that 
+   the migration does not wait for traffic. returns 1 while pending */
+int idict_rehash(idict_t *dict, ilong steps);
+
 /* delete dictionary */
 void idict_delete(idict_t *dict);
 
@@ -728,6 +787,13 @@ void idict_delete(idict_t *dict);
 /* search pair in dictionary */
 ivalue_t *idict_search(idict_t *dict, const ivalue_t *key, ilong *pos);
 
+/* search n keys at once: vals[i] is the value of keys[i] or NULL, 
+ * returns how many were found. all keys of a chunk are hashed and 
+ * their buckets prefetched before any is resolved, so large tables 
+ * pay for the cache misses of a batch only once */
+ilong idict_search_batch(idict_t *dict, const ivalue_t *keys, ilong n,
+	ivalue_t **vals);
+
 /* add (key, val) pair into dictionary */
 ilong idict_add(idict_t *dict, const ivalue_t *key, const ivalue_t *val);
 
@@ -791,6 +857,15 @@ int idict_search_sp(idict_t *dict, const char *key, ilong keysize,
 /* search: key(int) val(ptr) */
 int idict_search_ip(idict_t *dict, ilong key, void**ptr);
 
+/* batch search: key(int) val(int), found[i] (can be NULL) is 1 when
+ * vals[i] has been set, returns how many have been found */
+ilong idict_search_batch_ii(idict_t *dict, const ilong *keys, ilong n,
+	ilong *vals, int *found);
+
+/* batch search: key(int) val(ptr), ptrs[i] is NULL when not found */
+ilong idict_search_batch_ip(idict_t *dict, const ilong *keys, ilong n,
+	void **ptrs);
+
 /* add: key(str) val(str) */
 ilong idict_add_ss(idict_t *dict, const char *key, ilong keysize,
 	const char *val, ilong valsize);
@@ -1451,6 +1526,10 @@ void ims_clear(struct IMSTREAM *s);
 /* get flat ptr and size */
 ilong ims_flat(const struct IMSTREAM *s, void **pointer);
 
+/* get ptrs and sizes of the first (count) pages, returns page number */
+int ims_iovec(const struct IMSTREAM *s, void *ptrs[], ilong sizes[], 
+	int count);
+
 
 
 /**********************************************************************
@@ -1553,6 +1632,31 @@ ilong istrload(const char *src, ilong size, char *out);
 const char *istrcsvtok(const char *text, ilong *next, ilong *size);
 
 
+/**********************************************************************
+ * cpu features and vectorized scanning
+ **********************************************************************/
+#define ICPU_SSE2		1
+#define ICPU_SSSE3		2
+#define ICPU_SSE41		4
+#define ICPU_SSE42		8
+#define ICPU_PCLMUL		16
+#define ICPU_AVX		32
+#define ICPU_AVX2		64
+#define ICPU_SHA		128
+
+/* instruction set extensions usable by this process (ICPU_*), detected
+ * once; build with IDISABLE_SIMD to compile the vector paths out */
+int icpu_features(void);
+
+/* mask out features, eg. to exercise the portable code paths */
+void icpu_features_mask(int mask);
+
+/* offsets of bytes equal to ch, at most count of them: returns how many
+ * were found, scan again after pos[count - 1] when it equals count */
+ilong imemscan(const void *ptr, ilong size, int ch, IUINT32 *pos, 
+	ilong count);
+
+
 /**********************************************************************
  * ivalue_t string library
  **********************************************************************/
@@ -1725,7 +1829,8 @@ int istring_list_join(const istring_list_t *strings, const char *str,
    if dst == NULL, returns how many bytes needed for encode (>=real) */
 ilong ibase64_encode(const void *src, ilong size, char *dst);
 
-/* decode a base64 string into data, returns data size 
+/* decode a base64 string into data, returns data size, or -1 for a
+   character outside the alphabet or bad padding (white space skipped)
    if dst == NULL, returns how many bytes needed for decode (>=real) */
 ilong ibase64_decode(const char *src, ilong size, void *dst);
 
@@ -1733,7 +1838,8 @@ ilong ibase64_decode(const char *src, ilong size, void *dst);
    if dst == NULL, returns how many bytes needed for encode (>=real) */
 ilong ibase32_encode(const void *src, ilong size, char *dst);
 
-/* decode a base32 string into data, returns data size 
+/* decode a base32 string into data, returns data size, or -1 if it
+   is malformed (lower case accepted, white space skipped)
    if dst == NULL, returns how many bytes needed for decode (>=real) */
 ilong ibase32_decode(const char *src, ilong size, void *dst);
 
@@ -1741,7 +1847,8 @@ ilong ibase32_decode(const char *src, ilong size, void *dst);
    the 'dst' output size is (2 * size). '\0' isn't appended */
 ilong ibase16_encode(const void *src, ilong size, char *dst);
 
-/* decode a base16 string into data, returns data size 
+/* decode a base16 string into data, returns data size, or -1 for a
+   non hex digit or an odd digit count (white space skipped)
    if dst == NULL, returns how many bytes needed for decode (>=real) */
 ilong ibase16_decode(const char *src, ilong size, void *dst);
 
@@ -1760,6 +1867,26 @@ void icrypt_rc4_crypt(unsigned char *box, int *x, int *y,
 	const unsigned char *src, unsigned char *dst, ilong size);
 
 
+/**********************************************************************
+ * CHACHA20
+ **********************************************************************/
+typedef struct
+{
+	IUINT32 state[16];			/* constants, key, counter and nonce */
+	unsigned char stream[64];	/* keystream of the last block */
+	int avail;					/* unused bytes at the end of stream */
+}	ICHACHA20;
+
+/* chacha20 init: 32 bytes key, 8 bytes nonce (NULL for zero) and the
+ * first block of the 64-bit block counter (original djb layout) */
+void icrypt_chacha20_init(ICHACHA20 *ctx, const unsigned char *key,
+	const unsigned char *nonce, IUINT64 counter);
+
+/* chacha20 crypt: src and dst can be the same */
+void icrypt_chacha20_crypt(ICHACHA20 *ctx, const unsigned char *src,
+	unsigned char *dst, ilong size);
+
+
 /**********************************************************************
  * XOR crypt
  **********************************************************************/
@@ -28,6 +28,8 @@
 #include <unistd.h>
 #include <netinet/in.h>
 #include <sys/select.h>
+#include <sys/uio.h>
+#include <limits.h>
 
 #ifndef __AVM3__
 #include <poll.h>
@@ -39,12 +41,18 @@
 #include <sys/filio.h>
 #endif
 
+#if defined(__linux__) && (!defined(__AVM3__))
+#include <sys/sendfile.h>
+#include <linux/errqueue.h>
+#endif
+
 #elif (defined(_WIN32) || defined(WIN32))
 #if ((!defined(_M_PPC)) && (!defined(_M_PPC_BE)) && (!defined(_XBOX)))
 #include <mmsystem.h>
 #include <mswsock.h>
 #include <process.h>
 #include <stddef.h>
+#include <io.h>
 #ifdef _MSC_VER
 #pragma comment(lib, "winmm.lib")
 #pragma comment(lib, "ws2_32.lib")
@@ -590,6 +598,59 @@ long isend(int sock, const void *buf, long size, int mode)
 	return (long)send(sock, (char*)buf, size, mode);
 }
 
+/* send vector: gather (count) buffers into one send */
+long isendv(int sock, const void * const vecptr[], const long veclen[],
+	int count, int mode)
+{
+#if defined(__unix) && (!defined(__AVM3__))
+	struct iovec iov[ISENDV_MAX];
+	struct msghdr msg;
+	long total = 0, want, hr;
+	int limit = ISENDV_MAX;
+	int i, n;
+	#ifdef IOV_MAX
+	if (limit > IOV_MAX) limit = IOV_MAX;
+	#endif
+	if (count > ISENDV_MAX) count = ISENDV_MAX;
+	/* chunk by IOV_MAX, a short chunk means the send buffer is full */
+	while (count > 0) {
+		n = (count < limit)? count : limit;
+		for (want = 0, i = 0; i < n; i++) {
+			iov[i].iov_base = (void*)vecptr[i];
+			iov[i].iov_len = (size_t)veclen[i];
+			want += veclen[i];
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = n;
+		hr = (long)sendmsg(sock, &msg, mode);
+		if (hr < 0) return (total > 0)? total : hr;
+		total += hr;
+		if (hr < want) break;
+		vecptr += n;
+		veclen += n;
+		count -= n;
+	}
+	return total;
+#elif defined(_WIN32) && (!defined(_XBOX))
+	WSABUF bufs[ISENDV_MAX];
+	DWORD sent = 0;
+	int i;
+	if (count > ISENDV_MAX) count = ISENDV_MAX;
+	for (i = 0; i < count; i++) {
+		bufs[i].buf = (char*)vecptr[i];
+		bufs[i].len = (ULONG)veclen[i];
+	}
+	if (WSASend((SOCKET)sock, bufs, (DWORD)count, &sent, (DWORD)mode,
+		NULL, NULL) != 0) 
+		return -1;
+	return (long)sent;
+#else
+	if (count <= 0) return 0;
+	return isend(sock, vecptr[0], veclen[0], mode);
+#endif
+}
+
 /* receive data */
 long irecv(int sock, void *buf, long size, int mode)
 {
@@ -614,6 +675,187 @@ long isendto(int sock, const void *buf, long size, int mode,
 	return (long)sendto(sock, (char*)buf, size, mode, addr, len);
 }
 
+#if defined(__linux__) && defined(MSG_WAITFORONE) && \
+	(!defined(IDISABLE_MMSG))
+#define IHAVE_MMSG
+#endif
+
+/* receive up to count datagrams, returns datagrams received */
+int irecvmm(int sock, struct IDGRAMV *vec, int count, int mode)
+{
+#ifdef IHAVE_MMSG
+	struct mmsghdr msgs[IMMSG_MAX];
+	struct iovec iov[IMMSG_MAX];
+	int i, hr;
+	if (count > IMMSG_MAX) count = IMMSG_MAX;
+	if (count <= 0) return 0;
+	memset(msgs, 0, sizeof(struct mmsghdr) * count);
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = vec[i].data;
+		iov[i].iov_len = (size_t)vec[i].size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = vec[i].addr;
+		msgs[i].msg_hdr.msg_namelen = (vec[i].addr)? vec[i].addrlen : 0;
+	}
+	hr = recvmmsg(sock, msgs, count, mode, NULL);
+	for (i = 0; i < hr; i++) {
+		vec[i].size = (long)msgs[i].msg_len;
+		vec[i].addrlen = (int)msgs[i].msg_hdr.msg_namelen;
+	}
+	return hr;
+#else
+	int i;
+	for (i = 0; i < count; i++) {
+		long hr = irecvfrom(sock, vec[i].data, vec[i].size, mode, 
+				vec[i].addr, &vec[i].addrlen);
+		if (hr < 0) return (i > 0)? i : -1;
+		vec[i].size = hr;
+	}
+	return count;
+#endif
+}
+
+/* send up to count datagrams, returns datagrams sent */
+int isendmm(int sock, const struct IDGRAMV *vec, int count, int mode)
+{
+#ifdef IHAVE_MMSG
+	struct mmsghdr msgs[IMMSG_MAX];
+	struct iovec iov[IMMSG_MAX];
+	int i;
+	if (count > IMMSG_MAX) count = IMMSG_MAX;
+	if (count <= 0) return 0;
+	memset(msgs, 0, sizeof(struct mmsghdr) * count);
+	for (i = 0; i < count; i++) {
+		iov[i].iov_base = vec[i].data;
+		iov[i].iov_len = (size_t)vec[i].size;
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = vec[i].addr;
+		msgs[i].msg_hdr.msg_namelen = (vec[i].addr)? vec[i].addrlen : 0;
+	}
+	return sendmmsg(sock, msgs, count, mode);
+#else
+	int i;
+	for (i = 0; i < count; i++) {
+		long hr = isendto(sock, vec[i].data, vec[i].size, mode,
+				vec[i].addr, vec[i].addrlen);
+		if (hr < 0) return (i > 0)? i : -1;
+	}
+	return count;
+#endif
+}
+
+#if defined(__linux__) && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) \
+	&& defined(SO_EE_ORIGIN_ZEROCOPY) && (!defined(IDISABLE_ZEROCOPY))
+#define IHAVE_ZEROCOPY
+#endif
+
+/* read file at offset, returns bytes read, 0 for eof or -1 for error */
+static long ifile_pread(int fd, void *buf, long size, IINT64 offset)
+{
+#if defined(__unix) && (!defined(__AVM3__))
+	return (long)pread(fd, buf, (size_t)size, (off_t)offset);
+#elif defined(_WIN32) && (!defined(_XBOX))
+	if (_lseeki64(fd, offset, SEEK_SET) < 0) return -1;
+	return (long)_read(fd, buf, (unsigned int)size);
+#else
+	return -1;
+#endif
+}
+
+/* sendfile emulation: read chunks and send until the socket is full */
+static long isendfile_copy(int sock, int fd, IINT64 offset, long size)
+{
+	char buffer[0x4000];
+	long total = 0;
+	while (size > 0) {
+		long canread = (size < (long)sizeof(buffer))? size : 
+			(long)sizeof(buffer);
+		long hr = ifile_pread(fd, buffer, canread, offset);
+		long sent;
+		if (hr <= 0) return (total > 0)? total : hr;
+		sent = isend(sock, buffer, hr, 0);
+		if (sent < 0) return (total > 0)? total : -1;
+		total += sent;
+		offset += sent;
+		size -= sent;
+		if (sent < hr) break;
+	}
+	return total;
+}
+
+/* send file content, returns bytes sent, 0 for eof or -1 for error */
+long isendfile(int sock, int fd, IINT64 offset, long size)
+{
+#if defined(__linux__) && (!defined(__AVM3__))
+	off_t pos = (off_t)offset;
+	ssize_t hr = sendfile(sock, fd, &pos, (size_t)size);
+	if (hr >= 0) return (long)hr;
+	if (errno != EINVAL && errno != ENOSYS) return -1;
+#endif
+	return isendfile_copy(sock, fd, offset, size);
+}
+
+/* enable MSG_ZEROCOPY on the socket, returns 0 for success */
+int izerocopy_enable(int sock)
+{
+#ifdef IHAVE_ZEROCOPY
+	int value = 1;
+	return setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value));
+#else
+	return -1;
+#endif
+}
+
+/* send with MSG_ZEROCOPY, plain send where unsupported */
+long izerocopy_send(int sock, const void *buf, long size, int mode)
+{
+#ifdef IHAVE_ZEROCOPY
+	mode |= MSG_ZEROCOPY;
+#endif
+	return isend(sock, buf, size, mode);
+}
+
+/* reap one zerocopy completion from the socket error queue */
+int izerocopy_reap(int sock, IUINT32 *lo, IUINT32 *hi, int *copied)
+{
+#ifdef IHAVE_ZEROCOPY
+	while (1) {
+		char control[128];
+		struct msghdr msg;
+		struct cmsghdr *cm;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+			return -1;
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *ee;
+			if (!(cm->cmsg_level == IPPROTO_IP && 
+				cm->cmsg_type == IP_RECVERR) &&
+				!(cm->cmsg_level == IPPROTO_IPV6 && 
+				cm->cmsg_type == IPV6_RECVERR))
+				continue;
+			ee = (struct sock_extended_err*)CMSG_DATA(cm);
+			if (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY || ee->ee_errno)
+				continue;
+			if (lo) lo[0] = ee->ee_info;
+			if (hi) hi[0] = ee->ee_data;
+			if (copied) {
+				copied[0] = (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)? 1:0;
+			}
+			return 1;
+		}
+		/* not a zerocopy notification: drop it and read the next */
+	}
+#else
+	return -1;
+#endif
+}
+
 /* recvfrom */
 long irecvfrom(int sock, void *buf, long size, int mode, 
 			struct sockaddr *addr, int *addrlen)
@@ -1748,6 +1990,13 @@ int isocket_pair(int fds[2], int mode)
 #if defined(_AIX)
 #define IHAVE_POLLSET
 #endif
+#if defined(__linux__) && (!defined(IDISABLE_IOURING))
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define IHAVE_IOURING
+#endif
+#endif
+#endif
 #if defined(__linux__)
 /*#define IHAVE_RTSIG*/
 #endif
@@ -1775,6 +2024,7 @@ struct IPOLL_DRIVER
 	int (*poll_set)(ipolld ipd, int fd, int mask);		
 	int (*poll_wait)(ipolld ipd, int timeval);			
 	int (*poll_event)(ipolld ipd, int *fd, int *event, void **udata);
+	int (*poll_events)(ipolld ipd, struct ipoll_result *out, int max);
 };
 
 /* current poll device */
@@ -1825,6 +2075,9 @@ extern struct IPOLL_DRIVER IPOLL_KEVENT;
 #ifdef IHAVE_EPOLL
 extern struct IPOLL_DRIVER IPOLL_EPOLL;
 #endif
+#ifdef IHAVE_IOURING
+extern struct IPOLL_DRIVER IPOLL_IOURING;
+#endif
 #ifdef IHAVE_DEVPOLL
 extern struct IPOLL_DRIVER IPOLL_DEVPOLL;
 #endif
@@ -1851,6 +2104,9 @@ static struct IPOLL_DRIVER *ipoll_list[] = {
 #ifdef IHAVE_EPOLL
 	&IPOLL_EPOLL,
 #endif
+#ifdef IHAVE_IOURING
+	&IPOLL_IOURING,
+#endif
 #ifdef IHAVE_DEVPOLL
 	&IPOLL_DEVPOLL,
 #endif
@@ -1889,21 +2145,26 @@ int ipoll_init(int device)
 		if (ipoll_list[i] == NULL) 
 			return -1;
 		IPOLLDRV = *ipoll_list[i];
+		retval = IPOLLDRV.startup();
+		if (retval != 0) return -2;
 	}	else {
-		besti = 0;
-		bestv = -1;
-		for (i = 0; ipoll_list[i]; i++) {
-			if (ipoll_list[i]->performance > bestv) {
-				bestv = ipoll_list[i]->performance;
-				besti = i;
+		/* try devices from the fastest one, skip unsupported ones */
+		for (bestv = 0x7fffffff, retval = -1; retval != 0; ) {
+			int limit = bestv;
+			besti = -1;
+			bestv = -1;
+			for (i = 0; ipoll_list[i]; i++) {
+				int performance = ipoll_list[i]->performance;
+				if (performance > bestv && performance < limit) {
+					bestv = performance;
+					besti = i;
+				}
 			}
+			if (besti < 0) return -2;
+			IPOLLDRV = *ipoll_list[besti];
+			retval = IPOLLDRV.startup();
 		}
-		IPOLLDRV = *ipoll_list[besti];
 	}
-	
-	retval = IPOLLDRV.startup();
-
-	if (retval != 0) return -2;
 
 	IMUTEX_INIT(&ipoll_mutex);
 	ipoll_inited = 1;
@@ -2003,6 +2264,13 @@ int ipoll_event(ipolld ipd, int *fd, int *event, void **udata)
 	return retval;
 }
 
+/* get many events at once */
+int ipoll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	if (max <= 0) return 0;
+	return IPOLLDRV.poll_events(ipd, out, max);
+}
+
 /* vector init */
 static void ipv_init(struct IPVECTOR *vec)
 {
@@ -2108,6 +2376,7 @@ static int ips_poll_del(ipolld ipd, int fd);
 static int ips_poll_set(ipolld ipd, int fd, int mask);
 static int ips_poll_wait(ipolld ipd, int timeval);
 static int ips_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ips_poll_events(ipolld ipd, struct ipoll_result *out, int max);
 
 
 /*-------------------------------------------------------------------*/
@@ -2141,7 +2410,8 @@ struct IPOLL_DRIVER IPOLL_SELECT = {
 	ips_poll_del,
 	ips_poll_set,
 	ips_poll_wait,
-	ips_poll_event
+	ips_poll_event,
+	ips_poll_events
 };
 
 #ifdef PSTRUCT
@@ -2205,6 +2475,8 @@ static int ips_poll_add(ipolld ipd, int fd, int mask, void *user)
 	PSTRUCT *ps = PDESC(ipd);
 	int oldmax = ps->max_fd, i;
 
+	if (mask & IPOLL_ET) return -10;
+
 	#ifdef __unix
 	if (fd >= FD_SETSIZE) return -1;
 	#else
@@ -2336,6 +2608,37 @@ static int ips_poll_event(ipolld ipd, int *fd, int *event, void **user)
 	return 0;
 }
 
+/* query results in batch */
+static int ips_poll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int revents, count = 0, n;
+
+	while (count < max && ps->rbits > 0 && ps->cur_fd < ps->max_fd) {
+		n = ++ps->cur_fd;
+		revents = 0;
+		if (FD_ISSET(n, &ps->fdrtest)) revents = IPOLL_IN;
+		if (FD_ISSET(n, &ps->fdwtest)) revents |= IPOLL_OUT;
+		if (FD_ISSET(n, &ps->fdetest)) revents |= IPOLL_ERR;
+		if (revents == 0) continue;
+
+		if (revents & IPOLL_IN)  ps->rbits--;
+		if (revents & IPOLL_OUT) ps->rbits--;
+		if (revents & IPOLL_ERR) ps->rbits--;
+
+		if (ps->fv.fds[n].fd < 0) continue;
+		revents &= ps->fv.fds[n].mask;
+		if (revents == 0) continue;
+
+		out[count].fd = n;
+		out[count].event = revents;
+		out[count].udata = ps->fv.fds[n].user;
+		count++;
+	}
+
+	return count;
+}
+
 #endif
 
 
@@ -2357,6 +2660,7 @@ static int ipp_poll_del(ipolld ipd, int fd);
 static int ipp_poll_set(ipolld ipd, int fd, int mask);
 static int ipp_poll_wait(ipolld ipd, int timeval);
 static int ipp_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipp_poll_events(ipolld ipd, struct ipoll_result *out, int max);
 
 
 /*-------------------------------------------------------------------*/
@@ -2393,7 +2697,8 @@ struct IPOLL_DRIVER IPOLL_POLL = {
 	ipp_poll_del,
 	ipp_poll_set,
 	ipp_poll_wait,
-	ipp_poll_event
+	ipp_poll_event,
+	ipp_poll_events
 };
 
 #ifdef PSTRUCT
@@ -2460,6 +2765,8 @@ static int ipp_poll_add(ipolld ipd, int fd, int mask, void *user)
 	struct pollfd *pfd;
 	int retval, index, i;
 
+	if (mask & IPOLL_ET) return -10;
+
 	if (fd > ps->fd_max) ps->fd_max = fd;
 	if (fd < ps->fd_min) ps->fd_min = fd;
 
@@ -2597,6 +2904,38 @@ static int ipp_poll_event(ipolld ipd, int *fd, int *event, void **user)
 	return 0;
 }
 
+/* poll query events in batch */
+static int ipp_poll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int revents, eventx, count = 0, n;
+	struct pollfd *pfd;
+
+	if (ps->result_num < 0) return 0;
+
+	while (count < max && ps->result_cur < ps->result_num) {
+		pfd = &ps->resultq[ps->result_cur++];
+
+		revents = pfd->revents;
+		eventx = 0;
+		if (revents & POLLIN) eventx |= IPOLL_IN;
+		if (revents & POLLOUT)eventx |= IPOLL_OUT;
+		if (revents & POLLERR)eventx |= IPOLL_ERR;
+
+		n = pfd->fd;
+		if (ps->fv.fds[n].fd < 0) continue;
+		eventx &= ps->fv.fds[n].mask;
+		if (eventx == 0) continue;
+
+		out[count].fd = n;
+		out[count].event = eventx;
+		out[count].udata = ps->fv.fds[n].user;
+		count++;
+	}
+
+	return count;
+}
+
 
 #endif
 
@@ -2619,6 +2958,7 @@ static int ipk_poll_del(ipolld ipd, int fd);
 static int ipk_poll_set(ipolld ipd, int fd, int mask);
 static int ipk_poll_wait(ipolld ipd, int timeval);
 static int ipk_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipk_poll_events(ipolld ipd, struct ipoll_result *out, int max);
 
 /* kevent device structure */
 typedef struct
@@ -2654,7 +2994,8 @@ struct IPOLL_DRIVER IPOLL_KEVENT = {
 	ipk_poll_del,
 	ipk_poll_set,
 	ipk_poll_wait,
-	ipk_poll_event
+	ipk_poll_event,
+	ipk_poll_events
 };
 
 
@@ -2775,6 +3116,8 @@ static int ipk_poll_add(ipolld ipd, int fd, int mask, void *user)
 	PSTRUCT *ps = PDESC(ipd);
 	int usr_nlen, i, flag;
 
+	if (mask & IPOLL_ET) return -10;
+
 	if (ps->num_fd >= ps->max_fd) {
 		if (ipk_grow(ps, ps->max_fd * 2, -1)) return -1;
 	}
@@ -2921,6 +3264,43 @@ static int ipk_poll_event(ipolld ipd, int *fd, int *event, void **user)
 	return 0;
 }
 
+/* kevent query events in batch */
+static int ipk_poll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct kevent *ke;
+	int revent, count = 0, n;
+
+	while (count < max && ps->cur_res < ps->results) {
+		ke = &ps->mresult[ps->cur_res++];
+		n = ke->ident;
+
+		if (ke->filter == EVFILT_READ) revent = IPOLL_IN;
+		else if (ke->filter == EVFILT_WRITE)revent = IPOLL_OUT;
+		else revent = IPOLL_ERR;
+		if ((ke->flags & EV_ERROR)) revent = IPOLL_ERR;
+
+		if (ps->fv.fds[n].fd < 0) {
+			ipk_poll_kevent(ipd, n, EVFILT_READ, EV_DELETE | EV_DISABLE);
+			ipk_poll_kevent(ipd, n, EVFILT_WRITE, EV_DELETE | EV_DISABLE);
+			continue;
+		}
+
+		revent &= ps->fv.fds[n].mask;
+		if (revent == 0) {
+			ipk_poll_set(ipd, n, ps->fv.fds[n].mask);
+			continue;
+		}
+
+		out[count].fd = n;
+		out[count].event = revent;
+		out[count].udata = ps->fv.fds[n].user;
+		count++;
+	}
+
+	return count;
+}
+
 
 #endif
 
@@ -2939,6 +3319,11 @@ static int ipk_poll_event(ipolld ipd, int *fd, int *event, void **user)
 #define IEPOLL_LIMIT 20000
 #endif
 
+/* level-triggered entries keep a tagged fd in epoll_event.data.u64,
+ * edge-triggered entries keep an aligned IPOLLET pointer (bit 0 clear) */
+#define IEPOLL_TAG(fd)		((((IUINT64)(fd)) << 1) | 1)
+#define IEPOLL_FD(data)		((int)((data) >> 1))
+
 static int ipe_startup(void);
 static int ipe_shutdown(void);
 static int ipe_init_pd(ipolld ipd, int param);
@@ -2948,6 +3333,16 @@ static int ipe_poll_del(ipolld ipd, int fd);
 static int ipe_poll_set(ipolld ipd, int fd, int mask);
 static int ipe_poll_wait(ipolld ipd, int timeval);
 static int ipe_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipe_poll_events(ipolld ipd, struct ipoll_result *out, int max);
+
+/* edge-triggered entry: registered once and never re-armed */
+struct IPOLLET
+{
+	int fd;					/* file descriptor, -1 after deleted */
+	int mask;				/* event mask */
+	void *user;				/* user data */
+	struct IPOLLET *next;	/* released list */
+};
 
 /* epoll device structure */
 typedef struct
@@ -2960,7 +3355,10 @@ typedef struct
 	int cur_res;
 	int usr_len;
 	struct epoll_event *mresult;
+	struct IPOLLET **edges;
+	struct IPOLLET *released;
 	struct IPVECTOR vresult;
+	struct IPVECTOR vedges;
 }	IPD_EPOLL;
 
 /* epoll poll descriptor */
@@ -2977,7 +3375,8 @@ struct IPOLL_DRIVER IPOLL_EPOLL = {
 	ipe_poll_del,
 	ipe_poll_set,
 	ipe_poll_wait,
-	ipe_poll_event
+	ipe_poll_event,
+	ipe_poll_events
 };
 
 
@@ -3014,11 +3413,14 @@ static int ipe_init_pd(ipolld ipd, int param)
 #endif
 
 	ipv_init(&ps->vresult);
+	ipv_init(&ps->vedges);
 	ipoll_fvinit(&ps->fv);
 
 	ps->max_fd = 0;
 	ps->num_fd = 0;
 	ps->usr_len = 0;
+	ps->edges = NULL;
+	ps->released = NULL;
 	
 	if (ipv_resize(&ps->vresult, 4 * sizeof(struct epoll_event))) {
 		close(ps->epfd);
@@ -3031,12 +3433,30 @@ static int ipe_init_pd(ipolld ipd, int param)
 	return 0;
 }
 
+/* free edge-triggered entries deleted before last epoll_wait */
+static void ipe_release(PSTRUCT *ps)
+{
+	while (ps->released) {
+		struct IPOLLET *et = ps->released;
+		ps->released = et->next;
+		ikfree(et);
+	}
+}
+
 /* epoll destroy descriptor */
 static int ipe_destroy_pd(ipolld ipd)
 {
 	PSTRUCT *ps = PDESC(ipd);
+	int i;
+	for (i = 0; i < ps->usr_len; i++) {
+		if (ps->edges[i]) ikfree(ps->edges[i]);
+		ps->edges[i] = NULL;
+	}
+	ipe_release(ps);
 	ipv_destroy(&ps->vresult);
+	ipv_destroy(&ps->vedges);
 	ipoll_fvdestroy(&ps->fv);
+	ps->edges = NULL;
 
 	if (ps->epfd >= 0) close(ps->epfd);
 	ps->epfd = -1;
@@ -3047,6 +3467,7 @@ static int ipe_destroy_pd(ipolld ipd)
 static int ipe_poll_add(ipolld ipd, int fd, int mask, void *user)
 {
 	PSTRUCT *ps = PDESC(ipd);
+	struct IPOLLET *et = NULL;
 	int usr_nlen, i;
 	struct epoll_event ee;
 
@@ -3059,25 +3480,42 @@ static int ipe_poll_add(ipolld ipd, int fd, int mask, void *user)
 	}
 	if (fd >= ps->usr_len) {
 		usr_nlen = fd + 128;
+		if (ipv_resize(&ps->vedges, usr_nlen * sizeof(struct IPOLLET*)))
+			return -1;
+		ps->edges = (struct IPOLLET**)ps->vedges.data;
 		ipoll_fvresize(&ps->fv, usr_nlen);
 		for (i = ps->usr_len; i < usr_nlen; i++) {
 			ps->fv.fds[i].fd = -1;
 			ps->fv.fds[i].user = NULL;
 			ps->fv.fds[i].mask = 0;
+			ps->edges[i] = NULL;
 		}
 		ps->usr_len = usr_nlen;
 	}
 	if (ps->fv.fds[fd].fd >= 0) {
 		ps->fv.fds[fd].user = user;
+		if (ps->edges[fd]) ps->edges[fd]->user = user;
 		ipe_poll_set(ipd, fd, mask);
 		return 0;
 	}
-	ps->fv.fds[fd].fd = fd;
-	ps->fv.fds[fd].user = user;
-	ps->fv.fds[fd].mask = mask;
 
 	ee.events = 0;
-	ee.data.fd = fd;
+	ee.data.u64 = IEPOLL_TAG(fd);
+
+	if (mask & IPOLL_ET) {
+		et = (struct IPOLLET*)ikmalloc(sizeof(struct IPOLLET));
+		if (et == NULL) return -2;
+		et->fd = fd;
+		et->mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+		et->user = user;
+		et->next = NULL;
+		ee.events |= EPOLLET;
+		ee.data.ptr = et;
+	}
+
+	ps->fv.fds[fd].fd = fd;
+	ps->fv.fds[fd].user = user;
+	ps->fv.fds[fd].mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
 
 	if (mask & IPOLL_IN) ee.events |= EPOLLIN;
 	if (mask & IPOLL_OUT) ee.events |= EPOLLOUT;
@@ -3087,8 +3525,10 @@ static int ipe_poll_add(ipolld ipd, int fd, int mask, void *user)
 		ps->fv.fds[fd].fd = -1;
 		ps->fv.fds[fd].user = NULL;
 		ps->fv.fds[fd].mask = 0;
+		if (et) ikfree(et);
 		return -3;
 	}
+	ps->edges[fd] = et;
 	ps->num_fd++;
 
 	return 0;
@@ -3099,12 +3539,14 @@ static int ipe_poll_del(ipolld ipd, int fd)
 {
 	PSTRUCT *ps = PDESC(ipd);
 	struct epoll_event ee;
+	struct IPOLLET *et;
 
 	if (ps->num_fd <= 0) return -1;
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -2;
 	if (ps->fv.fds[fd].fd < 0) return -2;
 
 	ee.events = 0;
-	ee.data.fd = fd;
+	ee.data.u64 = IEPOLL_TAG(fd);
 
 	epoll_ctl(ps->epfd, EPOLL_CTL_DEL, fd, &ee);
 	ps->num_fd--;
@@ -3112,6 +3554,15 @@ static int ipe_poll_del(ipolld ipd, int fd)
 	ps->fv.fds[fd].user = NULL;
 	ps->fv.fds[fd].mask = 0;
 
+	/* pending results may still point to it: free after next wait */
+	et = ps->edges[fd];
+	if (et) {
+		et->fd = -1;
+		et->next = ps->released;
+		ps->released = et;
+		ps->edges[fd] = NULL;
+	}
+
 	return 0;
 }
 
@@ -3120,16 +3571,27 @@ static int ipe_poll_set(ipolld ipd, int fd, int mask)
 {
 	PSTRUCT *ps = PDESC(ipd);
 	struct epoll_event ee;
+	struct IPOLLET *et;
 	int retval;
 
 	ee.events = 0;
-	ee.data.fd = fd;
+	ee.data.u64 = IEPOLL_TAG(fd);
 
 	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -1;
 	if (fd < 0) return -1;
 	if (ps->fv.fds[fd].fd < 0) return -2;
 
-	ps->fv.fds[fd].mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+	mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+	et = ps->edges[fd];
+
+	if (et) {
+		if (et->mask == mask) return 0;
+		et->mask = mask;
+		ee.events |= EPOLLET;
+		ee.data.ptr = et;
+	}
+
+	ps->fv.fds[fd].mask = mask;
 
 	if (mask & IPOLL_IN) {
 		ee.events |= EPOLLIN;
@@ -3152,6 +3614,10 @@ static int ipe_poll_wait(ipolld ipd, int timeval)
 {
 	PSTRUCT *ps = PDESC(ipd);
 
+	if (ps->released) {
+		ipe_release(ps);
+	}
+
 	ps->results = epoll_wait(ps->epfd, ps->mresult, 
 		ps->max_fd * 2, timeval);
 	ps->cur_res = 0;
@@ -3169,16 +3635,25 @@ static int ipe_poll_event(ipolld ipd, int *fd, int *event, void **user)
 	if (ps->cur_res >= ps->results) return -1;
 
 	ee = &ps->mresult[ps->cur_res++];
-	n = ee->data.fd;
-	if (fd) *fd = n;
 
 	if (ee->events & EPOLLIN) revent |= IPOLL_IN;
 	if (ee->events & EPOLLOUT) revent |= IPOLL_OUT;
 	if (ee->events & (EPOLLERR | EPOLLHUP)) revent |= IPOLL_ERR; 
 
+	if ((ee->data.u64 & 1) == 0) {
+		struct IPOLLET *et = (struct IPOLLET*)ee->data.ptr;
+		if (fd) *fd = et->fd;
+		if (event) *event = (et->fd < 0)? 0 : (revent & et->mask);
+		if (user) *user = et->user;
+		return 0;
+	}
+
+	n = IEPOLL_FD(ee->data.u64);
+	if (fd) *fd = n;
+
 	if (ps->fv.fds[n].fd < 0) {
 		revent = 0;
-		uu.data.fd = n;
+		uu.data.u64 = IEPOLL_TAG(n);
 		uu.events = 0;
 		epoll_ctl(ps->epfd, EPOLL_CTL_DEL, n, &uu);
 	}	else {
@@ -3194,6 +3669,703 @@ static int ipe_poll_event(ipolld ipd, int *fd, int *event, void **user)
 	return 0;
 }
 
+/* epoll query events in batch */
+static int ipe_poll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPOLLFD *fds = ps->fv.fds;
+	struct epoll_event *ee, uu;
+	int revent, count = 0, n;
+
+	while (count < max && ps->cur_res < ps->results) {
+		ee = &ps->mresult[ps->cur_res++];
+
+		revent = 0;
+		if (ee->events & EPOLLIN) revent |= IPOLL_IN;
+		if (ee->events & EPOLLOUT) revent |= IPOLL_OUT;
+		if (ee->events & (EPOLLERR | EPOLLHUP)) revent |= IPOLL_ERR; 
+
+		if ((ee->data.u64 & 1) == 0) {
+			struct IPOLLET *et = (struct IPOLLET*)ee->data.ptr;
+			if (et->fd < 0) continue;
+			revent &= et->mask;
+			if (revent == 0) continue;
+			out[count].fd = et->fd;
+			out[count].event = revent;
+			out[count].udata = et->user;
+			count++;
+			continue;
+		}
+
+		n = IEPOLL_FD(ee->data.u64);
+
+		if (fds[n].fd < 0) {
+			uu.data.u64 = IEPOLL_TAG(n);
+			uu.events = 0;
+			epoll_ctl(ps->epfd, EPOLL_CTL_DEL, n, &uu);
+			continue;
+		}
+
+		revent &= fds[n].mask;
+		if (revent == 0) {
+			ipe_poll_set(ipd, n, fds[n].mask);
+			continue;
+		}
+
+		out[count].fd = n;
+		out[count].event = revent;
+		out[count].udata = fds[n].user;
+		count++;
+	}
+
+	return count;
+}
+
+
+#endif
+
+
+/*===================================================================*/
+/* POLL DRIVER - IOURING                                             */
+/*===================================================================*/
+
+#ifdef IHAVE_IOURING
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef IURING_ENTRIES
+#define IURING_ENTRIES 4096
+#endif
+
+/* user_data of cancellation requests, completions are ignored */
+#define IURING_CANCEL	((IUINT64)0xffffffffffffffffULL)
+
+/* multishot poll (5.13+) backs IPOLL_ET, probed in ipr_startup */
+static int ipr_multishot = 0;
+
+static int ipr_startup(void);
+static int ipr_shutdown(void);
+static int ipr_init_pd(ipolld ipd, int param);
+static int ipr_destroy_pd(ipolld ipd);
+static int ipr_poll_add(ipolld ipd, int fd, int mask, void *user);
+static int ipr_poll_del(ipolld ipd, int fd);
+static int ipr_poll_set(ipolld ipd, int fd, int mask);
+static int ipr_poll_wait(ipolld ipd, int timeval);
+static int ipr_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipr_poll_events(ipolld ipd, struct ipoll_result *out, int max);
+
+/* io_uring file descriptor entry */
+struct IPURINGFD
+{
+	int fd;			/* file descriptor, -1 for unused */
+	int mask;		/* event mask */
+	int armed;		/* poll request is in flight */
+	int dirty;		/* in the change list */
+	int edge;		/* edge-triggered: multishot, never re-armed */
+	IUINT32 gen;	/* generation, avoid stale completions */
+	void *user;		/* user data */
+};
+
+/* io_uring harvested event */
+struct IPURINGEV
+{
+	int fd;
+	int event;
+	IUINT32 gen;
+};
+
+/* io_uring device structure */
+typedef struct
+{
+	int ring;
+	int num_fd;
+	int usr_len;
+	int max_res;
+	int results;
+	int cur_res;
+	int num_chg;
+	int max_chg;
+	unsigned sq_entries;
+	unsigned sq_mask;
+	unsigned cq_mask;
+	unsigned sq_tail;
+	unsigned *sq_khead;
+	unsigned *sq_ktail;
+	unsigned *sq_array;
+	unsigned *cq_khead;
+	unsigned *cq_ktail;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_size;
+	size_t cq_size;
+	size_t sqe_size;
+	struct IPURINGFD *fds;
+	struct IPURINGEV *mresult;
+	int *mchange;
+	struct IPVECTOR vfds;
+	struct IPVECTOR vresult;
+	struct IPVECTOR vchange;
+}	IPD_IOURING;
+
+/* io_uring poll descriptor */
+struct IPOLL_DRIVER IPOLL_IOURING = {
+	sizeof (IPD_IOURING),	
+	IDEVICE_IOURING,
+	110,
+	"IOURING",
+	ipr_startup,
+	ipr_shutdown,
+	ipr_init_pd,
+	ipr_destroy_pd,
+	ipr_poll_add,
+	ipr_poll_del,
+	ipr_poll_set,
+	ipr_poll_wait,
+	ipr_poll_event,
+	ipr_poll_events
+};
+
+
+#ifdef PSTRUCT
+#undef PSTRUCT
+#endif
+
+#define PSTRUCT IPD_IOURING
+
+/* io_uring_setup syscall */
+static int ipr_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+/* io_uring_enter syscall */
+static int ipr_enter(int ring, unsigned submit, unsigned wait, 
+	unsigned flags, const void *arg, size_t argsz)
+{
+	return (int)syscall(__NR_io_uring_enter, ring, submit, wait, flags,
+		arg, argsz);
+}
+
+static int ipr_probe_multishot(PSTRUCT *ps);
+
+/* io_uring startup: need EXT_ARG (5.11+) for timeout in enter, and
+ * a full size ring must be mapped, or auto falls back to epoll rather 
+ * than failing every ipoll_create (eg. under a low RLIMIT_MEMLOCK) */
+static int ipr_startup(void)
+{
+	struct io_uring_params p;
+	PSTRUCT probe;
+	int ring;
+	memset(&p, 0, sizeof(p));
+	ring = ipr_setup(IURING_ENTRIES, &p);
+	if (ring < 0) return -1000 - errno;
+	close(ring);
+	if ((p.features & IORING_FEAT_EXT_ARG) == 0) return -1;
+	if ((p.features & IORING_FEAT_NODROP) == 0) return -2;
+	if (ipr_init_pd((ipolld)&probe, 0) != 0) return -3;
+	ipr_multishot = ipr_probe_multishot(&probe);
+	ipr_destroy_pd((ipolld)&probe);
+	return 0;
+}
+
+/* io_uring shutdown */
+static int ipr_shutdown(void)
+{
+	return 0;
+}
+
+/* unmap rings */
+static void ipr_unmap(PSTRUCT *ps)
+{
+	if (ps->sqes) munmap(ps->sqes, ps->sqe_size);
+	if (ps->cq_ptr && ps->cq_ptr != ps->sq_ptr) 
+		munmap(ps->cq_ptr, ps->cq_size);
+	if (ps->sq_ptr) munmap(ps->sq_ptr, ps->sq_size);
+	ps->sqes = NULL;
+	ps->sq_ptr = NULL;
+	ps->cq_ptr = NULL;
+}
+
+/* io_uring init poll descriptor */
+static int ipr_init_pd(ipolld ipd, int param)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	memset(ps, 0, sizeof(PSTRUCT));
+	param = param + 10;
+
+	ps->ring = ipr_setup(IURING_ENTRIES, &p);
+	if (ps->ring < 0) return -1;
+
+#ifdef FD_CLOEXEC
+	fcntl(ps->ring, F_SETFD, FD_CLOEXEC);
+#endif
+
+	ps->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ps->cq_size = p.cq_off.cqes + p.cq_entries * 
+		sizeof(struct io_uring_cqe);
+	ps->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ps->cq_size > ps->sq_size) ps->sq_size = ps->cq_size;
+		ps->cq_size = ps->sq_size;
+	}
+
+	ps->sq_ptr = mmap(NULL, ps->sq_size, PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE, ps->ring, IORING_OFF_SQ_RING);
+	if (ps->sq_ptr == MAP_FAILED) {
+		ps->sq_ptr = NULL;
+		close(ps->ring);
+		return -2;
+	}
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		ps->cq_ptr = ps->sq_ptr;
+	}	else {
+		ps->cq_ptr = mmap(NULL, ps->cq_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ps->ring, IORING_OFF_CQ_RING);
+		if (ps->cq_ptr == MAP_FAILED) {
+			ps->cq_ptr = NULL;
+			ipr_unmap(ps);
+			close(ps->ring);
+			return -3;
+		}
+	}
+
+	ps->sqes = (struct io_uring_sqe*)mmap(NULL, ps->sqe_size, 
+		PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+		ps->ring, IORING_OFF_SQES);
+	if ((void*)ps->sqes == MAP_FAILED) {
+		ps->sqes = NULL;
+		ipr_unmap(ps);
+		close(ps->ring);
+		return -4;
+	}
+
+	sq = (char*)ps->sq_ptr;
+	cq = (char*)ps->cq_ptr;
+	ps->sq_khead = (unsigned*)(sq + p.sq_off.head);
+	ps->sq_ktail = (unsigned*)(sq + p.sq_off.tail);
+	ps->sq_array = (unsigned*)(sq + p.sq_off.array);
+	ps->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+	ps->sq_entries = p.sq_entries;
+	ps->sq_tail = *ps->sq_ktail;
+	ps->cq_khead = (unsigned*)(cq + p.cq_off.head);
+	ps->cq_ktail = (unsigned*)(cq + p.cq_off.tail);
+	ps->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+	ps->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	ipv_init(&ps->vfds);
+	ipv_init(&ps->vresult);
+	ipv_init(&ps->vchange);
+
+	ps->num_fd = 0;
+	ps->usr_len = 0;
+	ps->results = 0;
+	ps->cur_res = 0;
+	ps->num_chg = 0;
+	ps->max_chg = 0;
+	ps->max_res = 4;
+
+	if (ipv_resize(&ps->vresult, 4 * sizeof(struct IPURINGEV) * 2)) {
+		ipr_destroy_pd(ipd);
+		return -5;
+	}
+
+	ps->mresult = (struct IPURINGEV*)ps->vresult.data;
+
+	return 0;
+}
+
+/* io_uring destroy descriptor */
+static int ipr_destroy_pd(ipolld ipd)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	ipr_unmap(ps);
+	ipv_destroy(&ps->vfds);
+	ipv_destroy(&ps->vresult);
+	ipv_destroy(&ps->vchange);
+	ps->fds = NULL;
+	ps->mresult = NULL;
+	ps->mchange = NULL;
+	if (ps->ring >= 0) close(ps->ring);
+	ps->ring = -1;
+	return 0;
+}
+
+/* submit queued sqes and optionally wait for completions */
+static int ipr_submit(PSTRUCT *ps, unsigned wait, int timeval)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned submit, flags = 0;
+	int retval;
+
+	submit = ps->sq_tail - __atomic_load_n(ps->sq_khead, __ATOMIC_ACQUIRE);
+
+	memset(&arg, 0, sizeof(arg));
+
+	if (wait > 0) {
+		flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeval >= 0) {
+			ts.tv_sec = timeval / 1000;
+			ts.tv_nsec = (timeval % 1000) * 1000000;
+			arg.ts = (IUINT64)(size_t)&ts;
+		}
+	}	
+	else if (submit == 0) {
+		return 0;
+	}
+
+	retval = ipr_enter(ps->ring, submit, wait, flags, 
+		(wait > 0)? &arg : NULL, (wait > 0)? sizeof(arg) : 0);
+
+	if (retval < 0) {
+		if (errno == EINTR || errno == ETIME || errno == EBUSY) 
+			return 0;
+		return -1;
+	}
+
+	return retval;
+}
+
+/* get a free sqe, flush the submission queue when it is full */
+static struct io_uring_sqe *ipr_get_sqe(PSTRUCT *ps)
+{
+	struct io_uring_sqe *sqe;
+	unsigned head = __atomic_load_n(ps->sq_khead, __ATOMIC_ACQUIRE);
+	unsigned index;
+	if (ps->sq_tail - head >= ps->sq_entries) {
+		if (ipr_submit(ps, 0, 0) < 0) return NULL;
+		head = __atomic_load_n(ps->sq_khead, __ATOMIC_ACQUIRE);
+		if (ps->sq_tail - head >= ps->sq_entries) return NULL;
+	}
+	index = ps->sq_tail & ps->sq_mask;
+	sqe = &ps->sqes[index];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	ps->sq_array[index] = index;
+	ps->sq_tail++;
+	__atomic_store_n(ps->sq_ktail, ps->sq_tail, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+/* arm a multishot poll on a readable pipe: kernels without it fail
+ * the request with -EINVAL, returns 1 when supported */
+static int ipr_probe_multishot(PSTRUCT *ps)
+{
+	struct io_uring_sqe *sqe;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail;
+	int fds[2], retval = 0;
+	if (pipe(fds) != 0) return 0;
+	if (write(fds[1], "x", 1) == 1 && (sqe = ipr_get_sqe(ps)) != NULL) {
+		sqe->opcode = IORING_OP_POLL_ADD;
+		sqe->fd = fds[0];
+		sqe->poll32_events = POLLIN;
+		sqe->len = IORING_POLL_ADD_MULTI;
+		sqe->user_data = 1;
+		ipr_submit(ps, 1, 100);
+		head = *ps->cq_khead;
+		tail = __atomic_load_n(ps->cq_ktail, __ATOMIC_ACQUIRE);
+		if (head != tail) {
+			cqe = &ps->cqes[head & ps->cq_mask];
+			if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_MORE)) retval = 1;
+		}
+	}
+	close(fds[0]);
+	close(fds[1]);
+	return retval;
+}
+
+/* queue a one-shot poll request for fd */
+static int ipr_queue_add(PSTRUCT *ps, int fd)
+{
+	struct IPURINGFD *entry = &ps->fds[fd];
+	struct io_uring_sqe *sqe;
+	unsigned events = 0;
+	if (entry->mask & IPOLL_IN) events |= POLLIN;
+	if (entry->mask & IPOLL_OUT) events |= POLLOUT;
+	if (entry->mask & IPOLL_ERR) events |= POLLERR | POLLHUP;
+	sqe = ipr_get_sqe(ps);
+	if (sqe == NULL) return -1;
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	if (entry->edge) sqe->len = IORING_POLL_ADD_MULTI;
+	sqe->user_data = ((IUINT64)entry->gen << 32) | (IUINT32)fd;
+	entry->armed = 1;
+	return 0;
+}
+
+/* queue a cancellation of the in-flight poll request of fd */
+static int ipr_queue_cancel(PSTRUCT *ps, int fd)
+{
+	struct IPURINGFD *entry = &ps->fds[fd];
+	struct io_uring_sqe *sqe;
+	if (entry->armed == 0) return 0;
+	sqe = ipr_get_sqe(ps);
+	if (sqe == NULL) return -1;
+	sqe->opcode = IORING_OP_POLL_REMOVE;
+	sqe->fd = -1;
+	sqe->addr = ((IUINT64)entry->gen << 32) | (IUINT32)fd;
+	sqe->user_data = IURING_CANCEL;
+	entry->armed = 0;
+	entry->gen++;
+	return 0;
+}
+
+/* mark fd to be (re)armed in the next ipr_poll_wait */
+static int ipr_mark(PSTRUCT *ps, int fd)
+{
+	if (ps->fds[fd].dirty) return 0;
+	if (ps->num_chg >= ps->max_chg) {
+		int newsize = (ps->max_chg <= 0)? 64 : ps->max_chg * 2;
+		if (ipv_resize(&ps->vchange, newsize * sizeof(int))) return -1;
+		ps->mchange = (int*)ps->vchange.data;
+		ps->max_chg = newsize;
+	}
+	ps->mchange[ps->num_chg++] = fd;
+	ps->fds[fd].dirty = 1;
+	return 0;
+}
+
+/* io_uring add file */
+static int ipr_poll_add(ipolld ipd, int fd, int mask, void *user)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int usr_nlen, i;
+
+	if (fd < 0) return -1;
+	if ((mask & IPOLL_ET) && ipr_multishot == 0) return -10;
+
+	if (ps->num_fd >= ps->max_res) {
+		i = ps->max_res * 2;
+		if (ipv_resize(&ps->vresult, i * sizeof(struct IPURINGEV) * 2))
+			return -1;
+		ps->mresult = (struct IPURINGEV*)ps->vresult.data;
+		ps->max_res = i;
+	}
+	if (fd >= ps->usr_len) {
+		usr_nlen = fd + 128;
+		if (ipv_resize(&ps->vfds, usr_nlen * sizeof(struct IPURINGFD)))
+			return -2;
+		ps->fds = (struct IPURINGFD*)ps->vfds.data;
+		for (i = ps->usr_len; i < usr_nlen; i++) {
+			ps->fds[i].fd = -1;
+			ps->fds[i].user = NULL;
+			ps->fds[i].mask = 0;
+			ps->fds[i].armed = 0;
+			ps->fds[i].dirty = 0;
+			ps->fds[i].edge = 0;
+			ps->fds[i].gen = 0;
+		}
+		ps->usr_len = usr_nlen;
+	}
+	if (ps->fds[fd].fd >= 0) {
+		ps->fds[fd].user = user;
+		ipr_poll_set(ipd, fd, mask);
+		return 0;
+	}
+	ps->fds[fd].fd = fd;
+	ps->fds[fd].user = user;
+	ps->fds[fd].mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+	ps->fds[fd].edge = (mask & IPOLL_ET)? 1 : 0;
+	ps->fds[fd].gen++;
+
+	if (ipr_mark(ps, fd) != 0) {
+		ps->fds[fd].fd = -1;
+		ps->fds[fd].user = NULL;
+		ps->fds[fd].mask = 0;
+		return -3;
+	}
+
+	ps->num_fd++;
+
+	return 0;
+}
+
+/* io_uring delete file */
+static int ipr_poll_del(ipolld ipd, int fd)
+{
+	PSTRUCT *ps = PDESC(ipd);
+
+	if (ps->num_fd <= 0) return -1;
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -2;
+	if (ps->fds[fd].fd < 0) return -2;
+
+	/* poll requests hold a file reference: cancel before close(fd) */
+	if (ps->fds[fd].armed) {
+		if (ipr_queue_cancel(ps, fd) != 0) {
+			ipr_submit(ps, 0, 0);
+			ipr_queue_cancel(ps, fd);
+		}
+		ipr_submit(ps, 0, 0);
+	}
+
+	/* a poll that could not be cancelled completes as stale */
+	ps->num_fd--;
+	ps->fds[fd].fd = -1;
+	ps->fds[fd].user = NULL;
+	ps->fds[fd].mask = 0;
+	ps->fds[fd].armed = 0;
+	ps->fds[fd].gen++;
+
+	return 0;
+}
+
+/* io_uring set event mask: applied in the next ipr_poll_wait */
+static int ipr_poll_set(ipolld ipd, int fd, int mask)
+{
+	PSTRUCT *ps = PDESC(ipd);
+
+	if ((unsigned int)fd >= (unsigned int)ps->usr_len) return -1;
+	if (fd < 0) return -1;
+	if (ps->fds[fd].fd < 0) return -2;
+	if ((mask & IPOLL_ET) && ipr_multishot == 0) return -10;
+
+	mask = mask & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+
+	if (mask == ps->fds[fd].mask) return 0;
+
+	ps->fds[fd].mask = mask;
+
+	if (ipr_mark(ps, fd) != 0) return -3;
+
+	return 0;
+}
+
+/* io_uring wait: batch all changes and completions in one syscall */
+static int ipr_poll_wait(ipolld ipd, int timeval)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	unsigned head, tail;
+	int retval, i, keep;
+
+	/* fds without a free sqe stay dirty and are retried next time */
+	for (i = 0, keep = 0; i < ps->num_chg; i++) {
+		int fd = ps->mchange[i];
+		struct IPURINGFD *entry = &ps->fds[fd];
+		entry->dirty = 0;
+		if (entry->fd < 0) continue;
+		if ((entry->armed && ipr_queue_cancel(ps, fd) != 0) ||
+			(entry->mask != 0 && ipr_queue_add(ps, fd) != 0)) {
+			ps->mchange[keep++] = fd;
+			entry->dirty = 1;
+		}
+	}
+
+	/* do not sleep while some fds are not armed */
+	if (keep > 0) timeval = 0;
+
+	ps->num_chg = keep;
+	ps->results = 0;
+	ps->cur_res = 0;
+
+	head = *ps->cq_khead;
+	tail = __atomic_load_n(ps->cq_ktail, __ATOMIC_ACQUIRE);
+
+	if (head == tail) {
+		retval = ipr_submit(ps, (timeval != 0)? 1 : 0, timeval);
+		if (retval < 0) return -1;
+		tail = __atomic_load_n(ps->cq_ktail, __ATOMIC_ACQUIRE);
+	}	else {
+		ipr_submit(ps, 0, 0);
+	}
+
+	for (; head != tail && ps->results < ps->max_res * 2; head++) {
+		struct io_uring_cqe *cqe = &ps->cqes[head & ps->cq_mask];
+		IUINT64 data = cqe->user_data;
+		struct IPURINGFD *entry;
+		struct IPURINGEV *ev;
+		int fd, revent = 0;
+		IUINT32 gen;
+		if (data == IURING_CANCEL) continue;
+		fd = (int)(data & 0xffffffff);
+		gen = (IUINT32)(data >> 32);
+		if (fd < 0 || fd >= ps->usr_len) continue;
+		entry = &ps->fds[fd];
+		if (entry->fd < 0 || entry->gen != gen) continue;
+		if ((cqe->flags & IORING_CQE_F_MORE) == 0) {
+			entry->armed = 0;
+			ipr_mark(ps, fd);
+		}
+		if (cqe->res < 0) {
+			if (cqe->res == -ECANCELED) continue;
+			revent = IPOLL_ERR;
+		}	else {
+			if (cqe->res & POLLIN) revent |= IPOLL_IN;
+			if (cqe->res & POLLOUT) revent |= IPOLL_OUT;
+			if (cqe->res & (POLLERR | POLLHUP)) revent |= IPOLL_ERR;
+		}
+		ev = &ps->mresult[ps->results++];
+		ev->fd = fd;
+		ev->event = revent;
+		ev->gen = gen;
+	}
+
+	__atomic_store_n(ps->cq_khead, head, __ATOMIC_RELEASE);
+
+	return ps->results;
+}
+
+/* io_uring query event */
+static int ipr_poll_event(ipolld ipd, int *fd, int *event, void **user)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPURINGEV *ev;
+	struct IPURINGFD *entry;
+	int revent, n;
+
+	if (ps->cur_res >= ps->results) return -1;
+
+	ev = &ps->mresult[ps->cur_res++];
+	n = ev->fd;
+	entry = &ps->fds[n];
+	revent = ev->event;
+
+	if (entry->fd < 0 || entry->gen != ev->gen) revent = 0;
+	else revent &= entry->mask;
+
+	if (fd) *fd = n;
+	if (event) *event = revent;
+	if (user) *user = entry->user;
+
+	return 0;
+}
+
+/* io_uring query events in batch */
+static int ipr_poll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	struct IPURINGEV *ev;
+	struct IPURINGFD *entry;
+	int revent, count = 0;
+
+	while (count < max && ps->cur_res < ps->results) {
+		ev = &ps->mresult[ps->cur_res++];
+		entry = &ps->fds[ev->fd];
+		if (entry->fd < 0 || entry->gen != ev->gen) continue;
+		revent = ev->event & entry->mask;
+		if (revent == 0) continue;
+		out[count].fd = ev->fd;
+		out[count].event = revent;
+		out[count].udata = entry->user;
+		count++;
+	}
+
+	return count;
+}
+
 
 #endif
 
@@ -3223,6 +4395,7 @@ static int ipu_poll_del(ipolld ipd, int fd);
 static int ipu_poll_set(ipolld ipd, int fd, int mask);
 static int ipu_poll_wait(ipolld ipd, int timeval);
 static int ipu_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipu_poll_events(ipolld ipd, struct ipoll_result *out, int max);
 
 
 /* devpoll descriptor */
@@ -3259,7 +4432,8 @@ struct IPOLL_DRIVER IPOLL_DEVPOLL = {
 	ipu_poll_del,
 	ipu_poll_set,
 	ipu_poll_wait,
-	ipu_poll_event
+	ipu_poll_event,
+	ipu_poll_events
 };
 
 
@@ -3422,6 +4596,8 @@ static int ipu_poll_add(ipolld ipd, int fd, int mask, void *user)
 	PSTRUCT *ps = PDESC(ipd);
 	int usr_nlen, i, events;
 
+	if (mask & IPOLL_ET) return -10;
+
 	if (ps->num_fd >= ps->max_fd) {
 		if (ipu_grow(ps, ps->max_fd * 2, -1)) return -1;
 	}
@@ -3578,6 +4754,43 @@ static int ipu_poll_event(ipolld ipd, int *fd, int *event, void **user)
 	return 0;
 }
 
+/* query events in batch */
+static int ipu_poll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int revents, eventx, count = 0, n;
+	struct pollfd *pfd;
+
+	if (ps->results <= 0) return 0;
+
+	while (count < max && ps->cur_res < ps->results) {
+		pfd = &ps->mresult[ps->cur_res++];
+
+		revents = pfd->revents;
+		eventx = 0;
+		if (revents & POLLIN) eventx |= IPOLL_IN;
+		if (revents & POLLOUT)eventx |= IPOLL_OUT;
+		if (revents & POLLERR)eventx |= IPOLL_ERR;
+
+		n = pfd->fd;
+		if (ps->fv.fds[n].fd < 0) {
+			ipu_changes_push(ipd, n, POLLREMOVE);
+			continue;
+		}
+
+		eventx &= ps->fv.fds[n].mask;
+		ipu_poll_set(ipd, n, ps->fv.fds[n].mask);
+		if (eventx == 0) continue;
+
+		out[count].fd = n;
+		out[count].event = eventx;
+		out[count].udata = ps->fv.fds[n].user;
+		count++;
+	}
+
+	return count;
+}
+
 #endif
 
 
@@ -3601,6 +4814,7 @@ static int ipx_poll_del(ipolld ipd, int fd);
 static int ipx_poll_set(ipolld ipd, int fd, int mask);
 static int ipx_poll_wait(ipolld ipd, int timeval);
 static int ipx_poll_event(ipolld ipd, int *fd, int *event, void **user);
+static int ipx_poll_events(ipolld ipd, struct ipoll_result *out, int max);
 
 
 /* pollset descriptor */
@@ -3636,7 +4850,8 @@ struct IPOLL_DRIVER IPOLL_POLLSET = {
 	ipx_poll_del,
 	ipx_poll_set,
 	ipx_poll_wait,
-	ipx_poll_event
+	ipx_poll_event,
+	ipx_poll_events
 };
 
 
@@ -3767,6 +4982,8 @@ static int ipx_poll_add(ipolld ipd, int fd, int mask, void *user)
 	PSTRUCT *ps = PDESC(ipd);
 	int usr_nlen, i, events;
 
+	if (mask & IPOLL_ET) return -10;
+
 	if (ps->num_fd >= ps->max_fd) {
 		if (ipx_grow(ps, ps->max_fd * 2, -1)) return -1;
 	}
@@ -3915,6 +5132,48 @@ static int ipx_poll_event(ipolld ipd, int *fd, int *event, void **user)
 	return 0;
 }
 
+/* query events in batch */
+static int ipx_poll_events(ipolld ipd, struct ipoll_result *out, int max)
+{
+	PSTRUCT *ps = PDESC(ipd);
+	int revents, eventx, count = 0, n;
+	struct pollfd *pfd;
+
+	if (ps->results <= 0) return 0;
+
+	while (count < max && ps->cur_res < ps->results) {
+		pfd = &ps->mresult[ps->cur_res++];
+
+		revents = pfd->revents;
+		eventx = 0;
+		if (revents & POLLIN) eventx |= IPOLL_IN;
+		if (revents & POLLOUT)eventx |= IPOLL_OUT;
+		if (revents & POLLERR)eventx |= IPOLL_ERR;
+
+		n = pfd->fd;
+		if (ps->fv.fds[n].fd < 0) {
+			ipx_changes_push(ipd, n, PS_DELETE, 0);
+			continue;
+		}
+
+		eventx &= ps->fv.fds[n].mask;
+		if (eventx == 0) {
+			ipx_changes_push(ipd, n, PS_DELETE, 0);
+			if (ps->fv.fds[n].mask != 0) {
+				ipx_changes_push(ipd, n, PS_MOD, ps->fv.fds[n].mask);
+			}
+			continue;
+		}
+
+		out[count].fd = n;
+		out[count].event = eventx;
+		out[count].udata = ps->fv.fds[n].user;
+		count++;
+	}
+
+	return count;
+}
+
 #endif
 
 
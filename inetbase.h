@@ -360,6 +360,14 @@ typedef SOCKET Socket;
 #define ISOCK_ESEND		2		/* event - send           */
 #define ISOCK_ERROR		4		/* event - error          */
 
+#ifndef ISENDV_MAX
+#define ISENDV_MAX		64		/* max buffers per isendv */
+#endif
+
+#ifndef IMMSG_MAX
+#define IMMSG_MAX		64		/* max datagrams per irecvmm/isendmm */
+#endif
+
 #if (defined(__BORLANDC__) || defined(__WATCOMC__))
 #pragma warn -8002  
 #pragma warn -8004  
@@ -576,6 +584,45 @@ long isend(int sock, const void *buf, long size, int mode);
 /* receive */
 long irecv(int sock, void *buf, long size, int mode);
 
+/* send vector: gather (count) buffers into one send */
+long isendv(int sock, const void * const vecptr[], const long veclen[],
+	int count, int mode);
+
+/* datagram vector for irecvmm / isendmm */
+struct IDGRAMV
+{
+	void *data;					/* datagram buffer */
+	long size;					/* buffer size in, datagram size out */
+	struct sockaddr *addr;		/* remote address, NULL for connected */
+	int addrlen;				/* address size in, address size out */
+};
+
+/* receive up to count datagrams with one recvmmsg (linux) or a loop of 
+ * irecvfrom (others), returns datagrams received or -1 for error */
+int irecvmm(int sock, struct IDGRAMV *vec, int count, int mode);
+
+/* send up to count datagrams with one sendmmsg (linux) or a loop of 
+ * isendto (others), returns datagrams sent or -1 for error */
+int isendmm(int sock, const struct IDGRAMV *vec, int count, int mode);
+
+/* send (size) bytes of file (fd) from offset with sendfile (linux) or a 
+ * read/send loop (others), returns bytes sent, 0 for eof or -1 */
+long isendfile(int sock, int fd, IINT64 offset, long size);
+
+/* enable MSG_ZEROCOPY (linux 4.14+), returns 0 for success, -1 for
+ * unsupported: sockets without it must not use izerocopy_send */
+int izerocopy_enable(int sock);
+
+/* send with MSG_ZEROCOPY: buf must stay untouched until a completion
+ * covering this call is reaped. each call that returns > 0 takes the
+ * next sequence number of the socket, starting from 0 */
+long izerocopy_send(int sock, const void *buf, long size, int mode);
+
+/* reap a zerocopy completion from the error queue: sends [lo, hi] have
+ * been released, copied is set when the kernel copied instead. returns
+ * 1 for a completion, 0 for none left, -1 for error or unsupported */
+int izerocopy_reap(int sock, IUINT32 *lo, IUINT32 *hi, int *copied);
+
 /* sendto */
 long isendto(int sock, const void *buf, long size, int mode, 
 	const struct sockaddr *addr, int addrlen);
@@ -721,6 +768,7 @@ int isocket_pair(int fds[2], int cloexec);
 #define IDEVICE_POLLSET		6
 #define IDEVICE_RTSIG		7
 #define IDEVICE_WINCP		8
+#define IDEVICE_IOURING		9
 
 #ifndef IPOLL_IN
 #define IPOLL_IN	1
@@ -734,8 +782,21 @@ int isocket_pair(int fds[2], int cloexec);
 #define IPOLL_ERR	4
 #endif
 
+/* edge-triggered, only for ipoll_add: fails if device doesn't support */
+#ifndef IPOLL_ET
+#define IPOLL_ET	8
+#endif
+
 typedef void * ipolld;
 
+/* result of ipoll_events */
+struct ipoll_result
+{
+	int fd;			/* file descriptor */
+	int event;		/* IPOLL_IN / IPOLL_OUT / IPOLL_ERR */
+	void *udata;	/* user data from ipoll_add */
+};
+
 /* init poll device */
 int ipoll_init(int device);
 
@@ -766,6 +827,10 @@ int ipoll_wait(ipolld ipd, int millisecond);
 /* query one event: loop call it until it returns non-zero */
 int ipoll_event(ipolld ipd, int *fd, int *event, void **udata);
 
+/* query many events at once: fills at most max results and returns 
+ * how many have been filled, loop call it until it returns zero */
+int ipoll_events(ipolld ipd, struct ipoll_result *out, int max);
+
 
 
 /*===================================================================*/
@@ -7,6 +7,7 @@
  *
  **********************************************************************/
 #include "inetcode.h"
+#include "inetkcp.h"
 
 #ifdef __unix
 #include <netdb.h>
@@ -120,6 +121,55 @@ int isocket_update_address(int resolvname)
 #define ASYNC_SOCK_MAXSIZE 0x800000
 #endif
 
+#ifndef ASYNC_SOCK_LINES
+#define ASYNC_SOCK_LINES 256		/* newlines found per scan */
+#endif
+
+#ifndef ASYNC_SOCK_STAGE
+#define ASYNC_SOCK_STAGE 0x2000		/* ITMH_LINESPLIT record staging */
+#endif
+
+/* performance counters: plain increments, ASYNC_CORE_NO_STATS drops them */
+#ifndef ASYNC_CORE_NO_STATS
+#define ASYNC_STAT(x) x
+#else
+#define ASYNC_STAT(x)
+#endif
+
+/* drop rc4 and chacha20 states */
+static void async_sock_cipher_reset(CAsyncSock *asyncsock)
+{
+	asyncsock->rc4_send_x = -1;
+	asyncsock->rc4_send_y = -1;
+	asyncsock->rc4_recv_x = -1;
+	asyncsock->rc4_recv_y = -1;
+	if (asyncsock->chacha_send) ikmem_free(asyncsock->chacha_send);
+	if (asyncsock->chacha_recv) ikmem_free(asyncsock->chacha_recv);
+	asyncsock->chacha_send = NULL;
+	asyncsock->chacha_recv = NULL;
+}
+
+/* any send cipher enabled */
+static inline int async_sock_ciphered(const CAsyncSock *asyncsock)
+{
+	if (asyncsock->rc4_send_x >= 0 && asyncsock->rc4_send_y >= 0) return 1;
+	return (asyncsock->chacha_send != NULL)? 1 : 0;
+}
+
+/* apply send ciphers, src and dst can be the same */
+static void async_sock_encrypt(CAsyncSock *asyncsock, 
+	const unsigned char *src, unsigned char *dst, long size)
+{
+	if (asyncsock->rc4_send_x >= 0 && asyncsock->rc4_send_y >= 0) {
+		icrypt_rc4_crypt(asyncsock->rc4_send_box, &asyncsock->rc4_send_x,
+			&asyncsock->rc4_send_y, src, dst, size);
+		src = dst;
+	}
+	if (asyncsock->chacha_send != NULL) {
+		icrypt_chacha20_crypt(asyncsock->chacha_send, src, dst, size);
+	}
+}
+
 /* create a new asyncsock */
 void async_sock_init(CAsyncSock *asyncsock, struct IMEMNODE *nodes)
 {
@@ -137,15 +187,27 @@ void async_sock_init(CAsyncSock *asyncsock, struct IMEMNODE *nodes)
 	asyncsock->rc4_send_y = -1;
 	asyncsock->rc4_recv_x = -1;
 	asyncsock->rc4_recv_y = -1;
+	asyncsock->chacha_send = NULL;
+	asyncsock->chacha_recv = NULL;
 	asyncsock->external = NULL;
 	asyncsock->bufsize = 0;
 	asyncsock->maxsize = ASYNC_SOCK_MAXSIZE;
 	asyncsock->limited = -1;
+	asyncsock->hiwater = 0;
+	asyncsock->lowater = 0;
 	asyncsock->ipv6 = 0;
 	asyncsock->mask = 0;
 	asyncsock->error = 0;
 	asyncsock->flags = 0;
-	iqueue_init(&asyncsock->node);
+	asyncsock->timer = -1;
+	asyncsock->kcp = NULL;
+	asyncsock->zcseq = 0;
+	memset(&asyncsock->stats, 0, sizeof(asyncsock->stats));
+	iqueue_init(&asyncsock->dirty);
+	iqueue_init(&asyncsock->bulk);
+	iqueue_init(&asyncsock->zcwait);
+	iqueue_init(&asyncsock->dgrams);
+	asyncsock->dgram_count = 0;
 	ims_init(&asyncsock->linemsg, nodes, 0, 0);
 	ims_init(&asyncsock->sendmsg, nodes, 0, 0);
 	ims_init(&asyncsock->recvmsg, nodes, 0, 0);
@@ -177,10 +239,7 @@ void async_sock_destroy(CAsyncSock *asyncsock)
 	ims_destroy(&asyncsock->linemsg);
 	ims_destroy(&asyncsock->sendmsg);
 	ims_destroy(&asyncsock->recvmsg);
-	asyncsock->rc4_send_x = -1;
-	asyncsock->rc4_send_y = -1;
-	asyncsock->rc4_recv_x = -1;
-	asyncsock->rc4_recv_y = -1;
+	async_sock_cipher_reset(asyncsock);
 }
 
 
@@ -209,10 +268,7 @@ int async_sock_connect(CAsyncSock *asyncsock, const struct sockaddr *remote,
 		}
 	}
 
-	asyncsock->rc4_send_x = -1;
-	asyncsock->rc4_send_y = -1;
-	asyncsock->rc4_recv_x = -1;
-	asyncsock->rc4_recv_y = -1;
+	async_sock_cipher_reset(asyncsock);
 	
 	if (addrlen <= 20) {
 		asyncsock->fd = isocket(AF_INET, SOCK_STREAM, 0);
@@ -275,10 +331,7 @@ int async_sock_assign(CAsyncSock *asyncsock, int sock, int header)
 		}
 	}
 
-	asyncsock->rc4_send_x = -1;
-	asyncsock->rc4_send_y = -1;
-	asyncsock->rc4_recv_x = -1;
-	asyncsock->rc4_recv_y = -1;
+	async_sock_cipher_reset(asyncsock);
 
 	ims_clear(&asyncsock->linemsg);
 	ims_clear(&asyncsock->sendmsg);
@@ -302,10 +355,7 @@ void async_sock_close(CAsyncSock *asyncsock)
 	if (asyncsock->fd >= 0) iclose(asyncsock->fd);
 	asyncsock->fd = -1;
 	asyncsock->state = ASYNC_SOCK_STATE_CLOSED;
-	asyncsock->rc4_send_x = -1;
-	asyncsock->rc4_send_y = -1;
-	asyncsock->rc4_recv_x = -1;
-	asyncsock->rc4_recv_y = -1;
+	async_sock_cipher_reset(asyncsock);
 }
 
 /* try connect */
@@ -329,33 +379,107 @@ static int async_sock_try_connect(CAsyncSock *asyncsock)
 	return 0;
 }
 
-/* try send */
-static int async_sock_try_send(CAsyncSock *asyncsock)
+/* try send at most limit bytes (-1 for all), returns bytes sent or -1 */
+static long async_sock_try_send_limit(CAsyncSock *asyncsock, long limit)
 {
-	void *ptr;
-	char *flat;
-	long size;
-	int retval;
+	void *ptrs[ISENDV_MAX];
+	ilong sizes[ISENDV_MAX];
+	long lens[ISENDV_MAX];
+	long total, retval, sent = 0;
+	int count, i;
 
 	if (asyncsock->state != ASYNC_SOCK_STATE_ESTAB) return 0;
 
-	while (1) {
-		size = ims_flat(&asyncsock->sendmsg, &ptr);
-		if (size <= 0) break;
-		flat = (char*)ptr;
-		retval = isend(asyncsock->fd, flat, size, 0);
+	while (limit < 0 || sent < limit) {
+		count = ims_iovec(&asyncsock->sendmsg, ptrs, sizes, ISENDV_MAX);
+		if (count <= 0) break;
+		for (total = 0, i = 0; i < count; i++) {
+			lens[i] = (long)sizes[i];
+			if (limit >= 0 && lens[i] > limit - sent - total) {
+				lens[i] = limit - sent - total;
+				count = i + 1;
+			}
+			total += lens[i];
+		}
+		retval = isendv(asyncsock->fd, (const void**)ptrs, lens, count, 0);
+		ASYNC_STAT(asyncsock->stats.send_calls++);
 		if (retval == 0) break;
 		else if (retval < 0) {
 			retval = ierrno();
-			if (retval == IEAGAIN || retval == 0) break;
+			if (retval == IEAGAIN || retval == 0) {
+				ASYNC_STAT(asyncsock->stats.eagain++);
+				break;
+			}
 			else {
-				asyncsock->error = retval;
+				asyncsock->error = (int)retval;
 				return -1;
 			}
 		}
 		ims_drop(&asyncsock->sendmsg, retval);
+		sent += retval;
+		ASYNC_STAT(asyncsock->stats.bytes_out += retval);
+		/* short write: kernel buffer is full, skip the EAGAIN round */
+		if (retval < total) {
+			ASYNC_STAT(asyncsock->stats.eagain++);
+			break;
+		}
+	}
+	return sent;
+}
+
+/* try send */
+static int async_sock_try_send(CAsyncSock *asyncsock)
+{
+	return (async_sock_try_send_limit(asyncsock, -1) < 0)? -1 : 0;
+}
+
+/* split received data into ITMH_LINESPLIT records: newlines are found
+ * by a vectorized scan, short records are staged and written together */
+static void async_sock_split_lines(CAsyncSock *asyncsock, 
+	const unsigned char *buffer, long size)
+{
+	IUINT32 lines[ASYNC_SOCK_LINES];
+	char stage[ASYNC_SOCK_STAGE];
+	long base = 0, start = 0, fill = 0, n, i;
+	while (base < size) {
+		n = (long)imemscan(buffer + base, size - base, '\n', lines, 
+			ASYNC_SOCK_LINES);
+		for (i = 0; i < n; i++) {
+			long end = base + (long)lines[i] + 1;
+			long x = end - start;
+			long y = asyncsock->linemsg.size;
+			if (y > 0 || fill + x + 4 > ASYNC_SOCK_STAGE) {
+				ims_write(&asyncsock->recvmsg, stage, fill);
+				fill = 0;
+			}
+			if (y > 0 || x + 4 > ASYNC_SOCK_STAGE) {
+				char head[4];
+				iencode32u_lsb(head, x + y + 4);
+				ims_write(&asyncsock->recvmsg, head, 4);
+				while (asyncsock->linemsg.size > 0) {
+					ilong csize;
+					void *ptr;
+					csize = ims_flat(&asyncsock->linemsg, &ptr);
+					ims_write(&asyncsock->recvmsg, ptr, csize);
+					ims_drop(&asyncsock->linemsg, csize);
+				}
+				ims_write(&asyncsock->recvmsg, &buffer[start], x);
+			}	else {
+				iencode32u_lsb(stage + fill, x + 4);
+				memcpy(stage + fill + 4, &buffer[start], x);
+				fill += x + 4;
+			}
+			start = end;
+		}
+		if (n < ASYNC_SOCK_LINES) break;
+		base = start;
+	}
+	if (fill > 0) {
+		ims_write(&asyncsock->recvmsg, stage, fill);
+	}
+	if (size > start) {
+		ims_write(&asyncsock->linemsg, &buffer[start], size - start);
 	}
-	return 0;
 }
 
 /* try receive */
@@ -367,6 +491,7 @@ static int async_sock_try_recv(CAsyncSock *asyncsock)
 	if (asyncsock->state == ASYNC_SOCK_STATE_CLOSED) return 0;
 	while (1) {
 		retval = irecv(asyncsock->fd, buffer, bufsize, 0);
+		ASYNC_STAT(asyncsock->stats.recv_calls++);
 		if (retval < 0) {
 			retval = ierrno();
 			if (retval == IEAGAIN || retval == 0) break;
@@ -379,35 +504,19 @@ static int async_sock_try_recv(CAsyncSock *asyncsock)
 			asyncsock->error = 0;
 			return -1;
 		}
+		ASYNC_STAT(asyncsock->stats.bytes_in += retval);
 		if (asyncsock->rc4_recv_x >= 0 && asyncsock->rc4_recv_y >= 0) {
 			icrypt_rc4_crypt(asyncsock->rc4_recv_box, &asyncsock->rc4_recv_x,
 				&asyncsock->rc4_recv_y, buffer, buffer, retval);
 		}
+		if (asyncsock->chacha_recv != NULL) {
+			icrypt_chacha20_crypt(asyncsock->chacha_recv, buffer, buffer,
+				retval);
+		}
 		if (asyncsock->header != ITMH_LINESPLIT) {
 			ims_write(&asyncsock->recvmsg, buffer, retval);
 		}	else {
-			long start = 0, pos = 0;
-			char head[4];
-			for (start = 0, pos = 0; pos < retval; pos++) {
-				if (buffer[pos] == '\n') {
-					long x = pos - start + 1;
-					long y = asyncsock->linemsg.size;
-					iencode32u_lsb(head, x + y + 4);
-					ims_write(&asyncsock->recvmsg, head, 4);
-					while (asyncsock->linemsg.size > 0) {
-						ilong csize;
-						void *ptr;
-						csize = ims_flat(&asyncsock->linemsg, &ptr);
-						ims_write(&asyncsock->recvmsg, ptr, csize);
-						ims_drop(&asyncsock->linemsg, csize);
-					}
-					ims_write(&asyncsock->recvmsg, &buffer[start], x);
-					start = pos + 1;
-				}
-			}
-			if (pos > start) {
-				ims_write(&asyncsock->linemsg, &buffer[start], pos - start);
-			}
+			async_sock_split_lines(asyncsock, buffer, retval);
 		}
 		if (retval < bufsize) break;
 	}
@@ -622,15 +731,14 @@ long async_sock_send_vector(CAsyncSock *asyncsock,
 	for (i = 0; i < count; i++) size += veclen[i];
 	hdrlen = async_sock_write_size(asyncsock, size, mask, (char*)head);
 
-	if (asyncsock->rc4_send_x >= 0 && asyncsock->rc4_send_y >= 0 && hdrlen) {
-		icrypt_rc4_crypt(asyncsock->rc4_send_box, &asyncsock->rc4_send_x,
-			&asyncsock->rc4_send_y, head, head, hdrlen);
+	if (async_sock_ciphered(asyncsock) && hdrlen) {
+		async_sock_encrypt(asyncsock, head, head, hdrlen);
 	}
 
 	ims_write(&asyncsock->sendmsg, head, hdrlen);
 
 	for (i = 0; i < count; i++) {
-		if (asyncsock->rc4_send_x < 0 || asyncsock->rc4_send_y < 0) {
+		if (async_sock_ciphered(asyncsock) == 0) {
 			ims_write(&asyncsock->sendmsg, vecptr[i], veclen[i]);
 		}	else {
 			unsigned char *buffer = (unsigned char*)asyncsock->buffer;
@@ -638,11 +746,8 @@ long async_sock_send_vector(CAsyncSock *asyncsock,
 			long remain = veclen[i];
 			long bufsize = asyncsock->bufsize;
 			for (; remain > 0; ) {
-				long canread = (size > bufsize)? bufsize : remain;
-				icrypt_rc4_crypt(asyncsock->rc4_send_box, 
-					&asyncsock->rc4_send_x, 
-					&asyncsock->rc4_send_y, 
-					lptr, buffer, canread);
+				long canread = (remain > bufsize)? bufsize : remain;
+				async_sock_encrypt(asyncsock, lptr, buffer, canread);
 				ims_write(&asyncsock->sendmsg, buffer, canread);
 				remain -= canread;
 				lptr += canread;
@@ -745,6 +850,37 @@ void async_sock_rc4_set_rkey(CAsyncSock *asyncsock,
 			&asyncsock->rc4_recv_y, key, keylen);
 }
 
+/* set chacha20 state: 32 bytes key and 8 bytes nonce */
+static int async_sock_chacha_set(ICHACHA20 **ctx, 
+	const unsigned char *key, const unsigned char *nonce)
+{
+	if (key == NULL) {
+		if (ctx[0]) ikmem_free(ctx[0]);
+		ctx[0] = NULL;
+		return 0;
+	}
+	if (ctx[0] == NULL) {
+		ctx[0] = (ICHACHA20*)ikmem_malloc(sizeof(ICHACHA20));
+		if (ctx[0] == NULL) return -1;
+	}
+	icrypt_chacha20_init(ctx[0], key, nonce, 0);
+	return 0;
+}
+
+/* set send chacha20 key */
+int async_sock_chacha_set_skey(CAsyncSock *asyncsock, 
+	const unsigned char *key, const unsigned char *nonce)
+{
+	return async_sock_chacha_set(&asyncsock->chacha_send, key, nonce);
+}
+
+/* set recv chacha20 key */
+int async_sock_chacha_set_rkey(CAsyncSock *asyncsock, 
+	const unsigned char *key, const unsigned char *nonce)
+{
+	return async_sock_chacha_set(&asyncsock->chacha_recv, key, nonce);
+}
+
 /* set nodelay */
 int async_sock_nodelay(CAsyncSock *asyncsock, int nodelay)
 {
@@ -777,12 +913,90 @@ int async_sock_keepalive(CAsyncSock *asyncsock, int keepcnt, int keepidle,
 /*===================================================================*/
 /* CAsyncCore                                                        */
 /*===================================================================*/
+/* hierarchical timer wheel: 256 slots of 1ms, then 4 levels of 64 */
+#define ASYNC_TIMER_TVR_BITS	8
+#define ASYNC_TIMER_TVN_BITS	6
+#define ASYNC_TIMER_TVR_SIZE	(1 << ASYNC_TIMER_TVR_BITS)
+#define ASYNC_TIMER_TVN_SIZE	(1 << ASYNC_TIMER_TVN_BITS)
+#define ASYNC_TIMER_TVR_MASK	(ASYNC_TIMER_TVR_SIZE - 1)
+#define ASYNC_TIMER_TVN_MASK	(ASYNC_TIMER_TVN_SIZE - 1)
+#define ASYNC_TIMER_SLOTS		(ASYNC_TIMER_TVR_SIZE + ASYNC_TIMER_TVN_SIZE * 4)
+
+#define ASYNC_TIMER_USER		0
+#define ASYNC_TIMER_IDLE		1
+#define ASYNC_TIMER_KCP			2
+
+typedef struct
+{
+	struct IQUEUEHEAD head;		/* wheel slot list node */
+	IUINT32 expires;			/* expiration tick */
+	IUINT32 period;				/* zero for one-shot */
+	long id;					/* timer id */
+	long tag;					/* user tag, or hid for idle timers */
+	int mode;					/* ASYNC_TIMER_USER/IDLE/KCP */
+}	CAsyncTimer;
+
+/* lock-free event ring, enabled by async_core_new(flags & 8) */
+#if (defined(__GNUC__) && ((__GNUC__ > 4) || \
+	((__GNUC__ == 4) && (__GNUC_MINOR__ >= 7)))) || defined(__clang__)
+#define ASYNC_ATOMIC_LOAD(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ASYNC_ATOMIC_STORE(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ASYNC_ATOMIC_CAS(p, o, n)	__sync_bool_compare_and_swap((p), (o), (n))
+#elif defined(_MSC_VER)
+#define ASYNC_ATOMIC_LOAD(p)		(*(volatile IUINT32*)(p))
+#define ASYNC_ATOMIC_STORE(p, v)	InterlockedExchange((volatile LONG*)(p), (LONG)(v))
+#define ASYNC_ATOMIC_CAS(p, o, n)	\
+	(InterlockedCompareExchange((volatile LONG*)(p), (LONG)(n), (LONG)(o)) \
+		== (LONG)(o))
+#elif !defined(ASYNC_CORE_NO_RING)
+#define ASYNC_CORE_NO_RING
+#endif
+
+#ifndef ASYNC_CORE_RING_SIZE
+#define ASYNC_CORE_RING_SIZE		4096		/* descriptors, power of 2 */
+#endif
+
+#ifndef ASYNC_CORE_RING_ARENA
+#define ASYNC_CORE_RING_ARENA		0x100000	/* payload bytes, power of 2 */
+#endif
+
+typedef struct
+{
+	volatile IUINT32 sequence;	/* slot state, see async_ring_push */
+	int event;
+	long wparam;
+	long lparam;
+	long size;
+	char *data;					/* payload: in arena or a kmem block */
+	IUINT32 release;			/* arena position after this payload */
+	IUINT32 stamp;				/* push time, see async_core_stamp */
+	int arena;
+}	CAsyncEvent;
+
+typedef struct
+{
+	CAsyncEvent *slots;
+	IUINT32 mask;
+	volatile IUINT32 tail;		/* next slot to claim (producers) */
+	IUINT32 head;				/* next slot to read (consumer) */
+	char *arena;				/* payloads pushed under core->lock */
+	IUINT32 amask;
+	IUINT32 atail;				/* written under core->lock */
+	volatile IUINT32 ahead;		/* released by consumer */
+	volatile IUINT32 spill;		/* events overflowed into core->msgs */
+}	CAsyncRing;
+
 struct CAsyncCore
 {
 	struct IMEMNODE *nodes;
 	struct IMEMNODE *cache;
 	struct IMSTREAM msgs;
-	struct IQUEUEHEAD head;
+	struct IVECTOR refcopy;
+	CAsyncRing *ring;
+	struct IQUEUEHEAD dirty;
+	struct IQUEUEHEAD linger;		/* closed hids with zerocopy in flight */
+	struct IQUEUEHEAD wheel[ASYNC_TIMER_SLOTS];
+	struct IMEMNODE *timers;
 	struct IVECTOR *vector;
 	ipolld pfd;
 	long bufsize;
@@ -794,16 +1008,33 @@ struct CAsyncCore
 	long msgcnt;
 	long count;
 	long index;
+	long tindex;
+	long tcount;
 	int xfd[3];
 	int nolock;
+	int edge;
+	int coalesce;
+	int refmode;
+	long refsize;
+	char *refblock;
+	char *dgram;
+	int dgramout;
+	int shard;
+	int shards;
 	int flags;
 	IMUTEX_TYPE lock;
 	IMUTEX_TYPE xmtx;
 	IMUTEX_TYPE xmsg;
 	IUINT32 current;
-	IUINT32 lastsec;
+	IUINT32 jiffies;
 	IUINT32 timeout;
 	CAsyncValidator validator;
+	struct CAsyncCoreStats stats;
+	IUINT32 *hist;				/* ASYNC_CORE_HIST_COUNT histograms */
+	IINT64 wake;				/* poll return time while dispatching */
+	IUINT32 slow;
+	CAsyncTracer tracer;
+	void *tracer_user;
 };
 
 
@@ -816,6 +1047,308 @@ struct CAsyncCore
 
 #define ASYNC_CORE_FLAG_PROGRESS	1
 #define ASYNC_CORE_FLAG_SENSITIVE	2
+#define ASYNC_CORE_FLAG_EDGE		4
+#define ASYNC_CORE_FLAG_WBLOCK		8
+
+#define ASYNC_CORE_REF_NONE			0
+#define ASYNC_CORE_REF_STREAM		1	/* payload in core->msgs page */
+#define ASYNC_CORE_REF_BLOCK		2	/* payload in core->refblock */
+#define ASYNC_CORE_REF_RING			3	/* payload in ring head slot */
+
+/* set in the length word: events are user values and keep all 16 bits */
+#define ASYNC_CORE_MSG_INDIRECT		0x80000000ul
+
+#ifndef ASYNC_CORE_INDIRECT
+#define ASYNC_CORE_INDIRECT			8192
+#endif
+
+#ifndef ASYNC_CORE_EVENTS
+#define ASYNC_CORE_EVENTS			256
+#endif
+
+#define ASYNC_CORE_FLAG_BATCH		16	/* dgram: recvmmsg into events */
+#define ASYNC_CORE_FLAG_ZCOPY		32	/* SO_ZEROCOPY enabled */
+#define ASYNC_CORE_FLAG_ZCOFF		64	/* no zerocopy: copy instead */
+#define ASYNC_CORE_FLAG_COALESCE	128	/* sends wait for dirty flush */
+#define ASYNC_CORE_FLAG_BLOCKED		256	/* over high watermark */
+
+#ifndef ASYNC_CORE_ZEROCOPY_MIN
+#define ASYNC_CORE_ZEROCOPY_MIN		8192	/* smaller buffers are copied */
+#endif
+
+#define ASYNC_CORE_BULK_FILE		0
+#define ASYNC_CORE_BULK_ZEROCOPY	1
+
+#ifndef ASYNC_CORE_MMSG
+#define ASYNC_CORE_MMSG				32	/* datagrams per recvmmsg */
+#endif
+
+#ifndef ASYNC_CORE_MMSG_ROUNDS
+#define ASYNC_CORE_MMSG_ROUNDS		8	/* recvmmsg calls per poll event */
+#endif
+
+#ifndef ASYNC_CORE_DGRAM_QUEUE
+#define ASYNC_CORE_DGRAM_QUEUE		4096	/* max queued datagrams */
+#endif
+
+#define ASYNC_CORE_DGRAM_MAX		0x10000
+#define ASYNC_CORE_DGRAM_HEAD		40	/* room for addrlen + sockaddr */
+#define ASYNC_CORE_DGRAM_SLOT		(ASYNC_CORE_DGRAM_MAX + 40)
+#define ASYNC_CORE_DGRAM_OUT		2048	/* kcp output slot */
+
+/* receive slots first, then the kcp output slots */
+#define ASYNC_CORE_DGRAM_OUTPUT(c, i) ((c)->dgram + \
+	ASYNC_CORE_DGRAM_SLOT * ASYNC_CORE_MMSG + ASYNC_CORE_DGRAM_OUT * (i))
+
+/* queued datagram in sock->dgrams, payload follows */
+typedef struct
+{
+	struct IQUEUEHEAD head;
+	long size;
+	int addrlen;
+	IUINT32 addr[8];
+}	CAsyncDgram;
+
+/* sendfile or zerocopy item in sock->bulk: the first (gap) bytes of
+ * sock->sendmsg not covered by earlier items go out before it */
+typedef struct
+{
+	struct IQUEUEHEAD head;		/* node in sock->bulk or sock->zcwait */
+	int type;					/* ASYNC_CORE_BULK_FILE/ZEROCOPY */
+	int fd;						/* file to send */
+	int copied;					/* data has been copied somewhere */
+	IINT64 offset;				/* file offset */
+	const char *ptr;			/* zerocopy buffer */
+	long size;					/* total bytes */
+	long pos;					/* bytes taken by the kernel */
+	long gap;					/* stream bytes queued before it */
+	long cookie;				/* lparam of ASYNC_CORE_EVT_RELEASE */
+	IUINT32 first;				/* sequence of the first zerocopy send */
+	IUINT32 sends;				/* zerocopy sends issued */
+	IUINT32 done;				/* zerocopy sends completed */
+}	CAsyncBulk;
+
+/* closed hid whose zerocopy pages the kernel may still reference: 
+ * the socket is shut down but its fd stays open until the error queue
+ * reports every send of the items */
+typedef struct
+{
+	struct IQUEUEHEAD head;		/* node in core->linger */
+	struct IQUEUEHEAD items;	/* CAsyncBulk with sends in flight */
+	long hid;					/* wparam of ASYNC_CORE_EVT_RELEASE */
+	int fd;
+}	CAsyncLinger;
+
+#ifndef ASYNC_CORE_LINGER_POLL
+#define ASYNC_CORE_LINGER_POLL		10	/* ms between linger reaps */
+#endif
+
+#define ASYNC_CORE_PENDING(sock) \
+	((sock)->sendmsg.size > 0 || !iqueue_is_empty(&(sock)->bulk))
+
+/* kcp session (ASYNC_CORE_NODE_KCP) or demux (ASYNC_CORE_NODE_KCPLISTEN) */
+struct CAsyncKcp
+{
+	CAsyncCore *core;
+	ikcpcb *kcp;				/* session: control block */
+	idict_t *convs;				/* listener: conv -> session hid */
+	long owner;					/* hid of the node owning the udp fd */
+	long timer;					/* session: ikcp_update timer id */
+	int fd;						/* udp fd used for output */
+	int addrlen;				/* remote address size, 0 if connected */
+	IUINT32 conv;
+	IUINT32 remote[8];
+	int config[7];				/* nodelay,interval,resend,nc,snd,rcv,mtu */
+};
+
+typedef struct CAsyncKcp CAsyncKcp;
+
+#define ASYNC_KCP_OVERHEAD			24
+
+
+/*-------------------------------------------------------------------*/
+/* timer wheel                                                       */
+/*-------------------------------------------------------------------*/
+static void async_core_timer_link(CAsyncCore *core, CAsyncTimer *timer)
+{
+	IUINT32 expires = timer->expires;
+	IUINT32 idx = expires - core->jiffies;
+	int slot;
+	if ((IINT32)idx < 0) {
+		slot = core->jiffies & ASYNC_TIMER_TVR_MASK;
+	}
+	else if (idx < (1ul << ASYNC_TIMER_TVR_BITS)) {
+		slot = expires & ASYNC_TIMER_TVR_MASK;
+	}
+	else {
+		int level = 0, shift = ASYNC_TIMER_TVR_BITS;
+		while (level < 3 && 
+			idx >= (1ul << (shift + ASYNC_TIMER_TVN_BITS))) {
+			shift += ASYNC_TIMER_TVN_BITS;
+			level++;
+		}
+		slot = ASYNC_TIMER_TVR_SIZE + level * ASYNC_TIMER_TVN_SIZE +
+			((expires >> shift) & ASYNC_TIMER_TVN_MASK);
+	}
+	iqueue_add_tail(&timer->head, &core->wheel[slot]);
+}
+
+/* new timer record, not scheduled */
+static long async_core_timer_new(CAsyncCore *core, int mode, 
+	IUINT32 period, long tag)
+{
+	CAsyncTimer *timer;
+	long index, id;
+	index = (long)imnode_new(core->timers);
+	if (index < 0) return -1;
+	if (index > 0xfffff) {
+		imnode_del(core->timers, index);
+		return -2;
+	}
+	id = index | (core->tindex << 20);
+	core->tindex++;
+	if (core->tindex >= 0x7ff) core->tindex = 1;
+	timer = (CAsyncTimer*)IMNODE_DATA(core->timers, index);
+	iqueue_init(&timer->head);
+	timer->expires = 0;
+	timer->period = period;
+	timer->id = id;
+	timer->tag = tag;
+	timer->mode = mode;
+	return id;
+}
+
+static CAsyncTimer* async_core_timer_get(CAsyncCore *core, long id)
+{
+	long index = id & 0xfffff;
+	CAsyncTimer *timer;
+	if (id < 0 || index >= (long)core->timers->node_max) return NULL;
+	if (IMNODE_MODE(core->timers, index) != 1) return NULL;
+	timer = (CAsyncTimer*)IMNODE_DATA(core->timers, index);
+	if (timer->id != id) return NULL;
+	return timer;
+}
+
+/* schedule (or reschedule) timer at the given tick */
+static void async_core_timer_start(CAsyncCore *core, CAsyncTimer *timer,
+	IUINT32 expires)
+{
+	if (iqueue_is_empty(&timer->head)) {
+		core->tcount++;
+	}	else {
+		iqueue_del(&timer->head);
+	}
+	timer->expires = expires;
+	async_core_timer_link(core, timer);
+}
+
+static void async_core_timer_stop(CAsyncCore *core, CAsyncTimer *timer)
+{
+	if (!iqueue_is_empty(&timer->head)) {
+		iqueue_del(&timer->head);
+		iqueue_init(&timer->head);
+		core->tcount--;
+	}
+}
+
+static void async_core_timer_free(CAsyncCore *core, CAsyncTimer *timer)
+{
+	long index;
+	if (timer == NULL) return;
+	async_core_timer_stop(core, timer);
+	index = timer->id & 0xfffff;
+	timer->id = -1;
+	imnode_del(core->timers, index);
+}
+
+/* move timers of a higher level slot down, returns the slot index */
+static int async_core_timer_cascade(CAsyncCore *core, int level)
+{
+	int shift = ASYNC_TIMER_TVR_BITS + (level - 1) * ASYNC_TIMER_TVN_BITS;
+	int index = (core->jiffies >> shift) & ASYNC_TIMER_TVN_MASK;
+	struct IQUEUEHEAD *slot = &core->wheel[ASYNC_TIMER_TVR_SIZE + 
+		(level - 1) * ASYNC_TIMER_TVN_SIZE + index];
+	struct IQUEUEHEAD queue;
+	iqueue_init(&queue);
+	iqueue_splice_init(slot, &queue);
+	while (!iqueue_is_empty(&queue)) {
+		CAsyncTimer *timer = iqueue_entry(queue.next, CAsyncTimer, head);
+		iqueue_del(&timer->head);
+		async_core_timer_link(core, timer);
+	}
+	return index;
+}
+
+/* ms from jiffies to the next tick worth processing, at most limit */
+static IUINT32 async_core_timer_next(const CAsyncCore *core, IUINT32 limit)
+{
+	IUINT32 jiffies = core->jiffies;
+	IUINT32 best = limit;
+	int i, wrap, level;
+	if (core->tcount == 0) return limit;
+	for (i = 0; i < ASYNC_TIMER_TVR_SIZE; i++) {
+		int index = (jiffies + i) & ASYNC_TIMER_TVR_MASK;
+		if (i > 0 && index == 0) break;
+		if (!iqueue_is_empty(&core->wheel[index])) {
+			return ((IUINT32)i < limit)? (IUINT32)i : limit;
+		}
+	}
+	/* remaining first level slots are not due before the next cascade */
+	for (wrap = i; i < ASYNC_TIMER_TVR_SIZE; i++) {
+		int index = (jiffies + i) & ASYNC_TIMER_TVR_MASK;
+		if (!iqueue_is_empty(&core->wheel[index])) {
+			if ((IUINT32)wrap < best) best = (IUINT32)wrap;
+			break;
+		}
+	}
+	/* a higher level slot is due when it is cascaded */
+	for (level = 1; level <= 4; level++) {
+		int shift = ASYNC_TIMER_TVR_BITS + (level - 1) * ASYNC_TIMER_TVN_BITS;
+		const struct IQUEUEHEAD *slots = &core->wheel[ASYNC_TIMER_TVR_SIZE +
+			(level - 1) * ASYNC_TIMER_TVN_SIZE];
+		IUINT32 base = jiffies >> shift;
+		IUINT32 k, first;
+		first = (jiffies & ((1ul << shift) - 1)) == 0 ? 0 : 1;
+		for (k = first; k < first + ASYNC_TIMER_TVN_SIZE; k++) {
+			if (!iqueue_is_empty(&slots[(base + k) & ASYNC_TIMER_TVN_MASK])) {
+				IUINT32 delta = ((base + k) << shift) - jiffies;
+				if (delta < best) best = delta;
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+static void async_core_timer_expire(CAsyncCore *core, CAsyncTimer *timer);
+
+/* run timers up to current time */
+static void async_core_timer_run(CAsyncCore *core, IUINT32 now)
+{
+	while (itimediff(now, core->jiffies) >= 0) {
+		struct IQUEUEHEAD queue;
+		int index = core->jiffies & ASYNC_TIMER_TVR_MASK;
+		if (core->tcount == 0) {
+			core->jiffies = now + 1;
+			break;
+		}
+		if (index == 0) {
+			int level = 1;
+			while (level <= 4 && async_core_timer_cascade(core, level) == 0)
+				level++;
+		}
+		core->jiffies++;
+		iqueue_init(&queue);
+		iqueue_splice_init(&core->wheel[index], &queue);
+		while (!iqueue_is_empty(&queue)) {
+			CAsyncTimer *timer = iqueue_entry(queue.next, CAsyncTimer, head);
+			iqueue_del(&timer->head);
+			iqueue_init(&timer->head);
+			core->tcount--;
+			async_core_timer_expire(core, timer);
+		}
+	}
+}
 
 /* used to monitor self-pipe trick */
 static unsigned int async_core_monitor = 0; 
@@ -831,12 +1364,29 @@ static long _async_core_node_head(const CAsyncCore *core);
 static long _async_core_node_next(const CAsyncCore *core, long hid);
 static long _async_core_node_prev(const CAsyncCore *core, long hid);
 
+#ifndef ASYNC_CORE_NO_RING
+static CAsyncRing* async_ring_new(void);
+static void async_ring_delete(CAsyncRing *ring);
+#endif
+
+static void async_core_event_close(CAsyncCore *core, CAsyncSock *sock,
+	int code);
+static int async_core_kcp_flush(CAsyncCore *core, CAsyncSock *sock);
+static void async_core_kcp_update(CAsyncCore *core, CAsyncSock *sock);
+static void async_core_kcp_free(CAsyncCore *core, CAsyncSock *sock);
+static void async_core_kcp_shutdown(CAsyncCore *core, CAsyncSock *sock);
+static void async_core_bulk_clear(CAsyncCore *core, CAsyncSock *sock,
+	int notify);
+static void async_core_linger_reap(CAsyncCore *core);
+static void async_core_linger_free(CAsyncCore *core);
+
 /*-------------------------------------------------------------------*/
 /* new async core                                                    */
 /*-------------------------------------------------------------------*/
 CAsyncCore* async_core_new(int flags)
 {
 	CAsyncCore *core;
+	int i;
 
 	core = (CAsyncCore*)ikmem_malloc(sizeof(CAsyncCore));
 	if (core == NULL) return NULL;
@@ -845,14 +1395,16 @@ CAsyncCore* async_core_new(int flags)
 
 	core->nodes = imnode_create(sizeof(CAsyncSock), 64);
 	core->cache = imnode_create(8192, 64);
+	core->timers = imnode_create(sizeof(CAsyncTimer), 64);
 	core->vector = iv_create();
 
-	assert(core->nodes && core->cache);
+	assert(core->nodes && core->cache && core->timers);
 
 	if (core->nodes == NULL || core->cache == NULL ||
-		core->vector == NULL) {
+		core->timers == NULL || core->vector == NULL) {
 		if (core->nodes) imnode_delete(core->nodes);
 		if (core->cache) imnode_delete(core->cache);
+		if (core->timers) imnode_delete(core->timers);
 		if (core->vector) iv_delete(core->vector);
 		memset(core, 0, sizeof(CAsyncCore));
 		ikmem_free(core);
@@ -864,6 +1416,7 @@ CAsyncCore* async_core_new(int flags)
 	if (iv_resize(core->vector, (core->bufsize + 64) * 2) != 0) {
 		imnode_delete(core->nodes);
 		imnode_delete(core->cache);
+		imnode_delete(core->timers);
 		iv_delete(core->vector);
 		memset(core, 0, sizeof(CAsyncCore));
 		ikmem_free(core);
@@ -873,6 +1426,7 @@ CAsyncCore* async_core_new(int flags)
 	if (ipoll_create(&core->pfd, 20000) != 0) {
 		imnode_delete(core->nodes);
 		imnode_delete(core->cache);
+		imnode_delete(core->timers);
 		iv_delete(core->vector);
 		memset(core, 0, sizeof(CAsyncCore));
 		ikmem_free(core);
@@ -880,19 +1434,34 @@ CAsyncCore* async_core_new(int flags)
 	}
 
 	ims_init(&core->msgs, core->cache, 0, 0);
-	iqueue_init(&core->head);
+	iv_init(&core->refcopy, NULL);
+	iqueue_init(&core->dirty);
+	iqueue_init(&core->linger);
+
+	for (i = 0; i < ASYNC_TIMER_SLOTS; i++) {
+		iqueue_init(&core->wheel[i]);
+	}
 
 	core->data = NULL;
 	core->msgcnt = 0;
 	core->count = 0;
 	core->timeout = 0;
 	core->index = 1;
+	core->shard = 0;
+	core->shards = 1;
 	core->validator = NULL;
 	core->user = NULL;
 	core->data = (char*)core->vector->data;
 	core->buffer = core->data + core->bufsize + 64;
 	core->current = iclock();
-	core->lastsec = 0;
+	core->jiffies = core->current;
+	core->tindex = 1;
+	core->tcount = 0;
+	core->refmode = ASYNC_CORE_REF_NONE;
+	core->refsize = 0;
+	core->refblock = NULL;
+	core->dgram = NULL;
+	core->dgramout = 0;
 	core->maxsize = ASYNC_SOCK_MAXSIZE;
 	core->limited = 0;
 	core->flags = 0;
@@ -906,6 +1475,27 @@ CAsyncCore* async_core_new(int flags)
 	IMUTEX_INIT(&core->xmsg);
 	
 	core->nolock = ((flags & 1) == 0)? 0 : 1;
+	core->edge = ((flags & 4) == 0)? 0 : 1;
+	core->coalesce = ((flags & 16) == 0)? 0 : 1;
+	core->ring = NULL;
+	core->hist = NULL;
+	core->wake = 0;
+	core->slow = 0;
+	core->tracer = NULL;
+	core->tracer_user = NULL;
+#ifndef ASYNC_CORE_NO_STATS
+	if (flags & 32) {
+		long size = sizeof(IUINT32) * ASYNC_CORE_HIST_BUCKETS * 
+			ASYNC_CORE_HIST_COUNT;
+		core->hist = (IUINT32*)ikmem_malloc(size);
+		if (core->hist) memset(core->hist, 0, size);
+	}
+#endif
+#ifndef ASYNC_CORE_NO_RING
+	if (flags & 8) {
+		core->ring = async_ring_new();
+	}
+#endif
 
 	/* self-pipe trick */
 	if ((flags & 2) == 0) {
@@ -960,8 +1550,15 @@ void async_core_delete(CAsyncCore *core)
 		if (hid < 0) break;
 		async_core_node_delete(core, hid);
 	}
-	if (!iqueue_is_empty(&core->head)) {
-		assert(iqueue_is_empty(&core->head));
+	while (1) {
+		long index = imnode_head(core->timers);
+		if (index < 0) break;
+		async_core_timer_free(core, 
+			(CAsyncTimer*)IMNODE_DATA(core->timers, index));
+	}
+	async_core_linger_free(core);
+	if (core->tcount != 0) {
+		assert(core->tcount == 0);
 		abort();
 	}
 	if (core->count != 0) {
@@ -972,17 +1569,34 @@ void async_core_delete(CAsyncCore *core)
 		ipoll_delete(core->pfd);
 		core->pfd = NULL;
 	}
+	async_core_read_release(core);
+	while (1) {
+		const void *ptr;
+		if (async_core_read_ref(core, NULL, NULL, NULL, &ptr) < 0) break;
+	}
+	async_core_read_release(core);
 	IMUTEX_LOCK(&core->xmsg);
 	ims_destroy(&core->msgs);
+	iv_destroy(&core->refcopy);
 	IMUTEX_UNLOCK(&core->xmsg);
+#ifndef ASYNC_CORE_NO_RING
+	if (core->ring) async_ring_delete(core->ring);
+	core->ring = NULL;
+#endif
+	if (core->hist) ikmem_free(core->hist);
+	core->hist = NULL;
 	if (core->vector) iv_delete(core->vector);
 	if (core->nodes) imnode_delete(core->nodes);
 	if (core->cache) imnode_delete(core->cache);
+	if (core->timers) imnode_delete(core->timers);
+	if (core->dgram) ikmem_free(core->dgram);
+	core->dgram = NULL;
 	core->vector = NULL;
 	core->nodes = NULL;
 	core->cache = NULL;
+	core->timers = NULL;
 	core->data = NULL;
-	iqueue_init(&core->head);
+	iqueue_init(&core->dirty);
 #ifdef __unix
 	#ifndef __AVM2__
 	if (core->xfd[0] >= 0) close(core->xfd[0]);
@@ -1021,9 +1635,10 @@ static long async_core_node_new(CAsyncCore *core)
 		abort();
 	}
 
+	/* serials of a group member are congruent to its shard index */
 	id = (index & 0xffff) | (core->index << 16);
-	core->index++;
-	if (core->index >= 0x7fff) core->index = 1;
+	core->index += core->shards;
+	if (core->index >= 0x7fff) core->index = core->shard + 1;
 
 	sock = (CAsyncSock*)IMNODE_DATA(core->nodes, index);
 	if (sock == NULL) {
@@ -1039,9 +1654,20 @@ static long async_core_node_new(CAsyncCore *core)
 	sock->time = core->current;
 	sock->maxsize = core->maxsize;
 	sock->limited = core->limited;
-	sock->flags = 0;
+	sock->flags = core->coalesce? ASYNC_CORE_FLAG_COALESCE : 0;
 	sock->error = 0;
-	iqueue_add_tail(&sock->node, &core->head);
+	sock->timer = async_core_timer_new(core, ASYNC_TIMER_IDLE, 0, id);
+
+	if (sock->timer < 0) {
+		async_sock_destroy(sock);
+		imnode_del(core->nodes, index);
+		return -3;
+	}
+
+	if (core->timeout > 0) {
+		CAsyncTimer *timer = async_core_timer_get(core, sock->timer);
+		async_core_timer_start(core, timer, sock->time + core->timeout);
+	}
 
 	core->count++;
 
@@ -1087,13 +1713,36 @@ async_core_node_get_const(const CAsyncCore *core, long hid)
 /*-------------------------------------------------------------------*/
 /* delete node                                                       */
 /*-------------------------------------------------------------------*/
+static void async_core_dgram_clear(CAsyncSock *sock)
+{
+	while (!iqueue_is_empty(&sock->dgrams)) {
+		CAsyncDgram *dgram = iqueue_entry(sock->dgrams.next, 
+				CAsyncDgram, head);
+		iqueue_del(&dgram->head);
+		ikmem_free(dgram);
+	}
+	sock->dgram_count = 0;
+	sock->flags &= ~ASYNC_CORE_FLAG_WBLOCK;
+}
+
 static long async_core_node_delete(CAsyncCore *core, long hid)
 {
 	CAsyncSock *sock = async_core_node_get(core, hid);
 	if (sock == NULL) return -1;
-	if (!iqueue_is_empty(&sock->node)) {
-		iqueue_del(&sock->node);
-		iqueue_init(&sock->node);
+	if (sock->mode == ASYNC_CORE_NODE_DGRAM) {
+		async_core_dgram_clear(sock);
+	}
+	if (sock->kcp != NULL) {
+		async_core_kcp_free(core, sock);
+	}
+	async_core_bulk_clear(core, sock, 0);
+	if (sock->timer >= 0) {
+		async_core_timer_free(core, async_core_timer_get(core, sock->timer));
+		sock->timer = -1;
+	}
+	if (!iqueue_is_empty(&sock->dirty)) {
+		iqueue_del(&sock->dirty);
+		iqueue_init(&sock->dirty);
 	}
 	async_sock_destroy(sock);
 	imnode_del(core->nodes, hid & 0xffff);
@@ -1109,9 +1758,8 @@ static int async_core_node_active(CAsyncCore *core, long hid)
 {
 	CAsyncSock *sock = async_core_node_get(core, hid);
 	if (sock == NULL) return -1;
+	/* the idle timer is re-armed lazily when it expires */
 	sock->time = core->current;
-	iqueue_del(&sock->node);
-	iqueue_add_tail(&sock->node, &core->head);
 	return 0;
 }
 
@@ -1199,70 +1847,375 @@ long async_core_node_prev(const CAsyncCore *core, long hid)
 }
 
 /*-------------------------------------------------------------------*/
-/* post message                                                      */
+/* latency histograms: log-linear, 16 sub-buckets per power of 2     */
 /*-------------------------------------------------------------------*/
-static int async_core_msg_push(CAsyncCore *core, int event, long wparam, 
-	long lparam, const void *data, long size)
+static inline int async_core_hist_index(IUINT32 value)
+{
+	int e = 4;
+	if (value < 16) return (int)value;
+#if defined(__GNUC__) || defined(__clang__)
+	e = 31 - __builtin_clz(value);
+#else
+	while ((value >> (e + 1)) != 0) e++;
+#endif
+	return 16 + ((e - 4) << 4) + (int)((value >> (e - 4)) & 15);
+}
+
+static void async_core_hist_add(CAsyncCore *core, int which, IINT64 us)
+{
+	IUINT32 *buckets = core->hist + which * ASYNC_CORE_HIST_BUCKETS;
+	if (us < 0) us = 0;
+	if (us > 0xffffffffll) us = 0xffffffffll;
+	buckets[async_core_hist_index((IUINT32)us)]++;
+}
+
+/* microsecond push time carried by each event when measuring */
+static inline IUINT32 async_core_stamp(const CAsyncCore *core)
+{
+	return (core->hist == NULL)? 0 : (IUINT32)iclockrt();
+}
+
+/* queueing delay of an event read now */
+static void async_core_hist_queue(CAsyncCore *core, IUINT32 stamp)
+{
+	IINT32 delta = (IINT32)((IUINT32)iclockrt() - stamp);
+	async_core_hist_add(core, ASYNC_CORE_HIST_QUEUE, delta);
+}
+
+
+/*-------------------------------------------------------------------*/
+/* write message into core->msgs                                     */
+/*-------------------------------------------------------------------*/
+static void async_core_msg_write(CAsyncCore *core, int event, long wparam, 
+	long lparam, const void *data, long size, IUINT32 stamp)
 {
-	char head[14];
+	char head[18];
+	int hlen = (core->hist == NULL)? 14 : 18;
+	char *block = NULL;
+	IUINT32 length;
 	size = size < 0 ? 0 : size;
-	iencode32u_lsb(head, (long)(size + 14));
+	length = (IUINT32)(size + hlen);
+	/* large payloads are kept contiguous for async_core_read_ref */
+	if (size >= ASYNC_CORE_INDIRECT) {
+		block = (char*)ikmem_malloc(size);
+		if (block != NULL) {
+			memcpy(block, data, size);
+			length |= ASYNC_CORE_MSG_INDIRECT;
+		}
+	}
+	iencode32u_lsb(head, length);
 	iencode16u_lsb(head + 4, (unsigned short)event);
 	iencode32i_lsb(head + 6, wparam);
 	iencode32i_lsb(head + 10, lparam);
+	iencode32u_lsb(head + 14, stamp);
 	if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
-	ims_write(&core->msgs, head, 14);
-	ims_write(&core->msgs, data, size);
+	ims_write(&core->msgs, head, hlen);
+	if (block == NULL) {
+		ims_write(&core->msgs, data, size);
+	}	else {
+		ims_write(&core->msgs, &block, sizeof(block));
+	}
 	core->msgcnt++;
+#ifndef ASYNC_CORE_NO_RING
+	if (core->ring) {
+		ASYNC_ATOMIC_STORE(&core->ring->spill, core->ring->spill + 1);
+	}
+#endif
 	if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
-	return 0;
 }
 
 
+#ifndef ASYNC_CORE_NO_RING
 /*-------------------------------------------------------------------*/
-/* get message                                                       */
+/* lock-free event ring                                              */
 /*-------------------------------------------------------------------*/
-static long async_core_msg_read(CAsyncCore *core, int *event, long *wparam,
-	long *lparam, void *data, long size)
+static CAsyncRing* async_ring_new(void)
 {
-	char head[14];
-	IUINT32 length;
-	IINT32 x;
-	IUINT16 y;
-	int EVENT;
+	CAsyncRing *ring;
+	IUINT32 i;
+	ring = (CAsyncRing*)ikmem_malloc(sizeof(CAsyncRing));
+	if (ring == NULL) return NULL;
+	ring->slots = (CAsyncEvent*)ikmem_malloc(sizeof(CAsyncEvent) * 
+		ASYNC_CORE_RING_SIZE);
+	ring->arena = (char*)ikmem_malloc(ASYNC_CORE_RING_ARENA);
+	if (ring->slots == NULL || ring->arena == NULL) {
+		if (ring->slots) ikmem_free(ring->slots);
+		if (ring->arena) ikmem_free(ring->arena);
+		ikmem_free(ring);
+		return NULL;
+	}
+	for (i = 0; i < ASYNC_CORE_RING_SIZE; i++) {
+		ring->slots[i].sequence = i;
+		ring->slots[i].data = NULL;
+	}
+	ring->mask = ASYNC_CORE_RING_SIZE - 1;
+	ring->tail = 0;
+	ring->head = 0;
+	ring->amask = ASYNC_CORE_RING_ARENA - 1;
+	ring->atail = 0;
+	ring->ahead = 0;
+	ring->spill = 0;
+	return ring;
+}
+
+static void async_ring_delete(CAsyncRing *ring)
+{
+	while (1) {
+		CAsyncEvent *slot = &ring->slots[ring->head & ring->mask];
+		if (slot->sequence != ring->head + 1) break;
+		if (slot->arena == 0) ikmem_free(slot->data);
+		ring->head++;
+	}
+	ikmem_free(ring->slots);
+	ikmem_free(ring->arena);
+	ikmem_free(ring);
+}
+
+/* allocate payload in arena, only for producers holding core->lock */
+static char* async_ring_alloc(CAsyncRing *ring, long size, 
+	IUINT32 *release)
+{
+	IUINT32 asize = ring->amask + 1;
+	IUINT32 pos = ring->atail & ring->amask;
+	IUINT32 skip = 0;
+	if ((IUINT32)size > (asize >> 2)) return NULL;
+	if (pos + (IUINT32)size > asize) skip = asize - pos;
+	if (ring->atail - ASYNC_ATOMIC_LOAD(&ring->ahead) + skip + size > asize)
+		return NULL;
+	ring->atail += skip + (IUINT32)size;
+	release[0] = ring->atail;
+	return ring->arena + ((pos + skip) & ring->amask);
+}
+
+/* claim a slot (bounded MPMC queue with per-slot sequence numbers):
+ * sequence == pos means free for producers, pos + 1 means readable */
+static void async_ring_push(CAsyncCore *core, int event, long wparam,
+	long lparam, const void *data, long size, int shared, IUINT32 stamp)
+{
+	CAsyncRing *ring = core->ring;
+	CAsyncEvent *slot = NULL;
+	IUINT32 atail = ring->atail;
+	IUINT32 release = 0;
+	IUINT32 pos;
+	char *payload = NULL;
+	int arena = 0;
+
+	size = size < 0 ? 0 : size;
+
+	/* after an overflow, keep order until core->msgs is drained */
+	if (ASYNC_ATOMIC_LOAD(&ring->spill) == 0) {
+		if (shared == 0) {
+			payload = async_ring_alloc(ring, size, &release);
+			arena = (payload != NULL)? 1 : 0;
+		}
+		if (payload == NULL) {
+			payload = (char*)ikmem_malloc(size > 0 ? size : 1);
+		}
+		if (payload != NULL) {
+			pos = ASYNC_ATOMIC_LOAD(&ring->tail);
+			while (1) {
+				IINT32 diff;
+				slot = &ring->slots[pos & ring->mask];
+				diff = (IINT32)(ASYNC_ATOMIC_LOAD(&slot->sequence) - pos);
+				if (diff == 0) {
+					if (ASYNC_ATOMIC_CAS(&ring->tail, pos, pos + 1)) break;
+				}
+				else if (diff < 0) {	/* full */
+					slot = NULL;
+					break;
+				}
+				pos = ASYNC_ATOMIC_LOAD(&ring->tail);
+			}
+			if (slot != NULL) {
+				if (size > 0) memcpy(payload, data, size);
+				slot->event = event;
+				slot->wparam = wparam;
+				slot->lparam = lparam;
+				slot->size = size;
+				slot->data = payload;
+				slot->release = release;
+				slot->stamp = stamp;
+				slot->arena = arena;
+				ASYNC_ATOMIC_STORE(&slot->sequence, pos + 1);
+				return;
+			}
+			if (arena) ring->atail = atail;
+			else ikmem_free(payload);
+		}
+	}
+
+	async_core_msg_write(core, event, wparam, lparam, data, size, stamp);
+}
+#endif
+
+
+/*-------------------------------------------------------------------*/
+/* post message                                                      */
+/*-------------------------------------------------------------------*/
+static int async_core_msg_push(CAsyncCore *core, int event, long wparam, 
+	long lparam, const void *data, long size)
+{
+	IUINT32 stamp = 0;
+	if (core->hist) {
+		IINT64 now = iclockrt();
+		stamp = (IUINT32)now;
+		if (core->wake != 0) {
+			async_core_hist_add(core, ASYNC_CORE_HIST_DELIVER, 
+				now - core->wake);
+		}
+	}
+#ifndef ASYNC_CORE_NO_RING
+	if (core->ring) {
+		async_ring_push(core, event, wparam, lparam, data, size, 0, stamp);
+		return 0;
+	}
+#endif
+	async_core_msg_write(core, event, wparam, lparam, data, size, stamp);
+	return 0;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* release the message borrowed by async_core_msg_borrow             */
+/*-------------------------------------------------------------------*/
+static void async_core_msg_release(CAsyncCore *core)
+{
+	switch (core->refmode) {
+	case ASYNC_CORE_REF_STREAM:
+		if (core->nolock == 0) IMUTEX_LOCK(&core->xmsg);
+		ims_drop(&core->msgs, core->refsize);
+		if (core->nolock == 0) IMUTEX_UNLOCK(&core->xmsg);
+		break;
+	case ASYNC_CORE_REF_BLOCK:
+		ikmem_free(core->refblock);
+		core->refblock = NULL;
+		break;
+#ifndef ASYNC_CORE_NO_RING
+	case ASYNC_CORE_REF_RING: {
+			CAsyncRing *ring = core->ring;
+			CAsyncEvent *slot = &ring->slots[ring->head & ring->mask];
+			if (slot->arena) {
+				ASYNC_ATOMIC_STORE(&ring->ahead, slot->release);
+			}	else {
+				ikmem_free(slot->data);
+			}
+			slot->data = NULL;
+			ASYNC_ATOMIC_STORE(&slot->sequence, ring->head + ring->mask + 1);
+			ring->head++;
+		}
+		break;
+#endif
+	}
+	core->refmode = ASYNC_CORE_REF_NONE;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* borrow next message: ptr == NULL to peek its size only, payloads  */
+/* not contiguous are copied into data (or an internal buffer)       */
+/*-------------------------------------------------------------------*/
+static long async_core_msg_borrow(CAsyncCore *core, int *event, 
+	long *wparam, long *lparam, const void **ptr, void *data, long size)
+{
+	char head[18];
+	int hlen = (core->hist == NULL)? 14 : 18;
+	IUINT32 length;
+	IUINT32 indirect;
+	IINT32 x;
+	IUINT16 y;
+	int EVENT;
 	long WPARAM;
 	long LPARAM;
+
+	if (core->refmode != ASYNC_CORE_REF_NONE) {
+		async_core_msg_release(core);
+	}
+
+#ifndef ASYNC_CORE_NO_RING
+	if (core->ring) {
+		CAsyncRing *ring = core->ring;
+		CAsyncEvent *slot = &ring->slots[ring->head & ring->mask];
+		if (ASYNC_ATOMIC_LOAD(&slot->sequence) == ring->head + 1) {
+			if (ptr == NULL) return slot->size;
+			if (data != NULL && size < slot->size) return -2;
+			if (event) event[0] = slot->event;
+			if (wparam) wparam[0] = slot->wparam;
+			if (lparam) lparam[0] = slot->lparam;
+			if (core->hist) async_core_hist_queue(core, slot->stamp);
+			ptr[0] = slot->data;
+			core->refmode = ASYNC_CORE_REF_RING;
+			return slot->size;
+		}
+		if (ASYNC_ATOMIC_LOAD(&ring->spill) == 0) return -1;
+		/* a claimed slot is still being filled: it precedes the spill */
+		if (ASYNC_ATOMIC_LOAD(&ring->tail) != ring->head) return -1;
+	}
+#endif
+
 	if (core->nolock == 0) {
 		IMUTEX_LOCK(&core->xmsg);
 	}
-	if (ims_peek(&core->msgs, head, 4) < 4) {
+	if (ims_peek(&core->msgs, head, hlen) < hlen) {
 		if (core->nolock == 0) {
 			IMUTEX_UNLOCK(&core->xmsg);
 		}
 		return -1;
 	}
 	idecode32u_lsb(head, &length);
-	length -= 14;
-	if (data == NULL) {
+	indirect = length & ASYNC_CORE_MSG_INDIRECT;
+	length = (length & ~ASYNC_CORE_MSG_INDIRECT) - hlen;
+	if (ptr == NULL) {
 		if (core->nolock == 0) {
 			IMUTEX_UNLOCK(&core->xmsg);
 		}
 		return length;
 	}
-	if (size < (long)length) {
+	if (data != NULL && size < (long)length) {
 		if (core->nolock == 0) {
 			IMUTEX_UNLOCK(&core->xmsg);
 		}
 		return -2;
 	}
-	ims_read(&core->msgs, head, 14);
+	ims_drop(&core->msgs, hlen);
+	if (core->hist) {
+		IUINT32 stamp;
+		idecode32u_lsb(head + 14, &stamp);
+		async_core_hist_queue(core, stamp);
+	}
 	idecode16u_lsb(head + 4, &y);
 	EVENT = y;
 	idecode32i_lsb(head + 6, &x);
 	WPARAM = x;
 	idecode32i_lsb(head + 10, &x);
 	LPARAM = x;
-	ims_read(&core->msgs, data, length);
+	if (indirect) {
+		ims_read(&core->msgs, &core->refblock, sizeof(core->refblock));
+		ptr[0] = core->refblock;
+		core->refmode = ASYNC_CORE_REF_BLOCK;
+	}	else {
+		void *flat = NULL;
+		if (ims_flat(&core->msgs, &flat) >= (ilong)length) {
+			/* producers only append: the page stays until release */
+			ptr[0] = flat;
+			core->refsize = length;
+			core->refmode = ASYNC_CORE_REF_STREAM;
+		}	else {
+			if (data == NULL) {
+				if (iv_resize(&core->refcopy, length) != 0) {
+					assert(core->refcopy.size >= length);
+					abort();
+				}
+				data = core->refcopy.data;
+			}
+			ims_read(&core->msgs, data, length);
+			ptr[0] = data;
+		}
+	}
+#ifndef ASYNC_CORE_NO_RING
+	if (core->ring) {
+		ASYNC_ATOMIC_STORE(&core->ring->spill, core->ring->spill - 1);
+	}
+#endif
 	if (core->nolock == 0) {
 		IMUTEX_UNLOCK(&core->xmsg);
 	}
@@ -1286,6 +2239,7 @@ static int async_core_buffer_resize(CAsyncCore *core, long newsize)
 	}
 	newsize = xsize;
 	if (iv_resize(core->vector, (newsize + 64) * 2) != 0) return -1;
+	ASYNC_STAT(core->stats.resizes++);
 	core->data = (char*)core->vector->data;
 	core->buffer = core->data + newsize + 64;
 	core->bufsize = newsize;
@@ -1304,22 +2258,393 @@ static int async_core_buffer_resize(CAsyncCore *core, long newsize)
 	return 0;
 }
 
+/*-------------------------------------------------------------------*/
+/* account the time a node spends waiting for IPOLL_OUT              */
+/*-------------------------------------------------------------------*/
+static void async_core_stat_wait(CAsyncCore *core, CAsyncSock *sock,
+	int waiting)
+{
+#ifndef ASYNC_CORE_NO_STATS
+	struct CAsyncSockStats *stats = &sock->stats;
+	if (waiting && stats->wblock_since == 0) {
+		stats->wblock_since = core->current | 1;
+	}
+	else if (waiting == 0 && stats->wblock_since != 0) {
+		IINT32 delta = (IINT32)(core->current - stats->wblock_since);
+		if (delta > 0) stats->wblock_ms += delta;
+		stats->wblock_since = 0;
+	}
+#endif
+}
+
 /*-------------------------------------------------------------------*/
 /* change event mask                                                 */
 /*-------------------------------------------------------------------*/
 static int async_core_node_mask(CAsyncCore *core, CAsyncSock *sock, 
 	int enable, int disable)
 {
+	int mask;
 	if (core == NULL || sock == NULL) return -1;
+	if (sock->flags & ASYNC_CORE_FLAG_EDGE) {
+		/* IPOLL_OUT stays armed in edge-triggered mode */
+		enable &= ~IPOLL_OUT;
+		disable &= ~IPOLL_OUT;
+	}
+	mask = sock->mask;
 	if (disable & IPOLL_IN) sock->mask &= ~(IPOLL_IN);
 	if (disable & IPOLL_OUT) sock->mask &= ~(IPOLL_OUT);
 	if (disable & IPOLL_ERR) sock->mask &= ~(IPOLL_ERR);
 	if (enable & IPOLL_IN) sock->mask |= IPOLL_IN;
 	if (enable & IPOLL_OUT) sock->mask |= IPOLL_OUT;
 	if (enable & IPOLL_ERR) sock->mask |= IPOLL_ERR;
+	if ((sock->flags & ASYNC_CORE_FLAG_EDGE) == 0) {
+		async_core_stat_wait(core, sock, sock->mask & IPOLL_OUT);
+	}
+	if (sock->mask == mask && (sock->flags & ASYNC_CORE_FLAG_EDGE)) 
+		return 0;
 	return ipoll_set(core->pfd, sock->fd, sock->mask);
 }
 
+/*-------------------------------------------------------------------*/
+/* add connection into poll device                                   */
+/*-------------------------------------------------------------------*/
+static int async_core_node_poll(CAsyncCore *core, CAsyncSock *sock, 
+	int mask)
+{
+	if (core->edge) {
+		int emask = IPOLL_IN | IPOLL_OUT | IPOLL_ERR;
+		if (ipoll_add(core->pfd, sock->fd, emask | IPOLL_ET, sock) == 0) {
+			sock->flags |= ASYNC_CORE_FLAG_EDGE;
+			sock->mask = emask;
+			return 0;
+		}
+	}
+	return ipoll_add(core->pfd, sock->fd, mask, sock);
+}
+
+/*-------------------------------------------------------------------*/
+/* bulk: emit ASYNC_CORE_EVT_RELEASE                                 */
+/*-------------------------------------------------------------------*/
+static void async_core_bulk_event(CAsyncCore *core, long hid,
+	int type, long cookie, int status)
+{
+	char data[4];
+	iencode16u_lsb(data, (short)type);
+	iencode16u_lsb(data + 2, (short)status);
+	async_core_msg_push(core, ASYNC_CORE_EVT_RELEASE, hid, 
+		cookie, data, 4);
+}
+
+/* release the item and free it */
+static void async_core_bulk_release(CAsyncCore *core, long hid,
+	CAsyncBulk *bulk, int status)
+{
+	async_core_bulk_event(core, hid, bulk->type, bulk->cookie, status);
+	iqueue_del(&bulk->head);
+	ikmem_free(bulk);
+}
+
+/* account a completed zerocopy range [lo, hi], 1 if all sends done */
+static int async_core_bulk_ack(CAsyncBulk *bulk, IUINT32 lo, IUINT32 hi,
+	int copied)
+{
+	IINT32 a = (IINT32)(lo - bulk->first);
+	IINT32 b = (IINT32)(hi - bulk->first);
+	if (bulk->sends == 0) return 0;
+	if (a < 0) a = 0;
+	if (b > (IINT32)bulk->sends - 1) b = bulk->sends - 1;
+	if (a > b) return 0;
+	bulk->done += (IUINT32)(b - a + 1);
+	if (copied) bulk->copied = 1;
+	return (bulk->done == bulk->sends)? 1 : 0;
+}
+
+/*-------------------------------------------------------------------*/
+/* bulk: drop all items, notify=1 emits status 2 (dropped) for each, */
+/* items with zerocopy sends in flight linger until the kernel is    */
+/* done with their pages, their fd is taken from the sock            */
+/*-------------------------------------------------------------------*/
+static void async_core_bulk_clear(CAsyncCore *core, CAsyncSock *sock,
+	int notify)
+{
+	struct IQUEUEHEAD *lists[2];
+	CAsyncLinger *linger = NULL;
+	int i;
+	lists[0] = &sock->bulk;
+	lists[1] = &sock->zcwait;
+	for (i = 0; i < 2; i++) {
+		while (!iqueue_is_empty(lists[i])) {
+			CAsyncBulk *bulk;
+			bulk = iqueue_entry(lists[i]->next, CAsyncBulk, head);
+			if (notify && bulk->done != bulk->sends && sock->fd >= 0) {
+				if (linger == NULL) {
+					linger = (CAsyncLinger*)
+						ikmem_malloc(sizeof(CAsyncLinger));
+					if (linger != NULL) iqueue_init(&linger->items);
+				}
+				if (linger != NULL) {
+					iqueue_del(&bulk->head);
+					iqueue_add_tail(&bulk->head, &linger->items);
+					continue;
+				}
+			}
+			if (notify) {
+				async_core_bulk_release(core, sock->hid, bulk, 2);
+			}	else {
+				iqueue_del(&bulk->head);
+				ikmem_free(bulk);
+			}
+		}
+	}
+	if (linger != NULL) {
+		linger->hid = sock->hid;
+		linger->fd = sock->fd;
+		sock->fd = -1;
+		ishutdown(linger->fd, 2);
+		iqueue_add_tail(&linger->head, &core->linger);
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* linger: release items whose pages the kernel no longer holds      */
+/*-------------------------------------------------------------------*/
+static void async_core_linger_reap(CAsyncCore *core)
+{
+	struct IQUEUEHEAD *it, *next;
+	for (it = core->linger.next; it != &core->linger; it = next) {
+		CAsyncLinger *linger = iqueue_entry(it, CAsyncLinger, head);
+		IUINT32 lo, hi;
+		int copied;
+		next = it->next;
+		while (izerocopy_reap(linger->fd, &lo, &hi, &copied) > 0) {
+			struct IQUEUEHEAD *p, *pn;
+			for (p = linger->items.next; p != &linger->items; p = pn) {
+				CAsyncBulk *bulk = iqueue_entry(p, CAsyncBulk, head);
+				pn = p->next;
+				if (async_core_bulk_ack(bulk, lo, hi, copied)) {
+					async_core_bulk_release(core, linger->hid, bulk,
+						(bulk->pos < bulk->size)? 2 : 
+						(bulk->copied? 1 : 0));
+				}
+			}
+		}
+		if (iqueue_is_empty(&linger->items)) {
+			iqueue_del(&linger->head);
+			iclose(linger->fd);
+			ikmem_free(linger);
+		}
+	}
+}
+
+/* free lingering items without events, used by async_core_delete */
+static void async_core_linger_free(CAsyncCore *core)
+{
+	while (!iqueue_is_empty(&core->linger)) {
+		CAsyncLinger *linger = iqueue_entry(core->linger.next, 
+				CAsyncLinger, head);
+		while (!iqueue_is_empty(&linger->items)) {
+			CAsyncBulk *bulk = iqueue_entry(linger->items.next, 
+					CAsyncBulk, head);
+			iqueue_del(&bulk->head);
+			ikmem_free(bulk);
+		}
+		iqueue_del(&linger->head);
+		iclose(linger->fd);
+		ikmem_free(linger);
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* bulk: push one item into the socket, 1 done, 0 blocked, -1 error  */
+/*-------------------------------------------------------------------*/
+static int async_core_bulk_send(CAsyncCore *core, CAsyncSock *sock,
+	CAsyncBulk *bulk)
+{
+	int copy = (sock->flags & ASYNC_CORE_FLAG_ZCOFF)? 1 : 0;
+	while (bulk->pos < bulk->size) {
+		long canwrite = bulk->size - bulk->pos;
+		long hr;
+		if (bulk->type == ASYNC_CORE_BULK_FILE) {
+			hr = isendfile(sock->fd, bulk->fd, bulk->offset + bulk->pos,
+				canwrite);
+			if (hr == 0) {	/* file is shorter than the range */
+				sock->error = 0;
+				return -1;
+			}
+		}
+		else if (copy) {
+			hr = isend(sock->fd, bulk->ptr + bulk->pos, canwrite, 0);
+			if (hr > 0) bulk->copied = 1;
+		}
+		else {
+			hr = izerocopy_send(sock->fd, bulk->ptr + bulk->pos, 
+				canwrite, 0);
+			if (hr > 0) {
+				if (bulk->sends == 0) bulk->first = sock->zcseq;
+				bulk->sends++;
+				sock->zcseq++;
+			}
+		}
+		ASYNC_STAT(sock->stats.send_calls++);
+		if (hr < 0) {
+			int code = ierrno();
+			if (code == IEAGAIN || code == 0) {
+				ASYNC_STAT(sock->stats.eagain++);
+				return 0;
+			}
+		#ifdef ENOBUFS
+			/* out of optmem for notifications: copy this round */
+			if (code == ENOBUFS && copy == 0) {
+				copy = 1;
+				continue;
+			}
+		#endif
+			sock->error = code;
+			return -1;
+		}
+		bulk->pos += hr;
+		ASYNC_STAT(sock->stats.bytes_out += hr);
+		/* short write on a stream means the socket buffer is full */
+		if (hr < canwrite && bulk->type != ASYNC_CORE_BULK_FILE) {
+			ASYNC_STAT(sock->stats.eagain++);
+			return 0;
+		}
+	}
+	if (bulk->done == bulk->sends) {
+		async_core_bulk_release(core, sock->hid, bulk, 
+			bulk->copied? 1 : 0);
+	}	else {
+		iqueue_del(&bulk->head);
+		iqueue_add_tail(&bulk->head, &sock->zcwait);
+	}
+	return 1;
+}
+
+/*-------------------------------------------------------------------*/
+/* bulk: reap zerocopy completions from the socket error queue       */
+/*-------------------------------------------------------------------*/
+static void async_core_bulk_reap(CAsyncCore *core, CAsyncSock *sock)
+{
+	IUINT32 lo, hi;
+	int copied;
+	while (izerocopy_reap(sock->fd, &lo, &hi, &copied) > 0) {
+		struct IQUEUEHEAD *lists[2], *it, *next;
+		int i;
+		/* the kernel copies anyway (loopback, no sg): stop pinning */
+		if (copied) sock->flags |= ASYNC_CORE_FLAG_ZCOFF;
+		lists[0] = &sock->bulk;
+		lists[1] = &sock->zcwait;
+		for (i = 0; i < 2; i++) {
+			for (it = lists[i]->next; it != lists[i]; it = next) {
+				CAsyncBulk *bulk = iqueue_entry(it, CAsyncBulk, head);
+				next = it->next;
+				if (async_core_bulk_ack(bulk, lo, hi, copied) &&
+					bulk->pos == bulk->size) {
+					async_core_bulk_release(core, sock->hid, bulk, 
+						bulk->copied? 1 : 0);
+				}
+			}
+		}
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* send stream bytes and bulk items in queue order, 0 for success    */
+/*-------------------------------------------------------------------*/
+static int async_core_node_send(CAsyncCore *core, CAsyncSock *sock)
+{
+	if (sock->state != ASYNC_SOCK_STATE_ESTAB) return 0;
+	while (!iqueue_is_empty(&sock->bulk)) {
+		CAsyncBulk *bulk = iqueue_entry(sock->bulk.next, CAsyncBulk, head);
+		int hr;
+		if (bulk->gap > 0) {
+			long sent = async_sock_try_send_limit(sock, bulk->gap);
+			if (sent < 0) return -1;
+			bulk->gap -= sent;
+			if (bulk->gap > 0) return 0;
+		}
+		hr = async_core_bulk_send(core, sock, bulk);
+		if (hr <= 0) return hr;
+	}
+	return async_sock_update(sock, 2);
+}
+
+/*-------------------------------------------------------------------*/
+/* bytes queued in user space: send buffer and pending bulk items,   */
+/* unacknowledged segments of a kcp session or queued datagrams      */
+/*-------------------------------------------------------------------*/
+static long async_core_node_queued(const CAsyncSock *sock)
+{
+	const struct IQUEUEHEAD *it;
+	long size = (long)sock->sendmsg.size;
+	if (sock->mode == ASYNC_CORE_NODE_KCP && sock->kcp != NULL) {
+		const ikcpcb *kcp = sock->kcp->kcp;
+		return (long)ikcp_waitsnd(kcp) * (long)kcp->mss;
+	}
+	for (it = sock->dgrams.next; it != &sock->dgrams; it = it->next) {
+		size += iqueue_entry(it, const CAsyncDgram, head)->size;
+	}
+	for (it = sock->bulk.next; it != &sock->bulk; it = it->next) {
+		const CAsyncBulk *bulk = iqueue_entry(it, CAsyncBulk, head);
+		size += bulk->size - bulk->pos;
+	}
+	return size;
+}
+
+/*-------------------------------------------------------------------*/
+/* emit BLOCKED / WRITABLE when the queue crosses the watermarks     */
+/*-------------------------------------------------------------------*/
+static void async_core_node_water(CAsyncCore *core, CAsyncSock *sock)
+{
+	char data[4];
+	long queued;
+	int event;
+	if (sock->hiwater <= 0 && (sock->flags & ASYNC_CORE_FLAG_BLOCKED) == 0)
+		return;
+	queued = async_core_node_queued(sock);
+	if ((sock->flags & ASYNC_CORE_FLAG_BLOCKED) == 0) {
+		if (queued < sock->hiwater) return;
+		sock->flags |= ASYNC_CORE_FLAG_BLOCKED;
+		event = ASYNC_CORE_EVT_BLOCKED;
+	}	else {
+		if (queued > sock->lowater && sock->hiwater > 0) return;
+		sock->flags &= ~ASYNC_CORE_FLAG_BLOCKED;
+		event = ASYNC_CORE_EVT_WRITABLE;
+	}
+	iencode32u_lsb(data, (IUINT32)queued);
+	async_core_msg_push(core, event, sock->hid, sock->tag, data, 4);
+}
+
+/*-------------------------------------------------------------------*/
+/* flush send buffer of edge-triggered or coalescing node            */
+/*-------------------------------------------------------------------*/
+static int async_core_node_flush(CAsyncCore *core, CAsyncSock *sock)
+{
+	if (sock->mode == ASYNC_CORE_NODE_KCP) {
+		return async_core_kcp_flush(core, sock);
+	}
+	if (!ASYNC_CORE_PENDING(sock)) return 0;
+	if (async_core_node_send(core, sock) != 0) return -1;
+	if (ASYNC_CORE_PENDING(sock)) {
+		/* socket buffer is full: wait for the next IPOLL_OUT */
+		if (sock->flags & ASYNC_CORE_FLAG_EDGE) {
+			sock->flags |= ASYNC_CORE_FLAG_WBLOCK;
+			async_core_stat_wait(core, sock, 1);
+		}
+		else if ((sock->mask & IPOLL_OUT) == 0) {
+			async_core_node_mask(core, sock, IPOLL_OUT, 0);
+		}
+	}	else {
+		sock->flags &= ~ASYNC_CORE_FLAG_WBLOCK;
+		if (sock->flags & ASYNC_CORE_FLAG_PROGRESS) {
+			async_core_msg_push(core, ASYNC_CORE_EVT_PROGRESS,
+				sock->hid, sock->tag, core->buffer, 0);
+		}
+	}
+	async_core_node_water(core, sock);
+	return 0;
+}
+
 /*-------------------------------------------------------------------*/
 /* new accept                                                        */
 /*-------------------------------------------------------------------*/
@@ -1331,7 +2656,7 @@ static long async_core_accept(CAsyncCore *core, long listen_hid)
 	struct sockaddr_in6 remote6;
 #endif
 	struct sockaddr *remote;
-	long hid, limited, maxsize;
+	long hid, limited, maxsize, hiwater, lowater;
 	int fd = -1;
 	int addrlen = 0;
 	int head = 0;
@@ -1378,6 +2703,8 @@ static long async_core_accept(CAsyncCore *core, long listen_hid)
 	head = sock->header;
 	limited = sock->limited;
 	maxsize = sock->maxsize;
+	hiwater = sock->hiwater;
+	lowater = sock->lowater;
 
 	sock = async_core_node_get(core, hid);
 
@@ -1395,14 +2722,17 @@ static long async_core_accept(CAsyncCore *core, long listen_hid)
 
 	sock->limited = limited;
 	sock->maxsize = maxsize;
+	sock->hiwater = hiwater;
+	sock->lowater = lowater;
 	
-	hr = ipoll_add(core->pfd, fd, IPOLL_IN | IPOLL_ERR, sock);
+	hr = async_core_node_poll(core, sock, IPOLL_IN | IPOLL_ERR);
 	if (hr != 0) {
 		async_core_node_delete(core, hid);
 		return -7;
 	}
 
 	async_core_node_mask(core, sock, IPOLL_IN | IPOLL_ERR, 0);
+	ASYNC_STAT(core->stats.accepts++);
 
 	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
 		listen_hid, remote, addrlen);
@@ -1437,7 +2767,9 @@ static long _async_core_new_connect(CAsyncCore *core,
 		return -2;
 	}
 
-	hr = ipoll_add(core->pfd, sock->fd, IPOLL_OUT | IPOLL_ERR, sock);
+	sock->flags = 0;
+
+	hr = async_core_node_poll(core, sock, IPOLL_OUT | IPOLL_ERR);
 	if (hr != 0) {
 		async_core_node_delete(core, hid);
 		return -3;
@@ -1445,7 +2777,6 @@ static long _async_core_new_connect(CAsyncCore *core,
 
 	async_core_node_mask(core, sock, IPOLL_OUT | IPOLL_IN | IPOLL_ERR, 0);
 	sock->mode = ASYNC_CORE_NODE_OUT;
-	sock->flags = 0;
 
 	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
 		0, addr, addrlen);
@@ -1510,7 +2841,7 @@ static long _async_core_new_assign(CAsyncCore *core, int fd,
 	async_sock_assign(sock, fd, header);
 	sock->ipv6 = ipv6;
 
-	hr = ipoll_add(core->pfd, sock->fd, IPOLL_OUT | IPOLL_ERR, sock);
+	hr = async_core_node_poll(core, sock, IPOLL_OUT | IPOLL_ERR);
 	if (hr != 0) {
 		async_core_node_delete(core, hid);
 		return -3;
@@ -1623,9 +2954,9 @@ static long _async_core_new_listen(CAsyncCore *core,
 	async_core_node_mask(core, sock, IPOLL_IN | IPOLL_ERR, 0);
 	sock->mode = ipv6? ASYNC_CORE_NODE_LISTEN6 : ASYNC_CORE_NODE_LISTEN4;
 
-	if (!iqueue_is_empty(&sock->node)) {
-		iqueue_del(&sock->node);
-		iqueue_init(&sock->node);
+	if (sock->timer >= 0) {
+		async_core_timer_free(core, async_core_timer_get(core, sock->timer));
+		sock->timer = -1;
 	}
 
 	sock->header = header & 0xff;
@@ -1637,6 +2968,19 @@ static long _async_core_new_listen(CAsyncCore *core,
 }
 
 
+/*-------------------------------------------------------------------*/
+/* datagram slots shared by batch dgram and kcp nodes                */
+/*-------------------------------------------------------------------*/
+static int async_core_dgram_alloc(CAsyncCore *core)
+{
+	if (core->dgram == NULL) {
+		core->dgram = (char*)ikmem_malloc((ASYNC_CORE_DGRAM_SLOT + 
+				ASYNC_CORE_DGRAM_OUT) * ASYNC_CORE_MMSG);
+		if (core->dgram == NULL) return -1;
+	}
+	return 0;
+}
+
 /*-------------------------------------------------------------------*/
 /* new dgram fd                                                      */
 /*-------------------------------------------------------------------*/
@@ -1678,6 +3022,15 @@ static long _async_core_new_dgram(CAsyncCore *core,
 	sock->state = ASYNC_SOCK_STATE_ESTAB;
 	sock->header = 0;
 
+	if (mode & ASYNC_CORE_DGRAM_BATCH) {
+		if (async_core_dgram_alloc(core) != 0) {
+			async_core_node_delete(core, hid);
+			return -7;
+		}
+		ienable(sock->fd, ISOCK_NOBLOCK);
+		sock->flags |= ASYNC_CORE_FLAG_BATCH;
+	}
+
 	if (addrlen <= 20) {
 		addrlen = sizeof(struct sockaddr_in);
 		sock->ipv6 = 0;
@@ -1695,9 +3048,9 @@ static long _async_core_new_dgram(CAsyncCore *core,
 		return -6;
 	}
 
-	if (!iqueue_is_empty(&sock->node)) {
-		iqueue_del(&sock->node);
-		iqueue_init(&sock->node);
+	if (sock->timer >= 0) {
+		async_core_timer_free(core, async_core_timer_get(core, sock->timer));
+		sock->timer = -1;
 	}
 
 	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
@@ -1759,679 +3112,2510 @@ long async_core_new_dgram(CAsyncCore *core,
 	return hr;
 }
 
+
 /*-------------------------------------------------------------------*/
-/* process close                                                     */
+/* update dgram poll mask: IPOLL_OUT is armed while datagrams queue  */
 /*-------------------------------------------------------------------*/
-static void async_core_event_close(CAsyncCore *core, 
-	CAsyncSock *sock, int code)
+static int async_core_dgram_poll(CAsyncCore *core, CAsyncSock *sock)
 {
-	IUINT32 data[2];
-	data[0] = sock->error;
-	data[1] = code;
-	if (sock->fd >= 0) {
-		ipoll_del(core->pfd, sock->fd);
-	}
-	async_sock_close(sock);
-	async_core_msg_push(core, ASYNC_CORE_EVT_LEAVE, sock->hid,
-		sock->tag, data, sizeof(IUINT32) * 2);
-	async_core_node_delete(core, sock->hid);
+	int mask = sock->mask;
+	if (sock->flags & ASYNC_CORE_FLAG_WBLOCK) mask |= IPOLL_OUT;
+	return ipoll_set(core->pfd, sock->fd, mask);
 }
 
+
 /*-------------------------------------------------------------------*/
-/* wait for events for millisec ms. and process events,              */
-/* if millisec equals zero, no wait.                                 */
+/* send queued datagrams with sendmmsg                               */
 /*-------------------------------------------------------------------*/
-static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
+static void async_core_dgram_flush(CAsyncCore *core, CAsyncSock *sock)
 {
-	int fd, event, x, count, xf, code = 2010;
-	void *udata;
-	IUINT64 ts;
-	IUINT32 now;
+	CAsyncDgram *items[ASYNC_CORE_MMSG];
+	struct IDGRAMV vec[ASYNC_CORE_MMSG];
+	int blocked = 0;
+	while (!iqueue_is_empty(&sock->dgrams) && sock->fd >= 0) {
+		struct IQUEUEHEAD *it = sock->dgrams.next;
+		int count = 0;
+		int hr, i;
+		for (; it != &sock->dgrams && count < ASYNC_CORE_MMSG; it = it->next)
+			items[count++] = iqueue_entry(it, CAsyncDgram, head);
+		for (i = 0; i < count; i++) {
+			vec[i].data = (char*)(items[i] + 1);
+			vec[i].size = items[i]->size;
+			vec[i].addr = (items[i]->addrlen > 0)? 
+				(struct sockaddr*)items[i]->addr : NULL;
+			vec[i].addrlen = items[i]->addrlen;
+		}
+		hr = isendmm(sock->fd, vec, count, 0);
+		if (hr < 0) {
+			int code = ierrno();
+			if (code == IEAGAIN || code == 0) {
+				blocked = 1;
+				break;
+			}
+			hr = 1;		/* drop the datagram which can not be sent */
+		}
+		if (hr == 0) {
+			blocked = 1;
+			break;
+		}
+		for (i = 0; i < hr; i++) {
+			iqueue_del(&items[i]->head);
+			ikmem_free(items[i]);
+		}
+		sock->dgram_count -= hr;
+	}
+	if (blocked && (sock->flags & ASYNC_CORE_FLAG_WBLOCK) == 0) {
+		sock->flags |= ASYNC_CORE_FLAG_WBLOCK;
+		async_core_dgram_poll(core, sock);
+	}
+	else if (!blocked && (sock->flags & ASYNC_CORE_FLAG_WBLOCK)) {
+		sock->flags &= ~ASYNC_CORE_FLAG_WBLOCK;
+		async_core_dgram_poll(core, sock);
+	}
+}
 
-	count = ipoll_wait(core->pfd, millisec);
-
-	ts = iclock64();
-	core->current = (IUINT32)(ts & 0xfffffffful);
-	now = (IUINT32)((ts / 1000) & 0xfffffffful);
 
-	xf = core->xfd[ASYNC_CORE_PIPE_READ];
-
-	for (x = count * 2; x > 0; x--) {
-		CAsyncSock *sock;
-		int needclose = 0;
-		if (ipoll_event(core->pfd, &fd, &event, &udata) != 0) {
-			break;
-		}
-		if (fd == xf && fd >= 0) {
-			if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
-				char dummy[10];
-				async_core_monitor++;
-				IMUTEX_LOCK(&core->xmtx);
-			#ifdef __unix
-				read(fd, dummy, 8);
-			#else
-				irecv(fd, dummy, 8, 0);
-			#endif
-				core->xfd[ASYNC_CORE_PIPE_FLAG] = 0;
-				IMUTEX_UNLOCK(&core->xmtx);
-				async_core_monitor--;
-			}
-			continue;
-		}
-		sock = (CAsyncSock*)udata;
-		if (sock == NULL || fd != sock->fd) {
-			assert(sock && fd == sock->fd);
-			abort();
-		}
-		if (sock->mode == ASYNC_CORE_NODE_DGRAM) {
-			char body[8];
-			int evt = event & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
-			iencode32u_lsb(body, (long)sock->fd);
-			iencode16u_lsb(body + 4, (short)evt);
-			iencode16u_lsb(body + 6, sock->ipv6? 1 : 0);
-			async_core_msg_push(core, ASYNC_CORE_EVT_DGRAM, 
-					sock->hid, sock->tag, body, 8);
-			continue;
-		}
-		if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
-			if (sock->mode == ASYNC_CORE_NODE_LISTEN4 ||
-				sock->mode == ASYNC_CORE_NODE_LISTEN6) {
-				async_core_accept(core, sock->hid);
-			}	
-			else {
-				if (async_sock_update(sock, 1) != 0) {
-					needclose = 1;
-					code = 0;
-				}
-				if (sock->mode == ASYNC_CORE_NODE_OUT) {
-					if (sock->state == ASYNC_SOCK_STATE_CONNECTING) {
-						if ((event & IPOLL_ERR) && needclose == 0) {
-							needclose = 1;
-							code = 2000;
-						}
-					}
-				}
-				if (needclose == 0) {
-					async_core_node_active(core, sock->hid);
-				}
-				while (needclose == 0) {
-					long size = async_sock_recv(sock, NULL, 0);
-					if (size < 0) {	/* not enough data or size error */
-						if (size == -3 || size == -4) {	/* size error */
-							needclose = 1;
-							code = (size == -3)? 2001 : 2002;
-						}
-						break;
-					}
-					else if (size > core->bufsize) {	/* buffer resize */
-						if (async_core_buffer_resize(core, size) != 0) {
-							needclose = 1;
-							code = 2003;
-							break;
-						}
-					}
-					size = async_sock_recv(sock, core->buffer,
-						core->bufsize);
-					async_core_msg_push(core, ASYNC_CORE_EVT_DATA,
-						sock->hid, sock->tag, core->buffer, size);
-				}
-			}
-		}
-		if ((event & IPOLL_OUT) && needclose == 0) {
-			if (sock->mode == ASYNC_CORE_NODE_OUT) {
-				if (sock->state == ASYNC_SOCK_STATE_CONNECTING) {
-					int hr = 0, done = 0;
-					int error = 0, len = sizeof(int);
-					hr = igetsockopt(sock->fd, SOL_SOCKET, SO_ERROR, 
-						(char*)&error, &len);
-					if (hr < 0 || (hr == 0 && error != 0)) {
-						done = 0;
-					}	else {
-						done = 1;
-					}
-					if (done) {
-						sock->state = ASYNC_SOCK_STATE_ESTAB;
-						async_core_msg_push(core, ASYNC_CORE_EVT_ESTAB, 
-							sock->hid, sock->tag, "", 0);
-						async_core_node_mask(core, sock, 
-							IPOLL_IN | IPOLL_ERR, 0);
-					}	else {
-						needclose = 1;
-						code = 2004;
-					}
-				}
-			}
-			if (sock->sendmsg.size > 0 && needclose == 0) {
-				if (async_sock_update(sock, 2) != 0) {
-					needclose = 1;
-					code = 2005;
-				}
-			}
-			if (sock->sendmsg.size == 0 && sock->fd >= 0 && !needclose) {
-				if (sock->mask & IPOLL_OUT) {
-					async_core_node_mask(core, sock, 0, IPOLL_OUT);
-					if (sock->flags & ASYNC_CORE_FLAG_PROGRESS) {
-						async_core_msg_push(core, ASYNC_CORE_EVT_PROGRESS,
-							sock->hid, sock->tag, core->buffer, 0);
-					}
-				}
-			}
-		}
-		if (sock->state == ASYNC_SOCK_STATE_CLOSED || needclose) {
-			async_core_event_close(core, sock, code);
+/*-------------------------------------------------------------------*/
+/* drain datagrams with recvmmsg into ASYNC_CORE_EVT_DATAGRAM        */
+/*-------------------------------------------------------------------*/
+static void async_core_dgram_recv(CAsyncCore *core, CAsyncSock *sock)
+{
+	struct IDGRAMV vec[ASYNC_CORE_MMSG];
+	IUINT32 addrs[ASYNC_CORE_MMSG][8];
+	int round, count, i;
+	if (core->dgram == NULL) return;
+	/* bounded: level-triggered polling reports what is left */
+	for (round = 0; round < ASYNC_CORE_MMSG_ROUNDS; round++) {
+		for (i = 0; i < ASYNC_CORE_MMSG; i++) {
+			vec[i].data = core->dgram + ASYNC_CORE_DGRAM_SLOT * i + 
+				ASYNC_CORE_DGRAM_HEAD;
+			vec[i].size = ASYNC_CORE_DGRAM_MAX;
+			vec[i].addr = (struct sockaddr*)addrs[i];
+			vec[i].addrlen = (int)sizeof(addrs[i]);
 		}
-	}
-
-	if (now != core->lastsec && core->timeout > 0) {
-		CAsyncSock *sock;
-		core->lastsec = now;
-		while (!iqueue_is_empty(&core->head)) {
-			IINT32 timeout;
-			sock = iqueue_entry(core->head.next, CAsyncSock, node);
-			timeout = itimediff(core->current, sock->time + core->timeout);
-			if (timeout < 0) break;
-			async_core_event_close(core, sock, 2006);
+		count = irecvmm(sock->fd, vec, ASYNC_CORE_MMSG, 0);
+		if (count <= 0) break;
+		for (i = 0; i < count; i++) {
+			int addrlen = vec[i].addrlen;
+			char *head;
+			if (addrlen < 0) addrlen = 0;
+			if (addrlen > (int)sizeof(addrs[i])) 
+				addrlen = (int)sizeof(addrs[i]);
+			/* addrlen and sockaddr go right before the payload */
+			head = (char*)vec[i].data - addrlen - 2;
+			iencode16u_lsb(head, (unsigned short)addrlen);
+			memcpy(head + 2, addrs[i], addrlen);
+			async_core_msg_push(core, ASYNC_CORE_EVT_DATAGRAM, 
+				sock->hid, sock->tag, head, vec[i].size + addrlen + 2);
 		}
+		if (count < ASYNC_CORE_MMSG) break;
 	}
 }
 
 
 /*-------------------------------------------------------------------*/
-/* send vector                                                       */
+/* send datagrams, queue what the kernel refuses                     */
 /*-------------------------------------------------------------------*/
-static long _async_core_send_vector(CAsyncCore *core, long hid,
-	const void * const vecptr[],
-	const long veclen[], int count, int mask)
+static long _async_core_sendto_batch(CAsyncCore *core, long hid,
+	const void * const vecptr[], const long veclen[],
+	const struct sockaddr * const addrs[], const int addrlens[], 
+	int count)
 {
 	CAsyncSock *sock = async_core_node_get(core, hid);
-	long hr;
+	struct IDGRAMV vec[ASYNC_CORE_MMSG];
+	long accepted = 0;
 	if (sock == NULL) return -100;
-	if (sock->limited > 0 && sock->sendmsg.size > (iulong)sock->limited) {
-		if ((sock->flags & ASYNC_CORE_FLAG_SENSITIVE) == 0) {
-			async_sock_update(sock, 2);
+	if (sock->mode != ASYNC_CORE_NODE_DGRAM || sock->fd < 0) return -200;
+	/* nothing queued: send straight from the caller's buffers */
+	while (iqueue_is_empty(&sock->dgrams) && accepted < count) {
+		int n = count - (int)accepted;
+		int hr, i;
+		if (n > ASYNC_CORE_MMSG) n = ASYNC_CORE_MMSG;
+		for (i = 0; i < n; i++) {
+			int k = (int)accepted + i;
+			vec[i].data = (void*)vecptr[k];
+			vec[i].size = veclen[k];
+			vec[i].addr = (addrs)? (struct sockaddr*)addrs[k] : NULL;
+			vec[i].addrlen = (addrs && addrs[k])? addrlens[k] : 0;
 		}
-		if (sock->sendmsg.size > (iulong)sock->limited) {
-			async_core_event_close(core, sock, 2007);
-			return -200;
+		hr = isendmm(sock->fd, vec, n, 0);
+		if (hr < 0) {
+			int code = ierrno();
+			if (code == IEAGAIN || code == 0) break;
+			hr = 1;		/* drop the datagram which can not be sent */
 		}
+		if (hr == 0) break;
+		accepted += hr;
 	}
-	hr = async_sock_send_vector(sock, vecptr, veclen, count, mask);
-	if (sock->sendmsg.size > 0 && sock->fd >= 0) {
-		if ((sock->mask & IPOLL_OUT) == 0) {
-			async_core_node_mask(core, sock, 
-				IPOLL_OUT, 0);
-		}
+	for (; accepted < count; accepted++) {
+		const struct sockaddr *addr = (addrs)? addrs[accepted] : NULL;
+		int addrlen = (addr)? addrlens[accepted] : 0;
+		long size = veclen[accepted];
+		CAsyncDgram *dgram;
+		if (addrlen < 0 || addrlen > (int)sizeof(dgram->addr)) break;
+		if (sock->dgram_count >= ASYNC_CORE_DGRAM_QUEUE) break;
+		dgram = (CAsyncDgram*)ikmem_malloc(sizeof(CAsyncDgram) + size);
+		if (dgram == NULL) break;
+		dgram->size = size;
+		dgram->addrlen = addrlen;
+		if (addrlen > 0) memcpy(dgram->addr, addr, addrlen);
+		memcpy(dgram + 1, vecptr[accepted], size);
+		iqueue_add_tail(&dgram->head, &sock->dgrams);
+		sock->dgram_count++;
 	}
-	return hr;
+	if (!iqueue_is_empty(&sock->dgrams) && 
+		(sock->flags & ASYNC_CORE_FLAG_WBLOCK) == 0) {
+		sock->flags |= ASYNC_CORE_FLAG_WBLOCK;
+		async_core_dgram_poll(core, sock);
+	}
+	return accepted;
 }
 
+
 /*-------------------------------------------------------------------*/
-/* send vector                                                       */
+/* thread safe                                                       */
 /*-------------------------------------------------------------------*/
-long async_core_send_vector(CAsyncCore *core, long hid,
-	const void * const vecptr[],
-	const long veclen[], int count, int mask)
+long async_core_sendto_batch(CAsyncCore *core, long hid,
+	const void * const vecptr[], const long veclen[],
+	const struct sockaddr * const addrs[], const int addrlens[], 
+	int count)
 {
-	long hr = -1;
+	long hr;
 	ASYNC_CORE_CRITICAL_BEGIN(core);
-	hr = _async_core_send_vector(core, hid, vecptr, veclen, count, mask);
+	hr = _async_core_sendto_batch(core, hid, vecptr, veclen, addrs,
+			addrlens, count);
 	ASYNC_CORE_CRITICAL_END(core);
 	return hr;
 }
 
+
 /*-------------------------------------------------------------------*/
-/* send data to given hid                                            */
+/* kcp: send datagrams collected by async_core_kcp_output            */
 /*-------------------------------------------------------------------*/
-long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len)
+static void async_core_kcp_commit(CAsyncCore *core, CAsyncKcp *ks)
 {
-	const void *vecptr[1];
-	long veclen[1];
-	long hr;
-	vecptr[0] = ptr;
-	veclen[0] = len;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	hr = _async_core_send_vector(core, hid, vecptr, veclen, 1, 0);
-	ASYNC_CORE_CRITICAL_END(core);
-	return hr;
+	struct IDGRAMV vec[ASYNC_CORE_MMSG];
+	int count = core->dgramout;
+	int pos = 0, i;
+	core->dgramout = 0;
+	for (i = 0; i < count; i++) {
+		char *slot = ASYNC_CORE_DGRAM_OUTPUT(core, i);
+		IUINT32 size;
+		idecode32u_lsb(slot, &size);
+		vec[i].data = slot + 4;
+		vec[i].size = (long)size;
+		vec[i].addr = (ks->addrlen > 0)? (struct sockaddr*)ks->remote : NULL;
+		vec[i].addrlen = ks->addrlen;
+	}
+	while (pos < count && ks->fd >= 0) {
+		int hr = isendmm(ks->fd, vec + pos, count - pos, 0);
+		if (hr <= 0) {
+			int code = ierrno();
+			if (code == IEAGAIN || code == 0) break;
+			hr = 1;		/* kcp retransmits what is dropped here */
+		}
+		pos += hr;
+	}
 }
 
 /*-------------------------------------------------------------------*/
-/* close given hid                                                   */
+/* kcp: output callback, packets are batched into one sendmmsg       */
 /*-------------------------------------------------------------------*/
-int async_core_close(CAsyncCore *core, long hid, int code)
+static int async_core_kcp_output(const char *buf, int len, 
+	ikcpcb *kcp, void *user)
 {
-	CAsyncSock *sock;
-	int hr = -1;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get(core, hid);
-	if (sock != NULL) {
-		if (sock->sendmsg.size > 0) {
-			async_sock_update(sock, 2);
-		}
-		async_core_event_close(core, sock, code);
-		hr = 0;
+	CAsyncKcp *ks = (CAsyncKcp*)user;
+	CAsyncCore *core = ks->core;
+	char *slot;
+	(void)kcp;
+	if (ks->fd < 0) return -1;
+	if (core->dgram == NULL || len + 4 > ASYNC_CORE_DGRAM_OUT) {
+		isendto(ks->fd, buf, len, 0, (ks->addrlen > 0)? 
+			(const struct sockaddr*)ks->remote : NULL, ks->addrlen);
+		return 0;
 	}
-	ASYNC_CORE_CRITICAL_END(core);
-	return hr;
+	if (core->dgramout >= ASYNC_CORE_MMSG) {
+		async_core_kcp_commit(core, ks);
+	}
+	slot = ASYNC_CORE_DGRAM_OUTPUT(core, core->dgramout);
+	iencode32u_lsb(slot, (IUINT32)len);
+	memcpy(slot + 4, buf, len);
+	core->dgramout++;
+	return 0;
 }
 
-
 /*-------------------------------------------------------------------*/
-/* wait for events for millisec ms. and process events,              */
-/* if millisec equals zero, no wait.                                 */
+/* kcp: apply nodelay / window / mtu settings, negative keeps        */
 /*-------------------------------------------------------------------*/
-void async_core_wait(CAsyncCore *core, IUINT32 millisec)
+static void async_core_kcp_apply(CAsyncKcp *ks, const int *config)
 {
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	if (core->count > 0 || core->xfd[0] >= 0) {
-		async_core_process_events(core, millisec);
-	}	else {
-		if (millisec > 0) {
-			isleep(millisec);
-		}
-	}
-	ASYNC_CORE_CRITICAL_END(core);
+	ikcpcb *kcp = ks->kcp;
+	if (config[0] >= 0 || config[1] >= 0 || config[2] >= 0 || config[3] >= 0)
+		ikcp_nodelay(kcp, config[0], config[1], config[2], config[3]);
+	if (config[4] > 0 || config[5] > 0) 
+		ikcp_wndsize(kcp, config[4], config[5]);
+	if (config[6] > 0) 
+		ikcp_setmtu(kcp, config[6]);
 }
 
 /*-------------------------------------------------------------------*/
-/* old interface compatible                                          */
+/* kcp: attach session or demux state to a node                      */
 /*-------------------------------------------------------------------*/
-void async_core_process(CAsyncCore *core, IUINT32 millisec)
+static int async_core_kcp_attach(CAsyncCore *core, CAsyncSock *sock,
+	CAsyncSock *owner, IUINT32 conv)
 {
-	async_core_wait(core, millisec);
+	CAsyncKcp *ks;
+	CAsyncTimer *timer;
+	int i;
+	if (async_core_dgram_alloc(core) != 0) return -1;
+	ks = (CAsyncKcp*)ikmem_malloc(sizeof(CAsyncKcp));
+	if (ks == NULL) return -2;
+	ks->core = core;
+	ks->kcp = NULL;
+	ks->convs = NULL;
+	ks->owner = (owner)? owner->hid : sock->hid;
+	ks->timer = -1;
+	ks->fd = (owner)? owner->fd : sock->fd;
+	ks->addrlen = 0;
+	ks->conv = conv;
+	for (i = 0; i < 7; i++) {
+		ks->config[i] = (owner)? owner->kcp->config[i] : -1;
+	}
+	if (sock->mode == ASYNC_CORE_NODE_KCPLISTEN) {
+		ks->convs = idict_create();
+		if (ks->convs == NULL) {
+			ikmem_free(ks);
+			return -3;
+		}
+		sock->kcp = ks;
+		return 0;
+	}
+	ks->kcp = ikcp_create(conv, ks);
+	if (ks->kcp == NULL) {
+		ikmem_free(ks);
+		return -4;
+	}
+	ks->kcp->output = async_core_kcp_output;
+	ks->timer = async_core_timer_new(core, ASYNC_TIMER_KCP, 0, sock->hid);
+	if (ks->timer < 0) {
+		ikcp_release(ks->kcp);
+		ikmem_free(ks);
+		return -5;
+	}
+	async_core_kcp_apply(ks, ks->config);
+	sock->kcp = ks;
+	ikcp_update(ks->kcp, core->current);
+	timer = async_core_timer_get(core, ks->timer);
+	async_core_timer_start(core, timer, ikcp_check(ks->kcp, core->current));
+	return 0;
 }
 
 /*-------------------------------------------------------------------*/
-/* wake-up async_core_wait                                           */
+/* kcp: release node state, called by async_core_node_delete         */
 /*-------------------------------------------------------------------*/
-int async_core_notify(CAsyncCore *core)
+static void async_core_kcp_free(CAsyncCore *core, CAsyncSock *sock)
 {
-	int fd;
-	int hr = -1;
-	IMUTEX_LOCK(&core->xmtx);
-	fd = core->xfd[ASYNC_CORE_PIPE_WRITE];
-	if (core->xfd[ASYNC_CORE_PIPE_FLAG] == 0) {
-		if (fd >= 0) {
-			char dummy = 1;
-			int hr = 0;
-		#ifdef __unix
-			#ifndef __AVM2__
-			hr = write(fd, &dummy, 1);
-			#else
-			dummy = dummy + 1;
-			#endif
-		#else
-			hr = send(fd, &dummy, 1, 0);
-		#endif
-			if (hr == 1) {
-				core->xfd[ASYNC_CORE_PIPE_FLAG] = 1;
-				hr = 0;
+	CAsyncKcp *ks = sock->kcp;
+	sock->kcp = NULL;
+	if (ks->kcp) {
+		CAsyncSock *owner = async_core_node_get(core, ks->owner);
+		ilong hid;
+		if (owner != NULL && owner != sock && owner->kcp && 
+			owner->kcp->convs) {
+			if (idict_search_ii(owner->kcp->convs, ks->conv, &hid) == 0 &&
+				hid == sock->hid) {
+				idict_del_i(owner->kcp->convs, ks->conv);
 			}
 		}
-	}	else {
-		hr = 1;
+		ikcp_release(ks->kcp);
+		ks->kcp = NULL;
 	}
-	IMUTEX_UNLOCK(&core->xmtx);
-	return hr;
+	if (ks->timer >= 0) {
+		async_core_timer_free(core, async_core_timer_get(core, ks->timer));
+		ks->timer = -1;
+	}
+	if (ks->convs) {
+		idict_delete(ks->convs);
+		ks->convs = NULL;
+	}
+	ikmem_free(ks);
 }
 
-
 /*-------------------------------------------------------------------*/
-/* get message                                                       */
+/* kcp: close every session of a closing listener                    */
 /*-------------------------------------------------------------------*/
-long async_core_read(CAsyncCore *core, int *event, long *wparam,
-	long *lparam, void *data, long size)
+static void async_core_kcp_shutdown(CAsyncCore *core, CAsyncSock *sock)
 {
-	return async_core_msg_read(core, event, wparam, lparam, data, size);
+	idict_t *convs = (sock->kcp)? sock->kcp->convs : NULL;
+	if (convs == NULL) return;
+	while (1) {
+		ilong pos = idict_pos_head(convs);
+		CAsyncSock *session;
+		if (pos < 0) break;
+		session = async_core_node_get(core, 
+			(long)it_int(idict_pos_get_val(convs, pos)));
+		if (session == NULL) {
+			idict_pos_delete(convs, pos);
+			continue;
+		}
+		/* removes itself from convs in async_core_kcp_free */
+		async_core_event_close(core, session, 2009);
+	}
 }
 
-
 /*-------------------------------------------------------------------*/
-/* push message to msg queue                                         */
+/* kcp: flush pending acks and data now, returns -1 for dead link    */
 /*-------------------------------------------------------------------*/
-int async_core_push(CAsyncCore *core, int event, long wparam, long lparam, 
-	const char *data, long size)
+static int async_core_kcp_flush(CAsyncCore *core, CAsyncSock *sock)
 {
-	async_core_msg_push(core, event, wparam, lparam, data, size);
+	CAsyncKcp *ks = sock->kcp;
+	CAsyncTimer *timer;
+	if (ks == NULL || ks->kcp == NULL) return 0;
+	ks->kcp->current = core->current;
+	ikcp_flush(ks->kcp);
+	async_core_kcp_commit(core, ks);
+	if (ks->kcp->state == (IUINT32)-1) return -1;
+	timer = async_core_timer_get(core, ks->timer);
+	if (timer != NULL) {
+		async_core_timer_start(core, timer, 
+			ikcp_check(ks->kcp, core->current));
+	}
 	return 0;
 }
 
-
 /*-------------------------------------------------------------------*/
-/* queue an ASYNC_CORE_EVT_PUSH event and wake async_core_wait up    */
+/* kcp: session timer, scheduled by ikcp_check                       */
 /*-------------------------------------------------------------------*/
-int async_core_post(CAsyncCore *core, long wparam, long lparam, 
-	const char *data, long size)
+static void async_core_kcp_update(CAsyncCore *core, CAsyncSock *sock)
 {
-	async_core_push(core, ASYNC_CORE_EVT_PUSH, wparam, lparam, data, size);
-	async_core_notify(core);
+	CAsyncKcp *ks = sock->kcp;
+	CAsyncTimer *timer;
+	ikcp_update(ks->kcp, core->current);
+	async_core_kcp_commit(core, ks);
+	if (ks->kcp->state == (IUINT32)-1) {
+		async_core_event_close(core, sock, 2008);
+		return;
+	}
+	timer = async_core_timer_get(core, ks->timer);
+	if (timer != NULL) {
+		async_core_timer_start(core, timer, 
+			ikcp_check(ks->kcp, core->current));
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* kcp: queue session for async_core_kcp_flush                       */
+/*-------------------------------------------------------------------*/
+static void async_core_kcp_dirty(CAsyncCore *core, CAsyncSock *sock)
+{
+	if (iqueue_is_empty(&sock->dirty)) {
+		iqueue_add_tail(&sock->dirty, &core->dirty);
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* kcp: deliver received messages as ASYNC_CORE_EVT_DATA             */
+/*-------------------------------------------------------------------*/
+static int async_core_kcp_deliver(CAsyncCore *core, CAsyncSock *sock)
+{
+	ikcpcb *kcp = sock->kcp->kcp;
+	while (1) {
+		int size = ikcp_peeksize(kcp);
+		if (size < 0) break;
+		if (size > sock->maxsize) return 2002;
+		if (size > core->bufsize) {
+			if (async_core_buffer_resize(core, size) != 0) return 2003;
+		}
+		size = ikcp_recv(kcp, core->buffer, (int)core->bufsize);
+		if (size < 0) break;
+		async_core_msg_push(core, ASYNC_CORE_EVT_DATA, sock->hid, 
+			sock->tag, core->buffer, size);
+	}
 	return 0;
 }
 
+/*-------------------------------------------------------------------*/
+/* kcp: new session from a listener for an unknown conv              */
+/*-------------------------------------------------------------------*/
+static CAsyncSock* async_core_kcp_accept(CAsyncCore *core, 
+	CAsyncSock *listener, IUINT32 conv, const char *data, long size,
+	const struct sockaddr *remote, int addrlen)
+{
+	CAsyncSock *sock;
+	long hid;
+	if (core->validator) {
+		void *user = core->user;
+		if (core->validator(remote, addrlen, core, listener->hid, 
+			user) == 0) {
+			return NULL;
+		}
+	}
+	hid = async_core_node_new(core);
+	if (hid < 0) return NULL;
+	sock = async_core_node_get(core, hid);
+	sock->fd = -1;
+	sock->mode = ASYNC_CORE_NODE_KCP;
+	sock->state = ASYNC_SOCK_STATE_ESTAB;
+	sock->ipv6 = listener->ipv6;
+	sock->header = 0;
+	sock->hiwater = listener->hiwater;
+	sock->lowater = listener->lowater;
+	if (async_core_kcp_attach(core, sock, listener, conv) != 0) {
+		async_core_node_delete(core, hid);
+		return NULL;
+	}
+	sock->kcp->addrlen = addrlen;
+	memcpy(sock->kcp->remote, remote, addrlen);
+	/* only a well-formed packet opens a session */
+	if (ikcp_input(sock->kcp->kcp, data, size) < 0) {
+		async_core_node_delete(core, hid);
+		return NULL;
+	}
+	idict_add_ii(listener->kcp->convs, (ilong)conv, hid);
+	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 
+		listener->hid, remote, addrlen);
+	return sock;
+}
+
+/*-------------------------------------------------------------------*/
+/* kcp: route one udp packet to its session                          */
+/*-------------------------------------------------------------------*/
+static void async_core_kcp_input(CAsyncCore *core, CAsyncSock *owner,
+	const char *data, long size, const struct sockaddr *remote, 
+	int addrlen)
+{
+	CAsyncSock *sock = NULL;
+	IUINT32 conv;
+	int rebind = 0;
+	int code;
+	if (size < ASYNC_KCP_OVERHEAD) return;
+	idecode32u_lsb(data, &conv);
+	if (owner->mode == ASYNC_CORE_NODE_KCP) {
+		if (conv != owner->kcp->conv) return;
+		sock = owner;
+	}	else {
+		ilong hid;
+		if (addrlen <= 0 || addrlen > (int)sizeof(owner->kcp->remote)) 
+			return;
+		if (idict_search_ii(owner->kcp->convs, (ilong)conv, &hid) != 0) {
+			sock = async_core_kcp_accept(core, owner, conv, data, size,
+				remote, addrlen);
+			if (sock == NULL) return;
+			size = 0;
+		}	else {
+			sock = async_core_node_get(core, (long)hid);
+			if (sock == NULL || sock->kcp == NULL) return;
+			if (sock->kcp->addrlen != addrlen || 
+				memcmp(sock->kcp->remote, remote, addrlen) != 0) {
+				rebind = 1;
+			}
+		}
+	}
+	if (size > 0) {
+		ikcpcb *kcp = sock->kcp->kcp;
+		IUINT32 rcv_nxt = kcp->rcv_nxt;
+		IUINT32 snd_una = kcp->snd_una;
+		kcp->current = core->current;
+		if (ikcp_input(kcp, data, size) < 0) return;
+		/* follow the peer to a new address (nat rebinding) only when
+		 * the packet moved the session forward: a spoofed, stale or 
+		 * replayed datagram can not redirect the output */
+		if (rebind && (kcp->rcv_nxt != rcv_nxt || kcp->snd_una != snd_una)) {
+			sock->kcp->addrlen = addrlen;
+			memcpy(sock->kcp->remote, remote, addrlen);
+		}
+		/* acknowledged segments may bring it under the low watermark */
+		async_core_node_water(core, sock);
+	}
+	async_core_node_active(core, sock->hid);
+	code = async_core_kcp_deliver(core, sock);
+	if (code != 0) {
+		async_core_event_close(core, sock, code);
+		return;
+	}
+	async_core_kcp_dirty(core, sock);
+}
+
+/*-------------------------------------------------------------------*/
+/* kcp: drain the udp socket of a listener or connector              */
+/*-------------------------------------------------------------------*/
+static void async_core_kcp_recv(CAsyncCore *core, CAsyncSock *sock)
+{
+	struct IDGRAMV vec[ASYNC_CORE_MMSG];
+	IUINT32 addrs[ASYNC_CORE_MMSG][8];
+	long hid = sock->hid;
+	int round, count, i;
+	for (round = 0; round < ASYNC_CORE_MMSG_ROUNDS; round++) {
+		for (i = 0; i < ASYNC_CORE_MMSG; i++) {
+			vec[i].data = core->dgram + ASYNC_CORE_DGRAM_SLOT * i + 
+				ASYNC_CORE_DGRAM_HEAD;
+			vec[i].size = ASYNC_CORE_DGRAM_MAX;
+			vec[i].addr = (struct sockaddr*)addrs[i];
+			vec[i].addrlen = (int)sizeof(addrs[i]);
+		}
+		count = irecvmm(sock->fd, vec, ASYNC_CORE_MMSG, 0);
+		if (count <= 0) break;
+		for (i = 0; i < count; i++) {
+			async_core_kcp_input(core, sock, (const char*)vec[i].data,
+				vec[i].size, (const struct sockaddr*)addrs[i], 
+				vec[i].addrlen);
+			/* a connector may be closed by its own input */
+			if (async_core_node_get(core, hid) != sock) return;
+		}
+		if (count < ASYNC_CORE_MMSG) break;
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* kcp: async_core_send on a session                                 */
+/*-------------------------------------------------------------------*/
+static long async_core_kcp_send(CAsyncCore *core, CAsyncSock *sock,
+	const void * const vecptr[], const long veclen[], int count)
+{
+	ikcpcb *kcp = sock->kcp->kcp;
+	const char *ptr;
+	long size = 0;
+	int i;
+	if (sock->limited > 0 && 
+		(long)ikcp_waitsnd(kcp) * (long)kcp->mss > sock->limited) {
+		async_core_event_close(core, sock, 2007);
+		return -200;
+	}
+	for (i = 0; i < count; i++) size += veclen[i];
+	if (count == 1) {
+		ptr = (const char*)vecptr[0];
+	}	else {
+		char *lptr;
+		if (size > core->bufsize) {
+			if (async_core_buffer_resize(core, size) != 0) return -300;
+		}
+		for (lptr = core->buffer, i = 0; i < count; i++) {
+			memcpy(lptr, vecptr[i], veclen[i]);
+			lptr += veclen[i];
+		}
+		ptr = core->buffer;
+	}
+	if (ikcp_send(kcp, ptr, (int)size) < 0) return -400;
+	/* flushed once per async_core_wait, before polling */
+	async_core_kcp_dirty(core, sock);
+	async_core_node_water(core, sock);
+	return size;
+}
+
+/*-------------------------------------------------------------------*/
+/* new kcp listener                                                  */
+/*-------------------------------------------------------------------*/
+static long _async_core_new_kcp_listen(CAsyncCore *core, 
+	const struct sockaddr *addr, int addrlen, int mode)
+{
+	CAsyncSock *sock;
+	long hid;
+	int fd;
+
+	fd = isocket_udp_open(addr, addrlen, (mode >> 8) & 0xff);
+	if (fd < 0) return -1;
+
+	hid = async_core_node_new(core);
+	if (hid < 0) {
+		iclose(fd);
+		return -2;
+	}
+
+	sock = async_core_node_get(core, hid);
+	sock->fd = fd;
+	sock->mode = ASYNC_CORE_NODE_KCPLISTEN;
+	sock->state = ASYNC_SOCK_STATE_ESTAB;
+	sock->ipv6 = (addrlen >= (int)sizeof(struct sockaddr_in6))? 1 : 0;
+	sock->header = 0;
+	ienable(fd, ISOCK_NOBLOCK);
+
+	if (async_core_kcp_attach(core, sock, NULL, 0) != 0) {
+		async_core_node_delete(core, hid);
+		return -3;
+	}
+
+	sock->mask = IPOLL_IN | IPOLL_ERR;
+	if (ipoll_add(core->pfd, fd, sock->mask, sock) != 0) {
+		async_core_node_delete(core, hid);
+		return -4;
+	}
+
+	/* a listener is never idle */
+	if (sock->timer >= 0) {
+		async_core_timer_free(core, async_core_timer_get(core, sock->timer));
+		sock->timer = -1;
+	}
+
+	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, -1, addr, addrlen);
+
+	return hid;
+}
+
+/*-------------------------------------------------------------------*/
+/* new kcp connector                                                 */
+/*-------------------------------------------------------------------*/
+static long _async_core_new_kcp_connect(CAsyncCore *core, 
+	const struct sockaddr *addr, int addrlen, IUINT32 conv)
+{
+	struct sockaddr_in local4;
+#ifdef AF_INET6
+	struct sockaddr_in6 local6;
+#endif
+	const struct sockaddr *local;
+	CAsyncSock *sock;
+	int fd, ipv6 = 0;
+	long hid;
+
+	memset(&local4, 0, sizeof(local4));
+	local4.sin_family = AF_INET;
+	local = (const struct sockaddr*)&local4;
+#ifdef AF_INET6
+	if (addrlen >= (int)sizeof(struct sockaddr_in6)) {
+		memset(&local6, 0, sizeof(local6));
+		local6.sin6_family = AF_INET6;
+		local = (const struct sockaddr*)&local6;
+		ipv6 = 1;
+	}
+#endif
+
+	fd = isocket_udp_open(local, ipv6? addrlen : (int)sizeof(local4), 0);
+	if (fd < 0) return -1;
+
+	if (iconnect(fd, addr, addrlen) != 0) {
+		iclose(fd);
+		return -2;
+	}
+	ienable(fd, ISOCK_NOBLOCK);
+
+	hid = async_core_node_new(core);
+	if (hid < 0) {
+		iclose(fd);
+		return -3;
+	}
+
+	sock = async_core_node_get(core, hid);
+	sock->fd = fd;
+	sock->mode = ASYNC_CORE_NODE_KCP;
+	sock->state = ASYNC_SOCK_STATE_ESTAB;
+	sock->ipv6 = ipv6;
+	sock->header = 0;
+
+	if (async_core_kcp_attach(core, sock, NULL, conv) != 0) {
+		async_core_node_delete(core, hid);
+		return -4;
+	}
+
+	sock->mask = IPOLL_IN | IPOLL_ERR;
+	if (ipoll_add(core->pfd, fd, sock->mask, sock) != 0) {
+		async_core_node_delete(core, hid);
+		return -5;
+	}
+
+	async_core_msg_push(core, ASYNC_CORE_EVT_NEW, hid, 0, addr, addrlen);
+	async_core_msg_push(core, ASYNC_CORE_EVT_ESTAB, hid, sock->tag, "", 0);
+
+	return hid;
+}
+
+/*-------------------------------------------------------------------*/
+/* thread safe                                                       */
+/*-------------------------------------------------------------------*/
+long async_core_new_kcp_listen(CAsyncCore *core, 
+	const struct sockaddr *addr, int addrlen, int mode)
+{
+	long hr;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_new_kcp_listen(core, addr, addrlen, mode);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* thread safe                                                       */
+/*-------------------------------------------------------------------*/
+long async_core_new_kcp_connect(CAsyncCore *core, 
+	const struct sockaddr *addr, int addrlen, IUINT32 conv)
+{
+	long hr;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_new_kcp_connect(core, addr, addrlen, conv);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* kcp settings, on a listener they apply to sessions created later  */
+/*-------------------------------------------------------------------*/
+static int async_core_kcp_config(CAsyncCore *core, long hid, 
+	int index, const int *values, int count)
+{
+	CAsyncSock *sock;
+	int hr = -1, i;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL && sock->kcp != NULL) {
+		int config[7];
+		for (i = 0; i < 7; i++) config[i] = -1;
+		for (i = 0; i < count; i++) {
+			config[index + i] = values[i];
+			if (values[i] >= 0) sock->kcp->config[index + i] = values[i];
+		}
+		if (sock->kcp->kcp) {
+			async_core_kcp_apply(sock->kcp, config);
+		}
+		hr = 0;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+int async_core_kcp_nodelay(CAsyncCore *core, long hid, int nodelay, 
+	int interval, int resend, int nc)
+{
+	int values[4];
+	values[0] = nodelay;
+	values[1] = interval;
+	values[2] = resend;
+	values[3] = nc;
+	return async_core_kcp_config(core, hid, 0, values, 4);
+}
+
+int async_core_kcp_window(CAsyncCore *core, long hid, int sndwnd,
+	int rcvwnd, int mtu)
+{
+	int values[3];
+	values[0] = sndwnd;
+	values[1] = rcvwnd;
+	values[2] = mtu;
+	return async_core_kcp_config(core, hid, 4, values, 3);
+}
+
+/*-------------------------------------------------------------------*/
+/* process close                                                     */
+/*-------------------------------------------------------------------*/
+static void async_core_event_close(CAsyncCore *core, 
+	CAsyncSock *sock, int code)
+{
+	IUINT32 data[2];
+	if (sock->mode == ASYNC_CORE_NODE_KCPLISTEN) {
+		async_core_kcp_shutdown(core, sock);
+	}
+	data[0] = sock->error;
+	data[1] = code;
+	if (sock->fd >= 0) {
+		ipoll_del(core->pfd, sock->fd);
+	}
+	async_core_bulk_clear(core, sock, 1);
+	async_sock_close(sock);
+	async_core_msg_push(core, ASYNC_CORE_EVT_LEAVE, sock->hid,
+		sock->tag, data, sizeof(IUINT32) * 2);
+	async_core_node_delete(core, sock->hid);
+}
+
+/*-------------------------------------------------------------------*/
+/* flush nodes queued in core->dirty                                 */
+/*-------------------------------------------------------------------*/
+static void async_core_dirty_flush(CAsyncCore *core)
+{
+	while (!iqueue_is_empty(&core->dirty)) {
+		CAsyncSock *sock = iqueue_entry(core->dirty.next, CAsyncSock, dirty);
+		iqueue_del(&sock->dirty);
+		iqueue_init(&sock->dirty);
+		if (async_core_node_flush(core, sock) != 0) {
+			async_core_event_close(core, sock, 
+				(sock->mode == ASYNC_CORE_NODE_KCP)? 2008 : 2005);
+		}
+	}
+}
+
+/*-------------------------------------------------------------------*/
+/* wait for events for millisec ms. and process events,              */
+/* if millisec equals zero, no wait.                                 */
+/*-------------------------------------------------------------------*/
+typedef struct
+{
+	IINT64 mark;				/* start of the current segment */
+	long hid;					/* its owner, -2 for none */
+	long top;					/* most expensive owner */
+	IINT64 cost;
+}	CAsyncTrace;
+
+/* close the running segment and open one owned by hid */
+static void async_core_trace_mark(CAsyncTrace *trace, long hid)
+{
+	IINT64 now = iclockrt();
+	if (trace->hid != -2 && now - trace->mark > trace->cost) {
+		trace->cost = now - trace->mark;
+		trace->top = trace->hid;
+	}
+	trace->mark = now;
+	trace->hid = hid;
+}
+
+static void async_core_process_events(CAsyncCore *core, IUINT32 millisec)
+{
+	struct ipoll_result results[ASYNC_CORE_EVENTS];
+	int fd, event, x, i, n, count, xf, code = 2010;
+	void *udata;
+	IUINT64 ts;
+	IUINT32 wait;
+#ifndef ASYNC_CORE_NO_STATS
+	IINT64 t0 = iclockrt(), t1, t2, elapsed;
+	CAsyncTrace trace;
+	trace.hid = -2;
+	trace.top = -1;
+	trace.cost = 0;
+#endif
+
+	async_core_dirty_flush(core);
+
+	/* lingering zerocopy pages are polled, not waited for */
+	if (!iqueue_is_empty(&core->linger) && 
+		millisec > ASYNC_CORE_LINGER_POLL) {
+		millisec = ASYNC_CORE_LINGER_POLL;
+	}
+
+	/* don't sleep past the nearest timer */
+	if (core->tcount > 0 && millisec > 0) {
+		IUINT32 current = iclock();
+		wait = async_core_timer_next(core, millisec) + 
+			(core->jiffies - current);
+		if ((IINT32)wait < 0) wait = 0;
+		if (wait < millisec) millisec = wait;
+	}
+
+#ifndef ASYNC_CORE_NO_STATS
+	t1 = iclockrt();
+#endif
+
+	count = ipoll_wait(core->pfd, millisec);
+
+#ifndef ASYNC_CORE_NO_STATS
+	t2 = iclockrt();
+	core->stats.loops++;
+	core->stats.wait_us += t2 - t1;
+	if (count > 0) {
+		core->stats.events += count;
+		if (count > core->stats.events_max) core->stats.events_max = count;
+	}
+	core->wake = (core->hist == NULL)? 0 : t2;
+#endif
+
+	ts = iclock64();
+	core->current = (IUINT32)(ts & 0xfffffffful);
+
+	if (!iqueue_is_empty(&core->linger)) {
+		async_core_linger_reap(core);
+	}
+
+	xf = core->xfd[ASYNC_CORE_PIPE_READ];
+
+	for (x = count * 2, i = 0, n = 0; x > 0; x--, i++) {
+		CAsyncSock *sock;
+		int needclose = 0;
+		if (i >= n) {
+			n = ipoll_events(core->pfd, results, ASYNC_CORE_EVENTS);
+			if (n <= 0) break;
+			i = 0;
+		}
+		fd = results[i].fd;
+		event = results[i].event;
+		udata = results[i].udata;
+	#ifndef ASYNC_CORE_NO_STATS
+		if (core->tracer) {
+			async_core_trace_mark(&trace, (fd == xf || udata == NULL)? 
+				-2 : ((CAsyncSock*)udata)->hid);
+		}
+	#endif
+		if (fd == xf && fd >= 0) {
+			if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
+				char dummy[10];
+				async_core_monitor++;
+				IMUTEX_LOCK(&core->xmtx);
+			#ifdef __unix
+				read(fd, dummy, 8);
+			#else
+				irecv(fd, dummy, 8, 0);
+			#endif
+				core->xfd[ASYNC_CORE_PIPE_FLAG] = 0;
+				IMUTEX_UNLOCK(&core->xmtx);
+				async_core_monitor--;
+			}
+			continue;
+		}
+		sock = (CAsyncSock*)udata;
+		if (sock == NULL) {
+			assert(sock);
+			abort();
+		}
+		if (fd != sock->fd) {	/* closed earlier in the same batch */
+			continue;
+		}
+		if (sock->kcp != NULL) {
+			async_core_kcp_recv(core, sock);
+			/* acks of the whole batch leave before returning */
+			async_core_dirty_flush(core);
+			continue;
+		}
+		if (sock->mode == ASYNC_CORE_NODE_DGRAM) {
+			char body[8];
+			int evt = event & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+			if ((evt & IPOLL_OUT) && (sock->flags & ASYNC_CORE_FLAG_WBLOCK)) {
+				async_core_dgram_flush(core, sock);
+				if ((sock->mask & IPOLL_OUT) == 0) evt &= ~IPOLL_OUT;
+			}
+			if ((sock->flags & ASYNC_CORE_FLAG_BATCH) && 
+				(evt & (IPOLL_IN | IPOLL_ERR))) {
+				async_core_dgram_recv(core, sock);
+				evt &= ~(IPOLL_IN | IPOLL_ERR);
+			}
+			if (evt == 0) continue;
+			iencode32u_lsb(body, (long)sock->fd);
+			iencode16u_lsb(body + 4, (short)evt);
+			iencode16u_lsb(body + 6, sock->ipv6? 1 : 0);
+			async_core_msg_push(core, ASYNC_CORE_EVT_DGRAM, 
+					sock->hid, sock->tag, body, 8);
+			continue;
+		}
+		if ((event & IPOLL_IN) || (event & IPOLL_ERR)) {
+			if (sock->mode == ASYNC_CORE_NODE_LISTEN4 ||
+				sock->mode == ASYNC_CORE_NODE_LISTEN6) {
+				async_core_accept(core, sock->hid);
+			}	
+			else {
+				if (sock->flags & ASYNC_CORE_FLAG_ZCOPY) {
+					async_core_bulk_reap(core, sock);
+				}
+				if (async_sock_update(sock, 1) != 0) {
+					needclose = 1;
+					code = 0;
+				}
+				if (sock->mode == ASYNC_CORE_NODE_OUT) {
+					if (sock->state == ASYNC_SOCK_STATE_CONNECTING) {
+						if ((event & IPOLL_ERR) && needclose == 0) {
+							needclose = 1;
+							code = 2000;
+						}
+					}
+				}
+				if (needclose == 0) {
+					async_core_node_active(core, sock->hid);
+				}
+				while (needclose == 0) {
+					long size = async_sock_recv(sock, NULL, 0);
+					if (size < 0) {	/* not enough data or size error */
+						if (size == -3 || size == -4) {	/* size error */
+							needclose = 1;
+							code = (size == -3)? 2001 : 2002;
+						}
+						break;
+					}
+					else if (size > core->bufsize) {	/* buffer resize */
+						if (async_core_buffer_resize(core, size) != 0) {
+							needclose = 1;
+							code = 2003;
+							break;
+						}
+					}
+					size = async_sock_recv(sock, core->buffer,
+						core->bufsize);
+					ASYNC_STAT(sock->stats.msgs_in++);
+					async_core_msg_push(core, ASYNC_CORE_EVT_DATA,
+						sock->hid, sock->tag, core->buffer, size);
+				}
+			}
+		}
+		if ((event & IPOLL_OUT) && needclose == 0) {
+			if (sock->mode == ASYNC_CORE_NODE_OUT) {
+				if (sock->state == ASYNC_SOCK_STATE_CONNECTING) {
+					int hr = 0, done = 0;
+					int error = 0, len = sizeof(int);
+					hr = igetsockopt(sock->fd, SOL_SOCKET, SO_ERROR, 
+						(char*)&error, &len);
+					if (hr < 0 || (hr == 0 && error != 0)) {
+						done = 0;
+					}	else {
+						done = 1;
+					}
+					if (done) {
+						sock->state = ASYNC_SOCK_STATE_ESTAB;
+						async_core_msg_push(core, ASYNC_CORE_EVT_ESTAB, 
+							sock->hid, sock->tag, "", 0);
+						async_core_node_mask(core, sock, 
+							IPOLL_IN | IPOLL_ERR, 0);
+					}	else {
+						needclose = 1;
+						code = 2004;
+					}
+				}
+			}
+			if (sock->flags & ASYNC_CORE_FLAG_EDGE) {
+				sock->flags &= ~ASYNC_CORE_FLAG_WBLOCK;
+				async_core_stat_wait(core, sock, 0);
+				if (needclose == 0 && async_core_node_flush(core, sock)) {
+					needclose = 1;
+					code = 2005;
+				}
+			}
+			else if (ASYNC_CORE_PENDING(sock) && needclose == 0) {
+				if (async_core_node_send(core, sock) != 0) {
+					needclose = 1;
+					code = 2005;
+				}	else {
+					async_core_node_water(core, sock);
+				}
+			}
+			if (!ASYNC_CORE_PENDING(sock) && sock->fd >= 0 && !needclose &&
+				(sock->flags & ASYNC_CORE_FLAG_EDGE) == 0) {
+				if (sock->mask & IPOLL_OUT) {
+					async_core_node_mask(core, sock, 0, IPOLL_OUT);
+					if (sock->flags & ASYNC_CORE_FLAG_PROGRESS) {
+						async_core_msg_push(core, ASYNC_CORE_EVT_PROGRESS,
+							sock->hid, sock->tag, core->buffer, 0);
+					}
+				}
+			}
+		}
+		if (sock->state == ASYNC_SOCK_STATE_CLOSED || needclose) {
+			async_core_event_close(core, sock, code);
+		}
+	}
+
+#ifndef ASYNC_CORE_NO_STATS
+	core->wake = 0;
+	if (core->tracer) async_core_trace_mark(&trace, -1);
+#endif
+
+	async_core_timer_run(core, core->current);
+
+#ifndef ASYNC_CORE_NO_STATS
+	if (core->tracer) async_core_trace_mark(&trace, -2);
+#endif
+
+	/* sends queued while handling this iteration leave together */
+	async_core_dirty_flush(core);
+
+#ifndef ASYNC_CORE_NO_STATS
+	elapsed = (t1 - t0) + (iclockrt() - t2);
+	core->stats.busy_us += elapsed;
+	if (core->hist) {
+		async_core_hist_add(core, ASYNC_CORE_HIST_LOOP, elapsed);
+	}
+	if (core->tracer && elapsed >= (IINT64)core->slow) {
+		core->tracer(core, (IUINT32)elapsed, trace.top, 
+			(IUINT32)trace.cost, core->tracer_user);
+	}
+#endif
+}
+
+
+/*-------------------------------------------------------------------*/
+/* timer expired                                                     */
+/*-------------------------------------------------------------------*/
+static void async_core_timer_expire(CAsyncCore *core, CAsyncTimer *timer)
+{
+	if (timer->mode == ASYNC_TIMER_KCP) {
+		CAsyncSock *sock = async_core_node_get(core, timer->tag);
+		if (sock != NULL && sock->kcp != NULL) {
+			async_core_kcp_update(core, sock);
+		}
+		return;
+	}
+	if (timer->mode == ASYNC_TIMER_IDLE) {
+		CAsyncSock *sock = async_core_node_get(core, timer->tag);
+		if (sock == NULL || core->timeout == 0) return;
+		if (itimediff(core->current, sock->time + core->timeout) < 0) {
+			async_core_timer_start(core, timer, sock->time + core->timeout);
+			return;
+		}
+		async_core_event_close(core, sock, 2006);
+		return;
+	}
+	async_core_msg_push(core, ASYNC_CORE_EVT_TIMER, timer->id, timer->tag,
+		"", 0);
+	if (timer->period == 0) {
+		async_core_timer_free(core, timer);
+	}	else {
+		IUINT32 expires = timer->expires + timer->period;
+		if (itimediff(expires, core->current) <= 0) {
+			expires = core->current + timer->period;
+		}
+		async_core_timer_start(core, timer, expires);
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* close the node with 2007 when its send buffer stays over limit    */
+/*-------------------------------------------------------------------*/
+static int async_core_node_limit(CAsyncCore *core, CAsyncSock *sock)
+{
+	if (sock->limited > 0 && sock->sendmsg.size > (iulong)sock->limited) {
+		if ((sock->flags & ASYNC_CORE_FLAG_SENSITIVE) == 0) {
+			async_core_node_send(core, sock);
+		}
+		if (sock->sendmsg.size > (iulong)sock->limited) {
+			async_core_event_close(core, sock, 2007);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*-------------------------------------------------------------------*/
+/* schedule output after new data has been queued                    */
+/*-------------------------------------------------------------------*/
+static void async_core_node_output(CAsyncCore *core, CAsyncSock *sock)
+{
+#ifndef ASYNC_CORE_NO_STATS
+	long queued = async_core_node_queued(sock);
+	if (queued > sock->stats.sendq_peak) sock->stats.sendq_peak = queued;
+	sock->stats.msgs_out++;
+#endif
+	if (sock->flags & (ASYNC_CORE_FLAG_EDGE | ASYNC_CORE_FLAG_COALESCE)) {
+		/* a socket already waiting for IPOLL_OUT is written by it */
+		int waiting = (sock->flags & ASYNC_CORE_FLAG_EDGE)?
+			(sock->flags & ASYNC_CORE_FLAG_WBLOCK) : 
+			(sock->mask & IPOLL_OUT);
+		if (waiting == 0 && iqueue_is_empty(&sock->dirty) && 
+			sock->fd >= 0) {
+			iqueue_add_tail(&sock->dirty, &core->dirty);
+		}
+	}
+	else if (ASYNC_CORE_PENDING(sock) && sock->fd >= 0) {
+		if ((sock->mask & IPOLL_OUT) == 0) {
+			async_core_node_mask(core, sock, 
+				IPOLL_OUT, 0);
+		}
+	}
+	async_core_node_water(core, sock);
+}
+
+/*-------------------------------------------------------------------*/
+/* send vector                                                       */
+/*-------------------------------------------------------------------*/
+static long _async_core_send_vector(CAsyncCore *core, long hid,
+	const void * const vecptr[],
+	const long veclen[], int count, int mask)
+{
+	CAsyncSock *sock = async_core_node_get(core, hid);
+	long hr;
+	if (sock == NULL) return -100;
+	if (sock->mode == ASYNC_CORE_NODE_KCP) {
+		return async_core_kcp_send(core, sock, vecptr, veclen, count);
+	}
+	if (sock->mode == ASYNC_CORE_NODE_DGRAM) return -300;
+	if (async_core_node_limit(core, sock) != 0) return -200;
+	hr = async_sock_send_vector(sock, vecptr, veclen, count, mask);
+	async_core_node_output(core, sock);
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* send vector                                                       */
+/*-------------------------------------------------------------------*/
+long async_core_send_vector(CAsyncCore *core, long hid,
+	const void * const vecptr[],
+	const long veclen[], int count, int mask)
+{
+	long hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_send_vector(core, hid, vecptr, veclen, count, mask);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* send data to given hid                                            */
+/*-------------------------------------------------------------------*/
+long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len)
+{
+	const void *vecptr[1];
+	long veclen[1];
+	long hr;
+	vecptr[0] = ptr;
+	veclen[0] = len;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_send_vector(core, hid, vecptr, veclen, 1, 0);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* queue a sendfile or zerocopy item behind the buffered stream      */
+/*-------------------------------------------------------------------*/
+static long _async_core_send_bulk(CAsyncCore *core, long hid, int type,
+	int fd, IINT64 offset, const void *ptr, long size, long cookie)
+{
+	CAsyncSock *sock = async_core_node_get(core, hid);
+	CAsyncBulk *bulk;
+	struct IQUEUEHEAD *it;
+	char head[4];
+	long gap;
+	int hdrlen;
+	if (sock == NULL) return -100;
+	if (sock->mode != ASYNC_CORE_NODE_IN && 
+		sock->mode != ASYNC_CORE_NODE_OUT &&
+		sock->mode != ASYNC_CORE_NODE_ASSIGN) 
+		return -300;
+	if (size < 0 || offset < 0) return -300;
+	if (async_sock_ciphered(sock)) {
+		/* plain text must not bypass the cipher */
+		if (type == ASYNC_CORE_BULK_FILE) return -300;
+		sock->flags |= ASYNC_CORE_FLAG_ZCOFF;
+	}
+	if (type == ASYNC_CORE_BULK_ZEROCOPY && 
+		(sock->flags & (ASYNC_CORE_FLAG_ZCOPY | ASYNC_CORE_FLAG_ZCOFF)) == 0) {
+		if (izerocopy_enable(sock->fd) == 0) {
+			sock->flags |= ASYNC_CORE_FLAG_ZCOPY;
+		}	else {
+			sock->flags |= ASYNC_CORE_FLAG_ZCOFF;
+		}
+	}
+	if (async_core_node_limit(core, sock) != 0) return -200;
+	if (type == ASYNC_CORE_BULK_ZEROCOPY) {
+		if (size < ASYNC_CORE_ZEROCOPY_MIN || 
+			(sock->flags & ASYNC_CORE_FLAG_ZCOFF)) {
+			long hr = async_sock_send_vector(sock, &ptr, &size, 1, 0);
+			async_core_node_output(core, sock);
+			async_core_bulk_event(core, sock->hid, type, cookie, 1);
+			return hr;
+		}
+	}
+	bulk = (CAsyncBulk*)ikmem_malloc(sizeof(CAsyncBulk));
+	if (bulk == NULL) return -1;
+	hdrlen = async_sock_write_size(sock, size, 0, head);
+	ims_write(&sock->sendmsg, head, hdrlen);
+	for (gap = (long)sock->sendmsg.size, it = sock->bulk.next; 
+		it != &sock->bulk; it = it->next) {
+		gap -= iqueue_entry(it, CAsyncBulk, head)->gap;
+	}
+	bulk->type = type;
+	bulk->fd = fd;
+	bulk->copied = 0;
+	bulk->offset = offset;
+	bulk->ptr = (const char*)ptr;
+	bulk->size = size;
+	bulk->pos = 0;
+	bulk->gap = gap;
+	bulk->cookie = cookie;
+	bulk->first = 0;
+	bulk->sends = 0;
+	bulk->done = 0;
+	iqueue_add_tail(&bulk->head, &sock->bulk);
+	async_core_node_output(core, sock);
+	return size;
+}
+
+/*-------------------------------------------------------------------*/
+/* send file content with sendfile                                   */
+/*-------------------------------------------------------------------*/
+long async_core_send_file(CAsyncCore *core, long hid, int fd, 
+	IINT64 offset, long length)
+{
+	long hr;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_send_bulk(core, hid, ASYNC_CORE_BULK_FILE, fd,
+		offset, NULL, length, fd);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* send buffer with MSG_ZEROCOPY                                     */
+/*-------------------------------------------------------------------*/
+long async_core_send_zerocopy(CAsyncCore *core, long hid, 
+	const void *ptr, long len, long cookie)
+{
+	long hr;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_send_bulk(core, hid, ASYNC_CORE_BULK_ZEROCOPY, -1,
+		0, ptr, len, cookie);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/*-------------------------------------------------------------------*/
+/* close given hid                                                   */
+/*-------------------------------------------------------------------*/
+int async_core_close(CAsyncCore *core, long hid, int code)
+{
+	CAsyncSock *sock;
+	int hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL) {
+		if (ASYNC_CORE_PENDING(sock)) {
+			async_core_node_send(core, sock);
+		}
+		if (sock->mode == ASYNC_CORE_NODE_KCP) {
+			async_core_kcp_flush(core, sock);
+		}
+		async_core_event_close(core, sock, code);
+		hr = 0;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* wait for events for millisec ms. and process events,              */
+/* if millisec equals zero, no wait.                                 */
+/*-------------------------------------------------------------------*/
+void async_core_wait(CAsyncCore *core, IUINT32 millisec)
+{
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	if (core->count > 0 || core->xfd[0] >= 0 || core->tcount > 0 ||
+		!iqueue_is_empty(&core->linger)) {
+		async_core_process_events(core, millisec);
+	}	else {
+		if (millisec > 0) {
+			isleep(millisec);
+		}
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/*-------------------------------------------------------------------*/
+/* flush coalesced send buffers                                      */
+/*-------------------------------------------------------------------*/
+void async_core_flush(CAsyncCore *core)
+{
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	async_core_dirty_flush(core);
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/*-------------------------------------------------------------------*/
+/* old interface compatible                                          */
+/*-------------------------------------------------------------------*/
+void async_core_process(CAsyncCore *core, IUINT32 millisec)
+{
+	async_core_wait(core, millisec);
+}
+
+/*-------------------------------------------------------------------*/
+/* wake-up async_core_wait                                           */
+/*-------------------------------------------------------------------*/
+int async_core_notify(CAsyncCore *core)
+{
+	int fd;
+	int hr = -1;
+	IMUTEX_LOCK(&core->xmtx);
+	fd = core->xfd[ASYNC_CORE_PIPE_WRITE];
+	if (core->xfd[ASYNC_CORE_PIPE_FLAG] == 0) {
+		if (fd >= 0) {
+			char dummy = 1;
+			int hr = 0;
+		#ifdef __unix
+			#ifndef __AVM2__
+			hr = write(fd, &dummy, 1);
+			#else
+			dummy = dummy + 1;
+			#endif
+		#else
+			hr = send(fd, &dummy, 1, 0);
+		#endif
+			if (hr == 1) {
+				core->xfd[ASYNC_CORE_PIPE_FLAG] = 1;
+				hr = 0;
+			}
+		}
+	}	else {
+		hr = 1;
+	}
+	IMUTEX_UNLOCK(&core->xmtx);
+	return hr;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* get message                                                       */
+/*-------------------------------------------------------------------*/
+long async_core_read(CAsyncCore *core, int *event, long *wparam,
+	long *lparam, void *data, long size)
+{
+	const void *ptr = NULL;
+	long length;
+	if (data == NULL) {
+		return async_core_msg_borrow(core, NULL, NULL, NULL, NULL, NULL, 0);
+	}
+	length = async_core_msg_borrow(core, event, wparam, lparam, &ptr, 
+		data, size);
+	if (length < 0) return length;
+	if (ptr != data && length > 0) {
+		memcpy(data, ptr, length);
+	}
+	async_core_msg_release(core);
+	return length;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* borrow message without copying                                    */
+/*-------------------------------------------------------------------*/
+long async_core_read_ref(CAsyncCore *core, int *event, long *wparam,
+	long *lparam, const void **data)
+{
+	const void *ptr = NULL;
+	long length;
+	length = async_core_msg_borrow(core, event, wparam, lparam, &ptr, 
+		NULL, 0);
+	if (data) data[0] = (length >= 0)? ptr : NULL;
+	return length;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* release message borrowed by async_core_read_ref                   */
+/*-------------------------------------------------------------------*/
+void async_core_read_release(CAsyncCore *core)
+{
+	if (core->refmode != ASYNC_CORE_REF_NONE) {
+		async_core_msg_release(core);
+	}
+}
+
+
+/*-------------------------------------------------------------------*/
+/* push message to msg queue                                         */
+/*-------------------------------------------------------------------*/
+int async_core_push(CAsyncCore *core, int event, long wparam, long lparam, 
+	const char *data, long size)
+{
+#ifndef ASYNC_CORE_NO_RING
+	if (core->ring) {
+		/* may be called without core->lock: arena is not available */
+		async_ring_push(core, event, wparam, lparam, data, size, 1,
+			async_core_stamp(core));
+		return 0;
+	}
+#endif
+	async_core_msg_write(core, event, wparam, lparam, data, size, 
+		async_core_stamp(core));
+	return 0;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* queue an ASYNC_CORE_EVT_PUSH event and wake async_core_wait up    */
+/*-------------------------------------------------------------------*/
+int async_core_post(CAsyncCore *core, long wparam, long lparam, 
+	const char *data, long size)
+{
+	async_core_push(core, ASYNC_CORE_EVT_PUSH, wparam, lparam, data, size);
+	async_core_notify(core);
+	return 0;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* get node mode: ASYNC_CORE_NODE_IN/OUT/LISTEN4/LISTEN6/ASSIGN      */
+/* returns -1 for not exists                                         */
+/*-------------------------------------------------------------------*/
+int async_core_get_mode(const CAsyncCore *core, long hid)
+{
+	const CAsyncSock *sock;
+	int mode = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get_const(core, hid);
+	if (sock != NULL) mode = sock->mode;
+	ASYNC_CORE_CRITICAL_END(core);
+	return mode;
+}
+
+/* get tag */
+long async_core_get_tag(const CAsyncCore *core, long hid)
+{
+	const CAsyncSock *sock;
+	long tag = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get_const(core, hid);
+	if (sock != NULL) tag = sock->tag;
+	ASYNC_CORE_CRITICAL_END(core);
+	return tag;
+}
+
+/* set tag */
+void async_core_set_tag(CAsyncCore *core, long hid, long tag)
+{
+	CAsyncSock *sock;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL) {
+		sock->tag = tag;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/* get send queue size */
+long async_core_remain(const CAsyncCore *core, long hid)
+{
+	const CAsyncSock *sock;
+	long size = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get_const(core, hid);
+	if (sock != NULL) size = async_core_node_queued(sock);
+	ASYNC_CORE_CRITICAL_END(core);
+	return size;
+}
+
+
+/* set connection socket option */
+static int _async_core_option(CAsyncCore *core, long hid, 
+	int opt, long value)
+{
+	int hr = -100;
+	CAsyncSock *sock = async_core_node_get(core, hid);
+
+	if (sock == NULL) return -10;
+	if (sock->fd < 0) return -20;
+
+	switch (opt) {
+	case ASYNC_CORE_OPTION_NODELAY:
+		if (value == 0) {
+			hr = idisable(sock->fd, ISOCK_NODELAY);
+		}	else {
+			hr = ienable(sock->fd, ISOCK_NODELAY);
+		}
+		break;
+	case ASYNC_CORE_OPTION_REUSEADDR:
+		if (value == 0) {
+			hr = idisable(sock->fd, ISOCK_REUSEADDR);
+		}	else {
+			hr = ienable(sock->fd, ISOCK_REUSEADDR);
+		}
+		break;
+	case ASYNC_CORE_OPTION_REUSEPORT:
+		if (value == 0) {
+			hr = idisable(sock->fd, ISOCK_REUSEPORT);
+		}	else {
+			hr = ienable(sock->fd, ISOCK_REUSEPORT);
+		}
+		break;
+	case ASYNC_CORE_OPTION_UNIXREUSE:
+		if (value == 0) {
+			hr = idisable(sock->fd, ISOCK_UNIXREUSE);
+		}	else {
+			hr = ienable(sock->fd, ISOCK_UNIXREUSE);
+		}
+		break;
+	case ASYNC_CORE_OPTION_KEEPALIVE:
+		if (value == 0) {
+			hr = ikeepalive(sock->fd, 5, 40, 1);
+		}	else {
+			hr = ikeepalive(sock->fd, -1, -1, -1);
+		}
+		break;
+	case ASYNC_CORE_OPTION_SYSSNDBUF:
+		hr = isocket_set_buffer(sock->fd, -1, value);
+		break;
+	case ASYNC_CORE_OPTION_SYSRCVBUF:
+		hr = isocket_set_buffer(sock->fd, value, -1);
+		break;
+	case ASYNC_CORE_OPTION_MAXSIZE:
+		sock->maxsize = value;
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_LIMITED:
+		sock->limited = value;
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_PROGRESS:
+		if (value) {
+			sock->flags |= ASYNC_CORE_FLAG_PROGRESS;
+		}	else {
+			sock->flags &= ~ASYNC_CORE_FLAG_PROGRESS;
+		}
+		break;
+	case ASYNC_CORE_OPTION_SENSITIVE:
+		if (value) {
+			sock->flags |= ASYNC_CORE_FLAG_SENSITIVE;
+		}	else {
+			sock->flags &= ~ASYNC_CORE_FLAG_SENSITIVE;
+		}
+		break;
+	case ASYNC_CORE_OPTION_COALESCE:
+		if (value) {
+			sock->flags |= ASYNC_CORE_FLAG_COALESCE;
+		}	else {
+			sock->flags &= ~ASYNC_CORE_FLAG_COALESCE;
+		}
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_HIWATER:
+		sock->hiwater = value;
+		async_core_node_water(core, sock);
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_LOWATER:
+		sock->lowater = value;
+		async_core_node_water(core, sock);
+		hr = 0;
+		break;
+	case ASYNC_CORE_OPTION_GETFD:
+		hr = sock->fd;
+		break;
+	case ASYNC_CORE_OPTION_MASKSET:
+		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
+			sock->mask = value & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+			hr = async_core_dgram_poll(core, sock);
+		}	else {
+			hr = -30;
+		}
+		break;
+	case ASYNC_CORE_OPTION_MASKGET:
+		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
+			hr = sock->mask;
+		}	else {
+			hr = 0;
+		}
+		break;
+	case ASYNC_CORE_OPTION_MASKADD:
+		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
+			sock->mask |= value & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
+			hr = async_core_dgram_poll(core, sock);
+		}	else {
+			hr = -30;
+		}
+		break;
+	case ASYNC_CORE_OPTION_MASKDEL:
+		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
+			sock->mask &= ~((int)value);
+			hr = async_core_dgram_poll(core, sock);
+		}	else {
+			hr = -30;
+		}
+		break;
+	}
+	return hr;
+}
+
+
+/* get connection socket status */
+static long _async_core_status(CAsyncCore *core, long hid, int opt)
+{
+	long hr = -100;
+	CAsyncSock *sock = async_core_node_get(core, hid);
+
+	if (sock == NULL) return -10;
+	if (sock->fd < 0) return -20;
+
+	switch (opt) {
+	case ASYNC_CORE_STATUS_STATE:
+		hr = sock->state;
+		break;
+	case ASYNC_CORE_STATUS_IPV6:
+		hr = sock->ipv6;
+		break;
+	case ASYNC_CORE_STATUS_ESTAB:
+		hr = isocket_tcp_estab(sock->fd);
+		break;
+	case ASYNC_CORE_STATUS_QUEUED:
+		hr = async_core_node_queued(sock);
+		break;
+	case ASYNC_CORE_STATUS_BLOCKED:
+		hr = (sock->flags & ASYNC_CORE_FLAG_BLOCKED)? 1 : 0;
+		break;
+	case ASYNC_CORE_STATUS_BYTES_IN:
+		hr = (long)sock->stats.bytes_in;
+		break;
+	case ASYNC_CORE_STATUS_BYTES_OUT:
+		hr = (long)sock->stats.bytes_out;
+		break;
+	case ASYNC_CORE_STATUS_MSGS_IN:
+		hr = (long)sock->stats.msgs_in;
+		break;
+	case ASYNC_CORE_STATUS_MSGS_OUT:
+		hr = (long)sock->stats.msgs_out;
+		break;
+	case ASYNC_CORE_STATUS_RECVCALL:
+		hr = (long)sock->stats.recv_calls;
+		break;
+	case ASYNC_CORE_STATUS_SENDCALL:
+		hr = (long)sock->stats.send_calls;
+		break;
+	case ASYNC_CORE_STATUS_EAGAIN:
+		hr = (long)sock->stats.eagain;
+		break;
+	case ASYNC_CORE_STATUS_SENDPEAK:
+		hr = (long)sock->stats.sendq_peak;
+		break;
+	case ASYNC_CORE_STATUS_WBLOCKMS:
+		hr = (long)sock->stats.wblock_ms;
+		break;
+	}
+
+	return hr;
+}
+
+/* thread safe */
+int async_core_option(CAsyncCore *core, long hid, int opt, long value)
+{
+	int hr = 0;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_option(core, hid, opt, value);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* thread safe */
+long async_core_status(CAsyncCore *core, long hid, int opt)
+{
+	long hr = 0;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	hr = _async_core_status(core, hid, opt);
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* copy counters of the hid */
+int async_core_stats_node(CAsyncCore *core, long hid, 
+	struct CAsyncSockStats *stats)
+{
+	const CAsyncSock *sock;
+	int hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get_const(core, hid);
+	if (sock != NULL) {
+		stats[0] = sock->stats;
+		hr = 0;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* copy counters of up to count hids */
+long async_core_stats_snapshot(CAsyncCore *core, long *hids, 
+	struct CAsyncSockStats *stats, long count)
+{
+	long hid, n = 0;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	for (hid = _async_core_node_head(core); hid >= 0 && n < count; 
+		hid = _async_core_node_next(core, hid)) {
+		const CAsyncSock *sock = async_core_node_get_const(core, hid);
+		if (sock == NULL) continue;
+		if (hids) hids[n] = hid;
+		if (stats) stats[n] = sock->stats;
+		n++;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return n;
+}
+
+/* copy the core counters */
+void async_core_stats(CAsyncCore *core, struct CAsyncCoreStats *stats)
+{
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	stats[0] = core->stats;
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/* set connection rc4 send key */
+int async_core_rc4_set_skey(CAsyncCore *core, long hid, 
+	const unsigned char *key, int keylen)
+{
+	CAsyncSock *sock;
+	int hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL) {
+		async_sock_rc4_set_skey(sock, key, keylen);
+		hr = 0;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* set connection rc4 recv key */
+int async_core_rc4_set_rkey(CAsyncCore *core, long hid,
+	const unsigned char *key, int keylen)
+{
+	CAsyncSock *sock;
+	int hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL) {
+		async_sock_rc4_set_rkey(sock, key, keylen);
+		hr = 0;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* set connection chacha20 send key */
+int async_core_chacha_set_skey(CAsyncCore *core, long hid, 
+	const unsigned char *key, const unsigned char *nonce)
+{
+	CAsyncSock *sock;
+	int hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL) {
+		hr = (async_sock_chacha_set_skey(sock, key, nonce) == 0)? 0 : -2;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* set connection chacha20 recv key */
+int async_core_chacha_set_rkey(CAsyncCore *core, long hid,
+	const unsigned char *key, const unsigned char *nonce)
+{
+	CAsyncSock *sock;
+	int hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL) {
+		hr = (async_sock_chacha_set_rkey(sock, key, nonce) == 0)? 0 : -2;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* set default buffer limit and max packet size */
+void async_core_limit(CAsyncCore *core, long limited, long maxsize)
+{
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	if (limited >= 0) {
+		core->limited = limited;
+	}
+	if (maxsize >= 0) {
+		core->maxsize = maxsize;
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/* set disable read polling event: 1/on, 0/off */
+int async_core_disable(CAsyncCore *core, long hid, int value)
+{
+	CAsyncSock *sock;
+	int hr = -1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	sock = async_core_node_get(core, hid);
+	if (sock != NULL) {
+		if (value == 0) {
+			hr = async_core_node_mask(core, sock, IPOLL_IN, 0);
+		}	else {
+			hr = async_core_node_mask(core, sock, 0, IPOLL_IN);;
+		}
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+	return hr;
+}
+
+/* set remote ip validator */
+void async_core_firewall(CAsyncCore *core, CAsyncValidator v, void *user)
+{
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	core->validator = v;
+	core->user = user;
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/* copy latency histogram without locking */
+int async_core_histogram(const CAsyncCore *core, int which, 
+	IUINT32 *buckets, int count)
+{
+	const IUINT32 *src;
+	int i;
+	if (core->hist == NULL) return -1;
+	if (which < 0 || which >= ASYNC_CORE_HIST_COUNT) return -1;
+	src = core->hist + which * ASYNC_CORE_HIST_BUCKETS;
+	if (count > ASYNC_CORE_HIST_BUCKETS) count = ASYNC_CORE_HIST_BUCKETS;
+	for (i = 0; i < count; i++) {
+		buckets[i] = ((const volatile IUINT32*)src)[i];
+	}
+	return count;
+}
+
+/* lower bound of a histogram bucket in microseconds */
+IUINT32 async_core_histogram_value(int index)
+{
+	int e;
+	if (index < 16) return (index < 0)? 0 : (IUINT32)index;
+	if (index >= ASYNC_CORE_HIST_BUCKETS) index = ASYNC_CORE_HIST_BUCKETS - 1;
+	e = ((index - 16) >> 4) + 4;
+	return ((IUINT32)(16 + (index & 15))) << (e - 4);
+}
 
-/*-------------------------------------------------------------------*/
-/* get node mode: ASYNC_CORE_NODE_IN/OUT/LISTEN4/LISTEN6/ASSIGN      */
-/* returns -1 for not exists                                         */
-/*-------------------------------------------------------------------*/
-int async_core_get_mode(const CAsyncCore *core, long hid)
+/* value below which permille/1000 of the samples fall */
+IUINT32 async_core_histogram_quantile(const IUINT32 *buckets, int count,
+	int permille)
+{
+	IUINT64 total = 0, need, sum = 0;
+	int i;
+	for (i = 0; i < count; i++) total += buckets[i];
+	if (total == 0) return 0;
+	if (permille < 0) permille = 0;
+	if (permille > 1000) permille = 1000;
+	need = (total * permille + 999) / 1000;
+	if (need == 0) need = 1;
+	for (i = 0; i < count; i++) {
+		sum += buckets[i];
+		if (sum >= need) break;
+	}
+	if (i + 1 >= ASYNC_CORE_HIST_BUCKETS) return 0xffffffff;
+	return async_core_histogram_value(i + 1);
+}
+
+/* call tracer after iterations slower than threshold microseconds */
+void async_core_trace(CAsyncCore *core, IUINT32 threshold, 
+	CAsyncTracer tracer, void *user)
+{
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	core->slow = threshold;
+	core->tracer = (threshold == 0)? NULL : tracer;
+	core->tracer_user = user;
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/* set timeout */
+void async_core_timeout(CAsyncCore *core, long seconds)
+{
+	long index;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	core->timeout = seconds * 1000;
+	for (index = imnode_head(core->nodes); index >= 0; 
+		index = imnode_next(core->nodes, index)) {
+		CAsyncSock *sock = (CAsyncSock*)IMNODE_DATA(core->nodes, index);
+		CAsyncTimer *timer = async_core_timer_get(core, sock->timer);
+		if (timer == NULL) continue;
+		if (core->timeout > 0) {
+			async_core_timer_start(core, timer, sock->time + core->timeout);
+		}	else {
+			async_core_timer_stop(core, timer);
+		}
+	}
+	ASYNC_CORE_CRITICAL_END(core);
+}
+
+/* getsockname */
+int async_core_sockname(const CAsyncCore *core, long hid, 
+	struct sockaddr *addr, int *size)
 {
 	const CAsyncSock *sock;
-	int mode = -1;
+	int hr = -2;
 	ASYNC_CORE_CRITICAL_BEGIN(core);
 	sock = async_core_node_get_const(core, hid);
-	if (sock != NULL) mode = sock->mode;
+	if (sock != NULL) hr = isockname(sock->fd, addr, size);
 	ASYNC_CORE_CRITICAL_END(core);
-	return mode;
+	return hr;
 }
 
-/* get tag */
-long async_core_get_tag(const CAsyncCore *core, long hid)
+/* getpeername */
+int async_core_peername(const CAsyncCore *core, long hid,
+	struct sockaddr *addr, int *size)
 {
 	const CAsyncSock *sock;
-	long tag = -1;
+	int hr = -2;
 	ASYNC_CORE_CRITICAL_BEGIN(core);
 	sock = async_core_node_get_const(core, hid);
-	if (sock != NULL) tag = sock->tag;
+	if (sock == NULL) {
+		hr = -2;
+	}
+	else if (sock->mode == ASYNC_CORE_NODE_KCP && sock->kcp->addrlen > 0) {
+		/* listener sessions share the udp fd: report the peer address */
+		hr = -1;
+		if (size && *size >= sock->kcp->addrlen) {
+			memcpy(addr, sock->kcp->remote, sock->kcp->addrlen);
+			*size = sock->kcp->addrlen;
+			hr = 0;
+		}
+	}
+	else {
+		hr = ipeername(sock->fd, addr, size);
+	}
 	ASYNC_CORE_CRITICAL_END(core);
-	return tag;
+	return hr;
 }
 
-/* set tag */
-void async_core_set_tag(CAsyncCore *core, long hid, long tag)
+/* get fd count */
+long async_core_nfds(const CAsyncCore *core)
 {
-	CAsyncSock *sock;
+	long count = 0;
 	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get(core, hid);
-	if (sock != NULL) {
-		sock->tag = tag;
+	count = core->count;
+	ASYNC_CORE_CRITICAL_END(core);
+	return count;
+}
+
+/* add timer */
+long async_core_timer_add(CAsyncCore *core, IUINT32 delay, int periodic,
+	long tag)
+{
+	CAsyncTimer *timer;
+	long id;
+	if (delay > 0x7fffffff) return -1;
+	if (periodic && delay == 0) delay = 1;
+	ASYNC_CORE_CRITICAL_BEGIN(core);
+	id = async_core_timer_new(core, ASYNC_TIMER_USER, 
+		periodic? delay : 0, tag);
+	if (id >= 0) {
+		timer = async_core_timer_get(core, id);
+		async_core_timer_start(core, timer, iclock() + delay);
 	}
 	ASYNC_CORE_CRITICAL_END(core);
+	return id;
 }
 
-/* get send queue size */
-long async_core_remain(const CAsyncCore *core, long hid)
+/* remove timer */
+int async_core_timer_del(CAsyncCore *core, long id)
 {
-	const CAsyncSock *sock;
-	long size = -1;
+	CAsyncTimer *timer;
+	int hr = -1;
 	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get_const(core, hid);
-	if (sock != NULL) size = (long)sock->sendmsg.size;
+	timer = async_core_timer_get(core, id);
+	if (timer != NULL && timer->mode == ASYNC_TIMER_USER) {
+		async_core_timer_free(core, timer);
+		hr = 0;
+	}
 	ASYNC_CORE_CRITICAL_END(core);
-	return size;
+	return hr;
 }
 
 
-/* set connection socket option */
-static int _async_core_option(CAsyncCore *core, long hid, 
-	int opt, long value)
+/*===================================================================*/
+/* CAsyncCoreGroup                                                   */
+/*===================================================================*/
+#ifdef _WIN32
+#define ASYNC_GROUP_SELF()	((IUINT64)GetCurrentThreadId())
+#else
+#define ASYNC_GROUP_SELF()	((IUINT64)(size_t)pthread_self())
+#endif
+
+typedef struct
 {
-	int hr = -100;
-	CAsyncSock *sock = async_core_node_get(core, hid);
+	CAsyncCore *core;
+	CAsyncCoreGroup *group;
+	IMUTEX_TYPE gate;
+	IUINT64 self;
+	ilong thread;
+	int index;
+	int started;
+	volatile int running;
+}	CAsyncShard;
+
+struct CAsyncCoreGroup
+{
+	CAsyncShard *shards;
+	CAsyncGroupHandler handler;
+	void *user;
+	IUINT32 interval;
+	IMUTEX_TYPE lock;
+	struct IVECTOR listeners;
+	int count;
+	int next;
+};
 
-	if (sock == NULL) return -10;
-	if (sock->fd < 0) return -20;
 
-	switch (opt) {
-	case ASYNC_CORE_OPTION_NODELAY:
-		if (value == 0) {
-			hr = idisable(sock->fd, ISOCK_NODELAY);
-		}	else {
-			hr = ienable(sock->fd, ISOCK_NODELAY);
-		}
-		break;
-	case ASYNC_CORE_OPTION_REUSEADDR:
-		if (value == 0) {
-			hr = idisable(sock->fd, ISOCK_REUSEADDR);
-		}	else {
-			hr = ienable(sock->fd, ISOCK_REUSEADDR);
-		}
-		break;
-	case ASYNC_CORE_OPTION_REUSEPORT:
-		if (value == 0) {
-			hr = idisable(sock->fd, ISOCK_REUSEPORT);
-		}	else {
-			hr = ienable(sock->fd, ISOCK_REUSEPORT);
-		}
-		break;
-	case ASYNC_CORE_OPTION_UNIXREUSE:
-		if (value == 0) {
-			hr = idisable(sock->fd, ISOCK_UNIXREUSE);
-		}	else {
-			hr = ienable(sock->fd, ISOCK_UNIXREUSE);
-		}
-		break;
-	case ASYNC_CORE_OPTION_KEEPALIVE:
-		if (value == 0) {
-			hr = ikeepalive(sock->fd, 5, 40, 1);
-		}	else {
-			hr = ikeepalive(sock->fd, -1, -1, -1);
-		}
-		break;
-	case ASYNC_CORE_OPTION_SYSSNDBUF:
-		hr = isocket_set_buffer(sock->fd, -1, value);
-		break;
-	case ASYNC_CORE_OPTION_SYSRCVBUF:
-		hr = isocket_set_buffer(sock->fd, value, -1);
-		break;
-	case ASYNC_CORE_OPTION_MAXSIZE:
-		sock->maxsize = value;
-		hr = 0;
-		break;
-	case ASYNC_CORE_OPTION_LIMITED:
-		sock->limited = value;
-		hr = 0;
-		break;
-	case ASYNC_CORE_OPTION_PROGRESS:
-		if (value) {
-			sock->flags |= ASYNC_CORE_FLAG_PROGRESS;
-		}	else {
-			sock->flags &= ~ASYNC_CORE_FLAG_PROGRESS;
-		}
-		break;
-	case ASYNC_CORE_OPTION_SENSITIVE:
-		if (value) {
-			sock->flags |= ASYNC_CORE_FLAG_SENSITIVE;
-		}	else {
-			sock->flags &= ~ASYNC_CORE_FLAG_SENSITIVE;
-		}
-		break;
-	case ASYNC_CORE_OPTION_GETFD:
-		hr = sock->fd;
-		break;
-	case ASYNC_CORE_OPTION_MASKSET:
-		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
-			sock->mask = value & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
-			hr = ipoll_set(core->pfd, sock->fd, sock->mask);
-		}	else {
-			hr = -30;
+/*-------------------------------------------------------------------*/
+/* new group                                                         */
+/*-------------------------------------------------------------------*/
+CAsyncCoreGroup* async_group_new(int count, int flags)
+{
+	CAsyncCoreGroup *group;
+	int i;
+
+	if (count <= 0 || count > ASYNC_GROUP_MAX) return NULL;
+
+	group = (CAsyncCoreGroup*)ikmem_malloc(sizeof(CAsyncCoreGroup));
+	if (group == NULL) return NULL;
+
+	group->shards = (CAsyncShard*)ikmem_malloc(sizeof(CAsyncShard) * count);
+	if (group->shards == NULL) {
+		ikmem_free(group);
+		return NULL;
+	}
+
+	group->handler = NULL;
+	group->user = NULL;
+	group->interval = 100;
+	group->count = count;
+	group->next = 0;
+	iv_init(&group->listeners, NULL);
+	IMUTEX_INIT(&group->lock);
+
+	for (i = 0; i < count; i++) {
+		CAsyncShard *shard = &group->shards[i];
+		shard->group = group;
+		shard->index = i;
+		shard->self = 0;
+		shard->thread = 0;
+		shard->started = 0;
+		shard->running = 0;
+		IMUTEX_INIT(&shard->gate);
+		/* cores are shared between threads: lock and notify required */
+		shard->core = async_core_new(flags & ~3);
+		if (shard->core == NULL) {
+			group->count = i;
+			IMUTEX_DESTROY(&shard->gate);
+			async_group_delete(group);
+			return NULL;
 		}
-		break;
-	case ASYNC_CORE_OPTION_MASKGET:
-		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
-			hr = sock->mask;
-		}	else {
-			hr = 0;
+		shard->core->shard = i;
+		shard->core->shards = count;
+		shard->core->index = i + 1;
+	}
+
+	return group;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* delete group                                                      */
+/*-------------------------------------------------------------------*/
+void async_group_delete(CAsyncCoreGroup *group)
+{
+	int i;
+	if (group == NULL) return;
+	async_group_stop(group);
+	for (i = 0; i < group->count; i++) {
+		CAsyncShard *shard = &group->shards[i];
+		async_core_delete(shard->core);
+		shard->core = NULL;
+		IMUTEX_DESTROY(&shard->gate);
+	}
+	iv_destroy(&group->listeners);
+	IMUTEX_DESTROY(&group->lock);
+	ikmem_free(group->shards);
+	ikmem_free(group);
+}
+
+
+/*-------------------------------------------------------------------*/
+/* reactor thread                                                    */
+/*-------------------------------------------------------------------*/
+static void async_group_worker(void *param)
+{
+	CAsyncShard *shard = (CAsyncShard*)param;
+	CAsyncCoreGroup *group = shard->group;
+	CAsyncCore *core = shard->core;
+	long wparam, lparam, size;
+	const void *data;
+	int event;
+
+	shard->self = ASYNC_GROUP_SELF();
+
+	while (shard->running) {
+		/* let callers from other threads, who already notified us,
+		   take the core lock before we block in ipoll_wait again */
+		IMUTEX_LOCK(&shard->gate);
+		IMUTEX_UNLOCK(&shard->gate);
+
+		async_core_wait(core, group->interval);
+
+		while (1) {
+			size = async_core_read_ref(core, &event, &wparam, &lparam,
+				&data);
+			if (size < 0) break;
+			group->handler(group->user, shard->index, event, 
+				wparam, lparam, data, size);
+			async_core_read_release(core);
 		}
-		break;
-	case ASYNC_CORE_OPTION_MASKADD:
-		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
-			sock->mask |= value & (IPOLL_IN | IPOLL_OUT | IPOLL_ERR);
-			hr = ipoll_set(core->pfd, sock->fd, sock->mask);
-		}	else {
-			hr = -30;
+	}
+
+	shard->self = 0;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* start reactor threads                                             */
+/*-------------------------------------------------------------------*/
+int async_group_start(CAsyncCoreGroup *group, CAsyncGroupHandler handler,
+	void *user)
+{
+	int i;
+	if (handler == NULL) return -1;
+	for (i = 0; i < group->count; i++) {
+		if (group->shards[i].started) return -2;
+	}
+	group->handler = handler;
+	group->user = user;
+	for (i = 0; i < group->count; i++) {
+		CAsyncShard *shard = &group->shards[i];
+		shard->running = 1;
+		if (ithread_create(&shard->thread, async_group_worker, 0, 
+			shard) != 0) {
+			shard->running = 0;
+			async_group_stop(group);
+			return -3;
 		}
-		break;
-	case ASYNC_CORE_OPTION_MASKDEL:
-		if (sock->mode == ASYNC_CORE_NODE_DGRAM && sock->fd >= 0) {
-			sock->mask &= ~((int)value);
-			hr = ipoll_set(core->pfd, sock->fd, sock->mask);
-		}	else {
-			hr = -30;
+		shard->started = 1;
+	}
+	return 0;
+}
+
+
+/*-------------------------------------------------------------------*/
+/* stop reactor threads                                              */
+/*-------------------------------------------------------------------*/
+void async_group_stop(CAsyncCoreGroup *group)
+{
+	int i;
+	for (i = 0; i < group->count; i++) {
+		group->shards[i].running = 0;
+		async_core_notify(group->shards[i].core);
+	}
+	for (i = 0; i < group->count; i++) {
+		CAsyncShard *shard = &group->shards[i];
+		if (shard->started) {
+			ithread_join(shard->thread);
+			shard->started = 0;
 		}
-		break;
 	}
-	return hr;
 }
 
 
-/* get connection socket status */
-static long _async_core_status(CAsyncCore *core, long hid, int opt)
+/*-------------------------------------------------------------------*/
+/* query                                                             */
+/*-------------------------------------------------------------------*/
+int async_group_count(const CAsyncCoreGroup *group)
+{
+	return group->count;
+}
+
+CAsyncCore* async_group_core(CAsyncCoreGroup *group, int shard)
+{
+	if (shard < 0 || shard >= group->count) return NULL;
+	return group->shards[shard].core;
+}
+
+int async_group_shard(const CAsyncCoreGroup *group, long hid)
 {
-	long hr = -100;
-	CAsyncSock *sock = async_core_node_get(core, hid);
+	long serial;
+	if (hid < 0) return -1;
+	serial = (hid >> 16) & 0x7fff;
+	if (serial <= 0) return -1;
+	return (int)((serial - 1) % group->count);
+}
 
-	if (sock == NULL) return -10;
-	if (sock->fd < 0) return -20;
+void async_group_interval(CAsyncCoreGroup *group, IUINT32 millisec)
+{
+	group->interval = millisec;
+}
 
-	switch (opt) {
-	case ASYNC_CORE_STATUS_STATE:
-		hr = sock->state;
-		break;
-	case ASYNC_CORE_STATUS_IPV6:
-		hr = sock->ipv6;
-		break;
-	case ASYNC_CORE_STATUS_ESTAB:
-		hr = isocket_tcp_estab(sock->fd);
-		break;
-	}
 
-	return hr;
+/*-------------------------------------------------------------------*/
+/* shard access from any thread                                      */
+/*-------------------------------------------------------------------*/
+static CAsyncShard* async_group_enter(CAsyncCoreGroup *group, int index)
+{
+	CAsyncShard *shard;
+	if (index < 0 || index >= group->count) return NULL;
+	shard = &group->shards[index];
+	if (shard->self == ASYNC_GROUP_SELF()) return shard;
+	IMUTEX_LOCK(&shard->gate);
+	if (shard->running) {
+		async_core_notify(shard->core);
+	}
+	return shard;
 }
 
-/* thread safe */
-int async_core_option(CAsyncCore *core, long hid, int opt, long value)
+static void async_group_leave(CAsyncShard *shard)
 {
-	int hr = 0;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	hr = _async_core_option(core, hid, opt, value);
-	ASYNC_CORE_CRITICAL_END(core);
-	return hr;
+	if (shard->self != ASYNC_GROUP_SELF()) {
+		IMUTEX_UNLOCK(&shard->gate);
+	}
 }
 
-/* thread safe */
-long async_core_status(CAsyncCore *core, long hid, int opt)
+static int async_group_pick(CAsyncCoreGroup *group)
 {
-	int hr = 0;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	hr = _async_core_status(core, hid, opt);
-	ASYNC_CORE_CRITICAL_END(core);
-	return hr;
+	int index;
+	IMUTEX_LOCK(&group->lock);
+	index = group->next;
+	group->next = (group->next + 1) % group->count;
+	IMUTEX_UNLOCK(&group->lock);
+	return index;
 }
 
-/* set connection rc4 send key */
-int async_core_rc4_set_skey(CAsyncCore *core, long hid, 
-	const unsigned char *key, int keylen)
+
+/*-------------------------------------------------------------------*/
+/* send data to hid, from any thread                                 */
+/*-------------------------------------------------------------------*/
+long async_group_send(CAsyncCoreGroup *group, long hid, const void *ptr,
+	long len)
 {
-	CAsyncSock *sock;
-	int hr = -1;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get(core, hid);
-	if (sock != NULL) {
-		async_sock_rc4_set_skey(sock, key, keylen);
-		hr = 0;
-	}
-	ASYNC_CORE_CRITICAL_END(core);
+	CAsyncShard *shard = async_group_enter(group, 
+		async_group_shard(group, hid));
+	long hr;
+	if (shard == NULL) return -100;
+	hr = async_core_send(shard->core, hid, ptr, len);
+	async_group_leave(shard);
 	return hr;
 }
 
-/* set connection rc4 recv key */
-int async_core_rc4_set_rkey(CAsyncCore *core, long hid,
-	const unsigned char *key, int keylen)
+long async_group_send_vector(CAsyncCoreGroup *group, long hid,
+	const void * const vecptr[], const long veclen[], int count, int mask)
 {
-	CAsyncSock *sock;
-	int hr = -1;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get(core, hid);
-	if (sock != NULL) {
-		async_sock_rc4_set_rkey(sock, key, keylen);
-		hr = 0;
-	}
-	ASYNC_CORE_CRITICAL_END(core);
+	CAsyncShard *shard = async_group_enter(group, 
+		async_group_shard(group, hid));
+	long hr;
+	if (shard == NULL) return -100;
+	hr = async_core_send_vector(shard->core, hid, vecptr, veclen, 
+		count, mask);
+	async_group_leave(shard);
 	return hr;
 }
 
-/* set default buffer limit and max packet size */
-void async_core_limit(CAsyncCore *core, long limited, long maxsize)
+
+/*-------------------------------------------------------------------*/
+/* close hid, or every shard of a group listener                     */
+/*-------------------------------------------------------------------*/
+int async_group_close(CAsyncCoreGroup *group, long hid, int code)
 {
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	if (limited >= 0) {
-		core->limited = limited;
+	long *hids = NULL;
+	long size, i, k;
+	int hr = -100;
+
+	IMUTEX_LOCK(&group->lock);
+	size = (long)(group->listeners.size / sizeof(long));
+	for (i = 0; i < size; i += group->count) {
+		long *entry = (long*)group->listeners.data + i;
+		if (entry[0] == hid) {
+			hids = (long*)ikmem_malloc(sizeof(long) * group->count);
+			if (hids) {
+				memcpy(hids, entry, sizeof(long) * group->count);
+				memmove(entry, entry + group->count, 
+					sizeof(long) * (size - i - group->count));
+				iv_resize(&group->listeners, 
+					sizeof(long) * (size - group->count));
+			}
+			break;
+		}
 	}
-	if (maxsize >= 0) {
-		core->maxsize = maxsize;
+	IMUTEX_UNLOCK(&group->lock);
+
+	if (hids == NULL) {
+		CAsyncShard *shard = async_group_enter(group, 
+			async_group_shard(group, hid));
+		if (shard == NULL) return -100;
+		hr = async_core_close(shard->core, hid, code);
+		async_group_leave(shard);
+		return hr;
 	}
-	ASYNC_CORE_CRITICAL_END(core);
-}
 
-/* set disable read polling event: 1/on, 0/off */
-int async_core_disable(CAsyncCore *core, long hid, int value)
-{
-	CAsyncSock *sock;
-	int hr = -1;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get(core, hid);
-	if (sock != NULL) {
-		if (value == 0) {
-			hr = async_core_node_mask(core, sock, IPOLL_IN, 0);
+	for (k = 0; k < group->count; k++) {
+		CAsyncShard *shard;
+		if (hids[k] < 0) continue;
+		shard = async_group_enter(group, (int)k);
+		if (k == 0) {
+			hr = async_core_close(shard->core, hids[k], code);
 		}	else {
-			hr = async_core_node_mask(core, sock, 0, IPOLL_IN);;
+			async_core_close(shard->core, hids[k], code);
 		}
+		async_group_leave(shard);
 	}
-	ASYNC_CORE_CRITICAL_END(core);
+	ikmem_free(hids);
+
 	return hr;
 }
 
-/* set remote ip validator */
-void async_core_firewall(CAsyncCore *core, CAsyncValidator v, void *user)
-{
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	core->validator = v;
-	core->user = user;
-	ASYNC_CORE_CRITICAL_END(core);
-}
 
-/* set timeout */
-void async_core_timeout(CAsyncCore *core, long seconds)
+/*-------------------------------------------------------------------*/
+/* listen on every shard with SO_REUSEPORT                           */
+/*-------------------------------------------------------------------*/
+long async_group_new_listen(CAsyncCoreGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header)
 {
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	core->timeout = seconds * 1000;
-	ASYNC_CORE_CRITICAL_END(core);
+	struct sockaddr_in6 local;
+	const struct sockaddr *target = addr;
+	int flag = (header >> 8) & 0xff;
+	long *hids;
+	long hr = -1;
+	int k;
+
+	/* the kernel balances connections across the listening sockets */
+	if (flag & 0x80) {
+		flag |= ISOCK_REUSEPORT;
+	}	else {
+		flag = 0x80 | ISOCK_REUSEPORT | ISOCK_UNIXREUSE;
+	}
+	header = (header & 0xff) | (flag << 8);
+
+	hids = (long*)ikmem_malloc(sizeof(long) * group->count);
+	if (hids == NULL) return -5;
+
+	for (k = 0; k < group->count; k++) {
+		CAsyncShard *shard = async_group_enter(group, k);
+		hids[k] = async_core_new_listen(shard->core, target, addrlen, 
+			header);
+		if (k == 0 && hids[0] >= 0 && addrlen <= (int)sizeof(local)) {
+			/* port 0: remaining shards must bind the same port */
+			int size = addrlen;
+			if (async_core_sockname(shard->core, hids[0],
+				(struct sockaddr*)&local, &size) == 0) {
+				target = (const struct sockaddr*)&local;
+			}
+		}
+		async_group_leave(shard);
+		if (k == 0 && hids[0] < 0) {
+			hr = hids[0];
+			ikmem_free(hids);
+			return hr;
+		}
+	}
+
+	/* without SO_REUSEPORT only the first shard accepts connections */
+	IMUTEX_LOCK(&group->lock);
+	hr = (long)(group->listeners.size);
+	if (iv_resize(&group->listeners, hr + sizeof(long) * group->count)) {
+		hr = -5;
+	}	else {
+		memcpy(group->listeners.data + hr, hids, 
+			sizeof(long) * group->count);
+		hr = hids[0];
+	}
+	IMUTEX_UNLOCK(&group->lock);
+
+	if (hr < 0) {
+		for (k = 0; k < group->count; k++) {
+			CAsyncShard *shard;
+			if (hids[k] < 0) continue;
+			shard = async_group_enter(group, k);
+			async_core_close(shard->core, hids[k], 0);
+			async_group_leave(shard);
+		}
+	}
+
+	ikmem_free(hids);
+
+	return hr;
 }
 
-/* getsockname */
-int async_core_sockname(const CAsyncCore *core, long hid, 
-	struct sockaddr *addr, int *size)
+
+/*-------------------------------------------------------------------*/
+/* connect / assign on the next shard (round robin)                  */
+/*-------------------------------------------------------------------*/
+long async_group_new_connect(CAsyncCoreGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header)
 {
-	const CAsyncSock *sock;
-	int hr = -2;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get_const(core, hid);
-	if (sock != NULL) hr = isockname(sock->fd, addr, size);
-	ASYNC_CORE_CRITICAL_END(core);
+	CAsyncShard *shard = async_group_enter(group, async_group_pick(group));
+	long hr = async_core_new_connect(shard->core, addr, addrlen, header);
+	async_group_leave(shard);
 	return hr;
 }
 
-/* getpeername */
-int async_core_peername(const CAsyncCore *core, long hid,
-	struct sockaddr *addr, int *size)
+long async_group_new_assign(CAsyncCoreGroup *group, int fd, int header,
+	int estab)
 {
-	const CAsyncSock *sock;
-	int hr = -2;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	sock = async_core_node_get_const(core, hid);
-	if (sock != NULL) hr = ipeername(sock->fd, addr, size);
-	ASYNC_CORE_CRITICAL_END(core);
+	CAsyncShard *shard = async_group_enter(group, async_group_pick(group));
+	long hr = async_core_new_assign(shard->core, fd, header, estab);
+	async_group_leave(shard);
 	return hr;
 }
 
-/* get fd count */
-long async_core_nfds(const CAsyncCore *core)
+
+/*-------------------------------------------------------------------*/
+/* post ASYNC_CORE_EVT_PUSH to a shard                               */
+/*-------------------------------------------------------------------*/
+int async_group_post(CAsyncCoreGroup *group, int shard, long wparam, 
+	long lparam, const char *data, long size)
 {
-	long count = 0;
-	ASYNC_CORE_CRITICAL_BEGIN(core);
-	count = core->count;
-	ASYNC_CORE_CRITICAL_END(core);
-	return count;
+	if (shard < 0 || shard >= group->count) return -100;
+	return async_core_post(group->shards[shard].core, wparam, lparam,
+		data, size);
 }
 
 
@@ -2598,6 +5782,246 @@ iulong queue_safe_size(iQueueSafe *q)
 
 
 
+/*===================================================================*/
+/* Concurrent Dictionary                                             */
+/*===================================================================*/
+#define IDICT_CONCURRENT_BATCH	64
+
+/* shard entries are only read after creation, the contended lock and
+ * dict are allocated separately */
+struct IDICTSHARD
+{
+	iRwLockPosix *lock;
+	idict_t *dict;
+};
+
+struct IDICTCONCURRENT
+{
+	struct IDICTSHARD *shards;
+	int count;
+	int shift;
+};
+
+
+/* new dictionary */
+idict_concurrent_t *idict_concurrent_new(int shards)
+{
+	idict_concurrent_t *cd;
+	int i, shift;
+
+	if (shards <= 0) shards = 16;
+	for (shift = 0; (1 << shift) < shards && shift < 16; shift++);
+
+	cd = (idict_concurrent_t*)ikmem_malloc(sizeof(idict_concurrent_t));
+	if (cd == NULL) return NULL;
+
+	cd->count = 1 << shift;
+	cd->shift = shift;
+	cd->shards = (struct IDICTSHARD*)
+		ikmem_malloc(sizeof(struct IDICTSHARD) * cd->count);
+
+	if (cd->shards == NULL) {
+		ikmem_free(cd);
+		return NULL;
+	}
+
+	for (i = 0; i < cd->count; i++) {
+		cd->shards[i].lock = NULL;
+		cd->shards[i].dict = NULL;
+	}
+
+	for (i = 0; i < cd->count; i++) {
+		cd->shards[i].lock = iposix_rwlock_new();
+		cd->shards[i].dict = idict_create_ex(IDICT_FLAT);
+		if (cd->shards[i].lock == NULL || cd->shards[i].dict == NULL) {
+			idict_concurrent_delete(cd);
+			return NULL;
+		}
+	}
+
+	return cd;
+}
+
+/* delete dictionary */
+void idict_concurrent_delete(idict_concurrent_t *cd)
+{
+	int i;
+	assert(cd);
+	for (i = 0; i < cd->count; i++) {
+		if (cd->shards[i].lock) iposix_rwlock_delete(cd->shards[i].lock);
+		if (cd->shards[i].dict) idict_delete(cd->shards[i].dict);
+	}
+	ikmem_free(cd->shards);
+	ikmem_free(cd);
+}
+
+/* reference key with its hash ready, returns the shard index */
+static inline int idict_concurrent_ref(const idict_concurrent_t *cd,
+	ivalue_t *dst, const ivalue_t *key)
+{
+	IUINT32 hash;
+	if (it_type(key) == ITYPE_STR) {
+		it_strref(dst, it_str(key), it_size(key));
+		if (it_rehash(key) == 0) {
+			it_hashstr(dst);
+		}	else {
+			it_hash(dst) = it_hash(key);
+			it_rehash(dst) = 1;
+		}
+	}	else {
+		*dst = *key;
+		it_hash(dst) = (iulong)it_int(dst);
+	}
+	if (cd->shift == 0) return 0;
+	hash = (IUINT32)(it_hash(dst) ^ (it_hash(dst) >> 16)) * 0x9e3779b1ul;
+	return (int)(hash >> (32 - cd->shift));
+}
+
+/* get value */
+int idict_concurrent_get(idict_concurrent_t *cd, const ivalue_t *key,
+	ivalue_t *val)
+{
+	struct IDICTSHARD *shard;
+	ivalue_t kk, *vv;
+	shard = &cd->shards[idict_concurrent_ref(cd, &kk, key)];
+	iposix_rwlock_r_lock(shard->lock);
+	vv = idict_search(shard->dict, &kk, NULL);
+	if (vv) it_cpy(val, vv);
+	iposix_rwlock_r_unlock(shard->lock);
+	return vv? 0 : -1;
+}
+
+/* add or update */
+int idict_concurrent_put(idict_concurrent_t *cd, const ivalue_t *key,
+	const ivalue_t *val)
+{
+	struct IDICTSHARD *shard;
+	ivalue_t kk;
+	ilong hr;
+	shard = &cd->shards[idict_concurrent_ref(cd, &kk, key)];
+	iposix_rwlock_w_lock(shard->lock);
+	hr = idict_update(shard->dict, &kk, val);
+	iposix_rwlock_w_unlock(shard->lock);
+	return (hr < 0)? -1 : 0;
+}
+
+/* delete key */
+int idict_concurrent_del(idict_concurrent_t *cd, const ivalue_t *key)
+{
+	struct IDICTSHARD *shard;
+	ivalue_t kk;
+	int hr;
+	shard = &cd->shards[idict_concurrent_ref(cd, &kk, key)];
+	iposix_rwlock_w_lock(shard->lock);
+	hr = idict_del(shard->dict, &kk);
+	iposix_rwlock_w_unlock(shard->lock);
+	return hr;
+}
+
+/* run a batch: keys are grouped by shard so each shard is locked once,
+ * returns how many keys have been found (get) or stored (put) */
+static int idict_concurrent_batch(idict_concurrent_t *cd, 
+	const ivalue_t *keys, ivalue_t *out, const ivalue_t *in, 
+	int *found, int count)
+{
+	ivalue_t kk[IDICT_CONCURRENT_BATCH];
+	int index[IDICT_CONCURRENT_BATCH];
+	int result = 0, base, i, j;
+
+	for (base = 0; base < count; base += IDICT_CONCURRENT_BATCH) {
+		int size = count - base;
+		if (size > IDICT_CONCURRENT_BATCH) size = IDICT_CONCURRENT_BATCH;
+		for (i = 0; i < size; i++) {
+			index[i] = idict_concurrent_ref(cd, &kk[i], &keys[base + i]);
+		}
+		for (i = 0; i < size; i++) {
+			struct IDICTSHARD *shard;
+			int current = index[i];
+			if (current < 0) continue;
+			shard = &cd->shards[current];
+			if (out) iposix_rwlock_r_lock(shard->lock);
+			else iposix_rwlock_w_lock(shard->lock);
+			for (j = i; j < size; j++) {
+				if (index[j] != current) continue;
+				index[j] = -1;
+				if (out) {
+					ivalue_t *vv = idict_search(shard->dict, &kk[j], NULL);
+					if (vv) {
+						it_cpy(&out[base + j], vv);
+						result++;
+					}
+					if (found) found[base + j] = vv? 1 : 0;
+				}	else {
+					if (idict_update(shard->dict, &kk[j], &in[base + j]) >= 0)
+						result++;
+				}
+			}
+			if (out) iposix_rwlock_r_unlock(shard->lock);
+			else iposix_rwlock_w_unlock(shard->lock);
+		}
+	}
+
+	return result;
+}
+
+/* get many values */
+int idict_concurrent_get_many(idict_concurrent_t *cd, const ivalue_t *keys,
+	ivalue_t *vals, int *found, int count)
+{
+	return idict_concurrent_batch(cd, keys, vals, NULL, found, count);
+}
+
+/* put many pairs */
+int idict_concurrent_put_many(idict_concurrent_t *cd, const ivalue_t *keys,
+	const ivalue_t *vals, int count)
+{
+	return idict_concurrent_batch(cd, keys, NULL, vals, NULL, count);
+}
+
+/* total pairs */
+ilong idict_concurrent_size(idict_concurrent_t *cd)
+{
+	ilong size = 0;
+	int i;
+	for (i = 0; i < cd->count; i++) {
+		size += cd->shards[i].dict->size;
+	}
+	return size;
+}
+
+/* point-in-time copy: shards are read locked in order and held until
+ * the copy is complete, writers only ever hold one shard lock */
+idict_t *idict_concurrent_snapshot(idict_concurrent_t *cd)
+{
+	idict_t *snap = idict_create();
+	int i, failed = 0;
+	if (snap == NULL) return NULL;
+	for (i = 0; i < cd->count; i++) {
+		iposix_rwlock_r_lock(cd->shards[i].lock);
+	}
+	for (i = 0; i < cd->count && failed == 0; i++) {
+		idict_t *dict = cd->shards[i].dict;
+		ilong pos = idict_pos_head(dict);
+		for (; pos >= 0; pos = idict_pos_next(dict, pos)) {
+			if (idict_add(snap, idict_pos_get_key(dict, pos), 
+				idict_pos_get_val(dict, pos)) < 0) {
+				failed = 1;
+				break;
+			}
+		}
+	}
+	for (i = cd->count - 1; i >= 0; i--) {
+		iposix_rwlock_r_unlock(cd->shards[i].lock);
+	}
+	if (failed) {
+		idict_delete(snap);
+		return NULL;
+	}
+	return snap;
+}
+
+
+
 /*-------------------------------------------------------------------*/
 /* PROXY                                                             */
 /*-------------------------------------------------------------------*/
@@ -2620,29 +6044,12 @@ iulong queue_safe_size(iQueueSafe *q)
 /* iproxy_base64 */
 int iproxy_base64(const unsigned char *in, unsigned char *out, int size)
 {
-	const char base64[] = 
-		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-	unsigned char fragment; 
-	unsigned char*saveout = out;
-
-	for (; size >= 3; size -= 3) {
-		*out++ = base64[in[0] >> 2];
-		*out++ = base64[((in[0] << 4) & 0x30) | (in[1] >> 4)];
-		*out++ = base64[((in[1] << 2) & 0x3c) | (in[2] >> 6)];
-		*out++ = base64[in[2] & 0x3f];
-		in += 3;
+	if (size <= 0) {
+		out[0] = '\0';
+		return 0;
 	}
-	if (size > 0) {
-		*out++ = base64[in[0] >> 2];
-		fragment = (in[0] << 4) & 0x30;
-		if (size > 1) fragment |= in[1] >> 4;
-		*out++ = base64[fragment];
-		*out++ = (size < 2) ? '=' : base64[(in[1] << 2) & 0x3c];
-		*out++ = '=';
-	}
-	*out = '\0';
-	return saveout - out;
-};
+	return (int)ibase64_encode(in, size, (char*)out);
+}
 
 
 /* polling */
@@ -51,6 +51,23 @@ int isocket_update_address(int resolvname);
 /*===================================================================*/
 /* CAsyncSock                                                        */
 /*===================================================================*/
+
+/* per connection counters, updated on the reactor thread and left at
+ * zero when compiled with ASYNC_CORE_NO_STATS */
+struct CAsyncSockStats
+{
+	IINT64 bytes_in;				/* bytes received */
+	IINT64 bytes_out;				/* bytes written to the socket */
+	IINT64 msgs_in;					/* packets delivered */
+	IINT64 msgs_out;				/* packets queued for sending */
+	IINT64 recv_calls;				/* recv syscalls */
+	IINT64 send_calls;				/* send syscalls */
+	IINT64 eagain;					/* sends stopped by a full buffer */
+	IINT64 sendq_peak;				/* largest send queue in bytes */
+	IINT64 wblock_ms;				/* time spent waiting for IPOLL_OUT */
+	IUINT32 wblock_since;			/* start of the current wait, or 0 */
+};
+
 struct CAsyncSock
 {
 	IUINT32 time;					/* timeout */
@@ -69,11 +86,23 @@ struct CAsyncSock
 	long bufsize;					/* working buffer size */
 	long maxsize;					/* max packet size */
 	long limited;					/* buffer limited */
+	long hiwater;					/* high watermark, <= 0 disabled */
+	long lowater;					/* low watermark */
 	int rc4_send_x;					/* rc4 encryption variable */
 	int rc4_send_y;					/* rc4 encryption variable */
 	int rc4_recv_x;					/* rc4 encryption variable */
 	int rc4_recv_y;					/* rc4 encryption variable */
-	struct IQUEUEHEAD node;			/* list node */
+	ICHACHA20 *chacha_send;			/* chacha20 send state or NULL */
+	ICHACHA20 *chacha_recv;			/* chacha20 recv state or NULL */
+	long timer;						/* idle timer id */
+	struct IQUEUEHEAD dirty;		/* pending flush list node */
+	struct CAsyncKcp *kcp;			/* kcp session or demux state */
+	struct IQUEUEHEAD bulk;			/* queued sendfile/zerocopy items */
+	struct IQUEUEHEAD zcwait;		/* zerocopy items awaiting release */
+	struct IQUEUEHEAD dgrams;		/* queued datagrams of dgram nodes */
+	long dgram_count;				/* number of queued datagrams */
+	IUINT32 zcseq;					/* next MSG_ZEROCOPY sequence */
+	struct CAsyncSockStats stats;	/* performance counters */
 	struct IMSTREAM linemsg;		/* line buffer */
 	struct IMSTREAM sendmsg;		/* send buffer */
 	struct IMSTREAM recvmsg;		/* recv buffer */
@@ -176,6 +205,15 @@ void async_sock_rc4_set_skey(CAsyncSock *asyncsock,
 void async_sock_rc4_set_rkey(CAsyncSock *asyncsock, 
 	const unsigned char *key, int keylen);
 
+/* set send chacha20 key (32 bytes) and nonce (8 bytes, NULL for zero),
+ * key NULL to disable. returns 0 for success, -1 for out of memory */
+int async_sock_chacha_set_skey(CAsyncSock *asyncsock, 
+	const unsigned char *key, const unsigned char *nonce);
+
+/* set recv chacha20 key and nonce */
+int async_sock_chacha_set_rkey(CAsyncSock *asyncsock, 
+	const unsigned char *key, const unsigned char *nonce);
+
 /* set nodelay */
 int async_sock_nodelay(CAsyncSock *asyncsock, int nodelay);
 
@@ -194,6 +232,26 @@ int async_sock_keepalive(CAsyncSock *asyncsock, int keepcnt, int keepidle,
 struct CAsyncCore;
 typedef struct CAsyncCore CAsyncCore;
 
+/* per core counters, see async_core_stats */
+struct CAsyncCoreStats
+{
+	IINT64 loops;					/* async_core_wait iterations */
+	IINT64 events;					/* poll events handled */
+	IINT64 events_max;				/* most poll events of one wait */
+	IINT64 wait_us;					/* time blocked in the poll device */
+	IINT64 busy_us;					/* time spent processing */
+	IINT64 accepts;					/* connections accepted */
+	IINT64 resizes;					/* working buffer resizes */
+};
+
+/* latency histograms, see async_core_histogram */
+#define ASYNC_CORE_HIST_LOOP     0   /* iteration time, poll wait excluded */
+#define ASYNC_CORE_HIST_DELIVER  1   /* poll return to event push */
+#define ASYNC_CORE_HIST_QUEUE    2   /* event push to async_core_read */
+
+#define ASYNC_CORE_HIST_COUNT    3
+#define ASYNC_CORE_HIST_BUCKETS  464 /* 16 sub-buckets per power of 2 */
+
 #define ASYNC_CORE_EVT_NEW       0   /* new: (hid, tag)   */
 #define ASYNC_CORE_EVT_LEAVE     1   /* leave: (hid, tag) */
 #define ASYNC_CORE_EVT_ESTAB     2   /* estab: (hid, tag) */
@@ -201,6 +259,11 @@ typedef struct CAsyncCore CAsyncCore;
 #define ASYNC_CORE_EVT_PROGRESS  4   /* output progress: (hid, tag) */
 #define ASYNC_CORE_EVT_PUSH      5   /* msg from async_core_push */
 #define ASYNC_CORE_EVT_DGRAM     6   /* raw fd event: (hid, tag) */
+#define ASYNC_CORE_EVT_TIMER     7   /* timer: (timer id, tag) */
+#define ASYNC_CORE_EVT_DATAGRAM  8   /* datagram: (hid, tag) */
+#define ASYNC_CORE_EVT_RELEASE   9   /* bulk released: (hid, cookie) */
+#define ASYNC_CORE_EVT_BLOCKED   10  /* over high watermark: (hid, tag) */
+#define ASYNC_CORE_EVT_WRITABLE  11  /* under low watermark: (hid, tag) */
 
 #define ASYNC_CORE_NODE_IN          1       /* accepted node */
 #define ASYNC_CORE_NODE_OUT         2       /* connected out node */
@@ -208,15 +271,31 @@ typedef struct CAsyncCore CAsyncCore;
 #define ASYNC_CORE_NODE_LISTEN6     4       /* ipv6 listener */
 #define ASYNC_CORE_NODE_ASSIGN      5       /* assigned fd ipv4 */
 #define ASYNC_CORE_NODE_DGRAM       6       /* raw dgram fd */
+#define ASYNC_CORE_NODE_KCP         7       /* kcp session */
+#define ASYNC_CORE_NODE_KCPLISTEN   8       /* kcp listener (udp demux) */
 
 /* Remote IP Validator: returns 1 to accept it, 0 to reject */
 typedef int (*CAsyncValidator)(const struct sockaddr *remote, int len,
 	CAsyncCore *core, long listenhid, void *user);
 
+/* Slow Iteration Tracer: elapsed is the iteration time in microseconds,
+ * hid the node whose events cost the most of it (-1 for timers) */
+typedef void (*CAsyncTracer)(CAsyncCore *core, IUINT32 elapsed, 
+	long hid, IUINT32 cost, void *user);
+
 
 /**
  * create CAsyncCore object:
- * if (flags & 1) disable lock, if (flags & 2) disable notify
+ * if (flags & 1) disable lock, if (flags & 2) disable notify,
+ * if (flags & 4) use edge-triggered polling for connections when the
+ * poll device supports it (epoll, io_uring): IPOLL_OUT stays armed and
+ * send buffers are flushed at the beginning of each async_core_wait.
+ * if (flags & 8) deliver events through a lock-free ring instead of the
+ * mutex protected stream: async_core_read never blocks the reactor, but
+ * must be called from one thread at a time.
+ * if (flags & 16) coalesce sends of every connection by default, see 
+ * ASYNC_CORE_OPTION_COALESCE.
+ * if (flags & 32) measure event latencies, see async_core_histogram.
  */
 CAsyncCore* async_core_new(int flags);
 
@@ -233,6 +312,10 @@ void async_core_wait(CAsyncCore *core, IUINT32 millisec);
 /* wake async_core_wait up, returns zero for success */
 int async_core_notify(CAsyncCore *core);
 
+/* write out the send buffers of coalescing and edge-triggered hids now
+ * instead of at the next async_core_wait */
+void async_core_flush(CAsyncCore *core);
+
 /**
  * read events, returns data length of the message, 
  * and returns -1 for no event, -2 for buffer size too small,
@@ -241,8 +324,17 @@ int async_core_notify(CAsyncCore *core);
 long async_core_read(CAsyncCore *core, int *event, long *wparam,
 	long *lparam, void *data, long size);
 
+/* borrow next event without copying: data points to the payload which
+ * stays valid until async_core_read_release or the next read, large
+ * payloads are always contiguous. returns payload size, or -1 for none */
+long async_core_read_ref(CAsyncCore *core, int *event, long *wparam,
+	long *lparam, const void **data);
+
+/* release the event borrowed by async_core_read_ref */
+void async_core_read_release(CAsyncCore *core);
+
 
-/* send data to given hid */
+/* send data to given hid, dgram hids take async_core_sendto (-300) */
 long async_core_send(CAsyncCore *core, long hid, const void *ptr, long len);
 
 /* close given hid */
@@ -254,6 +346,28 @@ long async_core_send_vector(CAsyncCore *core, long hid,
 	const long veclen[], int count, int mask);
 
 
+/* send (length) bytes of file (fd) from offset with sendfile as one 
+ * packet framed by the hid header. the range is queued in order with 
+ * other sends and ASYNC_CORE_EVT_RELEASE (hid, fd) is emitted once the 
+ * kernel has taken it (or the hid closed), so fd must stay open until
+ * then. returns length, -100 for hid not exist, -200 for closed by the
+ * buffer limit, -300 for unsupported node or a cipher enabled */
+long async_core_send_file(CAsyncCore *core, long hid, int fd, 
+	IINT64 offset, long length);
+
+/* send a buffer with MSG_ZEROCOPY as one packet, ordered like
+ * async_core_send_file. ptr must stay untouched until the kernel 
+ * releases it with ASYNC_CORE_EVT_RELEASE (hid, cookie), whose data is
+ * type (2 bytes lsb, 0:file 1:zerocopy) and status (2 bytes lsb, 0:sent
+ * without copying, 1:copied, 2:dropped by close). small buffers, 
+ * ciphered hids and sockets without SO_ZEROCOPY are copied and released
+ * at once. buffers the kernel still holds when the hid closes are 
+ * released after ASYNC_CORE_EVT_LEAVE, once it is done with them, or
+ * never if the core is deleted first */
+long async_core_send_zerocopy(CAsyncCore *core, long hid, 
+	const void *ptr, long len, long cookie);
+
+
 /* new connection to the target address, returns hid */
 long async_core_new_connect(CAsyncCore *core, const struct sockaddr *addr,
 	int addrlen, int header);
@@ -265,16 +379,54 @@ long async_core_new_listen(CAsyncCore *core, const struct sockaddr *addr,
 /* new assign to a existing socket, returns hid */
 long async_core_new_assign(CAsyncCore *core, int fd, int header, int estab);
 
-/* new dgram fd: mask=0:none, 1:read, 2:write, 3:r+w */
+/* new dgram fd: mask=0:none, 1:read, 2:write, 3:r+w, 
+ * if (mode & ASYNC_CORE_DGRAM_BATCH) the socket is non-blocking and the 
+ * core drains it with recvmmsg: each datagram is delivered as an 
+ * ASYNC_CORE_EVT_DATAGRAM event whose data is addrlen (2 bytes lsb),
+ * the source sockaddr (addrlen bytes) and then the payload. */
 long async_core_new_dgram(CAsyncCore *core, const struct sockaddr *addr,
 	int addrlen, int mode);
 
+#define ASYNC_CORE_DGRAM_BATCH   0x10000
+
+/* send datagrams on a dgram hid with sendmmsg, addrs can be NULL for a 
+ * connected socket. datagrams refused by the kernel are queued and sent 
+ * when the socket becomes writable. returns datagrams accepted. */
+long async_core_sendto_batch(CAsyncCore *core, long hid,
+	const void * const vecptr[], const long veclen[],
+	const struct sockaddr * const addrs[], const int addrlens[], 
+	int count);
+
+
+/* new kcp listener on a udp address, (mode >> 8) & 0xff are the udp 
+ * socket flags as in async_core_new_dgram. packets are demultiplexed by
+ * conv: the first valid packet of an unknown conv creates a session hid
+ * (ASYNC_CORE_NODE_KCP) and emits ASYNC_CORE_EVT_NEW (hid, listen_hid).
+ * sessions use async_core_send / ASYNC_CORE_EVT_DATA like tcp hids, and
+ * are closed with code 2008 on dead link or 2009 when the listener goes */
+long async_core_new_kcp_listen(CAsyncCore *core, 
+	const struct sockaddr *addr, int addrlen, int mode);
+
+/* new kcp session to the remote address on its own udp socket, emits 
+ * ASYNC_CORE_EVT_NEW and ASYNC_CORE_EVT_ESTAB at once, returns hid */
+long async_core_new_kcp_connect(CAsyncCore *core, 
+	const struct sockaddr *addr, int addrlen, IUINT32 conv);
+
+/* ikcp_nodelay for a kcp session, or defaults of a kcp listener for 
+ * sessions created later. negative values are left unchanged */
+int async_core_kcp_nodelay(CAsyncCore *core, long hid, int nodelay, 
+	int interval, int resend, int nc);
+
+/* ikcp_wndsize and ikcp_setmtu, same rules as async_core_kcp_nodelay */
+int async_core_kcp_window(CAsyncCore *core, long hid, int sndwnd,
+	int rcvwnd, int mtu);
+
 
 /* queue an ASYNC_CORE_EVT_PUSH event and wake async_core_wait up */
 int async_core_post(CAsyncCore *core, long wparam, long lparam, 
 	const char *data, long size);
 
-/* get node mode: ASYNC_CORE_NODE_IN/OUT/LISTEN4/LISTEN6/ASSIGN */
+/* get node mode: ASYNC_CORE_NODE_IN/OUT/LISTEN4/LISTEN6/ASSIGN/... */
 int async_core_get_mode(const CAsyncCore *core, long hid);
 
 /* returns connection tag, -1 for hid not exist */
@@ -319,6 +471,20 @@ long async_core_node_prev(const CAsyncCore *core, long hid);
 #define ASYNC_CORE_OPTION_MASKGET       14
 #define ASYNC_CORE_OPTION_MASKADD       15
 #define ASYNC_CORE_OPTION_MASKDEL       16
+#define ASYNC_CORE_OPTION_COALESCE      17
+#define ASYNC_CORE_OPTION_HIWATER       18
+#define ASYNC_CORE_OPTION_LOWATER       19
+
+/* ASYNC_CORE_OPTION_COALESCE: 1 makes sends only append to the buffer,
+ * the hid is written once with a gather write when async_core_wait 
+ * starts or finishes its iteration, or on async_core_flush. */
+
+/* ASYNC_CORE_OPTION_HIWATER / LOWATER: once the queued bytes reach the
+ * high watermark ASYNC_CORE_EVT_BLOCKED is emitted, and when they fall 
+ * to the low watermark ASYNC_CORE_EVT_WRITABLE follows, both carry the 
+ * queued bytes (4 bytes lsb). ASYNC_CORE_OPTION_LIMITED still closes
+ * the hid with 2007. accepted hids inherit them from the listener. kcp
+ * sessions count ikcp_waitsnd() segments times mss as queued bytes. */
 
 /* set connection socket option */
 int async_core_option(CAsyncCore *core, long hid, int opt, long value);
@@ -326,10 +492,51 @@ int async_core_option(CAsyncCore *core, long hid, int opt, long value);
 #define ASYNC_CORE_STATUS_STATE     0
 #define ASYNC_CORE_STATUS_IPV6      1
 #define ASYNC_CORE_STATUS_ESTAB     2
+#define ASYNC_CORE_STATUS_QUEUED    3   /* bytes queued for sending */
+#define ASYNC_CORE_STATUS_BLOCKED   4   /* 1 between BLOCKED/WRITABLE */
+#define ASYNC_CORE_STATUS_BYTES_IN  5   /* CAsyncSockStats fields */
+#define ASYNC_CORE_STATUS_BYTES_OUT 6
+#define ASYNC_CORE_STATUS_MSGS_IN   7
+#define ASYNC_CORE_STATUS_MSGS_OUT  8
+#define ASYNC_CORE_STATUS_RECVCALL  9
+#define ASYNC_CORE_STATUS_SENDCALL  10
+#define ASYNC_CORE_STATUS_EAGAIN    11
+#define ASYNC_CORE_STATUS_SENDPEAK  12
+#define ASYNC_CORE_STATUS_WBLOCKMS  13
 
 /* get connection socket status */
 long async_core_status(CAsyncCore *core, long hid, int opt);
 
+/* copy counters of the hid, returns 0 for success, -1 for not exist */
+int async_core_stats_node(CAsyncCore *core, long hid, 
+	struct CAsyncSockStats *stats);
+
+/* copy counters of up to count hids in node order under one lock, 
+ * returns the number of hids written into hids[] and stats[] */
+long async_core_stats_snapshot(CAsyncCore *core, long *hids, 
+	struct CAsyncSockStats *stats, long count);
+
+/* copy the core counters */
+void async_core_stats(CAsyncCore *core, struct CAsyncCoreStats *stats);
+
+/* copy latency histogram (ASYNC_CORE_HIST_*) without locking, needs
+ * async_core_new(flags & 32). returns buckets copied, -1 if disabled */
+int async_core_histogram(const CAsyncCore *core, int which, 
+	IUINT32 *buckets, int count);
+
+/* lower bound of a histogram bucket in microseconds */
+IUINT32 async_core_histogram_value(int index);
+
+/* value below which permille/1000 of the samples fall */
+IUINT32 async_core_histogram_quantile(const IUINT32 *buckets, int count,
+	int permille);
+
+/* call tracer after iterations slower than threshold microseconds,
+ * from the reactor thread with the core locked: it must not call back
+ * into the core. threshold 0 or tracer NULL to disable */
+void async_core_trace(CAsyncCore *core, IUINT32 threshold, 
+	CAsyncTracer tracer, void *user);
+
 /* set connection rc4 send key */
 int async_core_rc4_set_skey(CAsyncCore *core, long hid, 
 	const unsigned char *key, int keylen);
@@ -338,6 +545,17 @@ int async_core_rc4_set_skey(CAsyncCore *core, long hid,
 int async_core_rc4_set_rkey(CAsyncCore *core, long hid,
 	const unsigned char *key, int keylen);
 
+/* set connection chacha20 send key (32 bytes) and nonce (8 bytes, NULL 
+ * for zero), key NULL to disable. a key must never be used twice with
+ * the same nonce, so each direction of each link needs its own pair.
+ * returns 0 for success, -1 for hid not exist, -2 for out of memory */
+int async_core_chacha_set_skey(CAsyncCore *core, long hid, 
+	const unsigned char *key, const unsigned char *nonce);
+
+/* set connection chacha20 recv key and nonce */
+int async_core_chacha_set_rkey(CAsyncCore *core, long hid,
+	const unsigned char *key, const unsigned char *nonce);
+
 /* set remote ip validator */
 void async_core_firewall(CAsyncCore *core, CAsyncValidator v, void *user);
 
@@ -348,13 +566,95 @@ void async_core_timeout(CAsyncCore *core, long seconds);
 int async_core_sockname(const CAsyncCore *core, long hid, 
 	struct sockaddr *addr, int *size);
 
-/* getpeername */
+/* getpeername, for kcp sessions accepted by a listener it returns the
+   address the session currently sends to */
 int async_core_peername(const CAsyncCore *core, long hid,
 	struct sockaddr *addr, int *size);
 
 /* get fd count */
 long async_core_nfds(const CAsyncCore *core);
 
+/* add a timer which queues ASYNC_CORE_EVT_TIMER (wparam=timer id, 
+ * lparam=tag) after delay ms, repeats every delay ms if periodic is
+ * nonzero. returns timer id (>=0) for success */
+long async_core_timer_add(CAsyncCore *core, IUINT32 delay, int periodic,
+	long tag);
+
+/* remove timer, returns zero for success */
+int async_core_timer_del(CAsyncCore *core, long id);
+
+
+/*===================================================================*/
+/* CAsyncCoreGroup: N CAsyncCore reactors on N threads               */
+/*===================================================================*/
+struct CAsyncCoreGroup;
+typedef struct CAsyncCoreGroup CAsyncCoreGroup;
+
+#ifndef ASYNC_GROUP_MAX
+#define ASYNC_GROUP_MAX		256
+#endif
+
+/* event handler, called on the reactor thread owning the hid */
+typedef void (*CAsyncGroupHandler)(void *user, int shard, int event, 
+	long wparam, long lparam, const void *data, long size);
+
+/* create a group of count cores (flags as async_core_new, except 
+ * lock and notify are always enabled). hids encode their shard, so
+ * async_group_send/close can be called from any thread. */
+CAsyncCoreGroup* async_group_new(int count, int flags);
+
+/* stop threads and delete the group */
+void async_group_delete(CAsyncCoreGroup *group);
+
+/* start one reactor thread per core: async_core_wait/read run there
+ * and events are dispatched to handler, returns zero for success */
+int async_group_start(CAsyncCoreGroup *group, CAsyncGroupHandler handler,
+	void *user);
+
+/* stop and join reactor threads */
+void async_group_stop(CAsyncCoreGroup *group);
+
+/* get core count */
+int async_group_count(const CAsyncCoreGroup *group);
+
+/* get core of the given shard */
+CAsyncCore* async_group_core(CAsyncCoreGroup *group, int shard);
+
+/* get shard index of a hid, returns -1 for invalid hid */
+int async_group_shard(const CAsyncCoreGroup *group, long hid);
+
+/* set max wait time of reactor threads (default 100ms) */
+void async_group_interval(CAsyncCoreGroup *group, IUINT32 millisec);
+
+/* send data to hid */
+long async_group_send(CAsyncCoreGroup *group, long hid, const void *ptr,
+	long len);
+
+/* send vector to hid */
+long async_group_send_vector(CAsyncCoreGroup *group, long hid,
+	const void * const vecptr[], const long veclen[], int count, int mask);
+
+/* close hid, closes every shard when hid is from async_group_new_listen */
+int async_group_close(CAsyncCoreGroup *group, long hid, int code);
+
+/* open a SO_REUSEPORT listener on every shard, returns the hid on shard
+ * zero which stands for all of them. without SO_REUSEPORT support only
+ * shard zero accepts connections. */
+long async_group_new_listen(CAsyncCoreGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header);
+
+/* new connection on the next shard (round robin) */
+long async_group_new_connect(CAsyncCoreGroup *group, 
+	const struct sockaddr *addr, int addrlen, int header);
+
+/* assign a connected fd to the next shard (round robin) */
+long async_group_new_assign(CAsyncCoreGroup *group, int fd, int header,
+	int estab);
+
+/* queue an ASYNC_CORE_EVT_PUSH event to the given shard */
+int async_group_post(CAsyncCoreGroup *group, int shard, long wparam, 
+	long lparam, const char *data, long size);
+
 
 
 /*===================================================================*/
@@ -395,6 +695,51 @@ int queue_safe_peek_vec(iQueueSafe *q, void *vecptr[], int count,
 iulong queue_safe_size(iQueueSafe *q);
 
 
+/*===================================================================*/
+/* Concurrent Dictionary: keys striped over rwlocked idict shards    */
+/*===================================================================*/
+struct IDICTCONCURRENT;
+typedef struct IDICTCONCURRENT idict_concurrent_t;
+
+/* new dictionary with shards rounded up to a power of two (<= 0 for 
+   the default of 16), shards use the flat layout so that lookups 
+   never write to a shard and can share its read lock */
+idict_concurrent_t *idict_concurrent_new(int shards);
+
+/* delete dictionary */
+void idict_concurrent_delete(idict_concurrent_t *cd);
+
+/* copy the value of key into val (must be it_init-ed by the caller), 
+   returns 0 for success, -1 for not find */
+int idict_concurrent_get(idict_concurrent_t *cd, const ivalue_t *key, 
+	ivalue_t *val);
+
+/* add or update (key, val), returns 0 for success, -1 for no memory */
+int idict_concurrent_put(idict_concurrent_t *cd, const ivalue_t *key,
+	const ivalue_t *val);
+
+/* delete key, returns 0 for success, -1 for not find */
+int idict_concurrent_del(idict_concurrent_t *cd, const ivalue_t *key);
+
+/* get many values, each shard is locked once per batch. found[i] (can
+   be NULL) is set to 1 or 0, returns how many keys have been found */
+int idict_concurrent_get_many(idict_concurrent_t *cd, const ivalue_t *keys,
+	ivalue_t *vals, int *found, int count);
+
+/* put many pairs, returns how many pairs have been stored */
+int idict_concurrent_put_many(idict_concurrent_t *cd, const ivalue_t *keys,
+	const ivalue_t *vals, int count);
+
+/* total pairs, only a hint while other threads are writing */
+ilong idict_concurrent_size(idict_concurrent_t *cd);
+
+/* copy every pair into a private idict while all shards are read 
+   locked, iterate it with idict_pos_head/next and free it with 
+   idict_delete. returns NULL for no memory */
+idict_t *idict_concurrent_snapshot(idict_concurrent_t *cd);
+
+
+
 
 /*-------------------------------------------------------------------*/
 /* PROXY                                                             */
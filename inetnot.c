@@ -8,6 +8,7 @@
 //=====================================================================
 #include "inetcode.h"
 #include "inetnot.h"
+#include "isecure.h"
 
 #include <time.h>
 #include <stdarg.h>
@@ -31,6 +32,7 @@ struct CAsyncConfig
 	int buffer_limit;
 	int sign_timeout;
 	int retry_seconds;
+	int cipher;
 };
 
 
@@ -48,9 +50,16 @@ struct CAsyncNode
 	int rtt;
 	long ts_ping;
 	long ts_idle;
+	ICHACHA20 *cipher_send;	// DATA payload cipher, NULL for plain
+	ICHACHA20 *cipher_recv;
+	unsigned char cipher_prk[20];	// login secret until LOGINACK
 };
 
 
+// initiator salts remembered by listeners to refuse replayed logins
+#define ASYNC_NOTIFY_SALTS		4096
+
+
 //---------------------------------------------------------------------
 // CAsyncNotify
 //---------------------------------------------------------------------
@@ -87,12 +96,15 @@ struct CAsyncNotify
 	IMUTEX_TYPE lock;			// internal lock
 	CAsyncCore *core;			// AsyncCore object
 	struct CAsyncConfig cfg;	// configuration
+	int salt_pos;				// next slot in salts
+	int salt_count;				// used slots in salts
+	char salts[ASYNC_NOTIFY_SALTS][8];	// recent initiator salts
 };
 
 
 // message: msgid(16bits), cmd(16bits), data
-#define ASYNC_NOTIFY_MSG_LOGIN		0x6801	// (selfid, remoteid, ts, sign)
-#define ASYNC_NOTIFY_MSG_LOGINACK	0x6802	// (selfid, remoteid, ts, sign)
+#define ASYNC_NOTIFY_MSG_LOGIN		0x6801	// (selfid, remoteid, ts, sign, salt)
+#define ASYNC_NOTIFY_MSG_LOGINACK	0x6802	// (salt) for ciphers
 #define ASYNC_NOTIFY_MSG_DATA		0x6803	// (data)
 #define ASYNC_NOTIFY_MSG_PING		0x6804	// (millisec)
 #define ASYNC_NOTIFY_MSG_PACK		0x6805	// (millisec)
@@ -127,8 +139,10 @@ static void async_notify_on_timer(CAsyncNotify *notify);
 static int async_notify_firewall(const struct sockaddr *remote, int len,
 	CAsyncCore *core, long listenhid, void *user);
 
-static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node);
-static void async_notify_cmd_logack(CAsyncNotify *notify, CAsyncNode *node);
+static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node,
+	long length);
+static void async_notify_cmd_logack(CAsyncNotify *notify, CAsyncNode *node,
+	long length);
 static void async_notify_cmd_data(CAsyncNotify *notify, CAsyncNode *node,
 	char *data, long length);
 
@@ -164,6 +178,8 @@ static CAsyncNode *async_notify_node_new(CAsyncNotify *notify, long hid)
 	iqueue_init(&node->node_idle);
 	node->ts_ping = notify->seconds;
 	node->ts_idle = notify->seconds;
+	node->cipher_send = NULL;
+	node->cipher_recv = NULL;
 	notify->count_node++;
 	return node;
 }
@@ -182,6 +198,10 @@ static int async_notify_node_del(CAsyncNotify *notify, long hid)
 	if (!iqueue_is_empty(&node->node_idle)) {
 		iqueue_del_init(&node->node_idle);
 	}
+	if (node->cipher_send) ikmem_free(node->cipher_send);
+	if (node->cipher_recv) ikmem_free(node->cipher_recv);
+	node->cipher_send = NULL;
+	node->cipher_recv = NULL;
 	notify->count_node--;
 	return 0;
 }
@@ -400,6 +420,8 @@ CAsyncNotify* async_notify_new(int serverid)
 	notify->count_node = 0;
 	notify->count_in = 0;
 	notify->count_out = 0;
+	notify->salt_pos = 0;
+	notify->salt_count = 0;
 	notify->msgcnt = 0;
 	notify->evtmask = 0;
 	notify->lastsec = -1;
@@ -435,6 +457,8 @@ CAsyncNotify* async_notify_new(int serverid)
 	for (i = 0; i < 0x10000; i++) {
 		notify->nodes[i].hid = -1;
 		notify->nodes[i].mode = -1;
+		notify->nodes[i].cipher_send = NULL;
+		notify->nodes[i].cipher_recv = NULL;
 		notify->sid2hid[i] = -1;
 	}
 
@@ -450,6 +474,7 @@ CAsyncNotify* async_notify_new(int serverid)
 	notify->cfg.buffer_limit = -1;
 	notify->cfg.sign_timeout = -1;
 	notify->cfg.retry_seconds = -1;
+	notify->cfg.cipher = 0;
 
 	async_core_firewall(notify->core, async_notify_firewall, notify);
 	async_core_limit(notify->core, 0x400000, 0x200000);
@@ -477,6 +502,12 @@ void async_notify_delete(CAsyncNotify *notify)
 	}
 	
 	if (notify->nodes) {
+		int i;
+		for (i = 0; i < 0x10000; i++) {
+			CAsyncNode *node = &notify->nodes[i];
+			if (node->cipher_send) ikmem_free(node->cipher_send);
+			if (node->cipher_recv) ikmem_free(node->cipher_recv);
+		}
 		ikmem_free(notify->nodes);
 		notify->nodes = NULL;
 	}
@@ -1094,11 +1125,11 @@ static void async_notify_on_data(CAsyncNotify *notify, long hid, long tag,
 
 	switch (mid) {
 	case ASYNC_NOTIFY_MSG_LOGIN: 
-		async_notify_cmd_login(notify, node);
+		async_notify_cmd_login(notify, node, length);
 		break;
 
 	case ASYNC_NOTIFY_MSG_LOGINACK: 
-		async_notify_cmd_logack(notify, node);
+		async_notify_cmd_logack(notify, node, length);
 		break;
 
 	case ASYNC_NOTIFY_MSG_DATA:	
@@ -1127,18 +1158,85 @@ static void async_notify_on_data(CAsyncNotify *notify, long hid, long tag,
 	}
 }
 
+// login secret of the DATA payload ciphers: hmac-sha1 keyed by token
+// over login (header, sids, ts) and the initiator salt
+static void async_notify_cipher_prk(CAsyncNotify *notify, CAsyncNode *node,
+	const char *login, const char *salt)
+{
+	char src[28];
+	memcpy(src, login, 20);
+	memcpy(src + 20, salt, 8);
+	hash_hmac_sha1(it_str(&notify->token), (size_t)it_size(&notify->token),
+		src, 28, node->cipher_prk);
+}
+
+// init one direction of DATA payload ciphers, the key expands from the
+// login secret (hkdf style). out to in only takes the initiator salt so
+// DATA can follow LOGIN at once; in to out also takes the fresh salt of
+// LOGINACK, a replayed LOGIN never makes the listener reuse a keystream
+static int async_notify_cipher_init(CAsyncNode *node, int inbound,
+	const char *lsalt)
+{
+	unsigned char key[40];
+	unsigned char src[20 + 18];
+	unsigned char nonce[8];
+	ICHACHA20 **cipher;
+	int size = 1;
+	int out = (node->mode == ASYNC_CORE_NODE_OUT)? 1 : 0;
+	src[20] = inbound? 'i' : 'o';
+	if (lsalt != NULL) {
+		memcpy(src + 21, lsalt, 16);
+		size += 16;
+	}
+	src[20 + size] = 1;
+	hash_hmac_sha1(node->cipher_prk, 20, src + 20, size + 1, key);
+	memcpy(src, key, 20);
+	src[20 + size] = 2;
+	hash_hmac_sha1(node->cipher_prk, 20, src, 20 + size + 1, key + 20);
+	cipher = (out != inbound)? &node->cipher_send : &node->cipher_recv;
+	if (cipher[0] == NULL) 
+		cipher[0] = (ICHACHA20*)ikmem_malloc(sizeof(ICHACHA20));
+	if (cipher[0] == NULL) return -1;
+	memset(nonce, 0, sizeof(nonce));
+	icrypt_chacha20_init(cipher[0], key, nonce, 0);
+	memset(key, 0, sizeof(key));
+	if (inbound) memset(node->cipher_prk, 0, 20);
+	return 0;
+}
+
+// remember an initiator salt, returns -1 if it has been seen already
+static int async_notify_salt_check(CAsyncNotify *notify, const char *salt)
+{
+	int i;
+	for (i = 0; i < notify->salt_count; i++) {
+		if (memcmp(notify->salts[i], salt, 8) == 0) return -1;
+	}
+	memcpy(notify->salts[notify->salt_pos], salt, 8);
+	notify->salt_pos = (notify->salt_pos + 1) % ASYNC_NOTIFY_SALTS;
+	if (notify->salt_count < ASYNC_NOTIFY_SALTS) notify->salt_count++;
+	return 0;
+}
+
 // invoked when received a login request
-static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node)
+static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node,
+	long length)
 {
 	char *data = notify->data;
 	IUINT32 sid1, sid2;
 	char md5src[33];
 	char md5dst[33];
+	char login[28];
+	char lsalt[16];
 	IINT64 ts;
 	long seconds;
 	long hid = node->hid;
 	long hid2 = -1;
-	int size;
+	int size, mid, cipher;
+
+	async_notify_header_read(data, &mid, &cipher);
+	memcpy(login, data, 20);
+	memset(login + 20, 0, 8);
+	if (length >= 60) memcpy(login + 20, data + 52, 8);
 
 	idecode32u_lsb(data + 4, &sid1);
 	idecode32u_lsb(data + 8, &sid2);
@@ -1180,6 +1278,18 @@ static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node)
 		return;
 	}
 
+	// ciphers need a token and a salt, and a listener using them
+	// refuses plain logins
+	if ((cipher != 0 && (size <= 0 || length < 60)) || 
+		(cipher == 0 && notify->cfg.cipher != 0)) {
+		async_notify_header_write(data, ASYNC_NOTIFY_MSG_LOGINACK, 6);
+		async_core_send(notify->core, hid, data, 4);
+		async_core_close(notify->core, hid, 8006);
+		async_notify_log(notify, ASYNC_NOTIFY_LOG_WARNING,
+			"[WARNING] error login for hid=%lx: cipher mismatch", hid);
+		return;
+	}
+
 	if (size > 0) {
 		if (memcmp(md5src, md5dst, 32) != 0) {
 			async_notify_header_write(data, ASYNC_NOTIFY_MSG_LOGINACK, 1);
@@ -1205,6 +1315,16 @@ static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node)
 		}
 	}
 
+	// the initiator salt is random, seeing it twice means a replay
+	if (cipher != 0 && async_notify_salt_check(notify, login + 20) != 0) {
+		async_notify_header_write(data, ASYNC_NOTIFY_MSG_LOGINACK, 7);
+		async_core_send(notify->core, hid, data, 4);
+		async_core_close(notify->core, hid, 8008);
+		async_notify_log(notify, ASYNC_NOTIFY_LOG_WARNING,
+			"[WARNING] error login for hid=%lx: replayed salt", hid);
+		return;
+	}
+
 	hid2 = async_notify_get(notify, ASYNC_CORE_NODE_IN, sid1);
 
 	// already an existent connection for remote server
@@ -1222,13 +1342,30 @@ static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node)
 			hid, hid2, sid1);
 	}
 
+	if (cipher != 0) {
+		async_notify_cipher_prk(notify, node, login, login + 20);
+		if (irandom_bytes(lsalt, 16) != 0 ||
+			async_notify_cipher_init(node, 0, NULL) != 0 ||
+			async_notify_cipher_init(node, 1, lsalt) != 0) {
+			async_core_close(notify->core, hid, 8007);
+			async_notify_log(notify, ASYNC_NOTIFY_LOG_ERROR,
+				"[ERROR] cipher failed for hid=%lx", hid);
+			return;
+		}
+	}
+
 	node->sid = sid1;
 	node->state = ASYNC_NOTIFY_STATE_LOGINED;
 	async_notify_set(notify, ASYNC_CORE_NODE_IN, sid1, hid);
 
-	// send back login ack
+	// send back login ack, with the listener salt for ciphers
 	async_notify_header_write(data, ASYNC_NOTIFY_MSG_LOGINACK, 0);
-	async_core_send(notify->core, hid, data, 4);
+	if (cipher == 0) {
+		async_core_send(notify->core, hid, data, 4);
+	}	else {
+		memcpy(data + 4, lsalt, 16);
+		async_core_send(notify->core, hid, data, 4 + 16);
+	}
 
 	if (notify->evtmask & ASYNC_NOTIFY_EVT_NEW_IN) {
 		async_notify_msg_push(notify, ASYNC_NOTIFY_EVT_NEW_IN,
@@ -1239,7 +1376,8 @@ static void async_notify_cmd_login(CAsyncNotify *notify, CAsyncNode *node)
 		"login from remote successful: hid=%lx sid=%d", hid, sid1);
 }
 
-static void async_notify_cmd_logack(CAsyncNotify *notify, CAsyncNode *node)
+static void async_notify_cmd_logack(CAsyncNotify *notify, CAsyncNode *node,
+	long length)
 {
 	char *data = notify->data;
 	int mid, cmd;
@@ -1256,6 +1394,16 @@ static void async_notify_cmd_logack(CAsyncNotify *notify, CAsyncNode *node)
 			node->hid, node->sid, cmd);
 		return;
 	}
+	if (node->cipher_send != NULL) {
+		if (length < 4 + 16 || 
+			async_notify_cipher_init(node, 1, data + 4) != 0) {
+			async_core_close(notify->core, node->hid, 8120);
+			async_notify_log(notify, ASYNC_NOTIFY_LOG_WARNING, 
+				"[WARNING] login error for hid=%lx sid=%d: no cipher salt",
+				node->hid, node->sid);
+			return;
+		}
+	}
 	node->state = ASYNC_NOTIFY_STATE_LOGINED;
 	async_notify_black_set(notify, node->sid, 0);
 
@@ -1284,6 +1432,11 @@ static void async_notify_cmd_data(CAsyncNotify *notify, CAsyncNode *node,
 		return;
 	}
 
+	if (node->cipher_recv != NULL && length > 4) {
+		icrypt_chacha20_crypt(node->cipher_recv, (unsigned char*)data + 4,
+			(unsigned char*)data + 4, length - 4);
+	}
+
 	// push message
 	async_notify_msg_push(notify, ASYNC_NOTIFY_EVT_DATA, node->sid,
 		cmd, data + 4, length - 4);
@@ -1429,6 +1582,7 @@ static long async_notify_get_connection(CAsyncNotify *notify, int sid)
 	char *data;
 	char remote[128];
 	char signature[64];
+	char login[28];
 	struct sockaddr *rmt = (struct sockaddr*)remote;
 	long hid, hr, seconds;
 	int keysize;
@@ -1493,9 +1647,11 @@ static long async_notify_get_connection(CAsyncNotify *notify, int sid)
 	// add sid2hid map
 	async_notify_set(notify, ASYNC_CORE_NODE_OUT, sid, hid);
 	
-	// build login message: (selfid, remoteid, ts, sign)
+	// build login message: (selfid, remoteid, ts, sign, salt)
 	data = notify->data;
-	async_notify_header_write(data, ASYNC_NOTIFY_MSG_LOGIN, 0);
+	keysize = it_size(&notify->token);
+	async_notify_header_write(data, ASYNC_NOTIFY_MSG_LOGIN, 
+		(notify->cfg.cipher != 0 && keysize > 0)? 1 : 0);
 
 	iencode32u_lsb(data + 4, (IUINT32)notify->sid);
 	iencode32u_lsb(data + 8, (IUINT32)sid);
@@ -1503,16 +1659,31 @@ static long async_notify_get_connection(CAsyncNotify *notify, int sid)
 	itimeofday(&seconds, NULL);
 	async_notify_encode_64(data + 12, (IINT64)seconds);
 
-	keysize = it_size(&notify->token);
+	// random salt keeps ciphers of every login apart
+	memcpy(login, data, 20);
+	if (irandom_bytes(login + 20, 8) != 0) {
+		iencode32u_lsb(login + 20, (IUINT32)hid);
+		iencode32u_lsb(login + 24, (IUINT32)iclockrt());
+	}
+
 	memcpy(data + 20, it_str(&notify->token), keysize);
 
 	// calculate hash signature
 	memset(signature, 0, 32);
 	async_notify_hash(data, 20 + keysize, signature);
 	memcpy(data + 20, signature, 32);
+	memcpy(data + 52, login + 20, 8);
+
+	if (notify->cfg.cipher != 0 && keysize > 0) {
+		async_notify_cipher_prk(notify, node, login, login + 20);
+		if (async_notify_cipher_init(node, 0, NULL) != 0) {
+			async_core_close(notify->core, hid, 8007);
+			return -5;
+		}
+	}
 
 	// post login message
-	async_core_send(notify->core, hid, data, 20 + 32);
+	async_core_send(notify->core, hid, data, 20 + 32 + 8);
 
 	// post ping message: (millisec)
 	async_notify_header_write(data, ASYNC_NOTIFY_MSG_PING, 0);
@@ -1546,16 +1717,33 @@ int async_notify_send(CAsyncNotify *notify, int sid, short cmd,
 
 	// check if connection for remote server exists
 	if (hid >= 0) {	
+		CAsyncNode *node = async_notify_node_get(notify, hid);
 		const void *vecptr[2];
 		long veclen[2];
-		char *head = notify->data;
-		vecptr[0] = head;
+		char *head;
 		vecptr[1] = data;
-		veclen[0] = 4;
 		veclen[1] = size;
+		if (node != NULL && node->cipher_send != NULL && size > 0) {
+			if (async_notify_data_resize(notify, size + 4) == 0) {
+				icrypt_chacha20_crypt(node->cipher_send, 
+					(const unsigned char*)data, 
+					(unsigned char*)notify->data + 4, size);
+				vecptr[1] = notify->data + 4;
+			}	else {
+				vecptr[1] = NULL;
+			}
+		}
+		head = notify->data;
+		vecptr[0] = head;
+		veclen[0] = 4;
 		async_notify_header_write(head, ASYNC_NOTIFY_MSG_DATA, cmd);
-		x = async_core_send_vector(notify->core, hid, vecptr, veclen, 2, 0);
-		if (x < 0) hr = -1000 + x;
+		if (vecptr[1] != NULL) {
+			x = async_core_send_vector(notify->core, hid, vecptr, veclen,
+				2, 0);
+			if (x < 0) hr = -1000 + x;
+		}	else {
+			hr = -7;
+		}
 		// update idle time
 		async_notify_node_active(notify, hid, 1);
 	}	else {
@@ -1721,6 +1909,11 @@ int async_notify_option(CAsyncNotify *notify, int type, long value)
 	case ASYNC_NOTIFY_OPT_GET_IN_COUNT:
 		hr = notify->count_in;
 		break;
+
+	case ASYNC_NOTIFY_OPT_CIPHER:
+		notify->cfg.cipher = (int)value;
+		hr = 0;
+		break;
 	}
 	ASYNC_NOTIFY_CRITICAL_END(notify);
 	return hr;
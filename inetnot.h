@@ -122,6 +122,7 @@ void async_notify_sid_clear(CAsyncNotify *notify);
 #define ASYNC_NOTIFY_OPT_GET_PING			12
 #define ASYNC_NOTIFY_OPT_GET_OUT_COUNT		13
 #define ASYNC_NOTIFY_OPT_GET_IN_COUNT		14
+#define ASYNC_NOTIFY_OPT_CIPHER				15	// 1: chacha20 DATA payloads
 
 #define ASYNC_NOTIFY_LOG_INFO		1
 #define ASYNC_NOTIFY_LOG_REJECT		2
@@ -133,6 +134,12 @@ void async_notify_sid_clear(CAsyncNotify *notify);
 // config
 int async_notify_option(CAsyncNotify *notify, int type, long value);
 
+// ASYNC_NOTIFY_OPT_CIPHER encrypts DATA payloads of connections made 
+// from now on with chacha20, keys derive (hmac-sha1) from the token 
+// (required), the login, a random initiator salt and a random listener 
+// salt sent back in LOGINACK. listeners with it enabled refuse plain 
+// logins (8006) and initiator salts seen before (8008).
+
 // set login token
 void async_notify_token(CAsyncNotify *notify, const char *token, int size);
 
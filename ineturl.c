@@ -1376,7 +1376,7 @@ IURLD *ineturl_open(const char *URL, const void *data, long size,
 			it_strcatc(&auth, proxy_pass, -1);
 			size = ibase64_encode(NULL, it_size(&auth), NULL);
 			it_sresize(&base64, size);
-			ibase64_encode(it_str(&auth), it_size(&base64), it_str(&base64));
+			ibase64_encode(it_str(&auth), it_size(&auth), it_str(&base64));
 			it_sresize(&base64, strlen(it_str(&base64)));
 			it_strcatc(&header, "Proxy-Authorization: Basic ", -1);
 			it_strcatc(&header, it_str(&base64), -1);
@@ -35,6 +35,100 @@
 #endif
 
 
+//=====================================================================
+// INSTRUCTION SET EXTENSIONS
+//=====================================================================
+#if (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || \
+	defined(_M_IX86)) && (!defined(IDISABLE_SIMD))
+#define ISEC_X86 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) || defined(__clang__)
+#include <cpuid.h>
+#endif
+#if (defined(__SSE2__) || defined(_M_X64) || \
+	(defined(_M_IX86_FP) && (_M_IX86_FP >= 2))) && \
+	(defined(__clang__) || (defined(__GNUC__) && (__GNUC__ >= 5)) || \
+	(defined(_MSC_VER) && (_MSC_VER >= 1900)))
+#define ISEC_SIMD 1
+#include <immintrin.h>
+#endif
+#endif
+
+/* functions using extensions the compiler was not told about */
+#if defined(__GNUC__) || defined(__clang__)
+#define ISEC_TARGET(x) __attribute__((target(x)))
+#else
+#define ISEC_TARGET(x)
+#endif
+
+#define ISEC_CPU_SSE42		1
+#define ISEC_CPU_PCLMUL		2
+#define ISEC_CPU_AVX2		4
+#define ISEC_CPU_SHA		8
+
+static volatile int is_cpu_cache = -1;
+
+#ifdef ISEC_X86
+static void is_cpuid(int leaf, IUINT32 *regs)
+{
+#if defined(_MSC_VER)
+	int r[4];
+	__cpuidex(r, leaf, 0);
+	regs[0] = r[0]; regs[1] = r[1]; regs[2] = r[2]; regs[3] = r[3];
+#else
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	__cpuid_count(leaf, 0, a, b, c, d);
+	regs[0] = a; regs[1] = b; regs[2] = c; regs[3] = d;
+#endif
+}
+
+/* ymm state enabled by the os */
+static int is_ymm_enabled(void)
+{
+#if defined(_MSC_VER)
+	return ((_xgetbv(0) & 6) == 6)? 1 : 0;
+#else
+	IUINT32 a, d;
+	__asm__ __volatile__ ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((a & 6) == 6)? 1 : 0;
+#endif
+}
+#endif
+
+/* detect the extensions used by the hash functions */
+static int is_cpu_features(void)
+{
+	int features = is_cpu_cache;
+	if (features < 0) {
+		features = 0;
+	#ifdef ISEC_X86
+		{
+			IUINT32 r[4], top;
+			int avx = 0;
+			is_cpuid(0, r);
+			top = r[0];
+			if (top >= 1) {
+				is_cpuid(1, r);
+				if (r[2] & (1ul << 20)) features |= ISEC_CPU_SSE42;
+				if (r[2] & (1ul << 1)) features |= ISEC_CPU_PCLMUL;
+				if ((r[2] & (1ul << 27)) && (r[2] & (1ul << 28))) 
+					avx = is_ymm_enabled();
+			}
+			if (top >= 7) {
+				is_cpuid(7, r);
+				if ((r[1] & (1ul << 5)) && avx) features |= ISEC_CPU_AVX2;
+				if ((r[1] & (1ul << 29)) && (features & ISEC_CPU_SSE42))
+					features |= ISEC_CPU_SHA;
+			}
+		}
+	#endif
+		is_cpu_cache = features;
+	}
+	return features;
+}
+
+
 /* encode 8 bits unsigned int */
 static inline char *is_encode8u(char *p, unsigned char c)
 {
@@ -383,12 +477,7 @@ void HASH_MD5_Final(HASH_MD5_CTX *ctx, unsigned char digest[16])
 
 /* SHA1_BLK0() and SHA1_BLK() perform the initial expand. */
 /* I got the idea of expanding during the round function from SSLeay */
-#if !IWORDS_BIG_ENDIAN
-#define SHA1_BLK0(i) (block->l[i] = (SHA1_ROL(block->l[i],24)&0xFF00FF00) \
-    |(SHA1_ROL(block->l[i],8)&0x00FF00FF))
-#else
 #define SHA1_BLK0(i) block->l[i]
-#endif
 #define SHA1_BLK(i) (block->l[i&15] = SHA1_ROL(block->l[(i+13)&15]^block->l[(i+8)&15] \
     ^block->l[(i+2)&15]^block->l[i&15],1))
 
@@ -414,9 +503,8 @@ void HASH_SHA1_Transform(IUINT32 state[5], const unsigned char buffer[64])
 		b = buffer[(e << 2) + 1];
 		c = buffer[(e << 2) + 2];
 		d = buffer[(e << 2) + 3];
-		block->l[e] = a | (b << 8) | (c << 16) | (d << 24);
+		block->l[e] = (a << 24) | (b << 16) | (c << 8) | d;
 	}
-    block = (CHAR64LONG16*)buffer;
     /* Copy ctx->state[] to working vars */
     a = state[0];
     b = state[1];
@@ -457,6 +545,137 @@ void HASH_SHA1_Transform(IUINT32 state[5], const unsigned char buffer[64])
 }
 
 
+#ifdef ISEC_SIMD
+
+/* sha extensions: four rounds per sha1rnds4 */
+ISEC_TARGET("sha,ssse3,sse4.1")
+static void hash_sha1_shani(IUINT32 state[5], const unsigned char *data,
+	size_t blocks)
+{
+	__m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+	__m128i MSG0, MSG1, MSG2, MSG3;
+	const __m128i MASK = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 
+			8, 9, 10, 11, 12, 13, 14, 15);
+
+	ABCD = _mm_loadu_si128((const __m128i*)state);
+	E0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1b);
+
+	for (; blocks > 0; blocks--, data += 64) {
+		ABCD_SAVE = ABCD;
+		E0_SAVE = E0;
+
+		/* rounds 0-3 */
+		MSG0 = _mm_loadu_si128((const __m128i*)(data + 0));
+		MSG0 = _mm_shuffle_epi8(MSG0, MASK);
+		E0 = _mm_add_epi32(E0, MSG0);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+		/* rounds 4-7 */
+		MSG1 = _mm_loadu_si128((const __m128i*)(data + 16));
+		MSG1 = _mm_shuffle_epi8(MSG1, MASK);
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+		/* rounds 8-11 */
+		MSG2 = _mm_loadu_si128((const __m128i*)(data + 32));
+		MSG2 = _mm_shuffle_epi8(MSG2, MASK);
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+		MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+		MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+		/* rounds 12-15 */
+		MSG3 = _mm_loadu_si128((const __m128i*)(data + 48));
+		MSG3 = _mm_shuffle_epi8(MSG3, MASK);
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+		MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+		MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+		/* rounds 16-63: the schedule rotates through MSG0..MSG3 */
+		#define HASH_SHA1_NI(ei, eo, m0, m1, m2, m3, f) \
+			ei = _mm_sha1nexte_epu32(ei, m0); \
+			eo = ABCD; \
+			m1 = _mm_sha1msg2_epu32(m1, m0); \
+			ABCD = _mm_sha1rnds4_epu32(ABCD, ei, f); \
+			m3 = _mm_sha1msg1_epu32(m3, m0); \
+			m2 = _mm_xor_si128(m2, m0);
+
+		HASH_SHA1_NI(E0, E1, MSG0, MSG1, MSG2, MSG3, 0);
+		HASH_SHA1_NI(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);
+		HASH_SHA1_NI(E0, E1, MSG2, MSG3, MSG0, MSG1, 1);
+		HASH_SHA1_NI(E1, E0, MSG3, MSG0, MSG1, MSG2, 1);
+		HASH_SHA1_NI(E0, E1, MSG0, MSG1, MSG2, MSG3, 1);
+		HASH_SHA1_NI(E1, E0, MSG1, MSG2, MSG3, MSG0, 1);
+		HASH_SHA1_NI(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);
+		HASH_SHA1_NI(E1, E0, MSG3, MSG0, MSG1, MSG2, 2);
+		HASH_SHA1_NI(E0, E1, MSG0, MSG1, MSG2, MSG3, 2);
+		HASH_SHA1_NI(E1, E0, MSG1, MSG2, MSG3, MSG0, 2);
+		HASH_SHA1_NI(E0, E1, MSG2, MSG3, MSG0, MSG1, 2);
+		HASH_SHA1_NI(E1, E0, MSG3, MSG0, MSG1, MSG2, 3);
+
+		#undef HASH_SHA1_NI
+
+		/* rounds 64-67 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG0);
+		E1 = ABCD;
+		MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+		MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+		MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+		/* rounds 68-71 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG1);
+		E0 = ABCD;
+		MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+		MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+		/* rounds 72-75 */
+		E0 = _mm_sha1nexte_epu32(E0, MSG2);
+		E1 = ABCD;
+		MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+		/* rounds 76-79 */
+		E1 = _mm_sha1nexte_epu32(E1, MSG3);
+		E0 = ABCD;
+		ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+		E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	}
+
+	ABCD = _mm_shuffle_epi32(ABCD, 0x1b);
+	_mm_storeu_si128((__m128i*)state, ABCD);
+	state[4] = (IUINT32)_mm_extract_epi32(E0, 3);
+}
+
+#endif
+
+/* hash consecutive 64 bytes blocks */
+static void hash_sha1_blocks(IUINT32 state[5], const unsigned char *data,
+	size_t blocks)
+{
+#ifdef ISEC_SIMD
+	if (is_cpu_features() & ISEC_CPU_SHA) {
+		hash_sha1_shani(state, data, blocks);
+		return;
+	}
+#endif
+	for (; blocks > 0; blocks--, data += 64) {
+		HASH_SHA1_Transform(state, data);
+	}
+}
+
+
 /* HASH_SHA1_Init - Initialize new ctx */
 void HASH_SHA1_Init(HASH_SHA1_CTX* ctx)
 {
@@ -480,9 +699,10 @@ void HASH_SHA1_Update(HASH_SHA1_CTX* ctx, const void *input, unsigned int len)
     ctx->count[1] += (len >> 29);
     if ((j + len) > 63) {
         memcpy(&ctx->buffer[j], data, (i = 64-j));
-        HASH_SHA1_Transform(ctx->state, ctx->buffer);
-        for ( ; i + 63 < len; i += 64) {
-            HASH_SHA1_Transform(ctx->state, &data[i]);
+        hash_sha1_blocks(ctx->state, ctx->buffer, 1);
+        if (i + 63 < len) {
+            hash_sha1_blocks(ctx->state, &data[i], (len - i) >> 6);
+            i += ((len - i) >> 6) << 6;
         }
         j = 0;
     }
@@ -519,6 +739,305 @@ void HASH_SHA1_Final(HASH_SHA1_CTX* ctx, unsigned char digest[20])
 }
 
 
+//=====================================================================
+// MULTI-BUFFER: independent messages hashed in parallel lanes
+//=====================================================================
+
+/* padded trailing blocks of a lane */
+typedef struct {
+	const unsigned char *data;
+	size_t full;
+	size_t blocks;
+	unsigned char tail[128];
+}	HASH_MB_LANE;
+
+static void hash_mb_lane_init(HASH_MB_LANE *lane, const void *in, 
+	size_t len, int bigendian)
+{
+	size_t remain = len & 63;
+	IUINT64 bits = ((IUINT64)len) << 3;
+	size_t size = (remain + 9 > 64)? 128 : 64;
+	int i;
+	lane->data = (const unsigned char*)in;
+	lane->full = len >> 6;
+	lane->blocks = lane->full + (size >> 6);
+	memcpy(lane->tail, lane->data + (lane->full << 6), remain);
+	lane->tail[remain] = 0x80;
+	memset(lane->tail + remain + 1, 0, size - remain - 1);
+	for (i = 0; i < 8; i++) {
+		unsigned char ch = (unsigned char)((bits >> (i * 8)) & 0xff);
+		lane->tail[size - (bigendian? (i + 1) : (8 - i))] = ch;
+	}
+}
+
+static const unsigned char *hash_mb_lane_block(const HASH_MB_LANE *lane,
+	size_t index)
+{
+	if (index < lane->full) return lane->data + (index << 6);
+	return lane->tail + ((index - lane->full) << 6);
+}
+
+static void hash_sha1_single(const void *in, size_t len, 
+	unsigned char digest[20])
+{
+	HASH_SHA1_CTX ctx;
+	const unsigned char *p = (const unsigned char*)in;
+	HASH_SHA1_Init(&ctx);
+	for (; len > 0x40000000; len -= 0x40000000, p += 0x40000000) 
+		HASH_SHA1_Update(&ctx, p, 0x40000000);
+	HASH_SHA1_Update(&ctx, p, (unsigned int)len);
+	HASH_SHA1_Final(&ctx, digest);
+}
+
+static void hash_md5_single(const void *in, size_t len, 
+	unsigned char digest[16])
+{
+	HASH_MD5_CTX ctx;
+	const unsigned char *p = (const unsigned char*)in;
+	HASH_MD5_Init(&ctx, 0);
+	for (; len > 0x40000000; len -= 0x40000000, p += 0x40000000) 
+		HASH_MD5_Update(&ctx, p, 0x40000000);
+	HASH_MD5_Update(&ctx, p, (unsigned int)len);
+	HASH_MD5_Final(&ctx, digest);
+}
+
+#ifdef ISEC_SIMD
+
+#define HASH_MB_ROL(x, n) \
+	_mm256_or_si256(_mm256_slli_epi32(x, n), _mm256_srli_epi32(x, 32 - (n)))
+
+/* word t of the current block of every lane */
+ISEC_TARGET("avx2")
+static inline __m256i hash_mb_load(const unsigned char * const *p, int t)
+{
+	IUINT32 w[8];
+	int i;
+	for (i = 0; i < 8; i++) memcpy(&w[i], p[i] + t * 4, 4);
+	return _mm256_loadu_si256((const __m256i*)w);
+}
+
+/* 8 lanes of sha1, count <= 8 */
+ISEC_TARGET("avx2")
+static void hash_sha1_avx2(const void * const *in, const size_t *len,
+	int count, unsigned char (*digest)[20])
+{
+	static const IUINT32 K[4] = { 
+		0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6 };
+	HASH_MB_LANE lanes[8];
+	const unsigned char *p[8];
+	__m256i S[5], W[16];
+	__m256i SWAP = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 
+			4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15, 8, 9, 10, 11,
+			4, 5, 6, 7, 0, 1, 2, 3);
+	IUINT32 out[5][8];
+	size_t maxblocks = 0, n;
+	int i, t;
+	for (i = 0; i < 8; i++) {
+		hash_mb_lane_init(&lanes[i], in[i < count? i : 0], 
+				len[i < count? i : 0], 1);
+		if (lanes[i].blocks > maxblocks) maxblocks = lanes[i].blocks;
+	}
+	S[0] = _mm256_set1_epi32(0x67452301);
+	S[1] = _mm256_set1_epi32((int)0xefcdab89);
+	S[2] = _mm256_set1_epi32((int)0x98badcfe);
+	S[3] = _mm256_set1_epi32(0x10325476);
+	S[4] = _mm256_set1_epi32((int)0xc3d2e1f0);
+	for (n = 0; n < maxblocks; n++) {
+		__m256i a = S[0], b = S[1], c = S[2], d = S[3], e = S[4], f, x;
+		for (i = 0; i < 8; i++) {
+			/* finished lanes rehash their last block, never stored */
+			size_t k = (n < lanes[i].blocks)? n : lanes[i].blocks - 1;
+			p[i] = hash_mb_lane_block(&lanes[i], k);
+		}
+		for (t = 0; t < 80; t++) {
+			if (t < 16) {
+				x = _mm256_shuffle_epi8(hash_mb_load(p, t), SWAP);
+			}	else {
+				x = _mm256_xor_si256(W[(t + 13) & 15], W[(t + 8) & 15]);
+				x = _mm256_xor_si256(x, W[(t + 2) & 15]);
+				x = _mm256_xor_si256(x, W[t & 15]);
+				x = HASH_MB_ROL(x, 1);
+			}
+			W[t & 15] = x;
+			if (t < 20) {
+				f = _mm256_xor_si256(d, _mm256_and_si256(b, 
+					_mm256_xor_si256(c, d)));
+			}
+			else if (t >= 40 && t < 60) {
+				f = _mm256_or_si256(_mm256_and_si256(b, c), 
+					_mm256_and_si256(d, _mm256_or_si256(b, c)));
+			}
+			else {
+				f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+			}
+			f = _mm256_add_epi32(f, _mm256_set1_epi32((int)K[t / 20]));
+			f = _mm256_add_epi32(f, _mm256_add_epi32(e, x));
+			f = _mm256_add_epi32(f, HASH_MB_ROL(a, 5));
+			e = d;
+			d = c;
+			c = HASH_MB_ROL(b, 30);
+			b = a;
+			a = f;
+		}
+		S[0] = _mm256_add_epi32(S[0], a);
+		S[1] = _mm256_add_epi32(S[1], b);
+		S[2] = _mm256_add_epi32(S[2], c);
+		S[3] = _mm256_add_epi32(S[3], d);
+		S[4] = _mm256_add_epi32(S[4], e);
+		for (i = 0; i < count; i++) {
+			if (n + 1 == lanes[i].blocks) {
+				int j;
+				for (j = 0; j < 5; j++) 
+					_mm256_storeu_si256((__m256i*)out[j], S[j]);
+				for (j = 0; j < 20; j++) {
+					digest[i][j] = (unsigned char)
+						(out[j >> 2][i] >> ((3 - (j & 3)) * 8));
+				}
+			}
+		}
+	}
+}
+
+/* 8 lanes of md5, count <= 8 */
+ISEC_TARGET("avx2")
+static void hash_md5_avx2(const void * const *in, const size_t *len,
+	int count, unsigned char (*digest)[16])
+{
+	static const IUINT32 K[64] = {
+		0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 
+		0x4787c62a, 0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 
+		0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 
+		0x49b40821, 0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 
+		0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8, 0x21e1cde6, 
+		0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 
+		0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 
+		0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 
+		0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 
+		0xe6db99e5, 0x1fa27cf8, 0xc4ac5665, 0xf4292244, 0x432aff97, 
+		0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 
+		0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 
+		0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391 };
+	static const int R[16] = { 
+		7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+	HASH_MB_LANE lanes[8];
+	const unsigned char *p[8];
+	__m256i S[4], M[16], ONES = _mm256_set1_epi32(-1);
+	IUINT32 out[4][8];
+	size_t maxblocks = 0, n;
+	int i, t;
+	for (i = 0; i < 8; i++) {
+		hash_mb_lane_init(&lanes[i], in[i < count? i : 0], 
+				len[i < count? i : 0], 0);
+		if (lanes[i].blocks > maxblocks) maxblocks = lanes[i].blocks;
+	}
+	S[0] = _mm256_set1_epi32(0x67452301);
+	S[1] = _mm256_set1_epi32((int)0xefcdab89);
+	S[2] = _mm256_set1_epi32((int)0x98badcfe);
+	S[3] = _mm256_set1_epi32(0x10325476);
+	for (n = 0; n < maxblocks; n++) {
+		__m256i a = S[0], b = S[1], c = S[2], d = S[3], f;
+		for (i = 0; i < 8; i++) {
+			size_t k = (n < lanes[i].blocks)? n : lanes[i].blocks - 1;
+			p[i] = hash_mb_lane_block(&lanes[i], k);
+		}
+		for (t = 0; t < 16; t++) {
+			M[t] = hash_mb_load(p, t);
+		}
+		for (t = 0; t < 64; t++) {
+			int g, s = R[((t >> 4) << 2) | (t & 3)];
+			if (t < 16) {
+				f = _mm256_xor_si256(d, _mm256_and_si256(b, 
+					_mm256_xor_si256(c, d)));
+				g = t;
+			}
+			else if (t < 32) {
+				f = _mm256_xor_si256(c, _mm256_and_si256(d, 
+					_mm256_xor_si256(b, c)));
+				g = (t * 5 + 1) & 15;
+			}
+			else if (t < 48) {
+				f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+				g = (t * 3 + 5) & 15;
+			}
+			else {
+				f = _mm256_xor_si256(c, _mm256_or_si256(b, 
+					_mm256_xor_si256(d, ONES)));
+				g = (t * 7) & 15;
+			}
+			f = _mm256_add_epi32(f, _mm256_add_epi32(a, M[g]));
+			f = _mm256_add_epi32(f, _mm256_set1_epi32((int)K[t]));
+			f = _mm256_or_si256(
+				_mm256_sll_epi32(f, _mm_cvtsi32_si128(s)),
+				_mm256_srl_epi32(f, _mm_cvtsi32_si128(32 - s)));
+			a = d;
+			d = c;
+			c = b;
+			b = _mm256_add_epi32(b, f);
+		}
+		S[0] = _mm256_add_epi32(S[0], a);
+		S[1] = _mm256_add_epi32(S[1], b);
+		S[2] = _mm256_add_epi32(S[2], c);
+		S[3] = _mm256_add_epi32(S[3], d);
+		for (i = 0; i < count; i++) {
+			if (n + 1 == lanes[i].blocks) {
+				int j;
+				for (j = 0; j < 4; j++) 
+					_mm256_storeu_si256((__m256i*)out[j], S[j]);
+				for (j = 0; j < 16; j++) {
+					digest[i][j] = (unsigned char)
+						(out[j >> 2][i] >> ((j & 3) * 8));
+				}
+			}
+		}
+	}
+}
+
+#undef HASH_MB_ROL
+
+#endif
+
+// sha1 of count independent messages, eight at a time with avx2
+void hash_sha1_many(const void * const *in, const size_t *len, int count,
+	unsigned char (*digest)[20])
+{
+#ifdef ISEC_SIMD
+	if (is_cpu_features() & ISEC_CPU_AVX2) {
+		while (count >= 4) {
+			int n = (count < 8)? count : 8;
+			hash_sha1_avx2(in, len, n, digest);
+			in += n;
+			len += n;
+			digest += n;
+			count -= n;
+		}
+	}
+#endif
+	for (; count > 0; count--, in++, len++, digest++) {
+		hash_sha1_single(in[0], len[0], digest[0]);
+	}
+}
+
+// md5 of count independent messages, eight at a time with avx2
+void hash_md5_many(const void * const *in, const size_t *len, int count,
+	unsigned char (*digest)[16])
+{
+#ifdef ISEC_SIMD
+	if (is_cpu_features() & ISEC_CPU_AVX2) {
+		while (count >= 4) {
+			int n = (count < 8)? count : 8;
+			hash_md5_avx2(in, len, n, digest);
+			in += n;
+			len += n;
+			digest += n;
+			count -= n;
+		}
+	}
+#endif
+	for (; count > 0; count--, in++, len++, digest++) {
+		hash_md5_single(in[0], len[0], digest[0]);
+	}
+}
+
 
 //=====================================================================
 // UTILITIES
@@ -562,6 +1081,33 @@ char* hash_sha1sum(const void *in, size_t len, char *out)
 	return hash_digest_to_string(digest, 20, out);
 }
 
+void hash_hmac_sha1(const void *key, size_t keylen, const void *in, 
+	size_t len, unsigned char digest[20])
+{
+	unsigned char pad[64];
+	unsigned char inner[20];
+	HASH_SHA1_CTX ctx;
+	int i;
+	memset(pad, 0, 64);
+	if (keylen > 64) {
+		HASH_SHA1_Init(&ctx);
+		HASH_SHA1_Update(&ctx, key, (unsigned int)keylen);
+		HASH_SHA1_Final(&ctx, pad);
+	}	else if (keylen > 0) {
+		memcpy(pad, key, keylen);
+	}
+	for (i = 0; i < 64; i++) pad[i] ^= 0x36;
+	HASH_SHA1_Init(&ctx);
+	HASH_SHA1_Update(&ctx, pad, 64);
+	HASH_SHA1_Update(&ctx, in, (unsigned int)len);
+	HASH_SHA1_Final(&ctx, inner);
+	for (i = 0; i < 64; i++) pad[i] ^= 0x36 ^ 0x5c;
+	HASH_SHA1_Init(&ctx);
+	HASH_SHA1_Update(&ctx, pad, 64);
+	HASH_SHA1_Update(&ctx, inner, 20);
+	HASH_SHA1_Final(&ctx, digest);
+}
+
 // crc32
 
 /* Need an unsigned type capable of holding 32 bits; */
@@ -602,16 +1148,254 @@ IUINT32 crc_32_tab[] = { /* CRC polynomial 0xedb88320 */
 	0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94, 0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
 };
 
+// slicing-by-8 tables and folding constants of a reflected crc
+typedef struct {
+	IUINT32 table[8][256];
+	IUINT64 fold512[2];     /* x^576, x^512 mod P */
+	IUINT64 fold128[2];     /* x^192, x^128 mod P */
+}	HASH_CRC_POLY;
+
+static HASH_CRC_POLY hash_crc_ieee;
+static HASH_CRC_POLY hash_crc_castagnoli;
+static volatile long hash_crc_state = 0;	/* 0: none, 1: building, 2: ready */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define ISEC_CAS(p, o, n) __sync_bool_compare_and_swap(p, o, n)
+#if defined(__ATOMIC_ACQUIRE)
+#define ISEC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define ISEC_STORE(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+#define ISEC_LOAD(p) (__sync_synchronize(), *(p))
+#define ISEC_STORE(p, v) do { __sync_synchronize(); *(p) = (v); } while (0)
+#endif
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define ISEC_CAS(p, o, n) (_InterlockedCompareExchange(p, n, o) == (o))
+#define ISEC_LOAD(p) (*(p))
+#define ISEC_STORE(p, v) do { _ReadWriteBarrier(); *(p) = (v); } while (0)
+#else
+#define ISEC_CAS(p, o, n) ((*(p) == (o))? ((*(p) = (n)), 1) : 0)
+#define ISEC_LOAD(p) (*(p))
+#define ISEC_STORE(p, v) do { *(p) = (v); } while (0)
+#endif
+
+/* x^(n-1) mod P bit reflected, pclmulqdq of reflected operands 
+ * yields the product shifted by one bit which restores x^n */
+static IUINT64 hash_crc_fold_key(IUINT32 reflected, int n)
+{
+	IUINT64 poly = ((IUINT64)1) << 32;
+	IUINT64 r = 1, k = 0;
+	int i;
+	for (i = 0; i < 32; i++) {
+		if (reflected & (1ul << i)) poly |= ((IUINT64)1) << (31 - i);
+	}
+	for (i = 0; i < n - 1; i++) {
+		r <<= 1;
+		if (r >> 32) r ^= poly;
+	}
+	for (i = 0; i < 32; i++) {
+		if ((r >> i) & 1) k |= ((IUINT64)1) << (63 - i);
+	}
+	return k;
+}
+
+static void hash_crc_poly_init(HASH_CRC_POLY *poly, IUINT32 reflected)
+{
+	IUINT32 i, j, c;
+	for (i = 0; i < 256; i++) {
+		for (c = i, j = 0; j < 8; j++) {
+			c = (c & 1)? ((c >> 1) ^ reflected) : (c >> 1);
+		}
+		poly->table[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		for (c = poly->table[0][i], j = 1; j < 8; j++) {
+			c = poly->table[0][c & 0xff] ^ (c >> 8);
+			poly->table[j][i] = c;
+		}
+	}
+	poly->fold512[0] = hash_crc_fold_key(reflected, 576);
+	poly->fold512[1] = hash_crc_fold_key(reflected, 512);
+	poly->fold128[0] = hash_crc_fold_key(reflected, 192);
+	poly->fold128[1] = hash_crc_fold_key(reflected, 128);
+}
+
+/* build the tables once, other threads wait until they are published */
+static void hash_crc_init(void)
+{
+	if (ISEC_LOAD(&hash_crc_state) == 2) return;
+	while (ISEC_LOAD(&hash_crc_state) != 2) {
+		if (ISEC_CAS(&hash_crc_state, 0, 1)) {
+			hash_crc_poly_init(&hash_crc_ieee, 0xedb88320ul);
+			hash_crc_poly_init(&hash_crc_castagnoli, 0x82f63b78ul);
+			is_cpu_features();
+			ISEC_STORE(&hash_crc_state, 2);
+		}
+	}
+}
+
+/* portable slicing-by-8 */
+static IUINT32 hash_crc_slice8(const HASH_CRC_POLY *poly, IUINT32 crc,
+	const unsigned char *p, size_t len)
+{
+	const IUINT32 (*t)[256] = poly->table;
+	for (; len > 0 && (((size_t)p) & 7) != 0; p++, len--) {
+		crc = t[0][(crc ^ p[0]) & 0xff] ^ (crc >> 8);
+	}
+	for (; len >= 8; p += 8, len -= 8) {
+		IUINT32 lo = crc ^ (((IUINT32)p[0]) | (((IUINT32)p[1]) << 8) |
+			(((IUINT32)p[2]) << 16) | (((IUINT32)p[3]) << 24));
+		IUINT32 hi = ((IUINT32)p[4]) | (((IUINT32)p[5]) << 8) |
+			(((IUINT32)p[6]) << 16) | (((IUINT32)p[7]) << 24);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+			t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+			t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+			t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	for (; len > 0; p++, len--) {
+		crc = t[0][(crc ^ p[0]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
+
+#ifdef ISEC_SIMD
+
+/* the crc32 instruction only implements castagnoli */
+ISEC_TARGET("sse4.2")
+static IUINT32 hash_crc_sse42(IUINT32 crc, const unsigned char *p, 
+	size_t len)
+{
+	for (; len > 0 && (((size_t)p) & 7) != 0; p++, len--) {
+		crc = _mm_crc32_u8(crc, p[0]);
+	}
+#if defined(__x86_64__) || defined(_M_X64)
+	if (len >= 8) {
+		IUINT64 c = crc, x;
+		for (; len >= 8; p += 8, len -= 8) {
+			memcpy(&x, p, 8);
+			c = _mm_crc32_u64(c, x);
+		}
+		crc = (IUINT32)c;
+	}
+#else
+	for (; len >= 4; p += 4, len -= 4) {
+		IUINT32 x;
+		memcpy(&x, p, 4);
+		crc = _mm_crc32_u32(crc, x);
+	}
+#endif
+	for (; len > 0; p++, len--) {
+		crc = _mm_crc32_u8(crc, p[0]);
+	}
+	return crc;
+}
+
+ISEC_TARGET("sse2,pclmul")
+static inline __m128i hash_crc_fold(__m128i x, __m128i k)
+{
+	__m128i h = _mm_clmulepi64_si128(x, k, 0x00);
+	__m128i l = _mm_clmulepi64_si128(x, k, 0x11);
+	return _mm_xor_si128(h, l);
+}
+
+/* carry-less folding of four 128 bits lanes, len must be >= 64; the
+ * folded remainder is congruent to the consumed input modulo P, so it 
+ * is finished by the table together with the tail bytes */
+ISEC_TARGET("sse2,pclmul")
+static IUINT32 hash_crc_pclmul(const HASH_CRC_POLY *poly, IUINT32 crc,
+	const unsigned char *p, size_t len)
+{
+	const IUINT64 *k5 = poly->fold512;
+	const IUINT64 *k1 = poly->fold128;
+	__m128i x0, x1, x2, x3, k;
+	unsigned char remain[16];
+	x0 = _mm_loadu_si128((const __m128i*)(p + 0));
+	x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+	x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+	x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+	x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128((int)crc));
+	p += 64;
+	len -= 64;
+	k = _mm_set_epi32((int)(k5[1] >> 32), (int)(k5[1] & 0xfffffffful),
+		(int)(k5[0] >> 32), (int)(k5[0] & 0xfffffffful));
+	for (; len >= 64; p += 64, len -= 64) {
+		x0 = _mm_xor_si128(hash_crc_fold(x0, k), 
+				_mm_loadu_si128((const __m128i*)(p + 0)));
+		x1 = _mm_xor_si128(hash_crc_fold(x1, k), 
+				_mm_loadu_si128((const __m128i*)(p + 16)));
+		x2 = _mm_xor_si128(hash_crc_fold(x2, k), 
+				_mm_loadu_si128((const __m128i*)(p + 32)));
+		x3 = _mm_xor_si128(hash_crc_fold(x3, k), 
+				_mm_loadu_si128((const __m128i*)(p + 48)));
+	}
+	k = _mm_set_epi32((int)(k1[1] >> 32), (int)(k1[1] & 0xfffffffful),
+		(int)(k1[0] >> 32), (int)(k1[0] & 0xfffffffful));
+	x1 = _mm_xor_si128(hash_crc_fold(x0, k), x1);
+	x2 = _mm_xor_si128(hash_crc_fold(x1, k), x2);
+	x3 = _mm_xor_si128(hash_crc_fold(x2, k), x3);
+	for (; len >= 16; p += 16, len -= 16) {
+		x3 = _mm_xor_si128(hash_crc_fold(x3, k), 
+				_mm_loadu_si128((const __m128i*)p));
+	}
+	_mm_storeu_si128((__m128i*)remain, x3);
+	crc = hash_crc_slice8(poly, 0, remain, 16);
+	return hash_crc_slice8(poly, crc, p, len);
+}
+
+#endif
+
+/* update a running (inverted) crc register */
+static IUINT32 hash_crc_update(int castagnoli, IUINT32 crc, 
+	const void *in, size_t len)
+{
+	const HASH_CRC_POLY *poly;
+	const unsigned char *p = (const unsigned char*)in;
+	hash_crc_init();
+	poly = castagnoli? &hash_crc_castagnoli : &hash_crc_ieee;
+#ifdef ISEC_SIMD
+	if (len >= 128 && (is_cpu_cache & ISEC_CPU_PCLMUL)) {
+		return hash_crc_pclmul(poly, crc, p, len);
+	}
+	if (castagnoli && (is_cpu_cache & ISEC_CPU_SSE42)) {
+		return hash_crc_sse42(crc, p, len);
+	}
+#endif
+	return hash_crc_slice8(poly, crc, p, len);
+}
+
 // calculate crc32 and return result
 IUINT32 hash_crc32(const void *in, size_t len)
 {
-	unsigned char* p = (unsigned char *)in;
-	IUINT32 result = 0xffffffff;
-	size_t i = 0;
-	for (i = 0; i < len; i++){
-		result = UPDC32(p[i], result);
-	}
-	result ^= 0xffffffff;  
-	return result;
+	return hash_crc_update(0, 0xffffffff, in, len) ^ 0xffffffff;
+}
+
+// calculate crc32c (castagnoli) and return result
+IUINT32 hash_crc32c(const void *in, size_t len)
+{
+	return hash_crc_update(1, 0xffffffff, in, len) ^ 0xffffffff;
+}
+
+// incremental crc32
+void HASH_CRC32_Init(HASH_CRC32_CTX *ctx)
+{
+	ctx->crc = 0xffffffff;
+	ctx->castagnoli = 0;
+}
+
+// incremental crc32c
+void HASH_CRC32C_Init(HASH_CRC32_CTX *ctx)
+{
+	ctx->crc = 0xffffffff;
+	ctx->castagnoli = 1;
+}
+
+void HASH_CRC32_Update(HASH_CRC32_CTX *ctx, const void *input, size_t len)
+{
+	ctx->crc = hash_crc_update(ctx->castagnoli, ctx->crc, input, len);
+}
+
+IUINT32 HASH_CRC32_Final(HASH_CRC32_CTX *ctx)
+{
+	return ctx->crc ^ 0xffffffff;
 }
 
@@ -192,6 +192,33 @@ void HASH_SHA1_Update(HASH_SHA1_CTX *ctx, const void *input, unsigned int len);
 void HASH_SHA1_Final(HASH_SHA1_CTX *ctx, unsigned char digest[20]);
 
 
+//=====================================================================
+// MULTI-BUFFER: AVX2 hashes eight independent messages per pass
+//=====================================================================
+
+// sha1 of count messages, digest[i] receives the hash of in[i]
+void hash_sha1_many(const void * const *in, const size_t *len, int count,
+	unsigned char (*digest)[20]);
+
+// md5 of count messages, digest[i] receives the hash of in[i]
+void hash_md5_many(const void * const *in, const size_t *len, int count,
+	unsigned char (*digest)[16]);
+
+
+//=====================================================================
+// CRC32: slicing-by-8, SSE4.2 crc32 and PCLMULQDQ chosen by cpuid
+//=====================================================================
+typedef struct {
+	IUINT32 crc;
+	int castagnoli;
+}	HASH_CRC32_CTX;
+
+void HASH_CRC32_Init(HASH_CRC32_CTX *ctx);
+void HASH_CRC32C_Init(HASH_CRC32_CTX *ctx);
+void HASH_CRC32_Update(HASH_CRC32_CTX *ctx, const void *input, size_t len);
+IUINT32 HASH_CRC32_Final(HASH_CRC32_CTX *ctx);
+
+
 //=====================================================================
 // UTILITIES
 //=====================================================================
@@ -205,9 +232,16 @@ char* hash_md5sum(const void *in, size_t len, char *out);
 // calculate sha1sum and convert digests to string
 char* hash_sha1sum(const void *in, size_t len, char *out);
 
+// calculate hmac-sha1 (rfc 2104) of in with key
+void hash_hmac_sha1(const void *key, size_t keylen, const void *in, 
+	size_t len, unsigned char digest[20]);
+
 // calculate crc32 and return result
 IUINT32 hash_crc32(const void *in, size_t len);
 
+// calculate crc32c (castagnoli) and return result
+IUINT32 hash_crc32c(const void *in, size_t len);
+
 #define cal_crc32 hash_crc32
 
 
@@ -28,6 +28,7 @@
 //
 // AsyncSock         非阻塞 TCP套接字
 // AsyncCore         异步框架
+// AsyncCoreGroup    多线程异步框架
 //
 // Queue             线程安全的队列
 // TaskPool          线程池任务管理器
@@ -606,6 +607,11 @@ public:
 		return (retval == 0)? true : false;
 	}
 
+	// 批量取得事件，最多 max个，返回取得的个数，持续调用直到返回 0
+	int events(struct ipoll_result *out, int max) {
+		return ipoll_events(_ipoll_desc, out, max);
+	}
+
 protected:
 	ipolld _ipoll_desc;
 };
@@ -982,6 +988,16 @@ public:
 		async_sock_rc4_set_rkey(_sock, key, len);
 	}
 
+	int chacha_set_skey(const unsigned char *key, const unsigned char *nonce) {
+		CriticalScope scope(*_lock);
+		return async_sock_chacha_set_skey(_sock, key, nonce);
+	}
+
+	int chacha_set_rkey(const unsigned char *key, const unsigned char *nonce) {
+		CriticalScope scope(*_lock);
+		return async_sock_chacha_set_rkey(_sock, key, nonce);
+	}
+
 protected:
 	mutable CriticalSection *_lock;
 	CAsyncSock *_sock;
@@ -1023,6 +1039,11 @@ public:
 		async_core_notify(_core);
 	}
 
+	// 立即写出合并发送(ASYNC_CORE_OPTION_COALESCE)的连接，不等下一次 wait
+	void flush() {
+		async_core_flush(_core);
+	}
+
 	// 读取消息，返回消息长度 
 	// 如果没有消息，返回-1
 	// event的值为： ASYNC_CORE_EVT_NEW/LEAVE/ESTAB/DATA等
@@ -1031,11 +1052,29 @@ public:
 	// event=ASYNC_CORE_EVT_ESTAB: 连接成功 wparam=hid, lparam=tag (仅用于 new_connect)
 	// event=ASYNC_CORE_EVT_DATA:  收到数据 wparam=hid, lparam=tag
 	// event=ASYNC_CORE_EVT_PROGRESS: 成功发送完待发送数据 wparam=hid, lparam=tag
+	// event=ASYNC_CORE_EVT_TIMER: 定时器到期 wparam=定时器编号, lparam=tag
+	// event=ASYNC_CORE_EVT_DATAGRAM: 收到UDP包 wparam=hid, lparam=tag,
+	//        数据为 地址长度(2字节) + 来源地址 + 包内容 (需 ASYNC_CORE_DGRAM_BATCH)
+	// event=ASYNC_CORE_EVT_RELEASE: send_file/send_zerocopy 的数据已被内核
+	//        取走 wparam=hid, lparam=cookie(文件为fd), 数据为 类型(2字节) + 状态(2字节)
+	// event=ASYNC_CORE_EVT_BLOCKED/WRITABLE: 待发送数据超过高水位/降到低水位
+	//        wparam=hid, lparam=tag, 数据为待发送字节数(4字节)
 	// 普通用法：循环调用，没有消息可读时，调用一次wait去
 	long read(int *event, long *wparam, long *lparam, void *data, long maxsize) {
 		return async_core_read(_core, event, wparam, lparam, data, maxsize);
 	}
 
+	// 零拷贝读取消息：data指向消息内容，直到调用 read_release或者下一次
+	// read之前都有效，大消息总是连续的。返回消息长度，没有消息返回-1
+	long read_ref(int *event, long *wparam, long *lparam, const void **data) {
+		return async_core_read_ref(_core, event, wparam, lparam, data);
+	}
+
+	// 释放 read_ref取得的消息
+	void read_release() {
+		async_core_read_release(_core);
+	}
+
 	// 向某连接发送数据，hid为连接标识
 	long send(long hid, const void *data, long size) {
 		return async_core_send(_core, hid, data, size);
@@ -1051,6 +1090,16 @@ public:
 		return async_core_send_vector(_core, hid, vecptr, veclen, count, mask);
 	}
 
+	// 用 sendfile 发送文件的一段，和其他发送保持顺序，收到 RELEASE 前不要关闭 fd
+	long send_file(long hid, int fd, IINT64 offset, long length) {
+		return async_core_send_file(_core, hid, fd, offset, length);
+	}
+
+	// 用 MSG_ZEROCOPY 发送，收到 RELEASE(cookie) 前不能修改或释放 ptr
+	long send_zerocopy(long hid, const void *ptr, long len, long cookie) {
+		return async_core_send_zerocopy(_core, hid, ptr, len, cookie);
+	}
+
 	// 建立一个新的对外连接，返回 hid，错误返回 <0
 	long new_connect(const struct sockaddr *addr, int len, int header = 0) {
 		return async_core_new_connect(_core, addr, len, header);
@@ -1070,6 +1119,32 @@ public:
 	long new_dgram(const struct sockaddr *addr, int len, int mode = 0) {
 		return async_core_new_dgram(_core, addr, len, mode);
 	}
+
+	// 建立 KCP 监听，按 conv 分发到各个会话，每个会话是一个普通 hid
+	long new_kcp_listen(const struct sockaddr *addr, int len, int mode = 0) {
+		return async_core_new_kcp_listen(_core, addr, len, mode);
+	}
+
+	// 建立 KCP 连接，使用独立的 UDP socket
+	long new_kcp_connect(const struct sockaddr *addr, int len, IUINT32 conv) {
+		return async_core_new_kcp_connect(_core, addr, len, conv);
+	}
+
+	// 设置 KCP 参数，对监听 hid设置时作用于之后建立的会话，负数表示不变
+	int kcp_nodelay(long hid, int nodelay, int interval, int resend, int nc) {
+		return async_core_kcp_nodelay(_core, hid, nodelay, interval, resend, nc);
+	}
+
+	// 设置 KCP 窗口大小和 MTU，负数表示不变
+	int kcp_window(long hid, int sndwnd, int rcvwnd, int mtu = -1) {
+		return async_core_kcp_window(_core, hid, sndwnd, rcvwnd, mtu);
+	}
+
+	// 批量发送 UDP 数据包（sendmmsg），发不出去的排队等待可写
+	long sendto_batch(long hid, const void * const vecptr[], const long veclen[],
+		const struct sockaddr * const addrs[], const int addrlens[], int count) {
+		return async_core_sendto_batch(_core, hid, vecptr, veclen, addrs, addrlens, count);
+	}
 	
 
 	// 取得连接类型：ASYNC_CORE_NODE_IN/OUT/LISTEN4/LISTEN6/ASSIGN
@@ -1160,16 +1235,140 @@ public:
 		async_core_rc4_set_rkey(_core, hid, key, len);
 	}
 
+	// 设置 ChaCha20加密：发送端，key 32字节，nonce 8字节
+	int chacha_set_skey(long hid, const unsigned char *key, const unsigned char *nonce) {
+		return async_core_chacha_set_skey(_core, hid, key, nonce);
+	}
+
+	// 设置 ChaCha20解密：接收端
+	int chacha_set_rkey(long hid, const unsigned char *key, const unsigned char *nonce) {
+		return async_core_chacha_set_rkey(_core, hid, key, nonce);
+	}
+
 	// 得到有多少个连接
 	long nfds() const {
 		return async_core_nfds(_core);
 	}
 
+	// 添加定时器，delay毫秒后收到 ASYNC_CORE_EVT_TIMER消息，periodic为真
+	// 则每隔 delay毫秒重复一次，返回定时器编号，错误返回 <0
+	long timer_add(IUINT32 delay, bool periodic, long tag) {
+		return async_core_timer_add(_core, delay, periodic? 1 : 0, tag);
+	}
+
+	// 删除定时器
+	int timer_del(long id) {
+		return async_core_timer_del(_core, id);
+	}
+
 protected:
 	CAsyncCore *_core;
 };
 
 
+//---------------------------------------------------------------------
+// 多线程异步框架：count个 AsyncCore分别运行在 count个线程上
+// new_listen 会在每个线程上用 SO_REUSEPORT 监听同一个端口，由内核分配
+// 连接。hid 中编码了所属线程，因此 send/close 可以在任意线程调用。
+// 使用方法：继承并实现 on_event，它在连接所属的线程上被调用，然后 start
+//---------------------------------------------------------------------
+class AsyncCoreGroup
+{
+public:
+	AsyncCoreGroup(int count, int flags = 0) {
+		_group = async_group_new(count, flags);
+		if (_group == NULL) 
+			SYSTEM_THROW("create AsyncCoreGroup failed", 10000);
+	}
+
+	virtual ~AsyncCoreGroup() {
+		if (_group) {
+			async_group_delete(_group);
+			_group = NULL;
+		}
+	}
+
+	// 启动所有线程，成功返回 true
+	bool start() {
+		return async_group_start(_group, dispatch, this) == 0;
+	}
+
+	// 停止并等待所有线程结束（析构前必须调用，否则 on_event 可能仍在运行）
+	void stop() {
+		async_group_stop(_group);
+	}
+
+	// 线程数量
+	int count() const {
+		return async_group_count(_group);
+	}
+
+	// hid 所属的线程编号
+	int shard(long hid) const {
+		return async_group_shard(_group, hid);
+	}
+
+	// 取得某线程的 CAsyncCore，用于 get_tag/option 等其他操作
+	CAsyncCore *core(int shard) {
+		return async_group_core(_group, shard);
+	}
+
+	// 设置线程中每次 wait的最长时间
+	void set_interval(IUINT32 millisec) {
+		async_group_interval(_group, millisec);
+	}
+
+	// 向某连接发送数据，可以在任意线程调用
+	long send(long hid, const void *data, long size) {
+		return async_group_send(_group, hid, data, size);
+	}
+
+	// 发送矢量
+	long send(long hid, const void *vecptr[], long veclen[], int count, int mask = 0) {
+		return async_group_send_vector(_group, hid, vecptr, veclen, count, mask);
+	}
+
+	// 关闭连接，如果是 new_listen返回的 hid，则关闭所有线程上的监听
+	int close(long hid, int code) {
+		return async_group_close(_group, hid, code);
+	}
+
+	// 在每个线程上监听，返回 0号线程上的 hid
+	long new_listen(const struct sockaddr *addr, int len, int header = 0) {
+		return async_group_new_listen(_group, addr, len, header);
+	}
+
+	// 建立对外连接，按顺序分配到各个线程
+	long new_connect(const struct sockaddr *addr, int len, int header = 0) {
+		return async_group_new_connect(_group, addr, len, header);
+	}
+
+	// 加入已经连接的 socket，按顺序分配到各个线程
+	long new_assign(int fd, int header = 0, bool check_estab = true) {
+		return async_group_new_assign(_group, fd, header, check_estab? 1 : 0);
+	}
+
+	// 向某线程投递 ASYNC_CORE_EVT_PUSH消息
+	int post(int shard, long wparam, long lparam, const char *data, long size) {
+		return async_group_post(_group, shard, wparam, lparam, data, size);
+	}
+
+protected:
+	// 事件回调，参数含义同 AsyncCore::read
+	virtual void on_event(int shard, int event, long wparam, long lparam, 
+		const void *data, long size) = 0;
+
+	static void dispatch(void *user, int shard, int event, long wparam, 
+		long lparam, const void *data, long size) {
+		AsyncCoreGroup *self = (AsyncCoreGroup*)user;
+		self->on_event(shard, event, wparam, lparam, data, size);
+	}
+
+protected:
+	CAsyncCoreGroup *_group;
+};
+
+
 
 //---------------------------------------------------------------------
 // 异步节点通信
@@ -2223,20 +2422,17 @@ static inline bool LoadContent(const char *filename, std::string &content) {
 }
 
 static inline bool Base64Encode(const void *data, int len, std::string &b64) {
-	int nchars, result;
-	nchars = ((len + 2) / 3) * 4;
-	result = nchars + ((nchars - 1) / 76) + 1;
-	b64.resize(result + 1);
+	b64.resize(ibase64_encode(NULL, len, NULL) + 1);
 	int hr = ibase64_encode(data, len, &b64[0]);
 	b64.resize(hr);
 	return true;
 }
 
+// strict: returns false for characters outside the alphabet or bad padding
 static inline bool Base64Decode(const char *b64, int len, std::string &data) {
-	int nbytes;
-	nbytes = ((len + 7) / 4) * 3;
-	data.resize(nbytes + 1);
-	int hr = ibase64_decode((const char*)b64, len, &data[0]);
+	if (len < 0) len = (int)strlen(b64);
+	data.resize(ibase64_decode(b64, len, NULL) + 1);
+	int hr = ibase64_decode(b64, len, &data[0]);
 	data.resize((hr < 0)? 0 : hr);
 	return (hr < 0)? false : true;
 }